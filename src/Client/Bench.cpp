@@ -0,0 +1,267 @@
+#include "common.h"
+#include "PseuWoW.h"
+#include "Bench.h"
+#include "DefScript/DefScript.h"
+#include "World/WorldSession.h"
+#include "World/UpdateData.h"
+#include "World/Player.h"
+#include "World/ObjMgr.h"
+
+
+// pseuwow -bench script <name> <runs> [<file>]
+// runs a script over and over, the way scripts are run from world packet handlers.
+// the script is one of the loaded ones, or comes from <file> (which may contain other scripts it calls).
+static int _BenchScript(PseuInstance *ins, int argc, char *argv[])
+{
+    DefScriptPackage *scp = ins->GetScripts();
+    std::string name = stringToLower(argv[3]);
+    uint32 runs = atoi(argv[4]);
+    if(argc > 5 && !scp->LoadScriptFromFile(argv[5]))
+    {
+        logerror("bench: Can't load '%s'",argv[5]);
+        return 1;
+    }
+    if(!scp->ScriptExists(name) || !runs)
+    {
+        logerror("bench: Script '%s' not found",name.c_str());
+        return 1;
+    }
+    uint32 t = getMSTime();
+    for(uint32 i = 0; i < runs; i++)
+        scp->RunScript(name, NULL);
+    t = getMSTime() - t;
+    log("bench: script '%s': %u runs in %u ms, %.1f us per run", name.c_str(), runs, t, t * 1000.0f / runs);
+    return 0;
+}
+
+// pseuwow -bench scp <db> <field> <lookups>
+// looks up <field> of the rows of a database (loaded if the scripts didn't): by field name, by field id, and the rows by value
+static int _BenchScp(PseuInstance *ins, int argc, char *argv[])
+{
+    SCPDatabase *db = ins->dbmgr.GetDB(argv[3]);
+    if(!db && ins->dbmgr.SearchAndLoad(argv[3], false))
+        db = ins->dbmgr.GetDB(argv[3]);
+    const char *field = argv[4];
+    uint32 lookups = atoi(argv[5]);
+    const SCPFieldDef *def = db ? db->GetFieldDef(field) : NULL;
+    if(!def || !lookups)
+    {
+        logerror("bench: Database '%s' with field '%s' not found",argv[3],field);
+        return 1;
+    }
+    std::vector<uint32> ids; // there is no list of the IDs, so look for them
+    for(uint32 id = 0; id < (1 << 20) && ids.size() < db->GetRowsCount(); id++)
+        if(db->GetRowByIndex(id))
+            ids.push_back(id);
+    if(ids.empty())
+    {
+        logerror("bench: Database '%s' is empty",argv[3]);
+        return 1;
+    }
+    uint32 fid = def->id, n = ids.size(), t[3];
+    bool str = def->type == SCP_TYPE_STRING;
+    volatile uint32 sink = 0;
+
+    t[0] = getMSTime();
+    for(uint32 i = 0; i < lookups; i++)
+        sink += db->GetUint32(ids[i % n], field);
+    t[0] = getMSTime() - t[0];
+    t[1] = getMSTime();
+    for(uint32 i = 0; i < lookups; i++)
+        sink += db->GetUint32(ids[i % n], fid);
+    t[1] = getMSTime() - t[1];
+    t[2] = getMSTime();
+    for(uint32 i = 0; i < lookups; i++)
+    {
+        if(str)
+            sink += db->GetFieldByStringValue(field, db->GetString(ids[i % n], fid));
+        else
+            sink += db->GetFieldByUint32Value(field, db->GetUint32(ids[i % n], fid));
+    }
+    t[2] = getMSTime() - t[2];
+
+    log("bench: scp '%s', %u rows, field '%s' (%s), %u lookups each:", argv[3], n, field, str ? "string" : "number", lookups);
+    log("bench:   by field name:     %u ms, %.1f ns per lookup", t[0], t[0] * 1000000.0f / lookups);
+    log("bench:   by field id:       %u ms, %.1f ns per lookup", t[1], t[1] * 1000000.0f / lookups);
+    log("bench:   row by its value:  %u ms, %.1f ns per lookup", t[2], t[2] * 1000000.0f / lookups);
+    log("bench:   memory used: %u bytes", db->GetMemoryUsage());
+    return 0;
+}
+
+// pseuwow -bench scpload <compression> <db> [<db> ...]
+// loads the databases like a first start: their compiled files are deleted, so they are compiled from source.
+// then, once the compiled files were written in the background, like any later start.
+// a fresh manager with the default search paths is used, the DBs the scripts loaded don't count.
+static int _BenchScpLoad(PseuInstance *ins, int argc, char *argv[])
+{
+    std::deque<std::string> names;
+    char fn[100];
+    for(int i = 4; i < argc; i++)
+    {
+        names.push_back(stringToLower(argv[i]));
+        snprintf(fn,sizeof(fn),"./cache/%s.ccp",names.back().c_str());
+        remove(fn);
+    }
+    for(uint32 run = 0; run < 2; run++)
+    {
+        SCPDatabaseMgr mgr;
+        mgr.AddSearchPath("./cache");
+        mgr.AddSearchPath("./data/scp");
+        mgr.SetCompression(atoi(argv[3]));
+        uint32 t = getMSTime(), sources = mgr.SearchAndLoad(names, false);
+        t = getMSTime() - t;
+        uint32 loaded = 0;
+        for(uint32 i = 0; i < names.size(); i++)
+            if(mgr.GetDB(names[i]))
+                loaded++;
+        log("bench: scpload, %s: %u of %u databases (%u source files) in %u ms", run ? "compiled files" : "from source",
+            loaded, (uint32)names.size(), sources, t);
+        if(run)
+            break;
+
+        // the compiled files are written by the loader threads. they are renamed into place when complete.
+        uint32 written = 0;
+        for(t = getMSTime(); written < loaded && getMSTime() - t < 30000; ins->Sleep(10))
+        {
+            written = 0;
+            for(uint32 i = 0; i < names.size(); i++)
+            {
+                snprintf(fn,sizeof(fn),"./cache/%s.ccp",names[i].c_str());
+                if(mgr.GetDB(names[i]) && FileExists(fn))
+                    written++;
+            }
+        }
+        log("bench: scpload, %u compiled files written after %u ms", written, getMSTime() - t);
+    }
+    return 0;
+}
+
+// pseuwow -bench updates <blocks>
+// feeds SMSG_UPDATE_OBJECT packets with one values block each to a world session that has no socket,
+// the way the socket queues them (the packets reference the received data, see WorldSocket::_QueuePacket()).
+// the blocks go round-robin to 64 objects, the set bits and the values are random.
+static int _BenchUpdates(PseuInstance *ins, int argc, char *argv[])
+{
+    static const struct { uint8 typeId; uint32 bits; const char *note; } cases[] =
+    {
+        { TYPEID_PLAYER,   2, "" },
+        { TYPEID_PLAYER,   8, "" },
+        { TYPEID_UNIT,     3, "" },
+        { TYPEID_UNIT,    60, " (like a create block)" },
+        { TYPEID_PLAYER, 400, " (like a create block)" },
+    };
+    uint32 blocks = atoi(argv[3]);
+    if(!blocks)
+    {
+        logerror("bench: Need a number of blocks");
+        return 1;
+    }
+    WorldSession *ws = new WorldSession(ins);
+    if(!GetValuesCountByTypeId(TYPEID_PLAYER)) // the update fields depend on the client version
+    {
+        logerror("bench: No update fields, check the client version in the conf");
+        delete ws;
+        return 1;
+    }
+    bool tbc = ins->GetConf()->client <= CLIENT_TBC;
+    srand(42);
+    for(uint32 c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        uint64 guids[64];
+        for(uint32 i = 0; i < 64; i++)
+        {
+            Object *obj;
+            if(cases[c].typeId == TYPEID_PLAYER)
+            {
+                guids[i] = (c << 8) + i + 1;
+                obj = new Player();
+            }
+            else
+            {
+                guids[i] = (uint64(HIGHGUID_UNIT) << 48) | ((c << 8) + i + 1);
+                obj = new Unit();
+            }
+            obj->Create(guids[i]);
+            ws->objmgr.Add(obj);
+        }
+        uint32 fields = GetValuesCountByTypeId(cases[c].typeId), maskblocks = (fields + 31) >> 5;
+
+        // a set of packets to cycle through, so each object gets other values from each of them
+        uint32 npkts = std::min<uint32>(blocks, 1024);
+        ByteBuffer data(npkts * (24 + (maskblocks + cases[c].bits) * 4));
+        std::vector<uint32> ofs;
+        std::vector<uint32> mask(maskblocks);
+        for(uint32 p = 0; p < npkts; p++)
+        {
+            ofs.push_back(data.size());
+            std::fill(mask.begin(), mask.end(), 0);
+            for(uint32 k = 0; k < cases[c].bits; k++)
+            {
+                uint32 i = rand() % fields;
+                mask[i >> 5] |= 1u << (i & 31);
+            }
+            data << uint32(1); // block count
+            if(tbc)
+                data << uint8(0); // has transport
+            data << uint8(UPDATETYPE_VALUES);
+            data.appendPackGUID(guids[p % 64]);
+            data << uint8(maskblocks);
+            for(uint32 w = 0; w < maskblocks; w++)
+                data << mask[w];
+            for(uint32 w = 0; w < maskblocks; w++)
+                for(uint32 m = mask[w]; m; m &= m - 1)
+                    data << uint32(rand());
+        }
+        ofs.push_back(data.size());
+
+        uint32 t = getMSTime();
+        for(uint32 b = 0; b < blocks; b++)
+        {
+            uint32 p = b % npkts;
+            WorldPacket *wp = ws->AcquirePacket();
+            wp->SetOpcode(SMSG_UPDATE_OBJECT);
+            wp->setExternal(data.contents() + ofs[p], ofs[p + 1] - ofs[p]);
+            ws->HandleWorldPacket(wp);
+        }
+        t = getMSTime() - t;
+        log("bench: updates, %s of %u fields, %u set%s: %u blocks in %u ms, %.0f blocks/sec",
+            cases[c].typeId == TYPEID_PLAYER ? "player" : "unit", fields, cases[c].bits, cases[c].note, blocks, t,
+            t ? blocks * 1000.0f / t : 0.0f);
+    }
+    delete ws;
+    return 0;
+}
+
+int RunBench(int argc, char *argv[])
+{
+    PseuInstance *ins = new PseuInstance(NULL);
+    ins->SetHosted(); // no GUI, no CLI
+    uint32 t = getMSTime();
+    if(!ins->Init())
+    {
+        logerror("bench: Can't initialize the instance");
+        delete ins;
+        return 1;
+    }
+    log("bench: instance initialized in %u ms", getMSTime() - t);
+
+    int ret = 1;
+    if(argc >= 5 && !stricmp(argv[2], "script"))
+        ret = _BenchScript(ins, argc, argv);
+    else if(argc >= 6 && !stricmp(argv[2], "scp"))
+        ret = _BenchScp(ins, argc, argv);
+    else if(argc >= 5 && !stricmp(argv[2], "scpload"))
+        ret = _BenchScpLoad(ins, argc, argv);
+    else if(argc >= 4 && !stricmp(argv[2], "updates"))
+        ret = _BenchUpdates(ins, argc, argv);
+    else
+    {
+        log("Usage: pseuwow -bench <test> [<args>], tests are:");
+        log("  script <name> <runs> [<file>] - run a loaded script, or one from <file>, <runs> times");
+        log("  scp <db> <field> <lookups>    - look up a field of a database by name, by id and by value");
+        log("  scpload <compression> <db>... - load databases from source and then from their compiled files");
+        log("  updates <blocks>              - handle update packets with values blocks of several sizes");
+    }
+    delete ins;
+    return ret;
+}
@@ -0,0 +1,9 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+// pseuwow -bench <test> [<args>]
+// benchmarks of client internals. they run on an instance that is initialized from ./conf and ./scripts
+// like a normal one, but never connects anywhere.
+int RunBench(int argc, char *argv[]);
+
+#endif
@@ -19,6 +19,16 @@ enum DefScriptBlockType
     BLOCK_LOOP
 };
 
+enum DefScriptOpcode
+{
+    OP_NOP,      // markers, endif, loop
+    OP_CALL,     // run a function or script
+    OP_IF,       // continue at jump if the condition is false
+    OP_JUMP,     // else (reached from the true-branch), endloop
+    OP_EXITLOOP, // evaluate the line, then jump behind the loop
+    OP_ERROR     // block statement that does not match
+};
+
 // --- SECTION FOR SCRIPT PACKAGES ---
 DefScriptPackage::DefScriptPackage()
 {
@@ -28,6 +38,8 @@ DefScriptPackage::DefScriptPackage()
         hLogfile << "DefScript engine execution log, compilation date: " __DATE__ "  " __TIME__ "\n\n" ;
     )
     _eventmgr=new DefScript_DynamicEventMgr(this);
+    _scriptgen=0;
+    _funcgen=0;
     _InitFunctions();
 #   ifdef USING_DEFSCRIPT_EXTENSIONS
     _InitDefScriptInterface();
@@ -55,7 +67,8 @@ void DefScriptPackage::Clear(void)
         delete i->second; // delete each script
     }
 
-	Script.empty();
+	Script.clear();
+    _scriptgen++;
 }
 
 void DefScriptPackage::_InitFunctions(void)
@@ -167,7 +180,10 @@ void DefScriptPackage::AddFunc(std::string n,DefReturnResult (DefScriptPackage::
 void DefScriptPackage::AddFunc(DefScriptFunctionEntry e)
 {
     if( (!e.name.empty()) && (!HasFunc(e.name)) )
+    {
         _functable.push_back(e);
+        _funcgen++;
+    }
 }
 
 bool DefScriptPackage::HasFunc(std::string n)
@@ -184,6 +200,7 @@ void DefScriptPackage::DelFunc(std::string n)
         if(i->name==n)
         {
             _functable.erase(i);
+            _funcgen++;
             break;
         }
 }
@@ -207,10 +224,8 @@ DefScript_DynamicEventMgr *DefScriptPackage::GetEventMgr(void)
 
 bool DefScriptPackage::ScriptExists(std::string name)
 {
-    for (std::map<std::string,DefScript*>::iterator i = Script.begin();i != Script.end();i++)
-        if(i->first == name && i->second != NULL)
-            return true;
-    return false;
+    std::map<std::string,DefScript*>::iterator i = Script.find(name);
+    return i != Script.end() && i->second != NULL;
 }
 
 void DefScriptPackage::DeleteScript(std::string sn)
@@ -221,6 +236,7 @@ void DefScriptPackage::DeleteScript(std::string sn)
 
         delete GetScript(sn); // delete the script itself
         Script.erase(sn); // remove reference
+        _scriptgen++;
     }
 }
 
@@ -477,16 +493,21 @@ DefScript::DefScript(DefScriptPackage *p)
     _parent=p;
 	scriptname="{NONAME}";
     debugmode=false;
+    _prog=NULL;
+    _linegen=0;
 }
 
 DefScript::~DefScript()
 {
     Clear();
+    if(_prog)
+        _parent->_ReleaseProgram(_prog);
 }
 
 void DefScript::Clear(void)
 {
     Line.clear();
+    _linegen++;
 }
 
 void DefScript::SetDebug(bool d)
@@ -513,6 +534,7 @@ bool DefScript::AddLine(std::string l){
 	if(l.empty())
 		return false;
     Line.push_back(l);
+    _linegen++;
 	return true;
 }
 
@@ -551,20 +573,14 @@ bool DefScriptPackage::BoolRunScript(std::string name, CmdSet *pSet)
 DefReturnResult DefScriptPackage::RunScript(std::string name, CmdSet *pSet,std::string override_name)
 {
     DefReturnResult r;
-    if( (!ScriptExists(name)) && (!HasFunc(name)) )
+    std::map<std::string,DefScript*>::iterator it = Script.find(name);
+    if(it == Script.end() || !it->second)
     {
         r.ok=false; // doesnt exist
         r.ret="";
         return r;
     }
-
-    DefScript *sc = GetScript(name);
-    if(!sc)
-    {
-        r.ok=false;
-        r.ret="";
-        return r;
-    }
+    DefScript *sc = it->second;
 
     if(!override_name.empty())
         name=override_name;
@@ -577,150 +593,416 @@ DefReturnResult DefScriptPackage::RunScript(std::string name, CmdSet *pSet,std::
     pSet->caller=pSet->myname;
     pSet->myname=name;
 
-    std::deque<Def_Block> Blocks;
-    CmdSet mySet;
-    std::string line;
+    // compile on first run and after the lines were changed
+    if(!sc->_prog || sc->_prog->linegen != sc->_linegen)
+    {
+        if(sc->_prog)
+            _ReleaseProgram(sc->_prog);
+        sc->_prog = _CompileScript(sc);
+    }
+    DefScriptProgram *prog = sc->_prog;
+    prog->refs++; // the script may be changed or deleted while it is running
+    bool resolved = name == prog->scope; // false if run under another name, see override_name
 
-    for(unsigned int i=0;i<sc->GetLines();i++)
+    CmdSet mySet;
+    unsigned int i = 0;
+    while(i < prog->code.size())
     {
-        line=sc->GetLine(i);
-        if(line.empty() || line[0] == '#') // skip markers and preload statements if not removed before
+        DefScriptInstr& in = prog->code[i];
+        if(in.op == OP_NOP)
+        {
+            i++;
             continue;
+        }
+        if(in.op == OP_JUMP)
+        {
+            i = in.jump;
+            continue;
+        }
+        if(in.op == OP_ERROR)
+        {
+            PRINT_ERROR(in.errmsg,name.c_str(),i);
+            r.ok=false;
+            break;
+        }
+
+        if(!_FillSet(in,pSet,mySet,resolved))
+        {
+            DefXChgResult final=ReplaceVars(in.line,pSet,0,true);
+            mySet.Clear();
+            SplitLine(mySet,final.str);
+        }
+
+        if(in.op == OP_IF)
+        {
+            i = isTrue(mySet.defaultarg) ? i + 1 : in.jump;
+            continue;
+        }
+        if(in.op == OP_EXITLOOP)
+        {
+            i = in.jump;
+            continue;
+        }
+
+        mySet.myname=name;
+        mySet.caller=pSet?pSet->myname:"";
+        if(in.dynamic)
+            r=Interpret(mySet);
+        else
+        {
+            if(in.funcgen != _funcgen) // functions were added or removed since the last lookup
+            {
+                in.func = _FindFunc(in.set.cmd);
+                in.funcgen = _funcgen;
+            }
+            r=_Interpret(mySet,in.func);
+        }
+        if(r.mustreturn)
+        {
+            r.mustreturn=false;
+            break;
+        }
+        i++;
+    }
+    _ReleaseProgram(prog);
+    return r;
+}
+
+void DefScriptPackage::_ReleaseProgram(DefScriptProgram *prog)
+{
+    if(--prog->refs)
+        return;
+    for(unsigned int i = 0; i < prog->code.size(); i++)
+    {
+        DefScriptInstr& in = prog->code[i];
+        for(unsigned int a = 0; a < in.varargs.size(); a++)
+            if(in.varargs[a].second.atom >= 0)
+                variables.ReleaseAtom(in.varargs[a].second.atom);
+        for(unsigned int d = 0; d < in.defvars.size(); d++)
+            if(in.defvars[d].atom >= 0)
+                variables.ReleaseAtom(in.defvars[d].atom);
+    }
+    delete prog;
+}
+
+// translate a script into one instruction per line, with resolved jump targets for the block statements.
+// the block structure is checked when a script is loaded from file, but scripts can be changed at runtime too,
+// so lines that do not match are compiled to OP_ERROR, which stops the script when reached.
+DefScriptProgram *DefScriptPackage::_CompileScript(DefScript *sc)
+{
+    struct OpenBlock
+    {
+        unsigned char type; // DefScriptBlockType
+        unsigned int line;
+        std::vector<unsigned int> exits; // else or exitloop lines that jump to the end of the block
+    };
+
+    DefScriptProgram *prog = new DefScriptProgram();
+    prog->refs = 1;
+    prog->linegen = sc->_linegen;
+    prog->scope = sc->GetName();
+    prog->code.resize(sc->Line.size());
+    std::vector<OpenBlock> blocks;
+
+    for(unsigned int i = 0; i < prog->code.size(); i++)
+    {
+        DefScriptInstr& in = prog->code[i];
+        _CompileLine(sc->Line[i], prog->scope, in);
+        const std::string& line = in.line;
+
         if(line=="else")
         {
-            if(!Blocks.size())
+            if(blocks.empty())
             {
-                PRINT_ERROR("DEBUG: else-block without any block?! [%s:%u]",name.c_str(),i);
-                r.ok=false;
-                break;
+                in.op = OP_ERROR;
+                in.errmsg = "DEBUG: else-block without any block?! [%s:%u]";
             }
-            Def_Block b=Blocks.back();
-            if(b.type==BLOCK_IF && b.istrue)
+            else if(blocks.back().type==BLOCK_IF)
             {
-                unsigned int other_ifs=0;
-                for(i=b.startline+1;;i++)
-                {
-                    if(memcmp(sc->GetLine(i).c_str(),"if ",3)==0)
-                        other_ifs++;
-                    else if(sc->GetLine(i)=="endif")
-                    {
-                        if(!other_ifs)
-                            break;
-                        other_ifs--;
-                    }
-                }
-                i--; // next line read will be "endif", decide then what to do
+                OpenBlock& b = blocks.back();
+                if(prog->code[b.line].jump == uint32(-1))
+                    prog->code[b.line].jump = i + 1; // if false, continue after else
+                in.op = OP_JUMP; // if true, skip the else-branch
+                b.exits.push_back(i);
             }
-            continue;
+            else
+                in.op = OP_NOP;
         }
-        else if(line=="endif")
+        else if(line=="endif" || line=="endloop")
         {
-            if(!Blocks.size())
+            unsigned char type = line=="endif" ? BLOCK_IF : BLOCK_LOOP;
+            if(blocks.empty())
             {
-                PRINT_ERROR("DEBUG: endif without any block [%s:%u]",name.c_str(),i);
-                r.ok=false;
-                break;
+                in.op = OP_ERROR;
+                in.errmsg = type==BLOCK_IF ? "DEBUG: endif without any block [%s:%u]" : "DEBUG: endloop without any block [%s:%u]";
             }
-            if(Blocks.back().type!=BLOCK_IF)
+            else if(blocks.back().type!=type)
             {
-                PRINT_ERROR("DEBUG: endif: closed block is not an if block! [%s:%u]",name.c_str(),i);
-                r.ok=false;
-                break;
+                in.op = OP_ERROR;
+                in.errmsg = type==BLOCK_IF ? "DEBUG: endif: closed block is not an if block! [%s:%u]"
+                                           : "DEBUG: endloop: closed block is not a loop block! [%s:%u]";
+            }
+            else
+            {
+                OpenBlock& b = blocks.back();
+                if(type==BLOCK_IF)
+                {
+                    in.op = OP_NOP;
+                    if(prog->code[b.line].jump == uint32(-1))
+                        prog->code[b.line].jump = i + 1;
+                }
+                else
+                {
+                    in.op = OP_JUMP;
+                    in.jump = b.line + 1;
+                }
+                for(unsigned int e = 0; e < b.exits.size(); e++)
+                    prog->code[b.exits[e]].jump = i + 1;
+                blocks.pop_back();
             }
-            Blocks.pop_back();
-            continue;
         }
         else if(line=="loop")
         {
-            Def_Block b;
-            b.startline=i;
-            b.type=BLOCK_LOOP;
-            b.istrue=true;
-            Blocks.push_back(b);
+            in.op = OP_NOP;
+            OpenBlock b;
+            b.type = BLOCK_LOOP;
+            b.line = i;
+            blocks.push_back(b);
+        }
+        else if(in.op == OP_IF)
+        {
+            in.jump = uint32(-1); // set by else or endif
+            OpenBlock b;
+            b.type = BLOCK_IF;
+            b.line = i;
+            blocks.push_back(b);
+        }
+        else if(in.op == OP_EXITLOOP)
+        {
+            unsigned int l = blocks.size();
+            while(l && blocks[l-1].type!=BLOCK_LOOP)
+                l--;
+            if(l)
+                blocks[l-1].exits.push_back(i);
+            else
+                in.jump = prog->code.size();
+        }
+    }
+
+    // blocks still open run until the end of the script
+    for(unsigned int b = 0; b < blocks.size(); b++)
+    {
+        if(prog->code[blocks[b].line].op == OP_IF && prog->code[blocks[b].line].jump == uint32(-1))
+            prog->code[blocks[b].line].jump = prog->code.size();
+        for(unsigned int e = 0; e < blocks[b].exits.size(); e++)
+            prog->code[blocks[b].exits[e]].jump = prog->code.size();
+    }
+    return prog;
+}
+
+// pre-split a line. replacing ${..} and ?{..} can only change the cmd and arg layout if it happens in front of
+// the first space (where the defaultarg starts). lines that have ?{..} there, or a var in the cmd, are marked dynamic
+// and parsed as a whole at runtime. args with ${..} are replaced one by one at runtime, see _FillSet().
+// plain ${name} vars are resolved to atoms here, with the script name as scope.
+void DefScriptPackage::_CompileLine(const std::string& line, const std::string& scope, DefScriptInstr& in)
+{
+    in.line = line;
+    in.op = OP_CALL;
+    in.jump = 0;
+    in.errmsg = NULL;
+    in.dynamic = false;
+    in.vardefault = false;
+    in.deftemplate = false;
+    in.func = -1;
+    in.funcgen = _funcgen;
+    if(line.empty() || line[0] == '#') // skip markers and preload statements if not removed before
+    {
+        in.op = OP_NOP;
+        return;
+    }
+    if(line=="else" || line=="endif" || line=="loop" || line=="endloop")
+        return; // handled by _CompileScript()
+
+    // split into raw cmd and args up to the first space, like SplitLine() does
+    std::vector<std::string> tok(1);
+    unsigned int i, bopen = 0;
+    bool escaped = false;
+    for(i = 0; i < line.length(); i++)
+    {
+        char c = line[i];
+        if(c=='\\')
+        {
+            tok.back() += c;
+            if(++i < line.length())
+                tok.back() += line[i];
+            escaped = true;
             continue;
         }
-        else if(line=="endloop")
+        if(c=='{')
+            bopen++;
+        else if(c=='}')
+            bopen--;
+        else if(c==',' && !bopen)
         {
-            if(!Blocks.size())
-            {
-                PRINT_ERROR("DEBUG: endloop without any block [%s:%u]",name.c_str(),i);
-                r.ok=false;
-                break;
-            }
-            if(Blocks.back().type!=BLOCK_LOOP)
-            {
-                PRINT_ERROR("DEBUG: endloop: closed block is not a loop block! [%s:%u]",name.c_str(),i);
-                r.ok=false;
-                break;
-            }
-            i=Blocks.back().startline; // next line executed will be the line after "loop"
+            tok.push_back("");
             continue;
         }
-        //_DEFSC_DEBUG(printf("DefScript before: \"%s\"\n",line.c_str()));
-        DefXChgResult final=ReplaceVars(line,pSet,0,true);
-        //_DEFSC_DEBUG(printf("DefScript parsed: \"%s\"\n",final.str.c_str()));
-        mySet.Clear();
-	    SplitLine(mySet,final.str);
-        if(mySet.cmd=="if")
+        else if(c==' ' && !bopen)
+            break;
+        tok.back() += c;
+    }
+    if(i < line.length())
+    {
+        in.rawdefault = line.substr(i+1);
+        in.vardefault = in.rawdefault.find("${")!=std::string::npos || in.rawdefault.find("?{")!=std::string::npos;
+    }
+
+    // a defaultarg without ?{..}, escapes and nested vars is compiled to literal text and var atoms
+    if(in.vardefault && in.rawdefault.find("?{")==std::string::npos && in.rawdefault.find('\\')==std::string::npos)
+    {
+        const std::string& raw = in.rawdefault;
+        unsigned int depth = 0;
+        std::string text;
+        in.deftemplate = true;
+        for(unsigned int p = 0; p < raw.length() && in.deftemplate; p++)
         {
-            Def_Block b;
-            b.startline=i;
-            b.type=BLOCK_IF;
-            b.istrue=isTrue(mySet.defaultarg);
-            Blocks.push_back(b);
-            if(!b.istrue)
+            if(raw[p]=='$' && p+1 < raw.length() && raw[p+1]=='{')
             {
-                unsigned int other_ifs=0;
-                for(i=b.startline+1; i < sc->GetLines() ;i++)
+                unsigned int end = raw.find('}', p+2);
+                DefScriptVarRef ref;
+                if(end == std::string::npos || !_CompileVarRef(raw.substr(p+2, end-p-2), scope, ref) || ref.vname.empty())
                 {
-                    if(!memcmp(sc->GetLine(i).c_str(),"if ",3))
-                        other_ifs++;
-                    if(sc->GetLine(i)=="else" || sc->GetLine(i)=="endif")
-                    {
-                        if(!other_ifs)
-                            break;
-                        if(sc->GetLine(i)=="endif")
-                            other_ifs--;
-                    }
+                    in.deftemplate = false;
+                    if(ref.atom >= 0)
+                        variables.ReleaseAtom(ref.atom);
+                    break;
                 }
-                i--; // next line read will be either "else" or "endif", decide then what to do
+                ref.text = text;
+                ref.var = raw.substr(p, end-p+1);
+                in.defvars.push_back(ref);
+                text.clear();
+                p = end;
+                continue;
             }
-            continue; // and read line after "else"
+            if(raw[p]=='{')
+                depth++;
+            else if(raw[p]=='}' && !depth--)
+                in.deftemplate = false; // unbalanced brackets stop ReplaceVars() from replacing anything
+            text += raw[p];
         }
-        else if(mySet.cmd=="exitloop")
+        if(depth)
+            in.deftemplate = false;
+        in.deftail = text;
+        if(!in.deftemplate)
         {
-            // skip some ifs if they are present
-            while(Blocks.back().type!=BLOCK_LOOP)
-                Blocks.pop_back();
-            Blocks.pop_back();
-            unsigned int other_loops=0;
+            for(unsigned int d = 0; d < in.defvars.size(); d++)
+                if(in.defvars[d].atom >= 0)
+                    variables.ReleaseAtom(in.defvars[d].atom);
+            in.defvars.clear();
+        }
+    }
 
-            while(true)
+    SplitLine(in.set, line);
+
+    if(tok[0].empty() || tok[0].find("${")!=std::string::npos || tok[0].find("?{")!=std::string::npos)
+    {
+        in.dynamic = true; // cmd only known at runtime
+        return;
+    }
+    if(in.set.cmd=="if")
+        in.op = OP_IF;
+    else if(in.set.cmd=="exitloop")
+        in.op = OP_EXITLOOP;
+    else
+        in.func = _FindFunc(in.set.cmd);
+
+    for(unsigned int t = 1; t < tok.size(); t++)
+    {
+        if(tok[t].find("?{")!=std::string::npos || (escaped && tok[t].find("${")!=std::string::npos))
+        {
+            in.dynamic = true;
+            in.varargs.clear();
+            return;
+        }
+        if(tok[t].find("${")!=std::string::npos)
+        {
+            DefScriptVarRef ref;
+            if(tok[t].length() < 3 || tok[t][tok[t].length()-1] != '}' || tok[t].compare(0, 2, "${") ||
+                !_CompileVarRef(tok[t].substr(2, tok[t].length()-3), scope, ref))
             {
-                if(sc->GetLine(i)=="loop")
-                    other_loops++;
-                if(sc->GetLine(i)=="endloop")
-                {
-                    if(!other_loops)
-                        break;
-                    other_loops--;
-                }
-                i++; // go until next endloop
+                ref.vname.clear(); // not a plain ${name}, needs ReplaceVars()
             }
-            // next line read will be the line after "endloop"
-            continue;
+            ref.var = tok[t];
+            in.varargs.push_back(std::pair<unsigned int,DefScriptVarRef>(t - 1, ref));
         }
+    }
+}
 
-        mySet.myname=name;
-        mySet.caller=pSet?pSet->myname:"";
-        r=Interpret(mySet);
-        if(r.mustreturn)
+// resolve a plain var name, one that ReplaceVars() would look up without any further processing.
+// returns false if name is not plain.
+bool DefScriptPackage::_CompileVarRef(const std::string& name, const std::string& scope, DefScriptVarRef& ref)
+{
+    ref.atom = -1;
+    if(name.empty() || name.find_first_of("{}$?\\")!=std::string::npos)
+        return false;
+    ref.vname = _NormalizeVarName(name, scope);
+    if(!ref.vname.empty() && ref.vname[0]!='@')
+        ref.atom = variables.GetAtom(ref.vname);
+    return true;
+}
+
+// fill Set with the pre-split line, replacing vars where needed.
+// returns false if the line has to be parsed as a whole, which is the case if a replaced arg contains
+// chars that would have changed the splitting. args only hold ${..} vars here, so replacing them again is harmless.
+// resolved tells if the precompiled var names are valid, which is the case if the script runs under its own name.
+bool DefScriptPackage::_FillSet(DefScriptInstr& in, CmdSet *pSet, CmdSet& Set, bool resolved)
+{
+    if(in.dynamic)
+        return false;
+    Set.cmd = in.set.cmd;
+    Set.arg = in.set.arg;
+    Set.defaultarg = in.set.defaultarg;
+    Set.myname.clear();
+    Set.caller.clear();
+    std::string v;
+    for(unsigned int a = 0; a < in.varargs.size(); a++)
+    {
+        DefScriptVarRef& ref = in.varargs[a].second;
+        if(!resolved || ref.vname.empty())
+            v = ReplaceVars(ref.var,pSet,0,true).str;
+        else if(!_GetVar(ref.vname,ref.atom,pSet,v))
+            v = ref.var; // not set, ${..} stays
+        if(v.find_first_of(" ,{}\\")!=std::string::npos)
+            return false;
+        Set.arg[in.varargs[a].first] = v;
+    }
+    if(in.deftemplate && resolved)
+    {
+        // ReplaceVars() goes on parsing behind the inserted values, so values that could form new ${..}/?{..}
+        // or change the brackets must go the long way
+        std::string d;
+        unsigned int k;
+        for(k = 0; k < in.defvars.size(); k++)
         {
-            r.mustreturn=false;
-            break;
+            DefScriptVarRef& ref = in.defvars[k];
+            d += ref.text;
+            if(!_GetVar(ref.vname,ref.atom,pSet,v))
+                d += ref.var;
+            else if(v.find_first_of("{}\\")!=std::string::npos || (v.length() && (v[v.length()-1]=='$' || v[v.length()-1]=='?')))
+                break;
+            else
+                d += v;
+        }
+        if(k == in.defvars.size())
+        {
+            d += in.deftail;
+            Set.defaultarg = RemoveBracketsFromString(d);
+            return true;
         }
     }
-    return r;
+    if(in.vardefault)
+        Set.defaultarg = RemoveBracketsFromString(ReplaceVars(in.rawdefault,pSet,0,true).str);
+    return true;
 }
 
 DefReturnResult DefScriptPackage::RunSingleLine(std::string line)
@@ -976,54 +1258,8 @@ DefXChgResult DefScriptPackage::ReplaceVars(std::string str, CmdSet *pSet, unsig
         if(VarType==DEFSCRIPT_VAR)
         {
             std::string vname=_NormalizeVarName(str, (pSet==NULL) ? "" : pSet->myname);
-            if(vname[0]=='@')
-            {
-                std::stringstream vns;
-                std::string subs=vname.substr(1,str.length()-1);
-                unsigned int vn=atoi( subs.c_str() );
-                vns << vn;
-                if(pSet && vns.str()==subs) // resolve arg macros @0 - @4294967295
-                    str=pSet->arg[vn];
-                else if(pSet && subs=="def")
-                    str=pSet->defaultarg;
-                else if(pSet && subs=="myname")
-                    str=pSet->myname;
-                else if(pSet && subs=="cmd")
-                    str=pSet->cmd;
-                else if(pSet && subs=="caller")
-                    str=pSet->caller;
-                else if(subs=="n")
-                    str="\n";
-                else if(subs=="clock")
-                {
-                    std::stringstream clock_s;
-                    clock_s << clock();
-                    str = clock_s.str();
-                }
-                else if(subs=="time")
-                {
-                    std::stringstream time_s;
-                    time_s << time(NULL);
-                    str = time_s.str();
-                }
-                else if(variables.Exists(vname))
-                    str=variables.Get(vname);
-                else
-                {
-                    // TODO: call custom macro table
-                    //...
-                    str.clear();
-                }
+            if(_GetVar(vname,-1,pSet,str))
                 xchg.changed=true;
-            }
-            else
-            {
-                if(variables.Exists(vname))
-                {
-                    str=variables.Get(vname);
-                    xchg.changed=true;
-                }
-            }
         }
         else if(VarType==DEFSCRIPT_FUNC)
         {
@@ -1054,6 +1290,63 @@ DefXChgResult DefScriptPackage::ReplaceVars(std::string str, CmdSet *pSet, unsig
     return xchg;
 }
 
+// get the value of a normalized var name (see _NormalizeVarName()). atom is vname's atom in variables, -1 if not known.
+// returns false if the var is not set, in which case ${..} is left as it is.
+bool DefScriptPackage::_GetVar(const std::string& vname, int atom, CmdSet *pSet, std::string& out)
+{
+    if(atom >= 0)
+    {
+        if(!variables.Exists((unsigned int)atom))
+            return false;
+        out=variables.Get((unsigned int)atom);
+        return true;
+    }
+    if(vname[0]=='@')
+    {
+        std::stringstream vns;
+        std::string subs=vname.substr(1);
+        unsigned int vn=atoi( subs.c_str() );
+        vns << vn;
+        if(pSet && vns.str()==subs) // resolve arg macros @0 - @4294967295
+            out=pSet->arg[vn];
+        else if(pSet && subs=="def")
+            out=pSet->defaultarg;
+        else if(pSet && subs=="myname")
+            out=pSet->myname;
+        else if(pSet && subs=="cmd")
+            out=pSet->cmd;
+        else if(pSet && subs=="caller")
+            out=pSet->caller;
+        else if(subs=="n")
+            out="\n";
+        else if(subs=="clock")
+        {
+            std::stringstream clock_s;
+            clock_s << clock();
+            out = clock_s.str();
+        }
+        else if(subs=="time")
+        {
+            std::stringstream time_s;
+            time_s << time(NULL);
+            out = time_s.str();
+        }
+        else if(variables.Exists(vname))
+            out=variables.Get(vname);
+        else
+        {
+            // TODO: call custom macro table
+            //...
+            out.clear();
+        }
+        return true;
+    }
+    if(!variables.Exists(vname))
+        return false;
+    out=variables.Get(vname);
+    return true;
+}
+
 std::string DefScriptPackage::_NormalizeVarName(std::string vn, std::string sn)
 {
     bool global=false;
@@ -1077,7 +1370,21 @@ std::string DefScriptPackage::_NormalizeVarName(std::string vn, std::string sn)
     return vn;
 }
 
+int DefScriptPackage::_FindFunc(const std::string& name)
+{
+    for(unsigned int i=0;i<_functable.size();i++)
+        if(name==_functable[i].name)
+            return i;
+    return -1;
+}
+
 DefReturnResult DefScriptPackage::Interpret(CmdSet& Set)
+{
+    return _Interpret(Set, _FindFunc(Set.cmd));
+}
+
+// func is the index of Set.cmd in _functable, -1 if it is not a function
+DefReturnResult DefScriptPackage::_Interpret(CmdSet& Set, int func)
 {
     // TODO: remove this debug block again as soon as the interpreter bugs are fixed.
     _DEFSC_DEBUG
@@ -1092,19 +1399,17 @@ DefReturnResult DefScriptPackage::Interpret(CmdSet& Set)
 
     DefReturnResult result;
 
-    // first search if the script is defined in the internal functions
-    for(unsigned int i=0;i<_functable.size();i++)
+    // first check if the script is defined in the internal functions
+    if(func >= 0)
     {
-        if(Set.cmd==_functable[i].name)
-        {
-            if(_functable[i].escape) // if we are going to use a C++ function, unescape the whole set, if supposed to do so.
-                UnescapeSet(Set);    // it will not have any bad side effects, we leave the func within this block!
+        DefScriptFunctionEntry f = _functable[func]; // copy, the function might change the table
+        if(f.escape) // if we are going to use a C++ function, unescape the whole set, if supposed to do so.
+            UnescapeSet(Set);    // it will not have any bad side effects, we leave the func within this block!
 
-            result=(this->*(_functable[i].func))(Set);
-            if(_functable[i].escape)
-                result.ret = EscapeString(result.ret); // and since we are returning a string into the engine, escape it again, if set.
-            return result;
-        }
+        result=(this->*(f.func))(Set);
+        if(f.escape)
+            result.ret = EscapeString(result.ret); // and since we are returning a string into the engine, escape it again, if set.
+        return result;
     }
 
     if(Set.cmd=="return")
@@ -1123,6 +1428,18 @@ DefReturnResult DefScriptPackage::Interpret(CmdSet& Set)
     return result;
 }
 
+// a list that is about to be changed. the lines of a script are a list too; if it is one,
+// the script is compiled again before it runs the next time.
+DefList *DefScriptPackage::_GetListForWrite(const std::string& lname, bool create)
+{
+    if(strncmp(lname.c_str(), SCRIPT_NAMESPACE, strlen(SCRIPT_NAMESPACE))==0)
+    {
+        if(DefScript *sc = GetScript(lname.substr(strlen(SCRIPT_NAMESPACE))))
+            sc->_linegen++;
+    }
+    return create ? lists.Get(lname) : lists.GetNoCreate(lname);
+}
+
 void DefScriptPackage::_UpdateOrCreateScriptByName(std::string sn)
 {
     if(GetScript(sn))
@@ -1130,6 +1447,7 @@ void DefScriptPackage::_UpdateOrCreateScriptByName(std::string sn)
     DefScript *newscript = new DefScript(this);
     newscript->SetName(sn); // necessary that the script knows its own name
     Script[sn] = newscript;
+    _scriptgen++;
     lists.Assign(SCRIPT_NAMESPACE + sn, &(newscript->Line));
 }
 
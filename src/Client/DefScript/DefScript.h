@@ -78,6 +78,44 @@ typedef std::deque<DefScriptFunctionEntry> DefScriptFunctionTable;
 typedef std::deque<std::string> DefList;
 typedef std::map<std::string,DefList*> DefListMap;
 
+// a ${..} var in a compiled line, see DefScriptPackage::_CompileLine()
+struct DefScriptVarRef
+{
+    DefScriptVarRef() { atom = -1; }
+    std::string text; // literal text in front of the var (defaultarg only)
+    std::string var; // raw ${..} text
+    std::string vname; // normalized var name, empty if var is not a plain ${name}
+    int atom; // atom of vname in DefScriptPackage::variables, -1 for @macros and if vname is empty
+};
+
+// one compiled script line, see DefScriptPackage::_CompileScript()
+struct DefScriptInstr
+{
+    unsigned char op; // DefScriptOpcode
+    unsigned int jump; // target line of OP_IF (if false), OP_JUMP and OP_EXITLOOP
+    const char *errmsg; // for OP_ERROR
+    std::string line; // source line
+    bool dynamic; // cmd or arg layout can change by replacing vars, the whole line must be parsed at runtime
+    CmdSet set; // pre-split cmd, args and defaultarg, with brackets removed
+    std::vector<std::pair<unsigned int,DefScriptVarRef> > varargs; // args that contain ${..}, by arg index
+    bool vardefault; // defaultarg contains ${..} or ?{..}
+    std::string rawdefault;
+    bool deftemplate; // defaultarg only holds plain ${name} vars, which are listed in defvars
+    std::vector<DefScriptVarRef> defvars;
+    std::string deftail; // literal text behind the last var
+    int func; // index in _functable, -1 if cmd is not a function
+    unsigned int funcgen; // _funcgen at the time func was looked up
+};
+
+// a compiled script. it is rebuilt whenever the script's lines change, which they can at any time via the list functions.
+struct DefScriptProgram
+{
+    unsigned int linegen; // DefScript::_linegen of the lines the program was compiled from
+    std::string scope; // script name used to resolve the var names
+    std::vector<DefScriptInstr> code; // one instruction per line
+    unsigned int refs; // the script itself and every running instance of it
+};
+
 class DefScript {
     friend class DefScriptPackage;
 public:
@@ -105,6 +143,8 @@ private:
     bool debugmode;
 
     DefScriptPackage *_parent;   	
+    DefScriptProgram *_prog;
+    unsigned int _linegen; // changes whenever Line changes
 };
 
 
@@ -125,6 +165,7 @@ public:
 	DefReturnResult RunSingleLine(std::string);
 	bool ScriptExists(std::string);
     void DeleteScript(std::string);
+    inline unsigned int GetScriptGeneration(void) { return _scriptgen; } // changes whenever a script is (re)loaded or deleted
 	VarSet variables;
     void SetPath(std::string);
     bool LoadByName(std::string);
@@ -155,6 +196,15 @@ private:
     DefXChgResult ReplaceVars(std::string str, CmdSet* pSet, unsigned char VarType, bool run_embedded);
 	void SplitLine(CmdSet&,std::string);
     DefReturnResult Interpret(CmdSet&);
+    DefReturnResult _Interpret(CmdSet&, int func);
+    int _FindFunc(const std::string&);
+    DefScriptProgram *_CompileScript(DefScript*);
+    void _CompileLine(const std::string&, const std::string& scope, DefScriptInstr&);
+    bool _CompileVarRef(const std::string& name, const std::string& scope, DefScriptVarRef&);
+    bool _FillSet(DefScriptInstr&, CmdSet *pSet, CmdSet& Set, bool resolved);
+    bool _GetVar(const std::string& vname, int atom, CmdSet *pSet, std::string& out);
+    void _ReleaseProgram(DefScriptProgram*);
+    DefList *_GetListForWrite(const std::string& lname, bool create);
     void RemoveBrackets(CmdSet&);
     void UnescapeSet(CmdSet&);
     std::string RemoveBracketsFromString(std::string);
@@ -162,8 +212,10 @@ private:
     void *parentMethod;
     DefScript_DynamicEventMgr *_eventmgr;
     std::map<std::string,DefScript*> Script;
+    unsigned int _scriptgen;
     std::map<std::string,unsigned char> scriptPermissionMap;
     DefScriptFunctionTable _functable;
+    unsigned int _funcgen; // changes whenever _functable changes
     _DEFSC_DEBUG(std::fstream hLogfile);
 
     // Usable internal basic functions:
@@ -267,6 +319,8 @@ private:
 
     // Own variable declarations
     std::map<std::string, unsigned char> my_usrPermissionMap;
+    std::string my_scpDbName; // db and key remembered by GetScpValue
+    unsigned int my_scpKeyId;
 
 };
 
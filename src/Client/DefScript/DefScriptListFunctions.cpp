@@ -8,14 +8,14 @@ using namespace DefScriptTools;
 
 DefReturnResult DefScriptPackage::func_lpushback(CmdSet& Set)
 {
-	DefList *l = lists.Get(_NormalizeVarName(Set.arg[0],Set.myname));
+	DefList *l = _GetListForWrite(_NormalizeVarName(Set.arg[0],Set.myname), true);
 	l->push_back(Set.defaultarg);
 	return true;
 }
 
 DefReturnResult DefScriptPackage::func_lpushfront(CmdSet& Set)
 {
-	DefList *l = lists.Get(_NormalizeVarName(Set.arg[0],Set.myname));
+	DefList *l = _GetListForWrite(_NormalizeVarName(Set.arg[0],Set.myname), true);
 	l->push_front(Set.defaultarg);
 	return true;
 }
@@ -23,7 +23,7 @@ DefReturnResult DefScriptPackage::func_lpushfront(CmdSet& Set)
 DefReturnResult DefScriptPackage::func_lpopback(CmdSet& Set)
 {
     std::string r;
-	DefList *l = lists.GetNoCreate(_NormalizeVarName(Set.defaultarg,Set.myname));
+	DefList *l = _GetListForWrite(_NormalizeVarName(Set.defaultarg,Set.myname), false);
     if( (!l) || (!l->size()) ) // cant pop any element if the list doesnt exist or is empty
         return "";
 	r= l->back();
@@ -34,7 +34,7 @@ DefReturnResult DefScriptPackage::func_lpopback(CmdSet& Set)
 DefReturnResult DefScriptPackage::func_lpopfront(CmdSet& Set)
 {
     std::string r;
-	DefList *l = lists.GetNoCreate(_NormalizeVarName(Set.defaultarg,Set.myname));
+	DefList *l = _GetListForWrite(_NormalizeVarName(Set.defaultarg,Set.myname), false);
     if( (!l) || (!l->size()) ) // cant pop any element if the list doesnt exist or is empty
         return "";
 	r = l->front();
@@ -49,7 +49,7 @@ DefReturnResult DefScriptPackage::func_ldelete(CmdSet& Set)
     if(strncmp(lname.c_str(), SCRIPT_NAMESPACE,strlen(SCRIPT_NAMESPACE))==0)
     {
         printf("DefScript: WARNING: ldelete used on a script list, clearing instead! (called by '%s', list '%s')\n",Set.myname.c_str(), lname.c_str());
-        DefList *l = lists.GetNoCreate(lname);
+        DefList *l = _GetListForWrite(lname, false);
         if(l)
             l->clear();
         return true;
@@ -77,7 +77,7 @@ DefReturnResult DefScriptPackage::func_llen(CmdSet& Set)
 DefReturnResult DefScriptPackage::func_linsert(CmdSet& Set)
 {
 	bool result;
-	DefList *l = lists.Get(_NormalizeVarName(Set.arg[0],Set.myname));
+	DefList *l = _GetListForWrite(_NormalizeVarName(Set.arg[0],Set.myname), true);
 	unsigned int pos = (unsigned int)toNumber(Set.arg[1]);
 	if(pos > l->size()) // if the list is too short to insert at that pos...
 	{
@@ -99,7 +99,7 @@ DefReturnResult DefScriptPackage::func_linsert(CmdSet& Set)
 DefReturnResult DefScriptPackage::func_lsplit(CmdSet& Set)
 {
 	// 1st create a new list, or get an already existing one and clear it
-	DefList *l = lists.Get(_NormalizeVarName(Set.arg[0],Set.myname));
+	DefList *l = _GetListForWrite(_NormalizeVarName(Set.arg[0],Set.myname), true);
     l->clear();
 	if(Set.defaultarg.empty()) // we cant split an empty string, return nothing, and keep empty list
 		return "";
@@ -135,7 +135,7 @@ DefReturnResult DefScriptPackage::func_lsplit(CmdSet& Set)
 DefReturnResult DefScriptPackage::func_lcsplit(CmdSet& Set)
 {
 	// 1st create a new list, or get an already existing one and clear it
-	DefList *l = lists.Get(_NormalizeVarName(Set.arg[0],Set.myname));
+	DefList *l = _GetListForWrite(_NormalizeVarName(Set.arg[0],Set.myname), true);
     l->clear();
 	if(Set.defaultarg.empty()) // we cant split an empty string, return nothing, and keep empty list
 		return "";
@@ -190,7 +190,7 @@ DefReturnResult DefScriptPackage::func_lindex(CmdSet& Set)
 DefReturnResult DefScriptPackage::func_lclean(CmdSet& Set)
 {
     unsigned int r=0;
-    DefList *l = lists.GetNoCreate(_NormalizeVarName(Set.arg[0],Set.myname));
+    DefList *l = _GetListForWrite(_NormalizeVarName(Set.arg[0],Set.myname), false);
     if(!l)
         return "";
     for(DefList::iterator i=l->begin(); i!=l->end(); )
@@ -212,7 +212,7 @@ DefReturnResult DefScriptPackage::func_lclean(CmdSet& Set)
 DefReturnResult DefScriptPackage::func_lmclean(CmdSet& Set)
 {
     unsigned int r=0;
-    DefList *l = lists.GetNoCreate(_NormalizeVarName(Set.arg[0],Set.myname));
+    DefList *l = _GetListForWrite(_NormalizeVarName(Set.arg[0],Set.myname), false);
     if(!l)
         return "";
 
@@ -254,7 +254,7 @@ DefReturnResult DefScriptPackage::func_lmclean(CmdSet& Set)
 // erase element at position @def, return erased element
 DefReturnResult DefScriptPackage::func_lerase(CmdSet& Set)
 {
-    DefList *l = lists.GetNoCreate(_NormalizeVarName(Set.arg[0],Set.myname));
+    DefList *l = _GetListForWrite(_NormalizeVarName(Set.arg[0],Set.myname), false);
     if(!l)
         return "";
     std::string r;
@@ -272,7 +272,7 @@ DefReturnResult DefScriptPackage::func_lerase(CmdSet& Set)
 
 DefReturnResult DefScriptPackage::func_lsort(CmdSet& Set)
 {
-    DefList *l = lists.GetNoCreate(_NormalizeVarName(Set.defaultarg,Set.myname));
+    DefList *l = _GetListForWrite(_NormalizeVarName(Set.defaultarg,Set.myname), false);
     if(!l)
         return false;
     sort(l->begin(),l->end());
@@ -1,18 +1,20 @@
 #include "DefScript.h"
 #include "DynamicEvent.h"
+#include "tools.h"
+
+#define EVENT_NO_TIMER uint32(-1)
 
 struct DefScript_DynamicEvent
 {
 	std::string name, cmd, parent;
-	clock_t counter, interval;
-    bool ran; // if a script has an execution time longer then the interval, and modifies an event, need to check if the event was already triggered, to prevent endless loop
+	uint32 interval; // msecs
+    uint32 due; // monotonic msecs of the next run
+    uint32 timer; // id in the timer wheel, EVENT_NO_TIMER while the event runs
 };
 
-DefScript_DynamicEventMgr::DefScript_DynamicEventMgr(DefScriptPackage *pack)
+DefScript_DynamicEventMgr::DefScript_DynamicEventMgr(DefScriptPackage *pack) : _timers(getMonotonicMSTime())
 {
 	_pack = pack;
-	_lastclock = clock();
-    _events_changed = false;
 }
 
 DefScript_DynamicEventMgr::~DefScript_DynamicEventMgr()
@@ -20,83 +22,72 @@ DefScript_DynamicEventMgr::~DefScript_DynamicEventMgr()
     _storage.Clear();
 }
 
-void DefScript_DynamicEventMgr::Add(std::string name, std::string script, clock_t interval, const char *parent, bool force)
+void DefScript_DynamicEventMgr::Add(std::string name, std::string script, uint32 interval, const char *parent, bool force)
 {
     _DEFSC_DEBUG( printf("DEFSCRIPT: Add Event %s, interval=%u, parent=%s\n",name.c_str(),interval,parent?parent:""); printf("DEFSCRIPT: EventRun='%s'\n",script.c_str()); )
     if(name.empty() || script.empty() || interval==0)
         return;
-    if(_storage.Exists(name) && !force)
+    DefScript_DynamicEvent *e = _storage.GetNoCreate(name);
+    if(e && !force)
         return;
 
-    DefScript_DynamicEvent *e = _storage.Get(name);
+    if(!e)
+        e = _storage.Get(name);
+    else if(e->timer != EVENT_NO_TIMER)
+        _timers.Remove(e->timer);
     e->name = name;
     e->cmd = script;
     e->interval = interval;
     e->parent = parent?parent:"";
-    e->counter = 0;
-    e->ran = false;
-    _events_changed = true;
+    e->due = getMonotonicMSTime() + interval;
+    e->timer = _timers.Add(e->due, e);
 }
 
 void DefScript_DynamicEventMgr::Remove(std::string name)
 {
+    DefScript_DynamicEvent *e = _storage.GetNoCreate(name);
+    if(!e)
+        return;
+    if(e->timer != EVENT_NO_TIMER)
+        _timers.Remove(e->timer);
     _storage.Delete(name);
-    _events_changed = true;
 }
 
+// every due event runs once. if an update came too late for more than one interval, the missed runs are skipped,
+// but the event stays in its phase.
 void DefScript_DynamicEventMgr::Update(void)
 {
-    bool decr_timer = false;
-    clock_t diff = clock() - _lastclock;
-    _lastclock = clock();
-    DefScript *sc;
+    uint32 now = getMonotonicMSTime();
     DefScript_DynamicEvent *e;
-    _events_changed = false;
-
-    for(std::map<std::string,DefScript_DynamicEvent*>::iterator i = _storage.GetMap().begin(); i != _storage.GetMap().end(); i++ )
-    {
-        i->second->ran = false;
-    }
-
-    for(std::map<std::string,DefScript_DynamicEvent*>::iterator i = _storage.GetMap().begin(); i != _storage.GetMap().end(); )
+    while(_timers.Pop(now, e))
     {
-        e = i->second;
-        sc = NULL;
+        uint32 due = e->due;
+        std::string name = e->name;
+        e->timer = EVENT_NO_TIMER;
 		try
 		{
-			e->counter += diff;
-			if(e->counter >= e->interval && !e->ran)
-			{
-				decr_timer = true;
-
-				if(!e->parent.empty())
-					sc = _pack->GetScript(e->parent);
-
-				if(sc)
-					_pack->RunSingleLineFromScript(e->cmd,sc);
-				else
-					_pack->RunSingleLine(e->cmd);
-			}
+            DefScript *sc = e->parent.empty() ? NULL : _pack->GetScript(e->parent);
+            if(sc)
+                _pack->RunSingleLineFromScript(e->cmd,sc);
+            else
+                _pack->RunSingleLine(e->cmd);
 		}
 		catch (...)
 		{
 			printf("Error in DefScript_DynamicEventMgr::Update()\n");
-            return;
 		}
-        if(decr_timer)
-        {
-            e->counter %= e->interval;
-            e->ran = true;
-            decr_timer = false;
-        }
-        if(_events_changed)
-        {
-            _events_changed = false;
-            i = _storage.GetMap().begin();
-        }
-        else
+
+        // the script may have removed or replaced the event
+        e = _storage.GetNoCreate(name);
+        if(e && e->timer == EVENT_NO_TIMER)
         {
-            i++;
+            e->due = now + e->interval - (now - due) % e->interval;
+            e->timer = _timers.Add(e->due, e);
         }
     }
+}
+
+uint32 DefScript_DynamicEventMgr::GetNextEventDelay(void)
+{
+    return _timers.GetNextDelay(getMonotonicMSTime());
 }
@@ -5,27 +5,31 @@
 #include <list>
 #include <string>
 
+#include "SysDefs.h"
 #include "TypeStorage.h"
+#include "TimerWheel.h"
 
 struct DefScript_DynamicEvent;
 class DefScript;
 class DefScriptPackage;
 typedef TypeStorage<DefScript_DynamicEvent> DefDynamicEventStorage;
 
+// runs script lines in fixed intervals. the events are kept in a timer wheel, so Update() only has to look at the
+// events that are due.
 class DefScript_DynamicEventMgr
 {
 public:
     DefScript_DynamicEventMgr(DefScriptPackage *pack);
     ~DefScript_DynamicEventMgr();
-    void Add(std::string name, std::string script, clock_t interval, const char *parent, bool force = false);
+    void Add(std::string name, std::string script, uint32 interval, const char *parent, bool force = false);
 	void Remove(std::string name);
 	void Update(void);
+    uint32 GetNextEventDelay(void); // msecs until the next event is due, or uint32(-1) if there are none
 	
 private:
 	DefDynamicEventStorage _storage;
-	clock_t _lastclock;
+    TimerWheel<DefScript_DynamicEvent*> _timers;
     DefScriptPackage *_pack;
-    bool _events_changed; // this one helps to detect if a script called from an event has modified the event storage (risk of iterator invalidation!)
 };
 
 #endif
@@ -6,8 +6,22 @@
 #include <cctype>
 #include "VarSet.h"
 
+static const std::string emptystr;
+
+// FNV-1a
+static inline unsigned int HashName(const std::string& s)
+{
+    unsigned int h = 2166136261U;
+    for(unsigned int i = 0; i < s.length(); i++)
+        h = (h ^ (unsigned char)s[i]) * 16777619U;
+    return h;
+}
+
 VarSet::VarSet()
 {
+    _holes = 0;
+    _used = 0;
+    _Rehash(64);
 }
 
 VarSet::~VarSet()
@@ -15,69 +29,192 @@ VarSet::~VarSet()
 	Clear();
 }
 
-std::string VarSet::Get(std::string varname)
+int VarSet::_Find(const std::string& name, unsigned int hash)
+{
+    for(int i = _buckets[hash & (_buckets.size() - 1)]; i >= 0; i = _entries[i].next)
+        if(_entries[i].hash == hash && _entries[i].name == name)
+            return i;
+    return -1;
+}
+
+unsigned int VarSet::_Create(const std::string& name, unsigned int hash)
+{
+    if(_used >= _buckets.size())
+        _Rehash(_buckets.size() * 2);
+    unsigned int atom;
+    if(_freeatoms.size())
+    {
+        atom = _freeatoms.back();
+        _freeatoms.pop_back();
+    }
+    else
+    {
+        atom = _entries.size();
+        _entries.resize(atom + 1);
+    }
+    Entry& e = _entries[atom];
+    e.name = name;
+    e.hash = hash;
+    e.order = -1;
+    e.refs = 0;
+    unsigned int b = hash & (_buckets.size() - 1);
+    e.next = _buckets[b];
+    _buckets[b] = atom;
+    _used++;
+    return atom;
+}
+
+// remove an entry that is neither set nor referenced from the hash table, and keep its atom for reuse
+void VarSet::_Free(unsigned int atom)
+{
+    Entry& e = _entries[atom];
+    int *link = &_buckets[e.hash & (_buckets.size() - 1)];
+    while(*link != (int)atom)
+        link = &_entries[*link].next;
+    *link = e.next;
+    e.name.clear();
+    e.value.clear();
+    _freeatoms.push_back(atom);
+    _used--;
+}
+
+void VarSet::_Rehash(unsigned int buckets)
+{
+    _buckets.assign(buckets, -1);
+    std::vector<bool> isfree(_entries.size(), false);
+    for(unsigned int i = 0; i < _freeatoms.size(); i++)
+        isfree[_freeatoms[i]] = true;
+    for(unsigned int i = 0; i < _entries.size(); i++)
+    {
+        if(isfree[i])
+            continue;
+        unsigned int b = _entries[i].hash & (buckets - 1);
+        _entries[i].next = _buckets[b];
+        _buckets[b] = i;
+    }
+}
+
+void VarSet::_Compact(void)
+{
+    unsigned int n = 0;
+    for(unsigned int i = 0; i < _order.size(); i++)
+    {
+        if(_order[i] < 0)
+            continue;
+        _entries[_order[i]].order = n;
+        _order[n++] = _order[i];
+    }
+    _order.resize(n);
+    _holes = 0;
+}
+
+unsigned int VarSet::GetAtom(const std::string& name)
+{
+    unsigned int hash = HashName(name);
+    int atom = _Find(name, hash);
+    if(atom < 0)
+        atom = _Create(name, hash);
+    _entries[atom].refs++;
+    return atom;
+}
+
+void VarSet::ReleaseAtom(unsigned int atom)
+{
+    Entry& e = _entries[atom];
+    if(!--e.refs && e.order < 0)
+        _Free(atom);
+}
+
+void VarSet::Set(unsigned int atom, const std::string& value)
+{
+    Entry& e = _entries[atom];
+    e.value = value;
+    if(e.order < 0)
+    {
+        e.order = _order.size();
+        _order.push_back(atom);
+    }
+}
+
+void VarSet::Unset(unsigned int atom)
+{
+    Entry& e = _entries[atom];
+    if(e.order < 0)
+        return;
+    _order[e.order] = -1;
+    e.order = -1;
+    e.value.clear();
+    if(++_holes > 32 && _holes > _order.size() / 2)
+        _Compact();
+    if(!e.refs)
+        _Free(atom);
+}
+
+const std::string& VarSet::Get(const std::string& varname)
 {
-    for(std::deque<Var>::iterator i=buffer.begin();i!=buffer.end();i++)
-		if( i->name==varname )
-			return i->value;
-    return ""; // if var has not been set return empty string
+    int atom = _Find(varname, HashName(varname));
+    return atom < 0 ? emptystr : _entries[atom].value; // if var has not been set return empty string
 }
 
-void VarSet::Set(std::string varname, std::string varvalue)
+void VarSet::Set(const std::string& varname, const std::string& varvalue)
 {
 	if(varname.empty())
         return;
-	for(std::deque<Var>::iterator i = buffer.begin();i!=buffer.end();i++)
-    {
-		if( i->name==varname )
-        {
-			i->value=varvalue;
-			return;
-		}
-	}
-    Var v;
-    v.name=varname;
-    v.value=varvalue;
-    buffer.push_back(v);
-	return;
+    unsigned int hash = HashName(varname);
+    int atom = _Find(varname, hash);
+    if(atom < 0)
+        atom = _Create(varname, hash);
+    Set(atom, varvalue);
 }
 
 unsigned int VarSet::Size(void)
 {
-    return buffer.size();
+    return _order.size() - _holes;
 }
 
-bool VarSet::Exists(std::string varname)
+bool VarSet::Exists(const std::string& varname)
 {
-	for(std::deque<Var>::iterator i = buffer.begin();i!=buffer.end();i++)
-        if(i->name==varname)
-            return true;
-	return false;
+    int atom = _Find(varname, HashName(varname));
+    return atom >= 0 && _entries[atom].order >= 0;
 }
 
-void VarSet::Unset(std::string varname)
+void VarSet::Unset(const std::string& varname)
 {
     if ( varname.empty() )
         return;
-	for(std::deque<Var>::iterator i = buffer.begin();i!=buffer.end();i++)
-    {
-		if(i->name==varname)
-        {
-			buffer.erase(i);
-			return;
-		}
-	}
+    int atom = _Find(varname, HashName(varname));
+    if(atom >= 0)
+        Unset(atom);
 }
 
+// atoms held by GetAtom() stay valid
 void VarSet::Clear(void)
 {
-    buffer.clear();
+    for(unsigned int i = 0; i < _order.size(); i++)
+    {
+        if(_order[i] < 0)
+            continue;
+        Entry& e = _entries[_order[i]];
+        e.order = -1;
+        e.value.clear();
+        if(!e.refs)
+            _Free(_order[i]);
+    }
+    _order.clear();
+    _holes = 0;
 }
 
+// vars in order of creation
 Var VarSet::operator[](unsigned int id)
- {
-     return buffer.at(id);
- }
+{
+    if(_holes)
+        _Compact();
+    Entry& e = _entries[_order.at(id)];
+    Var v;
+    v.name = e.name;
+    v.value = e.value;
+    return v;
+}
 	
 bool VarSet::ReadVarsFromFile(std::string fn)
 {
@@ -2,30 +2,62 @@
 #define __VARSET_H
 
 #include <string>
+#include <vector>
 #include <deque>
 
 
 struct Var {
     std::string name, value;
 };
-	
 
+
+// variables are stored in a hash table. every name gets a fixed integer id (atom) when it is first used,
+// so that compiled scripts can resolve their var names once and access the values without hashing or comparing names.
+// atoms handed out by GetAtom() stay valid until ReleaseAtom(), even if the var is unset in between.
 class VarSet {
 public:
-    void Set(std::string,std::string);
-    std::string Get(std::string);
+    void Set(const std::string&, const std::string&);
+    const std::string& Get(const std::string&);
 	void Clear(void);
-	void Unset(std::string);
+	void Unset(const std::string&);
 	unsigned int Size(void);
-	bool Exists(std::string);
+	bool Exists(const std::string&);
     bool ReadVarsFromFile(std::string fn);
     Var operator[](unsigned int id);
 	VarSet();
 	~VarSet();
 	// far future: MergeWith(VarSet,bool overwrite);
 
+    unsigned int GetAtom(const std::string& name); // name must not be empty
+    void ReleaseAtom(unsigned int atom);
+    inline bool Exists(unsigned int atom) { return _entries[atom].order >= 0; }
+    inline const std::string& Get(unsigned int atom) { return _entries[atom].value; }
+    void Set(unsigned int atom, const std::string& value);
+    void Unset(unsigned int atom);
+
 private:
-    std::deque<Var> buffer;
+    struct Entry
+    {
+        std::string name, value;
+        unsigned int hash;
+        int next; // next entry in the same bucket, -1 if last
+        int order; // position in _order, -1 if the var is not set
+        unsigned int refs; // GetAtom() calls not yet released
+    };
+
+    int _Find(const std::string& name, unsigned int hash);
+    unsigned int _Create(const std::string& name, unsigned int hash);
+    void _Free(unsigned int atom);
+    void _Rehash(unsigned int buckets);
+    void _Compact(void);
+
+    std::deque<Entry> _entries; // indexed by atom. a deque, so references returned by Get() survive adding entries
+    std::vector<int> _buckets; // first entry of each bucket, -1 if empty
+    std::vector<unsigned int> _freeatoms;
+    std::vector<int> _order; // set vars in order of creation, -1 for vars unset since the last _Compact()
+    unsigned int _holes; // amount of -1 in _order
+    unsigned int _used; // entries in the hash table
+
     std::string toLower(std::string);
     std::string toUpper(std::string);
 
@@ -9,12 +9,15 @@
 #include "World/WorldSession.h"
 #include "World/Channel.h"
 #include "World/CacheHandler.h"
+#include "World/MovementMgr.h"
 #include "SCPDatabase.h"
 #include "MemoryDataHolder.h"
+#include "World/PathCache.h"
 
 
 void DefScriptPackage::_InitDefScriptInterface(void)
 {
+    my_scpKeyId = 0;
     AddFunc("pause",&DefScriptPackage::SCpause);
     AddFunc("emote",&DefScriptPackage::SCemote);
     AddFunc("follow",&DefScriptPackage::SCfollow);
@@ -45,6 +48,7 @@ void DefScriptPackage::_InitDefScriptInterface(void)
     AddFunc("lgetfiles",&DefScriptPackage::SCGetFileList);
     AddFunc("printscript",&DefScriptPackage::SCPrintScript);
     AddFunc("getobjectvalue",&DefScriptPackage::SCGetObjectValue);
+    AddFunc("fieldchanged",&DefScriptPackage::SCFieldChanged);
     AddFunc("getrace",&DefScriptPackage::SCGetRace);
     AddFunc("getclass",&DefScriptPackage::SCGetClass);
     AddFunc("sendworldpacket",&DefScriptPackage::SCSendWorldPacket);
@@ -56,12 +60,19 @@ void DefScriptPackage::_InitDefScriptInterface(void)
     AddFunc("sendwho",&DefScriptPackage::SCSendWho);
     AddFunc("getobjectdist",&DefScriptPackage::SCGetObjectDistance);
     AddFunc("getobjectpos",&DefScriptPackage::SCGetPos);
+    AddFunc("getobjectsinrange",&DefScriptPackage::SCGetObjectsInRange);
+    AddFunc("getnearestobjects",&DefScriptPackage::SCGetNearestObjects);
+    AddFunc("getrangechanges",&DefScriptPackage::SCGetRangeChanges);
+    AddFunc("moveto",&DefScriptPackage::SCMoveTo);
     AddFunc("switchopcodehandler",&DefScriptPackage::SCSwitchOpcodeHandler);
     AddFunc("opcodedisabled",&DefScriptPackage::SCOpcodeDisabled);
     AddFunc("spoofworldpacket",&DefScriptPackage::SCSpoofWorldPacket);
     AddFunc("loaddb",&DefScriptPackage::SCLoadDB);
     AddFunc("adddbpath",&DefScriptPackage::SCAddDBPath);
     AddFunc("preloadfile",&DefScriptPackage::SCPreloadFile);
+    AddFunc("bufferpoolstats",&DefScriptPackage::SCBufferPoolStats);
+    AddFunc("datacachestats",&DefScriptPackage::SCDataCacheStats);
+    AddFunc("pathcachestats",&DefScriptPackage::SCPathCacheStats);
 }
 
 DefReturnResult DefScriptPackage::SCshdn(CmdSet& Set)
@@ -381,8 +392,8 @@ DefReturnResult DefScriptPackage::SCloadscp(CmdSet& Set)
 // db & key will be stored, that multiple calls like GetScpValue entryxyz are possible
 DefReturnResult DefScriptPackage::SCGetScpValue(CmdSet& Set)
 {
-    static std::string dbname;
-    static uint32 keyid;
+    std::string& dbname = my_scpDbName;
+    unsigned int& keyid = my_scpKeyId;
     std::string entry;
     SCPDatabaseMgr& dbmgr = ((PseuInstance*)parentMethod)->dbmgr;
 
@@ -397,20 +408,20 @@ DefReturnResult DefScriptPackage::SCGetScpValue(CmdSet& Set)
         SCPDatabase *db = dbmgr.GetDB(dbname);
         if(db)
         {
-            uint32 ftype = db->GetFieldType((char*)entry.c_str());
-            switch(ftype)
+            const SCPFieldDef *fd = db->GetFieldDef(entry.c_str());
+            switch(fd ? fd->type : SCP_INVALID_INT)
             {
                 case SCP_TYPE_INT:
                 {
-                    return DefScriptTools::toString(db->GetInt(keyid,(char*)entry.c_str()));
+                    return DefScriptTools::toString(db->GetInt(keyid,fd->id));
                 }
                 case SCP_TYPE_FLOAT:
                 {
-                    return DefScriptTools::toString(db->GetFloat(keyid,(char*)entry.c_str()));
+                    return DefScriptTools::toString(db->GetFloat(keyid,fd->id));
                 }
                 case SCP_TYPE_STRING:
                 {
-                    return std::string(db->GetString(keyid,(char*)entry.c_str()));
+                    return std::string(db->GetString(keyid,fd->id));
                 }
                 default: logerror("GetSCPValue: field '%s' does not exist in DB '%s'!",entry.c_str(),dbname.c_str());
             }
@@ -802,7 +813,7 @@ DefReturnResult DefScriptPackage::SCGetItemProtoValue(CmdSet& Set)
 
 DefReturnResult DefScriptPackage::SCGetFileList(CmdSet& Set)
 {
-    DefList *l = lists.Get(_NormalizeVarName(Set.arg[0],Set.myname));
+    DefList *l = _GetListForWrite(_NormalizeVarName(Set.arg[0],Set.myname), true);
     l->clear();
     *l = (DefList)GetFileList(Set.defaultarg);
     if(Set.arg[1].length())
@@ -871,6 +882,31 @@ DefReturnResult DefScriptPackage::SCGetObjectValue(CmdSet &Set)
     return "";
 }
 
+// fieldchanged,<field> <guid>: true if the update field (same index as in getobjectvalue) was changed
+// by the update packet that is being handled; meant to be used in _onvalueschanged
+DefReturnResult DefScriptPackage::SCFieldChanged(CmdSet &Set)
+{
+    WorldSession *ws = ((PseuInstance*)parentMethod)->GetWSession();
+    if(!ws)
+    {
+        logerror("Invalid Script call: SCFieldChanged: WorldSession not valid");
+        DEF_RETURN_ERROR;
+    }
+
+    uint64 guid = DefScriptTools::toUint64(Set.defaultarg);
+    Object *o = ws->objmgr.GetObj(guid);
+    uint32 v = (uint32)DefScriptTools::toUint64(Set.arg[0]);
+    if(!o || !o->HasChangedFields())
+        return false;
+    if(v >= UPDATEFIELDS_NAME_COUNT)
+    {
+        logerror("SCFieldChanged ["I64FMTD", type %u]: invalid value index: %u",guid,o->GetTypeId(),v);
+        return false;
+    }
+    UpdateField& uf = Object::updatefields[v];
+    return o->IsFieldChanged(uf.offset) || (uf.type == UF_UINT64 && o->IsFieldChanged(uf.offset + 1));
+}
+
 DefReturnResult DefScriptPackage::SCGetRace(CmdSet &Set)
 {
     WorldSession *ws = ((PseuInstance*)parentMethod)->GetWSession();
@@ -1007,6 +1043,11 @@ DefReturnResult DefScriptPackage::SCBBPutPackedGuid(CmdSet &Set)
 DefReturnResult DefScriptPackage::SCGui(CmdSet &Set)
 {
     PseuInstance *ins = (PseuInstance*)parentMethod;
+    if(ins->IsHosted())
+    {
+        logerror("SCGui: not available for hosted instances");
+        return false;
+    }
     if(ins->InitGUI())
         logdebug("SCGui: gui created");
     else
@@ -1015,7 +1056,7 @@ DefReturnResult DefScriptPackage::SCGui(CmdSet &Set)
         return false;
     }
     while(!ins->GetGUI() || !ins->GetGUI()->IsInitialized())
-        ins->GetRunnable()->sleep(1);
+        ins->Sleep(1);
 
     ZThread::FastMutex mut;
     mut.acquire();
@@ -1188,14 +1229,27 @@ DefReturnResult DefScriptPackage::SCSpoofWorldPacket(CmdSet &Set)
     return false;
 }
 
+// LoadDB <name> [<name> ...]
+// several DBs given at once are compiled in parallel, if they must be compiled.
+// returns the amount of source files loaded, or "exists" if a single DB was requested that is already loaded.
 DefReturnResult DefScriptPackage::SCLoadDB(CmdSet &Set)
 {
     PseuInstance *ins = (PseuInstance*)parentMethod;
-    if(ins->dbmgr.GetDB(Set.defaultarg.c_str()))
-        return "exists";
-    logdetail("Loading database '%s'",Set.defaultarg.c_str());
-    uint32 result = ins->dbmgr.SearchAndLoad((char*)Set.defaultarg.c_str(), false);
-    return toString(result);
+    std::deque<std::string> names;
+    std::stringstream ss(Set.defaultarg);
+    std::string name;
+    uint32 given = 0;
+    while(ss >> name)
+    {
+        given++;
+        if(ins->dbmgr.GetDB(name))
+            continue;
+        logdetail("Loading database '%s'",name.c_str());
+        names.push_back(name);
+    }
+    if(names.empty())
+        return given == 1 ? "exists" : "0";
+    return toString(ins->dbmgr.SearchAndLoad(names, false));
 }
 
 DefReturnResult DefScriptPackage::SCAddDBPath(CmdSet &Set)
@@ -1230,12 +1284,231 @@ DefReturnResult DefScriptPackage::SCGetPos(CmdSet &Set)
     return "";
 }
 
+// empty type filter means any type
+static uint8 ScriptTypeIdFilter(const std::string& s)
+{
+    return s.empty() ? uint8(TYPEID_MAX) : uint8(DefScriptTools::toUint64(s));
+}
+
+// GetObjectsInRange,<list>,<radius>[,<typeid>[,<entry>]] [<guid>]
+// fills list with the guids of the objects within radius (2D) around the object, which is not included itself.
+// guid defaults to our own char. returns the amount of objects found.
+DefReturnResult DefScriptPackage::SCGetObjectsInRange(CmdSet& Set)
+{
+    WorldSession *ws = ((PseuInstance*)parentMethod)->GetWSession();
+    if(!ws)
+    {
+        logerror("Invalid Script call: SCGetObjectsInRange: WorldSession not valid");
+        DEF_RETURN_ERROR;
+    }
+    uint64 guid = DefScriptTools::toUint64(Set.defaultarg);
+    Object *obj = ws->objmgr.GetObj(guid ? guid : ws->GetGuid());
+    if(!obj || !obj->IsWorldObject())
+        return "";
+    WorldObject *center = (WorldObject*)obj;
+    DefList *l = _GetListForWrite(_NormalizeVarName(Set.arg[0],Set.myname), true);
+    l->clear();
+    WorldObjectList objs;
+    ws->objmgr.GetGrid().GetObjectsInRange(center->GetMapId(), center->GetX(), center->GetY(), (float)DefScriptTools::toNumber(Set.arg[1]),
+        objs, ScriptTypeIdFilter(Set.arg[2]), (uint32)DefScriptTools::toUint64(Set.arg[3]), center);
+    for(uint32 i = 0; i < objs.size(); i++)
+        l->push_back(DefScriptTools::toString(objs[i]->GetGUID()));
+    return DefScriptTools::toString((uint64)l->size());
+}
+
+// GetNearestObjects,<list>,<count>[,<maxradius>[,<typeid>[,<entry>]]] [<guid>]
+// like GetObjectsInRange, but only the <count> nearest objects, nearest first. no maxradius means no limit.
+DefReturnResult DefScriptPackage::SCGetNearestObjects(CmdSet& Set)
+{
+    WorldSession *ws = ((PseuInstance*)parentMethod)->GetWSession();
+    if(!ws)
+    {
+        logerror("Invalid Script call: SCGetNearestObjects: WorldSession not valid");
+        DEF_RETURN_ERROR;
+    }
+    uint64 guid = DefScriptTools::toUint64(Set.defaultarg);
+    Object *obj = ws->objmgr.GetObj(guid ? guid : ws->GetGuid());
+    if(!obj || !obj->IsWorldObject())
+        return "";
+    WorldObject *center = (WorldObject*)obj;
+    DefList *l = _GetListForWrite(_NormalizeVarName(Set.arg[0],Set.myname), true);
+    l->clear();
+    WorldObjectList objs;
+    ws->objmgr.GetGrid().GetNearestObjects(center->GetMapId(), center->GetX(), center->GetY(), (uint32)DefScriptTools::toUint64(Set.arg[1]),
+        (float)DefScriptTools::toNumber(Set.arg[2]), objs, ScriptTypeIdFilter(Set.arg[3]), (uint32)DefScriptTools::toUint64(Set.arg[4]), center);
+    for(uint32 i = 0; i < objs.size(); i++)
+        l->push_back(DefScriptTools::toString(objs[i]->GetGUID()));
+    return DefScriptTools::toString((uint64)l->size());
+}
+
+// GetRangeChanges,<enteredlist>,<leftlist>,<radius>[,<typeid>[,<entry>]] [<guid>]
+// fills the lists with the guids of the objects that came into / went out of range since the last call
+// with the same enteredlist. the first call reports all objects in range as entered.
+// returns the total amount of changes.
+DefReturnResult DefScriptPackage::SCGetRangeChanges(CmdSet& Set)
+{
+    WorldSession *ws = ((PseuInstance*)parentMethod)->GetWSession();
+    if(!ws)
+    {
+        logerror("Invalid Script call: SCGetRangeChanges: WorldSession not valid");
+        DEF_RETURN_ERROR;
+    }
+    uint64 guid = DefScriptTools::toUint64(Set.defaultarg);
+    Object *obj = ws->objmgr.GetObj(guid ? guid : ws->GetGuid());
+    if(!obj || !obj->IsWorldObject())
+        return "";
+    std::string ename = _NormalizeVarName(Set.arg[0],Set.myname);
+    DefList *entered = _GetListForWrite(ename, true);
+    DefList *left = _GetListForWrite(_NormalizeVarName(Set.arg[1],Set.myname), true);
+    entered->clear();
+    left->clear();
+    std::vector<uint64> e, lf;
+    ws->objmgr.GetRangeTracker(ename).Update(ws->objmgr.GetGrid(), (WorldObject*)obj, (float)DefScriptTools::toNumber(Set.arg[2]),
+        e, lf, ScriptTypeIdFilter(Set.arg[3]), (uint32)DefScriptTools::toUint64(Set.arg[4]));
+    for(uint32 i = 0; i < e.size(); i++)
+        entered->push_back(DefScriptTools::toString(e[i]));
+    for(uint32 i = 0; i < lf.size(); i++)
+        left->push_back(DefScriptTools::toString(lf[i]));
+    return DefScriptTools::toString(uint64(e.size() + lf.size()));
+}
+
+// MoveTo,<x>,<y>
+// walks our char to the given position, around steep terrain and deep water. targets further away than the
+// neighbouring map tiles need the navgraphs (see PathCacheSize in PseuWoW.conf).
+// returns the amount of points of the path, or false if there is none. "MoveTo stop" stops walking.
+DefReturnResult DefScriptPackage::SCMoveTo(CmdSet& Set)
+{
+    WorldSession *ws = ((PseuInstance*)parentMethod)->GetWSession();
+    if(!ws || !ws->GetWorld() || !ws->GetWorld()->GetMoveMgr())
+    {
+        logerror("Invalid Script call: SCMoveTo: not in world");
+        DEF_RETURN_ERROR;
+    }
+    MovementMgr *mmgr = ws->GetWorld()->GetMoveMgr();
+    if(DefScriptTools::stringToLower(Set.defaultarg) == "stop")
+    {
+        mmgr->StopFollowPath();
+        return true;
+    }
+    if(!mmgr->MoveTo((float)DefScriptTools::toNumber(Set.arg[0]), (float)DefScriptTools::toNumber(Set.arg[1])))
+        return false;
+    return DefScriptTools::toString(uint64(mmgr->GetPathSize()));
+}
+
 DefReturnResult DefScriptPackage::SCPreloadFile(CmdSet& Set)
 {
     MemoryDataHolder::BackgroundLoadFile(Set.defaultarg);
     return true;
 }
 
+// returns one counter of the packet buffer pool, or logs all of them if no name is given.
+// "trim" gives the cached blocks back to the system.
+DefReturnResult DefScriptPackage::SCBufferPoolStats(CmdSet& Set)
+{
+    std::string what = DefScriptTools::stringToLower(Set.defaultarg);
+    if(what == "trim")
+    {
+        BufferPool::Trim();
+        return true;
+    }
+    BufferPool::Stats st;
+    BufferPool::GetStats(st);
+    if(what.empty())
+    {
+        log("BufferPool: allocs=" I64FMTD " frees=" I64FMTD " threadhits=" I64FMTD " sharedhits=" I64FMTD " mallocs=" I64FMTD " inuse=" I64FMTD " cached=" I64FMTD,
+            st.allocs, st.frees, st.threadHits, st.sharedHits, st.mallocs, st.bytesInUse, st.bytesCached);
+        return true;
+    }
+    if(what == "allocs")
+        return DefScriptTools::toString(st.allocs);
+    if(what == "frees")
+        return DefScriptTools::toString(st.frees);
+    if(what == "threadhits")
+        return DefScriptTools::toString(st.threadHits);
+    if(what == "sharedhits")
+        return DefScriptTools::toString(st.sharedHits);
+    if(what == "mallocs")
+        return DefScriptTools::toString(st.mallocs);
+    if(what == "inuse")
+        return DefScriptTools::toString(st.bytesInUse);
+    if(what == "cached")
+        return DefScriptTools::toString(st.bytesCached);
+    logerror("SCBufferPoolStats: unknown counter '%s'", what.c_str());
+    return "";
+}
+
+// returns one counter of the file data cache, or logs all of them if no name is given.
+// "flush" drops all files that are not in use.
+DefReturnResult DefScriptPackage::SCDataCacheStats(CmdSet& Set)
+{
+    std::string what = DefScriptTools::stringToLower(Set.defaultarg);
+    if(what == "flush")
+    {
+        MemoryDataHolder::FlushCache();
+        return true;
+    }
+    MemoryDataHolder::CacheStats st;
+    MemoryDataHolder::GetCacheStats(st);
+    if(what.empty())
+    {
+        log("DataCache: hits=" I64FMTD " misses=" I64FMTD " evictions=" I64FMTD " files=%u pinned=%u bytes=%u unused=%u limit=%u",
+            st.hits, st.misses, st.evictions, st.files, st.pinned, st.bytes, st.unused, st.limit);
+        return true;
+    }
+    if(what == "hits")
+        return DefScriptTools::toString(st.hits);
+    if(what == "misses")
+        return DefScriptTools::toString(st.misses);
+    if(what == "evictions")
+        return DefScriptTools::toString(st.evictions);
+    if(what == "files")
+        return DefScriptTools::toString(st.files);
+    if(what == "pinned")
+        return DefScriptTools::toString(st.pinned);
+    if(what == "bytes")
+        return DefScriptTools::toString(st.bytes);
+    if(what == "unused")
+        return DefScriptTools::toString(st.unused);
+    if(what == "limit")
+        return DefScriptTools::toString(st.limit);
+    logerror("SCDataCacheStats: unknown counter '%s'", what.c_str());
+    return "";
+}
+
+// returns one counter of the long path cache, or logs all of them if no name is given.
+// "flush" drops all paths and navgraphs.
+DefReturnResult DefScriptPackage::SCPathCacheStats(CmdSet& Set)
+{
+    std::string what = DefScriptTools::stringToLower(Set.defaultarg);
+    if(what == "flush")
+    {
+        PathCache::FlushCache();
+        return true;
+    }
+    PathCache::CacheStats st;
+    PathCache::GetCacheStats(st);
+    if(what.empty())
+    {
+        log("PathCache: hits=" I64FMTD " misses=" I64FMTD " evictions=" I64FMTD " paths=%u limit=%u graphs=%u",
+            st.hits, st.misses, st.evictions, st.paths, st.limit, st.graphs);
+        return true;
+    }
+    if(what == "hits")
+        return DefScriptTools::toString(st.hits);
+    if(what == "misses")
+        return DefScriptTools::toString(st.misses);
+    if(what == "evictions")
+        return DefScriptTools::toString(st.evictions);
+    if(what == "paths")
+        return DefScriptTools::toString(st.paths);
+    if(what == "limit")
+        return DefScriptTools::toString(st.limit);
+    if(what == "graphs")
+        return DefScriptTools::toString(st.graphs);
+    logerror("SCPathCacheStats: unknown counter '%s'", what.c_str());
+    return "";
+}
+
 void DefScriptPackage::My_LoadUserPermissions(VarSet &vs)
 {
     static const char *prefix = "USERS::";
@@ -35,6 +35,7 @@ DefReturnResult SCGetScriptPerm(CmdSet&);
 DefReturnResult SCGetFileList(CmdSet&);
 DefReturnResult SCPrintScript(CmdSet&);
 DefReturnResult SCGetObjectValue(CmdSet&);
+DefReturnResult SCFieldChanged(CmdSet&);
 DefReturnResult SCGetRace(CmdSet&);
 DefReturnResult SCGetClass(CmdSet&);
 DefReturnResult SCSendWorldPacket(CmdSet&);
@@ -51,7 +52,14 @@ DefReturnResult SCSpoofWorldPacket(CmdSet&);
 DefReturnResult SCLoadDB(CmdSet&);
 DefReturnResult SCAddDBPath(CmdSet&);
 DefReturnResult SCGetPos(CmdSet&);
+DefReturnResult SCGetObjectsInRange(CmdSet&);
+DefReturnResult SCGetNearestObjects(CmdSet&);
+DefReturnResult SCGetRangeChanges(CmdSet&);
+DefReturnResult SCMoveTo(CmdSet&);
 DefReturnResult SCPreloadFile(CmdSet&);
+DefReturnResult SCBufferPoolStats(CmdSet&);
+DefReturnResult SCDataCacheStats(CmdSet&);
+DefReturnResult SCPathCacheStats(CmdSet&);
 
 
 void my_print(const char *fmt, ...);
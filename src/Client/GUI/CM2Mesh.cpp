@@ -2,20 +2,99 @@
 // This file is part of the "Irrlicht Engine".
 // For conditions of distribution and use, see copyright notice in irrlicht.h
 #include <iostream>
+#include <float.h>
 #include "irrlicht/irrlicht.h"
 #include "CM2Mesh.h"
 #include "CBoneSceneNode.h"
+#include "zthread/Thread.h"
+#include "zthread/Task.h"
+#include "zthread/PoolExecutor.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#  include <xmmintrin.h>
+#  define M2_SKIN_SSE
+#endif
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#  define SKIN_CAS(v,o,n) (_InterlockedCompareExchange((volatile long*)&(v), (n), (o)) == (o))
+#  define SKIN_ADD(v,n) _InterlockedExchangeAdd((volatile long*)&(v), (n))
+#else
+#  define SKIN_CAS(v,o,n) __sync_bool_compare_and_swap(&(v), (o), (n))
+#  define SKIN_ADD(v,n) __sync_fetch_and_add(&(v), (n))
+#endif
+
 namespace irr
 {
 namespace scene
 {
 
+enum
+{
+    SKIN_IDLE,    // nothing queued
+    SKIN_QUEUED,  // job waits in the pool; whoever switches it to SKIN_RUNNING does the work
+    SKIN_RUNNING,
+    SKIN_DONE     // the job finished on a pool thread, SkinnedBox must be copied when joined
+};
+
+static ZThread::PoolExecutor *SkinExecutor = 0;
+static u32 SkinThreads = M2_SKIN_THREADS;
+
+// animates and skins one frame of a mesh on a pool thread.
+// the mesh can't be deleted while a job holds a pointer to it, the destructor waits for SkinJobs to drop to 0.
+class CM2SkinJob : public ZThread::Runnable
+{
+public:
+    CM2SkinJob(CM2Mesh *mesh) : Mesh(mesh) {}
+    void run()
+    {
+        if (SKIN_CAS(Mesh->SkinState, SKIN_QUEUED, SKIN_RUNNING))
+        {
+            Mesh->animateJoints(Mesh->SkinFrame, 1.0f);
+            Mesh->skinVertices();
+            SKIN_CAS(Mesh->SkinState, SKIN_RUNNING, SKIN_DONE);
+        }
+        SKIN_ADD(Mesh->SkinJobs, -1); // must be the last access to the mesh
+    }
+private:
+    CM2Mesh *Mesh;
+};
+
+
+//! returns the index of the first key at or after frame, or -1 if there is none. keys must be sorted by frame.
+//! the hint is the key found last time; the animation usually stays there or moves on to the next key.
+template <class T> static s32 findKey(const core::array<T> &keys, f32 frame, s32 &hint)
+{
+    if (hint>=0 && (u32)hint < keys.size())
+    {
+        if (hint>0 && keys[hint].frame>=frame && keys[hint-1].frame<frame)
+            return hint;
+        if (hint+1 < (s32)keys.size() && keys[hint+1].frame>=frame && keys[hint].frame<frame)
+            return ++hint;
+    }
+
+    u32 lo=0, hi=keys.size();
+    while (lo<hi)
+    {
+        const u32 mid=(lo+hi)/2;
+        if (keys[mid].frame>=frame)
+            hi=mid;
+        else
+            lo=mid+1;
+    }
+    if (lo==keys.size())
+        return -1;
+    hint=lo;
+    return hint;
+}
+
 
 //! constructor
 CM2Mesh::CM2Mesh()
 : SkinningBuffers(0), HasAnimation(0), PreparedForSkinning(0),
     AnimationFrames(0.f), LastAnimatedFrame(0.f),
-    AnimateNormals(true), HardwareSkinning(0), InterpolationMode(EIM_LINEAR)
+    AnimateNormals(true), HardwareSkinning(0), InterpolationMode(EIM_LINEAR),
+    SkinVertexCount(0), SkinState(SKIN_IDLE), SkinJobs(0), SkinFrame(0.f)
 {
     #ifdef _DEBUG
     setDebugName("CM2Mesh");
@@ -28,6 +107,10 @@ CM2Mesh::CM2Mesh()
 //! destructor
 CM2Mesh::~CM2Mesh()
 {
+    waitForSkinning();
+    while (SkinJobs)
+        ZThread::Thread::yield();
+
     for (u32 i=0; i<AllJoints.size(); ++i)
         delete AllJoints[i];
 
@@ -52,13 +135,80 @@ IMesh* CM2Mesh::getMesh(s32 frame, s32 detailLevel, s32 startFrameLoop, s32 endF
 {
     if (frame==-1)
         return this;
-    animateMesh((f32)frame, 1.0f);
+    waitForSkinning();
+    if (!HasAnimation || (LastAnimatedFrame==(f32)frame && SkinnedLastFrame))
+        return this;
 
-    skinMesh();
+    if (!queueSkinning((f32)frame))
+    {
+        animateJoints((f32)frame, 1.0f);
+        if (skinVertices())
+            BoundingBox=SkinnedBox;
+    }
     return this;
 }
 
 
+//--------------------------------------------------------------------------
+//            Background Skinning
+//--------------------------------------------------------------------------
+
+
+void CM2Mesh::setSkinningThreads(u32 threads)
+{
+    SkinThreads=threads;
+    if (SkinExecutor && threads)
+        SkinExecutor->size(threads);
+}
+
+
+//! hands the animation of a frame to the skinning threads. returns false if it should be done right away.
+bool CM2Mesh::queueSkinning(f32 frame)
+{
+    if (!SkinThreads || HardwareSkinning || SkinVertexCount<M2_SKIN_MIN_VERTICES)
+        return false;
+    if (!SkinExecutor)
+        SkinExecutor=new ZThread::PoolExecutor(SkinThreads);
+
+    SkinFrame=frame;
+    SKIN_ADD(SkinJobs, 1);
+    SKIN_CAS(SkinState, SKIN_IDLE, SKIN_QUEUED);
+    SkinExecutor->execute(ZThread::Task(new CM2SkinJob(this))); // takes ownership
+    return true;
+}
+
+
+void CM2Mesh::waitForSkinning() const
+{
+    CM2Mesh *self=const_cast<CM2Mesh*>(this);
+    while (true)
+    {
+        switch (SkinState)
+        {
+        case SKIN_IDLE:
+            return;
+        case SKIN_QUEUED:
+            // not picked up yet, do it here. the job will find the state changed and do nothing.
+            if (SKIN_CAS(self->SkinState, SKIN_QUEUED, SKIN_RUNNING))
+            {
+                self->animateJoints(SkinFrame, 1.0f);
+                self->skinVertices();
+                self->BoundingBox=SkinnedBox;
+                SKIN_CAS(self->SkinState, SKIN_RUNNING, SKIN_IDLE);
+                return;
+            }
+            break;
+        case SKIN_DONE:
+            self->BoundingBox=SkinnedBox;
+            SKIN_CAS(self->SkinState, SKIN_DONE, SKIN_IDLE);
+            return;
+        default:
+            ZThread::Thread::yield();
+        }
+    }
+}
+
+
 //--------------------------------------------------------------------------
 //            Keyframe Animation
 //--------------------------------------------------------------------------
@@ -67,6 +217,13 @@ IMesh* CM2Mesh::getMesh(s32 frame, s32 detailLevel, s32 startFrameLoop, s32 endF
 //! Animates this mesh's joints based on frame input
 //! blend: {0-old position, 1-New position}
 void CM2Mesh::animateMesh(f32 frame, f32 blend)
+{
+    waitForSkinning();
+    animateJoints(frame, blend);
+}
+
+
+void CM2Mesh::animateJoints(f32 frame, f32 blend)
 {
     if ( !HasAnimation  || LastAnimatedFrame==frame)
         return;
@@ -183,39 +340,7 @@ void CM2Mesh::getFrameData(f32 frame, SJoint *joint,
 
         if (PositionKeys.size())
         {
-            foundPositionIndex = -1;
-
-            //Test the Hints...
-            if (positionHint>=0 && (u32)positionHint < PositionKeys.size())
-            {
-                //check this hint
-                if (positionHint>0 && PositionKeys[positionHint].frame>=frame && PositionKeys[positionHint-1].frame<frame )
-                    foundPositionIndex=positionHint;
-                else if (positionHint+1 < (s32)PositionKeys.size())
-                {
-                    //check the next index
-                    if ( PositionKeys[positionHint+1].frame>=frame &&
-                            PositionKeys[positionHint+0].frame<frame)
-                    {
-                        positionHint++;
-                        foundPositionIndex=positionHint;
-                    }
-                }
-            }
-
-            //The hint test failed, do a full scan...
-            if (foundPositionIndex==-1)
-            {
-                for (u32 i=0; i<PositionKeys.size(); ++i)
-                {
-                    if (PositionKeys[i].frame >= frame) //Keys should to be sorted by frame
-                    {
-                        foundPositionIndex=i;
-                        positionHint=i;
-                        break;
-                    }
-                }
-            }
+            foundPositionIndex = findKey(PositionKeys, frame, positionHint);
 
             //Do interpolation...
             if (foundPositionIndex!=-1)
@@ -240,40 +365,7 @@ void CM2Mesh::getFrameData(f32 frame, SJoint *joint,
 
         if (ScaleKeys.size())
         {
-            foundScaleIndex = -1;
-
-            //Test the Hints...
-            if (scaleHint>=0 && (u32)scaleHint < ScaleKeys.size())
-            {
-                //check this hint
-                if (scaleHint>0 && ScaleKeys[scaleHint].frame>=frame && ScaleKeys[scaleHint-1].frame<frame )
-                    foundScaleIndex=scaleHint;
-                else if (scaleHint+1 < (s32)ScaleKeys.size())
-                {
-                    //check the next index
-                    if ( ScaleKeys[scaleHint+1].frame>=frame &&
-                            ScaleKeys[scaleHint+0].frame<frame)
-                    {
-                        scaleHint++;
-                        foundScaleIndex=scaleHint;
-                    }
-                }
-            }
-
-
-            //The hint test failed, do a full scan...
-            if (foundScaleIndex==-1)
-            {
-                for (u32 i=0; i<ScaleKeys.size(); ++i)
-                {
-                    if (ScaleKeys[i].frame >= frame) //Keys should to be sorted by frame
-                    {
-                        foundScaleIndex=i;
-                        scaleHint=i;
-                        break;
-                    }
-                }
-            }
+            foundScaleIndex = findKey(ScaleKeys, frame, scaleHint);
 
             //Do interpolation...
             if (foundScaleIndex!=-1)
@@ -298,40 +390,7 @@ void CM2Mesh::getFrameData(f32 frame, SJoint *joint,
 
         if (RotationKeys.size())
         {
-            foundRotationIndex = -1;
-
-            //Test the Hints...
-            if (rotationHint>=0 && (u32)rotationHint < RotationKeys.size())
-            {
-                //check this hint
-                if (rotationHint>0 && RotationKeys[rotationHint].frame>=frame && RotationKeys[rotationHint-1].frame<frame )
-                    foundRotationIndex=rotationHint;
-                else if (rotationHint+1 < (s32)RotationKeys.size())
-                {
-                    //check the next index
-                    if ( RotationKeys[rotationHint+1].frame>=frame &&
-                            RotationKeys[rotationHint+0].frame<frame)
-                    {
-                        rotationHint++;
-                        foundRotationIndex=rotationHint;
-                    }
-                }
-            }
-
-
-            //The hint test failed, do a full scan...
-            if (foundRotationIndex==-1)
-            {
-                for (u32 i=0; i<RotationKeys.size(); ++i)
-                {
-                    if (RotationKeys[i].frame >= frame) //Keys should be sorted by frame
-                    {
-                        foundRotationIndex=i;
-                        rotationHint=i;
-                        break;
-                    }
-                }
-            }
+            foundRotationIndex = findKey(RotationKeys, frame, rotationHint);
 
             //Do interpolation...
             if (foundRotationIndex!=-1)
@@ -368,9 +427,18 @@ void CM2Mesh::getFrameData(f32 frame, SJoint *joint,
 
 //! Preforms a software skin on this mesh based of joint positions
 void CM2Mesh::skinMesh()
+{
+    waitForSkinning();
+    if (skinVertices())
+        BoundingBox=SkinnedBox;
+}
+
+
+//! skins the mesh buffers and puts the new bounding box into SkinnedBox. returns false if there was nothing to do.
+bool CM2Mesh::skinVertices()
 {
     if ( !HasAnimation || SkinnedLastFrame )
-        return;
+        return false;
 
     SkinnedLastFrame=true;
     if (!HardwareSkinning)
@@ -388,72 +456,125 @@ void CM2Mesh::skinMesh()
             }
         }
 
-        //clear skinning helper array
-        for (i=0; i<Vertices_Moved.size(); ++i)
-            for (u32 j=0; j<Vertices_Moved[i].size(); ++j)
-                Vertices_Moved[i][j]=false;
+        //the weighted vertices are a blend of the static vertex transformed by each of its joints
+        core::matrix4 jointVertexPull(core::matrix4::EM4CONST_NOTHING);
+        SkinPalette.set_used(AllJoints.size()*16);
+        for (i=0; i<AllJoints.size(); ++i)
+        {
+            jointVertexPull.setbyproduct(AllJoints[i]->GlobalAnimatedMatrix, AllJoints[i]->GlobalInversedMatrix);
+            memcpy(&SkinPalette[i*16], jointVertexPull.pointer(), 16*sizeof(f32));
+        }
 
-        //skin starting with the root joints
-        for (i=0; i<RootJoints.size(); ++i)
-            SkinJoint(RootJoints[i], 0);
+        for (i=0; i<SkinStreams.size(); ++i)
+            skinBuffer(i);
 
         for (i=0; i<SkinningBuffers->size(); ++i)
             (*SkinningBuffers)[i]->setDirty();
 
     }
-    updateBoundingBox();
+    getSkinnedBoundingBox(SkinnedBox);
+    return true;
 }
 
 
-void CM2Mesh::SkinJoint(SJoint *joint, SJoint *parentJoint)
+//! skins one mesh buffer with the matrices in SkinPalette, and sets its bounding box.
+//! the 4 joint matrices of a vertex are blended by weight first, then the blended matrix moves the vertex.
+void CM2Mesh::skinBuffer(u32 b)
 {
-    if (joint->Weights.size())
-    {
-        //Find this joints pull on vertices...
-        core::matrix4 jointVertexPull(core::matrix4::EM4CONST_NOTHING);
-        jointVertexPull.setbyproduct(joint->GlobalAnimatedMatrix, joint->GlobalInversedMatrix);
-
-        core::vector3df thisVertexMove, thisNormalMove;
-
-        core::array<scene::SSkinMeshBuffer*> &buffersUsed=*SkinningBuffers;
+    const SkinStream &s = SkinStreams[b];
+    const u32 count = s.Vertex.size();
+    if (!count)
+        return;
 
-        //Skin Vertices Positions and Normals...
-        for (u32 i=0; i<joint->Weights.size(); ++i)
+    SSkinMeshBuffer *buffer = (*SkinningBuffers)[b];
+    u8 *vertices = (u8*)buffer->getVertices();
+    const u32 pitch = video::getVertexPitchFromType(buffer->getVertexType());
+    const f32 *palette = SkinPalette.const_pointer();
+    const u16 *bone = s.Bone.const_pointer();
+    const f32 *weight = s.Weight.const_pointer();
+    const f32 *pos = s.StaticPos.const_pointer();
+    const f32 *normal = s.StaticNormal.const_pointer();
+    const bool normals = AnimateNormals;
+
+#ifdef M2_SKIN_SSE
+    __m128 boxMin = _mm_set1_ps(FLT_MAX);
+    __m128 boxMax = _mm_set1_ps(-FLT_MAX);
+    float out[4];
+    for (u32 i=0; i<count; ++i, bone+=4, weight+=4, pos+=3, normal+=3)
+    {
+        const f32 *m = palette + bone[0]*16;
+        __m128 w = _mm_set1_ps(weight[0]);
+        __m128 c0 = _mm_mul_ps(_mm_loadu_ps(m), w);
+        __m128 c1 = _mm_mul_ps(_mm_loadu_ps(m+4), w);
+        __m128 c2 = _mm_mul_ps(_mm_loadu_ps(m+8), w);
+        __m128 c3 = _mm_mul_ps(_mm_loadu_ps(m+12), w);
+        for (u32 k=1; k<4 && weight[k]>0.f; ++k)
         {
-            SWeight& weight = joint->Weights[i];
-
-            // Pull this vertex...
-            jointVertexPull.transformVect(thisVertexMove, weight.StaticPos);
-
-            if (AnimateNormals)
-                jointVertexPull.rotateVect(thisNormalMove, weight.StaticNormal);
+            m = palette + bone[k]*16;
+            w = _mm_set1_ps(weight[k]);
+            c0 = _mm_add_ps(c0, _mm_mul_ps(_mm_loadu_ps(m), w));
+            c1 = _mm_add_ps(c1, _mm_mul_ps(_mm_loadu_ps(m+4), w));
+            c2 = _mm_add_ps(c2, _mm_mul_ps(_mm_loadu_ps(m+8), w));
+            c3 = _mm_add_ps(c3, _mm_mul_ps(_mm_loadu_ps(m+12), w));
+        }
 
-            if (! (*(weight.Moved)) )
-            {
-                *(weight.Moved) = true;
+        video::S3DVertex *v = (video::S3DVertex*)(vertices + s.Vertex[i]*pitch);
+        __m128 p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(pos[0])), _mm_mul_ps(c1, _mm_set1_ps(pos[1]))),
+                              _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(pos[2])), c3));
+        boxMin = _mm_min_ps(boxMin, p);
+        boxMax = _mm_max_ps(boxMax, p);
+        _mm_storeu_ps(out, p);
+        v->Pos.set(out[0], out[1], out[2]);
 
-                buffersUsed[weight.buffer_id]->getVertex(weight.vertex_id)->Pos = thisVertexMove * weight.strength;
+        if (normals)
+        {
+            __m128 n = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(normal[0])), _mm_mul_ps(c1, _mm_set1_ps(normal[1]))),
+                                  _mm_mul_ps(c2, _mm_set1_ps(normal[2])));
+            _mm_storeu_ps(out, n);
+            v->Normal.set(out[0], out[1], out[2]);
+        }
+    }
+    _mm_storeu_ps(out, boxMin);
+    core::aabbox3d<f32> box(out[0], out[1], out[2], out[0], out[1], out[2]);
+    _mm_storeu_ps(out, boxMax);
+    box.addInternalPoint(out[0], out[1], out[2]);
+#else
+    core::aabbox3d<f32> box;
+    f32 c[16];
+    for (u32 i=0; i<count; ++i, bone+=4, weight+=4, pos+=3, normal+=3)
+    {
+        const f32 *m = palette + bone[0]*16;
+        u32 j;
+        for (j=0; j<16; ++j)
+            c[j] = m[j]*weight[0];
+        for (u32 k=1; k<4 && weight[k]>0.f; ++k)
+        {
+            m = palette + bone[k]*16;
+            for (j=0; j<16; ++j)
+                c[j] += m[j]*weight[k];
+        }
 
-                if (AnimateNormals)
-                    buffersUsed[weight.buffer_id]->getVertex(weight.vertex_id)->Normal = thisNormalMove * weight.strength;
-            }
-            else
-            {
-                buffersUsed[weight.buffer_id]->getVertex(weight.vertex_id)->Pos += thisVertexMove * weight.strength;
+        video::S3DVertex *v = (video::S3DVertex*)(vertices + s.Vertex[i]*pitch);
+        v->Pos.set(c[0]*pos[0] + c[4]*pos[1] + c[8]*pos[2] + c[12],
+                   c[1]*pos[0] + c[5]*pos[1] + c[9]*pos[2] + c[13],
+                   c[2]*pos[0] + c[6]*pos[1] + c[10]*pos[2] + c[14]);
+        if (i)
+            box.addInternalPoint(v->Pos);
+        else
+            box.reset(v->Pos);
 
-                if (AnimateNormals)
-                    buffersUsed[weight.buffer_id]->getVertex(weight.vertex_id)->Normal += thisNormalMove * weight.strength;
-            }
-            buffersUsed[weight.buffer_id]->boundingBoxNeedsRecalculated();
-        }
+        if (normals)
+            v->Normal.set(c[0]*normal[0] + c[4]*normal[1] + c[8]*normal[2],
+                          c[1]*normal[0] + c[5]*normal[1] + c[9]*normal[2],
+                          c[2]*normal[0] + c[6]*normal[1] + c[10]*normal[2]);
     }
+#endif
 
-    //Skin all children
-    for (u32 j=0; j<joint->Children.size(); ++j)
-        SkinJoint(joint->Children[j], joint);
+    if (s.HasStatic)
+        box.addInternalBox(s.StaticBox);
+    buffer->BoundingBox = box;
 }
 
-
 E_ANIMATED_MESH_TYPE CM2Mesh::getMeshType() const
 {
     return EAMT_M2;
@@ -499,6 +620,7 @@ u32 CM2Mesh::getMeshBufferCount() const
 //! returns pointer to a mesh buffer
 IMeshBuffer* CM2Mesh::getMeshBuffer(u32 nr) const
 {
+    waitForSkinning();
     if (nr < LocalBuffers.size())
         return LocalBuffers[nr];
     else
@@ -509,6 +631,7 @@ IMeshBuffer* CM2Mesh::getMeshBuffer(u32 nr) const
 //! Returns pointer to a mesh buffer which fits a material
 IMeshBuffer* CM2Mesh::getMeshBuffer(const video::SMaterial &material) const
 {
+    waitForSkinning();
     for (u32 i=0; i<LocalBuffers.size(); ++i)
     {
         if (LocalBuffers[i]->getMaterial() == material)
@@ -543,6 +666,7 @@ void CM2Mesh::setMaterialFlag(video::E_MATERIAL_FLAG flag, bool newvalue)
 void CM2Mesh::setHardwareMappingHint(E_HARDWARE_MAPPING newMappingHint,
                 E_BUFFER_TYPE buffer)
 {
+        waitForSkinning();
         for (u32 i=0; i<LocalBuffers.size(); ++i)
                 LocalBuffers[i]->setHardwareMappingHint(newMappingHint, buffer);
 }
@@ -551,6 +675,7 @@ void CM2Mesh::setHardwareMappingHint(E_HARDWARE_MAPPING newMappingHint,
 //! flags the meshbuffer as changed, reloads hardware buffers
 void CM2Mesh::setDirty(E_BUFFER_TYPE buffer)
 {
+        waitForSkinning();
         for (u32 i=0; i<LocalBuffers.size(); ++i)
                 LocalBuffers[i]->setDirty(buffer);
 }
@@ -559,6 +684,7 @@ void CM2Mesh::setDirty(E_BUFFER_TYPE buffer)
 //! uses animation from another mesh
 bool CM2Mesh::useAnimationFrom(const ISkinnedMesh *mesh)
 {
+    waitForSkinning();
     bool unmatched=false;
 
     for(u32 i=0;i<AllJoints.size();++i)
@@ -607,18 +733,21 @@ void CM2Mesh::setInterpolationMode(E_INTERPOLATION_MODE mode)
 
 core::array<scene::SSkinMeshBuffer*> &CM2Mesh::getMeshBuffers()
 {
+    waitForSkinning();
     return LocalBuffers;
 }
 
 
 core::array<CM2Mesh::SJoint*> &CM2Mesh::getAllJoints()
 {
+    waitForSkinning();
     return AllJoints;
 }
 
 
 const core::array<CM2Mesh::SJoint*> &CM2Mesh::getAllJoints() const
 {
+    waitForSkinning();
     return AllJoints;
 }
 
@@ -626,6 +755,7 @@ const core::array<CM2Mesh::SJoint*> &CM2Mesh::getAllJoints() const
 //! (This feature is not implementated in irrlicht yet)
 bool CM2Mesh::setHardwareSkinning(bool on)
 {
+    waitForSkinning();
     if (HardwareSkinning!=on)
     {
 
@@ -763,12 +893,6 @@ void CM2Mesh::checkForAnimation()
             }
         }
 
-        //An array used in skinning
-
-        for (i=0; i<Vertices_Moved.size(); ++i)
-            for (j=0; j<Vertices_Moved[i].size(); ++j)
-                Vertices_Moved[i][j] = false;
-
         // For skinning: cache weight values for speed
 
         for (i=0; i<AllJoints.size(); ++i)
@@ -779,7 +903,7 @@ void CM2Mesh::checkForAnimation()
                 const u16 buffer_id=joint->Weights[j].buffer_id;
                 const u32 vertex_id=joint->Weights[j].vertex_id;
 
-                joint->Weights[j].Moved = &Vertices_Moved[buffer_id] [vertex_id];
+                joint->Weights[j].Moved = 0;
                 joint->Weights[j].StaticPos = LocalBuffers[buffer_id]->getVertex(vertex_id)->Pos;
                 joint->Weights[j].StaticNormal = LocalBuffers[buffer_id]->getVertex(vertex_id)->Normal;
 
@@ -788,6 +912,106 @@ void CM2Mesh::checkForAnimation()
 
         // normalize weights
         normalizeWeights();
+
+        buildSkinStreams();
+    }
+}
+
+
+//! sorts the weights of every vertex into the SkinStreams. vertices with more than 4 weights keep the
+//! strongest 4, which are normalized again. M2 files have no more than 4 per vertex anyway.
+void CM2Mesh::buildSkinStreams()
+{
+    u32 i,j,k;
+    const u32 slots=4;
+
+    SkinStreams.clear();
+    SkinVertexCount=0;
+
+    for (u32 b=0; b<LocalBuffers.size(); ++b)
+    {
+        SkinStreams.push_back(SkinStream());
+        SkinStream &s = SkinStreams.getLast();
+        const u32 vertexCount = LocalBuffers[b]->getVertexCount();
+        s.HasStatic = false;
+
+        core::array<u16> bones;
+        core::array<f32> weights;
+        core::array<u8> counts;
+        bones.set_used(vertexCount*slots);
+        weights.set_used(vertexCount*slots);
+        counts.set_used(vertexCount);
+        for (i=0; i<vertexCount*slots; ++i)
+        {
+            bones[i] = 0;
+            weights[i] = 0.f;
+        }
+        for (i=0; i<vertexCount; ++i)
+            counts[i] = 0;
+
+        for (i=0; i<AllJoints.size(); ++i)
+        {
+            const core::array<SWeight> &jointWeights = AllJoints[i]->Weights;
+            for (j=0; j<jointWeights.size(); ++j)
+            {
+                if (jointWeights[j].buffer_id != b)
+                    continue;
+                const u32 vertex = jointWeights[j].vertex_id;
+                const f32 strength = jointWeights[j].strength;
+                u16 *vb = &bones[vertex*slots];
+                f32 *vw = &weights[vertex*slots];
+                if (counts[vertex] < 255)
+                    ++counts[vertex];
+                // insert sorted, the weakest falls off the end if all slots are used
+                for (k=slots; k>0 && vw[k-1] < strength; --k)
+                {
+                    if (k<slots)
+                    {
+                        vw[k] = vw[k-1];
+                        vb[k] = vb[k-1];
+                    }
+                }
+                if (k<slots)
+                {
+                    vw[k] = strength;
+                    vb[k] = (u16)i;
+                }
+            }
+        }
+
+        for (i=0; i<vertexCount; ++i)
+        {
+            const video::S3DVertex *v = LocalBuffers[b]->getVertex(i);
+            if (!counts[i])
+            {
+                if (s.HasStatic)
+                    s.StaticBox.addInternalPoint(v->Pos);
+                else
+                    s.StaticBox.reset(v->Pos);
+                s.HasStatic = true;
+                continue;
+            }
+            f32 *vw = &weights[i*slots];
+            if (counts[i] > slots)
+            {
+                const f32 total = vw[0]+vw[1]+vw[2]+vw[3];
+                for (k=0; k<slots; ++k)
+                    vw[k] /= total;
+            }
+            s.Vertex.push_back(i);
+            for (k=0; k<slots; ++k)
+            {
+                s.Bone.push_back(bones[i*slots+k]);
+                s.Weight.push_back(vw[k]);
+            }
+            s.StaticPos.push_back(v->Pos.X);
+            s.StaticPos.push_back(v->Pos.Y);
+            s.StaticPos.push_back(v->Pos.Z);
+            s.StaticNormal.push_back(v->Normal.X);
+            s.StaticNormal.push_back(v->Normal.Y);
+            s.StaticNormal.push_back(v->Normal.Z);
+        }
+        SkinVertexCount += s.Vertex.size();
     }
 }
 
@@ -795,6 +1019,7 @@ void CM2Mesh::checkForAnimation()
 //! called by loader after populating with mesh and bone data
 void CM2Mesh::finalize()
 {
+    waitForSkinning();
     u32 i;
     LastAnimatedFrame=-1;
     SkinnedLastFrame=false;
@@ -840,14 +1065,6 @@ void CM2Mesh::finalize()
         AllJoints[i]->UseAnimationFrom=AllJoints[i];
     }
 
-    //Set array sizes...
-
-    for (i=0; i<LocalBuffers.size(); ++i)
-    {
-        Vertices_Moved.push_back( core::array<bool>() );
-        Vertices_Moved[i].set_used(LocalBuffers[i]->getVertexCount());
-    }
-
     //Todo: optimise keys here...
 
     checkForAnimation();
@@ -1031,11 +1248,18 @@ if (HasAnimation)
 }
 
 void CM2Mesh::updateBoundingBox(void)
+{
+    waitForSkinning();
+    getSkinnedBoundingBox(BoundingBox);
+}
+
+
+void CM2Mesh::getSkinnedBoundingBox(core::aabbox3d<f32> &box)
 {
     if(!SkinningBuffers)
         return;
     core::array<SSkinMeshBuffer*> & buffer = *SkinningBuffers;
-    BoundingBox.reset(0,0,0);
+    box.reset(0,0,0);
 
     if (!buffer.empty())
     {
@@ -1045,7 +1269,7 @@ void CM2Mesh::updateBoundingBox(void)
             core::aabbox3df bb = buffer[j]->BoundingBox;
             buffer[j]->Transformation.transformBoxEx(bb);
 
-            BoundingBox.addInternalBox(bb);
+            box.addInternalBox(bb);
         }
     }
 }
@@ -1176,6 +1400,7 @@ void CM2Mesh::normalizeWeights()
 
 void CM2Mesh::recoverJointsFromMesh(core::array<IBoneSceneNode*> &JointChildSceneNodes)
 {
+    waitForSkinning();
     for (u32 i=0;i<AllJoints.size();++i)
     {
         IBoneSceneNode* node=JointChildSceneNodes[i];
@@ -1199,6 +1424,7 @@ void CM2Mesh::recoverJointsFromMesh(core::array<IBoneSceneNode*> &JointChildScen
 
 void CM2Mesh::transferJointsToMesh(const core::array<IBoneSceneNode*> &JointChildSceneNodes)
 {
+    waitForSkinning();
     for (u32 i=0; i<AllJoints.size(); ++i)
     {
         const IBoneSceneNode* const node=JointChildSceneNodes[i];
@@ -1226,6 +1452,7 @@ void CM2Mesh::transferJointsToMesh(const core::array<IBoneSceneNode*> &JointChil
 
 void CM2Mesh::transferOnlyJointsHintsToMesh(const core::array<IBoneSceneNode*> &JointChildSceneNodes)
 {
+    waitForSkinning();
     for (u32 i=0;i<AllJoints.size();++i)
     {
         const IBoneSceneNode* const node=JointChildSceneNodes[i];
@@ -1242,6 +1469,7 @@ void CM2Mesh::createJoints(core::array<IBoneSceneNode*> &JointChildSceneNodes,
         IAnimatedMeshSceneNode* AnimatedMeshSceneNode,
         ISceneManager* SceneManager)
 {
+    waitForSkinning();
     u32 i;
 
     //Create new joints
@@ -1286,6 +1514,7 @@ void CM2Mesh::createJoints(core::array<IBoneSceneNode*> &JointChildSceneNodes,
 
 void CM2Mesh::convertMeshToTangents()
 {
+    waitForSkinning();
     // now calculate tangents
     for (u32 b=0; b < LocalBuffers.size(); ++b)
     {
@@ -1536,6 +1765,7 @@ void CM2Mesh::LinkChildMeshes (IAnimatedMeshSceneNode *ParentMeshNode, ISceneMan
 
 void CM2Mesh::findExtremes() 
 {
+	waitForSkinning();
 	u32 NUMBER;
 	if (ExtreamPointGroups.size() > 0)
 	{
@@ -1643,6 +1873,7 @@ void CM2Mesh::findExtremes()
 
 void CM2Mesh::getDist_NearandFar_ofSubmesh(u32 submeshID, float &near, float &far, core::vector3df camPos, core::vector3df camNormal)
 {
+	waitForSkinning();
 	core::plane3df camPlane(camPos, camNormal);
 
 	for (u32 p=0; p < ExtreamPointGroups[submeshID].indexes.size()-1; p++)
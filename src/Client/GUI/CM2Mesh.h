@@ -4,6 +4,11 @@
 #include "irrlicht/irrlicht.h"
 #include <limits>
 
+// threads that animate and skin meshes in the background, 0 to do it all on the render thread
+#define M2_SKIN_THREADS 2
+// meshes with less skinned vertices are skinned right away, it's not worth handing them to another thread
+#define M2_SKIN_MIN_VERTICES 512
+
 namespace irr
 {
 namespace scene
@@ -17,9 +22,16 @@ namespace scene
     };
 	class IAnimatedMeshSceneNode;
 	class IBoneSceneNode;
+	class CM2SkinJob;
 
+	// getMesh() only queues the animation and skinning of a frame on the skinning threads and returns.
+	// everything that reads or changes the joints or mesh buffers waits for a queued job first, or runs it itself
+	// if no thread has picked it up yet. the scene nodes call getMesh() in OnAnimate() and again in render(),
+	// so all animated meshes of a scene are skinned in parallel before the first one is drawn.
+	// getBoundingBox() does not wait and returns the box of the last skinned frame.
 	class CM2Mesh: public ISkinnedMesh
 	{
+		friend class CM2SkinJob;
 	public:
 
 		//! constructor
@@ -149,6 +161,12 @@ namespace scene
 
 		virtual SWeight *addWeight(SJoint *joint);
 
+        //! waits until a queued animation/skinning job of this mesh is done
+        void waitForSkinning() const;
+
+        //! amount of threads used for skinning by all meshes, 0 to skin on the calling thread
+        static void setSkinningThreads(u32 threads);
+
         //Retrieve animation information
         void getFrameLoop(u32 animId, s32 &start, s32 &end);
         void newAnimation(u32 id, s32 start, s32 end, f32 probability);
@@ -251,6 +269,8 @@ private:
 
 		void normalizeWeights();
 
+		void buildSkinStreams();
+
 		void buildAllAnimatedMatrices(SJoint *Joint=0, SJoint *ParentJoint=0); //public?
 
 		void getFrameData(f32 frame, SJoint *Node,
@@ -260,7 +280,15 @@ private:
 
 		void CalculateGlobalMatrices(SJoint *Joint,SJoint *ParentJoint);
 
-		void SkinJoint(SJoint *Joint, SJoint *ParentJoint);
+		// the work of animateMesh() and skinMesh(), without waiting for queued jobs
+		void animateJoints(f32 frame, f32 blend);
+		bool skinVertices();
+
+		void skinBuffer(u32 buffer);
+
+		void getSkinnedBoundingBox(core::aabbox3d<f32> &box);
+
+		bool queueSkinning(f32 frame);
 
 		void calculateTangents(core::vector3df& normal,
 			core::vector3df& tangent, core::vector3df& binormal,
@@ -295,7 +323,27 @@ private:
 
 		core::aabbox3d<f32> BoundingBox;
 
-		core::array< core::array<bool> > Vertices_Moved;
+		// skinning data of one mesh buffer, in flat arrays to be walked front to back.
+		// every skinned vertex has 4 bone slots, sorted by weight; unused slots have weight 0.
+		struct SkinStream
+		{
+			core::array<u32> Vertex;       // index of the vertex in the buffer
+			core::array<u16> Bone;         // 4 per vertex, index into SkinPalette
+			core::array<f32> Weight;       // 4 per vertex
+			core::array<f32> StaticPos;    // 3 per vertex
+			core::array<f32> StaticNormal; // 3 per vertex
+			core::aabbox3d<f32> StaticBox; // box of the vertices without weights, they never move
+			bool HasStatic;
+		};
+		core::array<SkinStream> SkinStreams;
+		core::array<f32> SkinPalette; // GlobalAnimatedMatrix * GlobalInversedMatrix of every joint, 16 floats each
+		u32 SkinVertexCount;
+
+		// state of the background job, see CM2SkinJob
+		volatile s32 SkinState;
+		volatile s32 SkinJobs; // jobs handed to the pool which still hold a pointer to this mesh
+		f32 SkinFrame;
+		core::aabbox3d<f32> SkinnedBox; // box computed by the job, copied to BoundingBox when the job is joined
 
         core::array< M2Animation > Animations;
         core::map<u32, core::array<u32> > AnimationLookup;
@@ -45,7 +45,11 @@
 	if (AllDoodads.empty() == true) //fill list
 	{
 		// TODO: at some later point we will need the geometry for correct collision calculation, etc...
-		
+
+		// the tiles are loaded in the background, wait until the ones around us are there
+		while(!Lmapmgr->Loaded())
+			instance->WaitForCondition(COND_MAP_LOADED, 50);
+		Lmapmgr->GetTileMutex().acquire();
 		for(uint32 tiley = 0; tiley < 3; tiley++)
 		{
 			for(uint32 tilex = 0; tilex < 3; tilex++)
@@ -63,6 +67,7 @@
 				}
 			}
 		}
+		Lmapmgr->GetTileMutex().release();
 	}
 	// only keep models that are unique
 	AllDoodads.sort();
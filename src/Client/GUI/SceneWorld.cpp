@@ -549,12 +549,13 @@ void SceneWorld::UpdateTerrain(void)
     map_gridX = mapmgr->GetGridX();
     map_gridY = mapmgr->GetGridY();
 
-    // TODO: better to do this with some ZThread Condition or FastMutex, but dont know how to. help plz! [FG]
+    // the tiles are loaded in the background; MapMgr signals when the tiles around us are done.
+    // the timeout covers the case that it was signalled right before we started waiting.
     if(!mapmgr->Loaded())
     {
         logdebug("SceneWorld: Waiting until maps are loaded...");
         while(!mapmgr->Loaded())
-            device->sleep(1);
+            instance->WaitForCondition(COND_MAP_LOADED, 50);
         logdebug("SceneWorld: ... maps done loading");
     }
 
@@ -571,7 +572,8 @@ void SceneWorld::UpdateTerrain(void)
     UpdateMapSceneNodes(_sound_emitters); // same with sound emitters
     UpdateMapSceneNodes(_wmos);
 
-    mutex.acquire(); // prevent other threads from deleting maptiles
+    mutex.acquire();
+    mapmgr->GetTileMutex().acquire(); // prevent other threads from deleting maptiles
 
     // to set the correct position of the terrain, we have to use the top-left tile's coords as terrain base pos
     MapTile *maptile = mapmgr->GetNearTile(-1, -1);
@@ -607,12 +609,12 @@ void SceneWorld::UpdateTerrain(void)
                 {
                     for(uint32 chx = 0; chx < 16; chx++)
                     {
-                        MapChunk *chunk = maptile->GetChunk(chx, chy);
+                        const MapChunkHeights *chunk = maptile->GetChunkHeights(chx, chy);
                         for(uint32 hy = 0; hy < 8; hy++)
                         {
                             for(uint32 hx = 0; hx < 8; hx++)
                             {
-                                f32 h = chunk->hmap_rough[hy * 9 + hx] + chunk->baseheight; // not sure if hx and hy are used correctly here
+                                f32 h = chunk->GetRough(hy * 9 + hx); // not sure if hx and hy are used correctly here
                                 u32 terrainx = (128 * tilex) + (8 * chx) + hx;
                                 u32 terrainy = (128 * tiley) + (8 * chy) + hy;
                                 terrain->setHeight(terrainy, terrainx, h);
@@ -823,6 +825,7 @@ void SceneWorld::UpdateTerrain(void)
             }
         }
     }
+    mapmgr->GetTileMutex().release();
     mutex.release();
 
     // find out highest/lowest spot
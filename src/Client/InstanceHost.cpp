@@ -0,0 +1,326 @@
+#include <fstream>
+#include <sstream>
+#include "common.h"
+#include "PseuWoW.h"
+#include "InstanceHost.h"
+#include "World/WorldSession.h"
+#include "MemoryDataHolder.h"
+#include "BufferPool.h"
+#ifdef SOCKETS_USE_EPOLL
+#  include <poll.h>
+#endif
+
+class PseuInstanceHostWorker : public ZThread::Runnable
+{
+public:
+    PseuInstanceHostWorker(PseuInstanceHost *host) : _host(host), _reportgen(0) {}
+    inline void AddConf(const HostedInstanceConf& c) { _todo.push_back(c); }
+    void run(void);
+
+private:
+    void _Wait(uint32 msecs);
+    void _Report(void);
+
+    PseuInstanceHost *_host;
+    std::vector<HostedInstanceConf> _todo;
+    std::list<PseuInstance*> _running;
+    uint32 _reportgen;
+#ifdef SOCKETS_USE_EPOLL
+    std::vector<struct pollfd> _fds;
+    std::vector<PseuInstance*> _wakers; // instance whose wakeup fd is in _fds at the same index, NULL for socket fds
+#endif
+};
+
+void PseuInstanceHostWorker::run(void)
+{
+    for(uint32 i = 0; i < _todo.size() && !_host->_stop; i++)
+    {
+        PseuInstance *ins = new PseuInstance(NULL);
+        ins->SetConfDir(_todo[i].confdir);
+        ins->SetScpDir(_todo[i].scpdir);
+        ins->SetHosted();
+        _host->_AddInstance(ins); // from now on it can be stopped by the host
+        if(ins->Init() && _host->_CheckClientBuild(ins) && ins->Start())
+            _running.push_back(ins);
+        else
+        {
+            logerror("InstanceHost: Instance [%s] failed to start", _todo[i].confdir.c_str());
+            ins->Finish();
+        }
+    }
+
+    while(_running.size())
+    {
+        if(_reportgen != _host->_reportgen)
+        {
+            _reportgen = _host->_reportgen;
+            _Report();
+        }
+
+        uint32 wait = PSEUINSTANCE_MAX_WAIT;
+        for(std::list<PseuInstance*>::iterator it = _running.begin(); it != _running.end(); )
+        {
+            PseuInstance *ins = *it;
+            if(!ins->Stopped())
+                ins->Update();
+            if(ins->Stopped())
+            {
+                ins->Finish(); // the instance itself is deleted by the host
+                it = _running.erase(it);
+                continue;
+            }
+            uint32 w = ins->GetWaitTime();
+            if(w < wait)
+                wait = w;
+            it++;
+        }
+
+        if(wait && _running.size())
+            _Wait(wait);
+    }
+
+    _host->_WorkerDone();
+}
+
+// block until any of our instances has something to do, or the wait time is over
+void PseuInstanceHostWorker::_Wait(uint32 msecs)
+{
+#ifdef SOCKETS_USE_EPOLL
+    int fdlist[4];
+    bool pollable = true;
+    _fds.clear();
+    _wakers.clear();
+    for(std::list<PseuInstance*>::iterator it = _running.begin(); it != _running.end() && pollable; it++)
+    {
+        uint32 n = (*it)->GetPollFds(fdlist, 4);
+        pollable = n > 0;
+        for(uint32 i = 0; i < n; i++)
+        {
+            struct pollfd p;
+            p.fd = fdlist[i];
+            p.events = POLLIN;
+            p.revents = 0;
+            _fds.push_back(p);
+            _wakers.push_back(i ? NULL : *it); // the wakeup fd always comes first
+        }
+    }
+    if(pollable)
+    {
+        if(poll(&_fds[0], _fds.size(), msecs) > 0)
+        {
+            for(uint32 i = 0; i < _fds.size(); i++)
+                if(_wakers[i] && (_fds[i].revents & POLLIN))
+                    _wakers[i]->ResetWakeUp();
+        }
+        return;
+    }
+#endif
+    uint32 nst = _running.front()->GetConf()->networksleeptime;
+    ZThread::Thread::sleep(nst < msecs ? nst : msecs);
+}
+
+// rough per-instance numbers; the memory used by the objects depends on their type and the amount of update fields
+void PseuInstanceHostWorker::_Report(void)
+{
+    for(std::list<PseuInstance*>::iterator it = _running.begin(); it != _running.end(); it++)
+    {
+        PseuInstance *ins = *it;
+        WorldSession *ws = ins->GetWSession();
+        log("InstanceHost: [%s] %u objects, %u vars, %u scripts, %s own / %s shared SCP data",
+            ins->GetConfDir().c_str(),
+            ws ? ws->objmgr.GetObjectCount() : 0,
+            ins->GetScripts()->variables.Size(),
+            ins->GetScripts()->GetScripts(),
+            FilesizeFormat(ins->dbmgr.GetMemoryUsage(false)).c_str(),
+            FilesizeFormat(ins->dbmgr.GetMemoryUsage(true)).c_str());
+    }
+}
+
+
+PseuInstanceHost::PseuInstanceHost()
+{
+    _threads = INSTANCEHOST_DEFAULT_THREADS;
+    _memreport = 0;
+    _activeworkers = 0;
+    _reportgen = 0;
+    _clientbuild = 0;
+    _stop = false;
+}
+
+PseuInstanceHost::~PseuInstanceHost()
+{
+    for(uint32 i = 0; i < _instances.size(); i++)
+        delete _instances[i];
+}
+
+// instance list format, one entry per line:
+//   <confdir> [<scriptdir>]   - start an instance with conf files from confdir. scriptdir defaults to ./scripts/
+//   threads=<n>               - amount of worker threads the instances are spread over
+//   memreport=<secs>          - log memory usage every <secs> seconds, 0 to disable
+// lines starting with // are comments.
+bool PseuInstanceHost::LoadConfig(const char *fn)
+{
+    std::ifstream fh(fn);
+    if(!fh.is_open())
+    {
+        logerror("InstanceHost: Can't open instance list '%s'", fn);
+        return false;
+    }
+
+    std::string line;
+    while(std::getline(fh, line))
+    {
+        size_t start = line.find_first_not_of(" \t\r");
+        if(start == std::string::npos)
+            continue;
+        line = line.substr(start, line.find_last_not_of(" \t\r") - start + 1);
+        if(line.size() >= 2 && line[0] == '/' && line[1] == '/')
+            continue;
+
+        size_t eq = line.find('=');
+        if(eq != std::string::npos)
+        {
+            std::string key = stringToLower(line.substr(0, eq));
+            uint32 val = atoi(line.c_str() + eq + 1);
+            if(key == "threads")
+                _threads = val ? val : 1;
+            else if(key == "memreport")
+                _memreport = val;
+            else
+                logerror("InstanceHost: Unknown option '%s' in '%s'", key.c_str(), fn);
+            continue;
+        }
+
+        HostedInstanceConf c;
+        std::stringstream ss(line);
+        ss >> c.confdir >> c.scpdir;
+        if(c.scpdir.empty())
+            c.scpdir = "./scripts/";
+        if(c.confdir[c.confdir.size() - 1] != '/')
+            c.confdir += '/';
+        if(c.scpdir[c.scpdir.size() - 1] != '/')
+            c.scpdir += '/';
+        _confs.push_back(c);
+    }
+
+    if(_confs.empty())
+    {
+        logerror("InstanceHost: No instances listed in '%s'", fn);
+        return false;
+    }
+    return true;
+}
+
+void PseuInstanceHost::Run(volatile sig_atomic_t *stopreq /* = NULL */)
+{
+    uint32 threads = _threads < _confs.size() ? _threads : _confs.size();
+    log("InstanceHost: Starting %u instances in %u threads", _confs.size(), threads);
+
+    std::vector<PseuInstanceHostWorker*> workers;
+    for(uint32 i = 0; i < threads; i++)
+        workers.push_back(new PseuInstanceHostWorker(this));
+    for(uint32 i = 0; i < _confs.size(); i++)
+        workers[i % threads]->AddConf(_confs[i]);
+
+    _activeworkers = threads;
+    std::vector<ZThread::Thread*> thr;
+    for(uint32 i = 0; i < threads; i++)
+        thr.push_back(new ZThread::Thread(workers[i])); // the thread takes ownership of the worker
+
+    uint32 nextreport = getMSTime() + _memreport * 1000;
+    while(true)
+    {
+        {
+            ZThread::Guard<ZThread::FastMutex> g(_mutex);
+            if(!_activeworkers)
+                break;
+        }
+        ZThread::Thread::sleep(100);
+        if(stopreq && *stopreq)
+        {
+            StopAll(*stopreq == 2);
+            *stopreq = 0;
+        }
+        if(_memreport && int32(getMSTime() - nextreport) >= 0)
+        {
+            _LogMemoryReport();
+            nextreport += _memreport * 1000;
+        }
+    }
+
+    for(uint32 i = 0; i < thr.size(); i++)
+    {
+        thr[i]->wait();
+        delete thr[i];
+    }
+    log("InstanceHost: All instances stopped");
+}
+
+void PseuInstanceHost::StopAll(bool fast /* = false */)
+{
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    _stop = true;
+    for(uint32 i = 0; i < _instances.size(); i++)
+    {
+        if(fast)
+            _instances[i]->SetFastQuit(true);
+        _instances[i]->Stop();
+    }
+}
+
+void PseuInstanceHost::_AddInstance(PseuInstance *ins)
+{
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    _instances.push_back(ins);
+    if(_stop)
+        ins->Stop();
+}
+
+// the update field tables are global, so all instances must use the same client version.
+// returns false for an instance that uses another one than the first; it must not be started.
+bool PseuInstanceHost::_CheckClientBuild(PseuInstance *ins)
+{
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    uint16 build = ins->GetConf()->clientbuild;
+    if(!_clientbuild)
+        _clientbuild = build;
+    else if(build != _clientbuild)
+    {
+        logerror("InstanceHost: Instance [%s] uses client build %u, but %u is already used. Mixing client versions is not supported, not starting it!",
+            ins->GetConfDir().c_str(), build, _clientbuild);
+        return false;
+    }
+    return true;
+}
+
+void PseuInstanceHost::_WorkerDone(void)
+{
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    _activeworkers--;
+}
+
+void PseuInstanceHost::_LogMemoryReport(void)
+{
+    uint32 count;
+    {
+        ZThread::Guard<ZThread::FastMutex> g(_mutex);
+        count = _instances.size();
+    }
+    _reportgen++; // the workers log the numbers of their instances themselves
+
+    uint64 rss = GetProcessMemoryUsage();
+    BufferPool::Stats st;
+    BufferPool::GetStats(st);
+    MemoryDataHolder::CacheStats cst;
+    MemoryDataHolder::GetCacheStats(cst);
+    log("InstanceHost: %u instances, process memory: %s (%s per instance)", count,
+        rss ? FilesizeFormat(rss).c_str() : "unknown",
+        rss && count ? FilesizeFormat(rss / count).c_str() : "unknown");
+    log("InstanceHost: shared: %s SCP data, %s file data (%s unused, " I64FMTD " hits, " I64FMTD " misses, " I64FMTD " evicted); packet buffers: %s in use, %s cached",
+        FilesizeFormat(SCPDatabaseMgr::GetSharedMemoryUsage()).c_str(),
+        FilesizeFormat(cst.bytes).c_str(),
+        FilesizeFormat(cst.unused).c_str(),
+        cst.hits, cst.misses, cst.evictions,
+        FilesizeFormat(st.bytesInUse).c_str(),
+        FilesizeFormat(st.bytesCached).c_str());
+}
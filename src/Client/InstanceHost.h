@@ -0,0 +1,53 @@
+#ifndef _INSTANCEHOST_H
+#define _INSTANCEHOST_H
+
+#include "common.h"
+
+class PseuInstance;
+class PseuInstanceHostWorker;
+
+// default amount of worker threads, if not set in the instance list
+#define INSTANCEHOST_DEFAULT_THREADS 2
+
+struct HostedInstanceConf
+{
+    std::string confdir;
+    std::string scpdir;
+};
+
+// runs many PseuInstances in one process (bot farms, load tests).
+// the instances are spread over a few worker threads; a worker updates all its instances in turn
+// and then waits for network/cli events of all of them at once.
+// read-only data (compacted SCP databases, files held by the MemoryDataHolder, the opcode handler table)
+// is loaded only once and shared by all instances.
+class PseuInstanceHost
+{
+    friend class PseuInstanceHostWorker;
+public:
+    PseuInstanceHost();
+    ~PseuInstanceHost();
+
+    bool LoadConfig(const char *fn);
+    // blocks until all instances stopped. if stopreq is given, a nonzero value makes Run() stop all instances
+    // (fast if 2) and reset it; it is polled, so it can be set from a signal handler.
+    void Run(volatile sig_atomic_t *stopreq = NULL);
+    void StopAll(bool fast = false); // threadsafe, but not from a signal handler
+
+private:
+    void _AddInstance(PseuInstance *ins);
+    bool _CheckClientBuild(PseuInstance *ins);
+    void _WorkerDone(void);
+    void _LogMemoryReport(void);
+
+    std::vector<HostedInstanceConf> _confs;
+    std::vector<PseuInstance*> _instances; // every instance that was created, in order of creation
+    ZThread::FastMutex _mutex; // guards _instances and _activeworkers
+    uint32 _threads;
+    uint32 _memreport; // secs between two memory reports, 0 to disable
+    uint32 _activeworkers;
+    uint16 _clientbuild; // client build of the first instance, the others must use the same
+    volatile uint32 _reportgen; // increased to make the workers report their instances
+    volatile bool _stop;
+};
+
+#endif
@@ -10,12 +10,19 @@
 #include "DefScript/DefScript.h"
 #include "Realm/RealmSession.h"
 #include "World/WorldSession.h"
+#include "World/World.h"
+#include "World/MovementMgr.h"
 #include "World/CacheHandler.h"
 #include "GUI/PseuGUI.h"
 #include "RemoteController.h"
 #include "Cli.h"
 #include "GUI/SceneData.h"
 #include "MemoryDataHolder.h"
+#include "World/PathCache.h"
+#ifdef SOCKETS_USE_EPOLL
+#  include <poll.h>
+#  include <sys/eventfd.h>
+#endif
 
 
 //###### Start of program code #######
@@ -65,10 +72,17 @@ PseuInstance::PseuInstance(PseuInstanceRunnable *run)
     _creaters=false;
     _error=false;
     _initialized=false;
+    _hosted=false;
+    _reconnecttime=0;
     for(uint32 i = 0; i < COND_MAX; i++)
     {
         _condition[i] = new ZThread::Condition(_mutex);
     }
+#ifdef SOCKETS_USE_EPOLL
+    _wakefd = eventfd(0, EFD_NONBLOCK);
+#else
+    _wakefd = -1;
+#endif
 
 }
 
@@ -103,6 +117,10 @@ PseuInstance::~PseuInstance()
     {
         delete _condition[i];
     }
+#ifdef SOCKETS_USE_EPOLL
+    if(_wakefd != -1)
+        close(_wakefd);
+#endif
 
     log("--- Instance shut down ---");
 }
@@ -131,11 +149,13 @@ bool PseuInstance::Init(void)
 
     dbmgr.AddSearchPath("./cache");
     dbmgr.AddSearchPath("./data/scp");
-    dbmgr.SetCompression(6);
+    dbmgr.SetCompression(0); // uncompressed files are mapped and used in place
 
     _scp->variables.Set("@version_short",_ver_short);
     _scp->variables.Set("@version",_ver);
     _scp->variables.Set("@inworld","false");
+    _scp->variables.Set("@confdir",_confdir);
+    _scp->variables.Set("@scriptdir",_scpdir);
 
     if(!_scp->LoadScriptFromFile("./_startup.def"))
     {
@@ -149,7 +169,8 @@ bool PseuInstance::Init(void)
     }
 
     // TODO: find a better loaction where to place this block!
-    if(GetConf()->enablegui)
+    // hosted instances share the process with many others, a GUI or CLI per instance makes no sense there
+    if(GetConf()->enablegui && !_hosted)
     {
         if(InitGUI())
             logdebug("GUI: Init successful.");
@@ -163,7 +184,7 @@ bool PseuInstance::Init(void)
     }
 
 #if !(PLATFORM == PLATFORM_WIN32 && !defined(_CONSOLE))
-    if(GetConf()->enablecli)
+    if(GetConf()->enablecli && !_hosted)
     {
         log("Starting CLI...");
         _cli = new CliRunnable(this);
@@ -229,9 +250,21 @@ bool PseuInstance::InitGUI(void)
 }
 
 void PseuInstance::Run(void)
+{
+    if(Start())
+    {
+        // this is the mainloop
+        while(!_stop)
+            Update();
+    }
+    Finish();
+}
+
+// returns false if the instance can't run; Finish() must be called anyways
+bool PseuInstance::Start(void)
 {
     if(!_initialized)
-        return;
+        return false;
 
     logdetail("PseuInstance: Initialized and running!");
 
@@ -248,30 +281,25 @@ void PseuInstance::Run(void)
     {
         logcritical("Realmlist address not set, can't connect.");
         SetError();
+        return false;
+    }
+
+    if(!GetGUI() || !(GetConf()->accname.empty() || GetConf()->accpass.empty()) )
+    {
+        logdebug("GUI not active or Login data pre-entered, skipping Login GUI");
+        CreateRealmSession();
     }
     else
     {
-
-        if(!GetConf()->enablegui || !(GetConf()->accname.empty() || GetConf()->accpass.empty()) )
-        {
-            logdebug("GUI not active or Login data pre-entered, skipping Login GUI");
-            CreateRealmSession();
-        }
-        else
-        {
-            GetGUI()->SetSceneState(SCENESTATE_LOGINSCREEN);
-        }
-
-        // this is the mainloop
-        while(!_stop)
-        {
-            Update();
-            if(_error)
-                _stop=true;
-        }
-
-
+        GetGUI()->SetSceneState(SCENESTATE_LOGINSCREEN);
     }
+    return true;
+}
+
+void PseuInstance::Finish(void)
+{
+    if(!_initialized)
+        return;
 
     // fastquit is defined if we clicked [X] (on windows)
     // If softquit is set, do not terminate forcefully, but shut it down instead
@@ -297,7 +325,7 @@ void PseuInstance::Run(void)
         GetScripts()->RunScript("_onexit",&Set);
     }
 
-    if(GetConf()->exitonerror == false && _error)
+    if(GetConf()->exitonerror == false && _error && !_hosted)
     {
         log("Exiting on error is disabled, PseuWoW is now IDLE");
         log("-- Press enter to exit --");
@@ -350,11 +378,14 @@ void PseuInstance::Update()
         {
             logdev("Skipping reconnect, acc name or password not set");
         }
-        else
+        else if(!_reconnecttime)
         {   // everything fine, we have all data
             logdetail("Waiting %u ms before reconnecting.",GetConf()->reconnect);
-            for(uint32 t = 0; t < GetConf()->reconnect && !this->Stopped(); t+=100) Sleep(100);
-            this->Sleep(1000); // wait 1 sec before reconnecting
+            _reconnecttime = getMSTime() + GetConf()->reconnect + 1000; // wait 1 sec more before reconnecting
+        }
+        else if(int32(getMSTime() - _reconnecttime) >= 0)
+        {
+            _reconnecttime = 0;
             CreateRealmSession();
         }
     }
@@ -391,7 +422,114 @@ void PseuInstance::Update()
 
     GetScripts()->GetEventMgr()->Update();
 
-    this->Sleep(GetConf()->networksleeptime);
+    if(_error)
+        _stop=true;
+
+    // hosted instances are waited for by the host, together with all others
+    if(!_hosted)
+        _WaitForEvents();
+}
+
+// how long the main loop may wait for events before it has to update again
+uint32 PseuInstance::GetWaitTime(void)
+{
+    if(_stop || _createws || _creaters || _cliQueue.size())
+        return 0;
+    if( (_rsession && _rsession->GetSocketHandler().HasPendingReads())
+        || (_wsession && _wsession->GetSocketHandler().HasPendingReads())
+        || (_rmcontrol && _rmcontrol->GetSocketHandler().HasPendingReads()) )
+        return 0;
+
+    uint32 wait = PSEUINSTANCE_MAX_WAIT;
+    if(_wsession)
+    {
+        // movement is polled, keep the old update rate while moving
+        World *world = _wsession->GetWorld();
+        if(world && world->GetMoveMgr() && world->GetMoveMgr()->IsMoving())
+            wait = GetConf()->networksleeptime;
+        uint32 pktwait = _wsession->GetDelayedPacketWait();
+        if(pktwait < wait)
+            wait = pktwait;
+    }
+    if(_reconnecttime)
+    {
+        int32 left = int32(_reconnecttime - getMSTime());
+        if(left <= 0)
+            return 0;
+        if(uint32(left) < wait)
+            wait = left;
+    }
+    uint32 evwait = GetScripts()->GetEventMgr()->GetNextEventDelay();
+    return evwait < wait ? evwait : wait;
+}
+
+// stores the fds that signal new events for this instance in fds; returns the amount stored.
+// returns 0 if there is no way to wait for events on this platform.
+uint32 PseuInstance::GetPollFds(int *fds, uint32 max)
+{
+    uint32 n = 0;
+#ifdef SOCKETS_USE_EPOLL
+    if(_wakefd == -1 || max < 4)
+        return 0;
+    fds[n++] = _wakefd;
+    if(_rsession)
+        fds[n++] = _rsession->GetSocketHandler().GetPollFd();
+    if(_wsession)
+        fds[n++] = _wsession->GetSocketHandler().GetPollFd();
+    if(_rmcontrol)
+        fds[n++] = _rmcontrol->GetSocketHandler().GetPollFd();
+#endif
+    return n;
+}
+
+// call after the fds from GetPollFds() were waited on
+void PseuInstance::ResetWakeUp(void)
+{
+#ifdef SOCKETS_USE_EPOLL
+    if(_wakefd != -1)
+    {
+        uint64 cnt;
+        read(_wakefd, &cnt, sizeof(cnt)); // reset the counter; fails harmlessly if it was not set
+    }
+#endif
+}
+
+// block until a socket becomes ready, another thread calls WakeUp(), or the wait time is over
+void PseuInstance::_WaitForEvents(void)
+{
+    uint32 wait = GetWaitTime();
+    if(!wait)
+        return;
+#ifdef SOCKETS_USE_EPOLL
+    int fdlist[4];
+    uint32 n = GetPollFds(fdlist, 4);
+    if(n)
+    {
+        struct pollfd fds[4];
+        for(uint32 i = 0; i < n; i++)
+        {
+            fds[i].fd = fdlist[i];
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if(poll(fds, n, wait) > 0 && (fds[0].revents & POLLIN))
+            ResetWakeUp();
+        return;
+    }
+#endif
+    uint32 nst = GetConf()->networksleeptime;
+    this->Sleep(nst < wait ? nst : wait); // can not wait for the sockets, poll them
+}
+
+void PseuInstance::WakeUp(void)
+{
+#ifdef SOCKETS_USE_EPOLL
+    if(_wakefd != -1)
+    {
+        uint64 one = 1;
+        write(_wakefd, &one, sizeof(one));
+    }
+#endif
 }
 
 void PseuInstance::ProcessCliQueue(void)
@@ -414,6 +552,7 @@ void PseuInstance::ProcessCliQueue(void)
 void PseuInstance::AddCliCommand(std::string cmd)
 {
     _cliQueue.add(cmd);
+    WakeUp();
 }
 
 void PseuInstance::SaveAllCache(void)
@@ -431,7 +570,7 @@ void PseuInstance::SaveAllCache(void)
 
 void PseuInstance::Sleep(uint32 msecs)
 {
-    GetRunnable()->sleep(msecs);
+    ZThread::Thread::sleep(msecs); // hosted instances have no runnable of their own
 }
 
 void PseuInstance::DeleteGUI(void)
@@ -515,6 +654,10 @@ void PseuInstanceConf::ApplyFromVarSet(VarSet &v)
     dumpPackets=(uint8)atoi(v.Get("DUMPPACKETS").c_str());
     softquit=(bool)atoi(v.Get("SOFTQUIT").c_str());
     dataLoaderThreads=atoi(v.Get("DATALOADERTHREADS").c_str());
+    dataCacheSize=atoi(v.Get("DATACACHESIZE").c_str());
+    pathCacheSize=atoi(v.Get("PATHCACHESIZE").c_str());
+    asynclog=(bool)atoi(v.Get("ASYNCLOG").c_str());
+    logflushms=atoi(v.Get("LOGFLUSHMS").c_str());
     useMPQ=(bool)atoi(v.Get("USEMPQ").c_str());
 
     switch(client)
@@ -575,7 +718,10 @@ void PseuInstanceConf::ApplyFromVarSet(VarSet &v)
     // cleanups, internal settings, etc.
     log_setloglevel(debug);
     log_setlogtime((bool)atoi(v.Get("LOGTIME").c_str()));
+    log_setasync(asynclog, logflushms ? logflushms : LOG_DEFAULT_FLUSH_MS);
     MemoryDataHolder::SetThreadCount(dataLoaderThreads);
+    MemoryDataHolder::SetCacheLimit((dataCacheSize ? dataCacheSize : MDH_DEFAULT_CACHE_MB) * 1024 * 1024);
+    PathCache::SetCacheLimit(pathCacheSize ? pathCacheSize : PATHCACHE_DEFAULT_SIZE);
     MemoryDataHolder::SetUseMPQ(clientlang);
 }
 
@@ -11,6 +11,9 @@
 #include "SCPDatabase.h"
 #include "GUI/PseuGUI.h"
 
+// the main loop blocks on network/cli/gui events, but never longer than this (msecs)
+#define PSEUINSTANCE_MAX_WAIT 250
+
 class RealmSession;
 class WorldSession;
 class Sockethandler;
@@ -80,6 +83,10 @@ class PseuInstanceConf
     uint8 dumpPackets;
     bool softquit;
     uint8 dataLoaderThreads;
+    uint32 dataCacheSize; // MB
+    uint32 pathCacheSize; // paths
+    bool asynclog;
+    uint32 logflushms;
     bool useMPQ;
 
     // gui related
@@ -103,7 +110,7 @@ class PseuInstance
 {
 public:
 
-    PseuInstance(PseuInstanceRunnable *run);
+    PseuInstance(PseuInstanceRunnable *run); // run may be NULL if the instance is driven by a PseuInstanceHost
     ~PseuInstance();
 
 
@@ -119,6 +126,9 @@ public:
     inline void SetConfDir(std::string dir) { _confdir = dir; }
     inline std::string GetConfDir(void) { return _confdir; }
     inline void SetScpDir(std::string dir) { _scpdir = dir; }
+    inline std::string GetScpDir(void) { return _scpdir; }
+    inline void SetHosted(bool h = true) { _hosted = h; }
+    inline bool IsHosted(void) { return _hosted; }
     inline void SetSessionKey(BigNumber key) { _sessionkey = key; }
     inline BigNumber *GetSessionKey(void) { return &_sessionkey; }
     inline void SetError(void) { _error = true; }
@@ -127,15 +137,23 @@ public:
     bool Init(void);
     bool InitGUI(void);
     void SaveAllCache(void);
-    inline void Stop(void) { _stop = true; }
+    inline void Stop(void) { _stop = true; WakeUp(); }
     inline bool Stopped(void) { return _stop; }
     inline void SetFastQuit(bool q=true) { _fastquit=true; }
-    void Run(void);
+    void Run(void); // Start(), Update() until stopped, Finish()
+    bool Start(void);
     void Update(void);
+    void Finish(void);
     void Sleep(uint32 msecs);
+    void WakeUp(void); // threadsafe; makes the main loop stop waiting for events
+
+    // used to wait for events of several instances at once
+    uint32 GetWaitTime(void);
+    uint32 GetPollFds(int *fds, uint32 max);
+    void ResetWakeUp(void);
 
-    inline void CreateWorldSession(void) { _createws = true; }
-    inline void CreateRealmSession(void) { _creaters = true; }
+    inline void CreateWorldSession(void) { _createws = true; WakeUp(); }
+    inline void CreateRealmSession(void) { _creaters = true; WakeUp(); }
 
     void ProcessCliQueue(void);
     void AddCliCommand(std::string);
@@ -144,6 +162,7 @@ public:
     inline ZThread::Condition *GetCondition(InstanceConditions c) { return _condition[c]; }
 
 private:
+    void _WaitForEvents(void);
 
     PseuInstanceRunnable *_runnable;
     RealmSession *_rsession;
@@ -156,6 +175,8 @@ private:
     bool _startrealm;
     bool _error;
     bool _createws, _creaters; // must create world/realm session?
+    bool _hosted; // true if updated by a PseuInstanceHost; no GUI, no CLI, no waiting in Update()
+    uint32 _reconnecttime; // getMSTime() when to reconnect, 0 if not waiting
     BigNumber _sessionkey;
     const char *_ver,*_ver_short;
     SocketHandler _sh;
@@ -167,6 +188,7 @@ private:
     ZThread::Thread *_guithread;
     ZThread::Condition *_condition[COND_MAX];
     ZThread::FastRecursiveMutex _mutex;
+    int _wakefd; // eventfd the main loop waits on together with the sockets, -1 if not supported
 
 };
 
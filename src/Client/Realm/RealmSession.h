@@ -38,6 +38,7 @@ public:
     void SetRealmAddr(std::string);
     inline uint32 GetRealmCount(void) { return _realms.size(); }
     inline SRealmInfo& GetRealm(uint32 i) { return _realms[i]; }
+    inline SocketHandler& GetSocketHandler(void) { return _sh; }
 
 
 private:
@@ -26,6 +26,7 @@ public:
     void SetPermission(uint8 p) { _perm = p; }
     void Update(void);
     bool MustDie(void) { return _mustdie; }
+    SocketHandler& GetSocketHandler(void) { return h; }
 
 private:
     ControlSocketHandler h;
@@ -1,26 +1,225 @@
 #include <fstream>
+#include <algorithm>
 #include "common.h"
 #include "Auth/MD5Hash.h"
 #include "SCPDatabase.h"
+#include "MemoryDataHolder.h"
 
 #define HEADER_SIZE (21*sizeof(uint32))
 
+#if COMPILER == COMPILER_MICROSOFT
+#  include <windows.h>
+#  define ATOMIC_INC(v) (InterlockedIncrement((volatile LONG*)&(v)) - 1)
+#  define MEMORY_BARRIER() MemoryBarrier()
+#else
+#  define ATOMIC_INC(v) __sync_fetch_and_add(&(v), 1)
+#  define MEMORY_BARRIER() __sync_synchronize()
+#endif
+
 inline char *gettypename(uint32 ty)
 {
     return (char*)(ty==0 ? "INT" : (ty==1 ? "FLOAT" : "STRING"));
 }
 
-// file-globally declared pointer holder. NOT multi-instance-safe for now!!
-struct memblock
+std::map<std::string,std::string> FileRelation; // stores filename -> DB name
+
+// compacted databases are read-only, so every instance in this process that loads the same DB
+// from the same search paths can use the same copy.
+struct SharedSCPDatabase
 {
-    memblock() : ptr(NULL), size(0) {}
-    memblock(uint8 *p, uint32 s) : size(s), ptr(p) {}
-    ~memblock() { if(ptr) delete [] ptr; }
-    uint8 *ptr;
-    uint32 size;
+    SCPDatabase *db;
+    uint32 refs;
+    uint32 sources; // amount of source files, returned by SearchAndLoad()
 };
-TypeStorage<memblock> Pointers; // stores filename -> file content
-std::map<std::string,std::string> FileRelation; // stores filename -> DB name
+std::map<std::string,SharedSCPDatabase> SharedDBs; // stores dbname + search paths -> DB
+ZThread::FastRecursiveMutex SCPMutex; // guards FileRelation and SharedDBs
+ZThread::FastMutex SCPIndexMutex; // guards building the value indexes of all DBs
+volatile uint32 SCPGeneration = 0; // last SCPDatabase::_gen handed out
+
+// FNV-1a
+inline uint32 HashString(const char *s)
+{
+    uint32 h = 2166136261U;
+    for(; *s; s++)
+        h = (h ^ uint8(*s)) * 16777619U;
+    return h;
+}
+
+inline uint32 HashStringNoCase(const char *s)
+{
+    uint32 h = 2166136261U;
+    for(; *s; s++)
+        h = (h ^ uint8(tolower(*s))) * 16777619U;
+    return h;
+}
+
+// IDs and flags are often multiples of some power of 2, so mix the bits before masking
+inline uint32 HashUint32(uint32 v)
+{
+    v = (v ^ (v >> 16)) * 0x45d9f3b;
+    return v ^ (v >> 16);
+}
+
+inline uint32 RoundUpPow2(uint32 n)
+{
+    uint32 p = 1;
+    while(p < n)
+        p <<= 1;
+    return p;
+}
+
+// splits the text of a .scp file into its lines in a single pass, without copying them.
+// leading blanks are skipped, lines shorter than 2 chars and // comments are ignored.
+class SCPTokenizer
+{
+public:
+    enum Token
+    {
+        END,
+        DBNAME,  // "#dbname=<value>"
+        SECTION, // "[<key>", key is the rest of the line
+        ENTRY    // "<key>=<value>"
+    };
+
+    SCPTokenizer(const char *buf, uint32 size) : _pos(buf), _end(buf + size) {}
+    Token Next(void);
+    inline std::string Key(void) { return std::string(_key, _keylen); }
+    inline std::string Value(void) { return std::string(_value, _valuelen); }
+
+private:
+    const char *_pos, *_end;
+    const char *_key, *_value;
+    uint32 _keylen, _valuelen;
+};
+
+SCPTokenizer::Token SCPTokenizer::Next(void)
+{
+    while(_pos < _end)
+    {
+        const char *line = _pos;
+        while(_pos < _end && *_pos != '\n' && *_pos != '\r')
+            _pos++;
+        const char *eol = _pos;
+        if(_pos < _end)
+            _pos++;
+        while(line < eol && (*line == ' ' || *line == '\t'))
+            line++;
+        if(eol - line < 2 || (line[0] == '/' && line[1] == '/'))
+            continue;
+        if(const char *eq = (const char*)memchr(line, '=', eol - line))
+        {
+            _key = line;
+            _keylen = eq - line;
+            _value = eq + 1;
+            _valuelen = eol - _value;
+            return (_keylen == 7 && _valuelen && !strnicmp(_key, "#dbname", 7)) ? DBNAME : ENTRY;
+        }
+        if(line[0] == '[')
+        {
+            _key = line + 1;
+            _keylen = eol - _key;
+            return SECTION;
+        }
+    }
+    return END;
+}
+
+// writes a compiled DB to its cache file. compression is done here too, so that it can run in the background
+// while the DB is already used.
+class SCPFileWriter : public ZThread::Runnable
+{
+public:
+    SCPFileWriter(const char *fn, uint32 compression) : _fn(fn), _compr(compression) {}
+    void run(void) { Write(); }
+    bool Write(void);
+    ByteBuffer hbuf; // header; flags are completed by Write()
+    ZCompressor z; // everything after the header, uncompressed
+
+private:
+    std::string _fn;
+    uint32 _compr;
+};
+
+bool SCPFileWriter::Write(void)
+{
+    uint32 flags = hbuf.read<uint32>(4);
+    if(_compr)
+    {
+        z.Deflate(_compr);
+        if(z.Compressed())
+        {
+            hbuf << z.RealSize();
+            flags |= SCP_FLAG_COMPRESSED;
+        }
+        else
+        {
+            logdebug("SCP Compact: Unable to compress '%s' (too small?)",_fn.c_str());
+        }
+    }
+    hbuf.put<uint32>(4,flags); // first 4 bytes are 'SCPC', then flags...
+
+    // other instances or processes may have the old file mapped; write a new one and replace it, never overwrite in place
+    std::string tmps = MakeTempFilename(_fn.c_str(), this);
+    const char *tmp = tmps.c_str();
+    FILE *fh = fopen(tmp,"wb");
+    if(!fh)
+    {
+        logerror("SCP: Can't write '%s'",tmp);
+        return false;
+    }
+
+    bool ok = fwrite(hbuf.contents(), hbuf.size(), 1, fh) == 1;
+    ok = fwrite(z.contents(), z.size(), 1, fh) == 1 && ok;
+    ok = fclose(fh) == 0 && ok;
+#if PLATFORM == PLATFORM_WIN32
+    remove(_fn.c_str()); // rename() does not overwrite here
+#endif
+    if(!ok || rename(tmp, _fn.c_str()) != 0)
+    {
+        logerror("SCP: Can't write '%s'",_fn.c_str());
+        remove(tmp);
+        return false;
+    }
+    return true;
+}
+
+// databases compiled by one SearchAndLoad() call. each is parsed and compacted on its own, so they can be done in parallel.
+struct SCPCompileJob
+{
+    std::string dbname;
+    std::deque<std::string> files;
+    SCPDatabase *db; // the result, NULL if it failed
+    SCPFileWriter *writer;
+};
+
+class SCPCompileWorker : public ZThread::Runnable
+{
+public:
+    SCPCompileWorker(SCPDatabaseMgr *mgr, std::vector<SCPCompileJob> *jobs, uint32 *next, ZThread::FastMutex *mutex)
+        : _mgr(mgr), _jobs(jobs), _next(next), _mutex(mutex) {}
+    void run(void);
+
+private:
+    SCPDatabaseMgr *_mgr;
+    std::vector<SCPCompileJob> *_jobs;
+    uint32 *_next; // next job to be taken, shared by all workers
+    ZThread::FastMutex *_mutex; // guards *_next
+};
+
+void SCPCompileWorker::run(void)
+{
+    while(true)
+    {
+        uint32 i;
+        {
+            ZThread::Guard<ZThread::FastMutex> g(*_mutex);
+            i = (*_next)++;
+        }
+        if(i >= _jobs->size())
+            return;
+        _mgr->_CompileJob((*_jobs)[i]);
+    }
+}
 
 SCPDatabase::~SCPDatabase()
 {
@@ -32,126 +231,272 @@ SCPDatabase::SCPDatabase()
 {
     _stringbuf = NULL;
     _intbuf = NULL;
+    _file = NULL;
     _compact = false;
+    _stringsize = 0;
+    _rowcount = 0;
+    _fields_per_row = 0;
+    _gen = 0;
+    _valmask = 0;
 }
 
 void SCPDatabase::DropAll(void)
 {
     DropTextData();
-    if(_stringbuf)
-        delete [] _stringbuf;
-    if(_intbuf)
-        delete [] _intbuf;
-    _indexes.clear();
-    _indexes_reverse.clear();
+    if(_file)
+        delete _file;
+    else
+    {
+        if(_stringbuf)
+            delete [] _stringbuf;
+        if(_intbuf)
+            delete [] _intbuf;
+    }
+    _file = NULL;
+    _DropValueIndexes();
+    _rowids.clear();
+    _rowmap.clear();
+    _fieldhash.clear();
     _fielddefs.clear();
     _stringbuf = NULL;
     _intbuf = NULL;
     _stringsize = 0;
+    _rowcount = 0;
+    _fields_per_row = 0;
+    _gen = 0;
     _compact = false;
 }
 
 void SCPDatabase::DropTextData(void)
 {
     DEBUG(logdebug("Dropping plaintext parts of DB '%s'",_name.c_str()));
-    for(SCPSourceList::iterator it = sources.begin(); it != sources.end(); it++)
-        Pointers.Delete(*it);
     sources.clear();
     fields.clear();
+    _stamps.clear();
 }
 
-void *SCPDatabase::GetPtr(uint32 index, const char *entry)
+// note: the access funcs may be called by several threads at once if the DB is shared; they must not modify anything,
+// except for building the value indexes, which is guarded.
+uint32 SCPDatabase::_GetRow(uint32 index)
 {
-    std::map<uint32,uint32>::iterator it = _indexes.find(index);
-    if(it == _indexes.end())
-        return NULL;
-    std::map<std::string,SCPFieldDef>::iterator fi = _fielddefs.find(entry);
-    if(fi == _fielddefs.end())
-        return NULL;
+    if(_rowmap.size())
+    {
+        uint32 i = index - _rowids[0];
+        return i < _rowmap.size() ? _rowmap[i] : SCP_INVALID_INT;
+    }
+    std::vector<uint32>::iterator it = std::lower_bound(_rowids.begin(), _rowids.end(), index);
+    return it != _rowids.end() && *it == index ? uint32(it - _rowids.begin()) : SCP_INVALID_INT;
+}
 
-    uint32 target_row = _indexes[index];
-    uint32 field_id = _fielddefs[entry].id;
-    return (void*)&_intbuf[(_fields_per_row * target_row) + field_id];
+void *SCPDatabase::GetPtr(uint32 index, const char *entry)
+{
+    const SCPFieldDef *d = GetFieldDef(entry);
+    return d ? GetPtrByField(index, d->id) : NULL;
 }
 
 void *SCPDatabase::GetPtrByField(uint32 index, uint32 entry)
 {
-    std::map<uint32,uint32>::iterator it = _indexes.find(index);
-    if(it == _indexes.end())
+    uint32 row = _GetRow(index);
+    if(row == SCP_INVALID_INT || entry >= _fields_per_row)
         return NULL;
+    return (void*)&_intbuf[(_fields_per_row * row) + entry];
+}
 
-    uint32 target_row = _indexes[index];
-    return (void*)&_intbuf[(_fields_per_row * target_row) + entry];
+// returns the value index of a field, building it if it does not exist yet. NULL if the DB is too small to need one.
+// the slots hold row numbers; the ints and string offsets are hashed as they are, strings by their lowercased text.
+const uint32 *SCPDatabase::_GetValueIndex(uint32 field, bool str)
+{
+    if(_rowcount < SCP_INDEX_MIN_ROWS)
+        return NULL;
+    std::vector<uint32*>& indexes = str ? _strindex : _valindex;
+    uint32 *idx = indexes[field];
+    if(idx)
+        return idx;
+
+    ZThread::Guard<ZThread::FastMutex> g(SCPIndexMutex);
+    idx = indexes[field];
+    if(idx)
+        return idx;
+    uint32 mask = _valmask;
+    idx = new uint32[mask + 1];
+    memset(idx, 0xFF, (mask + 1) * sizeof(uint32));
+    for(uint32 row = 0; row < _rowcount; row++)
+    {
+        uint32 val = _intbuf[row * _fields_per_row + field];
+        uint32 h = str ? HashStringNoCase(GetStringByOffset(val)) : HashUint32(val);
+        for(uint32 i = h & mask; ; i = (i + 1) & mask)
+        {
+            if(idx[i] == SCP_INVALID_INT)
+            {
+                idx[i] = row;
+                break;
+            }
+            uint32 other = _intbuf[idx[i] * _fields_per_row + field];
+            if(str ? !stricmp(GetStringByOffset(other), GetStringByOffset(val)) : other == val)
+                break; // the scan would return the first row with this value, so keep that one
+        }
+    }
+    MEMORY_BARRIER(); // the table must be complete before other threads can see it
+    indexes[field] = idx;
+    return idx;
 }
 
 uint32 SCPDatabase::GetFieldByUint32Value(const char *entry, uint32 val)
 {
-    std::map<std::string,SCPFieldDef>::iterator fi = _fielddefs.find(entry);
-    if(fi == _fielddefs.end())
-        return SCP_INVALID_INT;
-
-    uint32 field_id = _fielddefs[entry].id;
-    return GetFieldByUint32Value(field_id,val);
+    const SCPFieldDef *d = GetFieldDef(entry);
+    return d ? GetFieldByUint32Value(d->id, val) : SCP_INVALID_INT;
 }
 
 uint32 SCPDatabase::GetFieldByUint32Value(uint32 entry, uint32 val)
 {
+    if(entry >= _fields_per_row)
+        return SCP_INVALID_INT;
+    if(const uint32 *idx = _GetValueIndex(entry, false))
+    {
+        uint32 mask = _valmask;
+        for(uint32 i = HashUint32(val) & mask; idx[i] != SCP_INVALID_INT; i = (i + 1) & mask)
+            if(_intbuf[idx[i] * _fields_per_row + entry] == val)
+                return _rowids[idx[i]];
+        return SCP_INVALID_INT;
+    }
     for(uint32 row = 0; row < _rowcount; row++)
         if(_intbuf[row * _fields_per_row + entry] == val)
-            return _indexes_reverse[row];
+            return _rowids[row];
     return SCP_INVALID_INT;
 }
 
 uint32 SCPDatabase::GetFieldByIntValue(const char *entry, int32 val)
 {
-    std::map<std::string,SCPFieldDef>::iterator fi = _fielddefs.find(entry);
-    if(fi == _fielddefs.end())
-        return SCP_INVALID_INT;
-
-    uint32 field_id = _fielddefs[entry].id;
-    return GetFieldByIntValue(field_id,val);
+    return GetFieldByUint32Value(entry, (uint32)val);
 }
 
 uint32 SCPDatabase::GetFieldByIntValue(uint32 entry, int32 val)
 {
-    for(uint32 row = 0; row < _rowcount; row++)
-        if((int)_intbuf[row * _fields_per_row + entry] == val)
-            return _indexes_reverse[row];
-    return (int)SCP_INVALID_INT;
+    return GetFieldByUint32Value(entry, (uint32)val);
 }
 
 uint32 SCPDatabase::GetFieldByStringValue(const char *entry, const char *val)
 {
-    std::map<std::string,SCPFieldDef>::iterator fi = _fielddefs.find(entry);
-    if(fi == _fielddefs.end())
-        return SCP_INVALID_INT;
-
-    uint32 field_id = _fielddefs[entry].id;
-    return GetFieldByStringValue(field_id,val);
+    const SCPFieldDef *d = GetFieldDef(entry);
+    return d ? GetFieldByStringValue(d->id, val) : SCP_INVALID_INT;
 }
 
 uint32 SCPDatabase::GetFieldByStringValue(uint32 entry, const char *val)
 {
+    if(entry >= _fields_per_row)
+        return SCP_INVALID_INT;
+    if(const uint32 *idx = _GetValueIndex(entry, true))
+    {
+        uint32 mask = _valmask;
+        for(uint32 i = HashStringNoCase(val) & mask; idx[i] != SCP_INVALID_INT; i = (i + 1) & mask)
+            if(!stricmp(GetStringByOffset(_intbuf[idx[i] * _fields_per_row + entry]), val))
+                return _rowids[idx[i]];
+        return SCP_INVALID_INT;
+    }
     for(uint32 row = 0; row < _rowcount; row++)
         if(!stricmp(GetStringByOffset(_intbuf[row * _fields_per_row + entry]), val))
-            return _indexes_reverse[row];
+            return _rowids[row];
     return SCP_INVALID_INT;
 }
 
+const SCPFieldDef *SCPDatabase::GetFieldDef(const char *entry)
+{
+    if(_fieldhash.empty())
+        return NULL;
+    uint32 h = HashString(entry);
+    uint32 mask = _fieldhash.size() - 1;
+    for(uint32 i = h & mask; _fieldhash[i].name; i = (i + 1) & mask)
+        if(_fieldhash[i].hash == h && !strcmp(_fieldhash[i].name, entry))
+            return &_fieldhash[i].def;
+    return NULL;
+}
+
 uint32 SCPDatabase::GetFieldType(const char *entry)
 {
-    std::map<std::string,SCPFieldDef>::iterator it = _fielddefs.find(entry);
-    if(it != _fielddefs.end())
-        return it->second.type;
-    return SCP_INVALID_INT;
+    const SCPFieldDef *d = GetFieldDef(entry);
+    return d ? d->type : SCP_INVALID_INT;
 }
 
 uint32 SCPDatabase::GetFieldId(const char *entry)
 {
-    std::map<std::string,SCPFieldDef>::iterator it = _fielddefs.find(entry);
-    if(it != _fielddefs.end())
-        return it->second.id;
-    return SCP_INVALID_INT;
+    const SCPFieldDef *d = GetFieldDef(entry);
+    return d ? d->id : SCP_INVALID_INT;
+}
+
+// set up the lookup tables once the compacted data are in place. returns false if the rows are not sorted by ID,
+// which the compiler guarantees, so the file must be broken.
+bool SCPDatabase::_BuildIndexes(void)
+{
+    for(uint32 row = 1; row < _rowids.size(); row++)
+        if(_rowids[row] <= _rowids[row - 1])
+            return false;
+
+    // a direct ID -> row table, unless the IDs are spread too far
+    _rowmap.clear();
+    if(_rowids.size() && _rowids.back() - _rowids[0] < _rowids.size() * 4 + 256)
+    {
+        _rowmap.resize(_rowids.back() - _rowids[0] + 1, SCP_INVALID_INT);
+        for(uint32 row = 0; row < _rowids.size(); row++)
+            _rowmap[_rowids[row] - _rowids[0]] = row;
+    }
+
+    _fieldhash.clear();
+    FieldSlot empty;
+    memset(&empty, 0, sizeof(empty));
+    _fieldhash.resize(RoundUpPow2(_fielddefs.size() * 2 + 1), empty);
+    uint32 mask = _fieldhash.size() - 1;
+    for(std::map<std::string,SCPFieldDef>::iterator it = _fielddefs.begin(); it != _fielddefs.end(); it++)
+    {
+        uint32 h = HashString(it->first.c_str());
+        uint32 i = h & mask;
+        while(_fieldhash[i].name)
+            i = (i + 1) & mask;
+        _fieldhash[i].hash = h;
+        _fieldhash[i].name = it->first.c_str();
+        _fieldhash[i].def = it->second;
+    }
+
+    _DropValueIndexes();
+    _valindex.resize(_fields_per_row, NULL);
+    _strindex.resize(_fields_per_row, NULL);
+    _valmask = RoundUpPow2(_rowcount * 2) - 1;
+    _gen = ATOMIC_INC(SCPGeneration) + 1;
+    return true;
+}
+
+void SCPDatabase::_DropValueIndexes(void)
+{
+    for(uint32 i = 0; i < _valindex.size(); i++)
+        delete [] _valindex[i];
+    for(uint32 i = 0; i < _strindex.size(); i++)
+        delete [] _strindex[i];
+    _valindex.clear();
+    _strindex.clear();
+}
+
+uint32 SCPDatabase::GetMemoryUsage(void)
+{
+    if(!_compact)
+        return 0;
+    uint32 bytes = (_rowcount * _fields_per_row * sizeof(uint32)) + _stringsize
+        + ((_rowids.size() + _rowmap.size()) * sizeof(uint32)) + (_fieldhash.size() * sizeof(FieldSlot))
+        + (_fielddefs.size() * 80); // the map node size is a rough guess, but good enough to compare instances
+    uint32 idxsize = (_valmask + 1) * sizeof(uint32);
+    for(uint32 i = 0; i < _valindex.size(); i++)
+        bytes += (_valindex[i] ? idxsize : 0) + (_strindex[i] ? idxsize : 0);
+    return bytes;
+}
+
+SCPDatabaseMgr::~SCPDatabaseMgr()
+{
+    // shared databases are owned by the registry, not by us
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(SCPMutex);
+    while(_shared.size())
+    {
+        SCPDatabase *db = *_shared.begin();
+        _map.UnlinkByPtr(db);
+        _ReleaseShared(db);
+    }
 }
 
 SCPDatabase *SCPDatabaseMgr::GetDB(std::string n, bool create)
@@ -159,78 +504,165 @@ SCPDatabase *SCPDatabaseMgr::GetDB(std::string n, bool create)
     return create ? _map.Get(n) : _map.GetNoCreate(n);
 }
 
-uint32 SCPDatabaseMgr::AutoLoadFile(const char *fn)
+void SCPDatabaseMgr::DropDB(std::string s)
 {
-    char *buf;
-    uint32 size;
+    _DropDB(stringToLower(s));
+}
 
-    // check if file was loaded before; use memory data if this is the case
-    if(memblock *mb = Pointers.GetNoCreate(fn))
+void SCPDatabaseMgr::_DropDB(std::string s)
+{
+    SCPDatabase *db = _map.GetNoCreate(s);
+    if(!db)
+        return;
+    if(_shared.find(db) != _shared.end())
     {
-        size = mb->size;
-        buf = (char*)mb->ptr;
+        ZThread::Guard<ZThread::FastRecursiveMutex> g(SCPMutex);
+        _map.Unlink(s);
+        _ReleaseShared(db);
     }
-    else // and if not, read the file from disk
-    {
-        std::fstream fh;
-        size = GetFileSize(fn);
-        if(!size)
-            return 0;
+    else
+        _map.Delete(s);
+}
 
-        fh.open(fn,std::ios_base::in | std::ios_base::binary);
-        if( !fh.is_open() )
-            return 0;
+// the same DB name may refer to different data if loaded from other paths
+std::string SCPDatabaseMgr::_GetSharedKey(const char *dbname)
+{
+    std::string key = stringToLower(dbname);
+    for(std::deque<std::string>::iterator it = _paths.begin(); it != _paths.end(); it++)
+        key += '|' + *it;
+    return key;
+}
 
-        buf = new char[size];
+// must be called with SCPMutex held
+bool SCPDatabaseMgr::_AttachShared(const char *dbname, uint32& sources)
+{
+    std::map<std::string,SharedSCPDatabase>::iterator it = SharedDBs.find(_GetSharedKey(dbname));
+    if(it == SharedDBs.end())
+        return false;
+    _DropDB(stringToLower(dbname));
+    it->second.refs++;
+    sources = it->second.sources;
+    _map.Assign(dbname, it->second.db);
+    _shared.insert(it->second.db);
+    return true;
+}
 
-        fh.read(buf,size);
-        fh.close();
+// hand a freshly loaded DB over to the registry. must be called with SCPMutex held
+void SCPDatabaseMgr::_ShareDB(const char *dbname, uint32 sources)
+{
+    SCPDatabase *db = GetDB(dbname);
+    if(!db || !db->IsCompact())
+        return;
+    SharedSCPDatabase& sdb = SharedDBs[_GetSharedKey(dbname)];
+    if(sdb.db) // should not happen; _AttachShared() would have picked it up
+        return;
+    sdb.db = db;
+    sdb.refs = 1;
+    sdb.sources = sources;
+    _shared.insert(db);
+}
 
-        // store the loaded file buffer so we can reuse it later if necessary
-        Pointers.Assign(fn, new memblock((uint8*)buf,size));
+// must be called with SCPMutex held, after db was unlinked from _map
+void SCPDatabaseMgr::_ReleaseShared(SCPDatabase *db)
+{
+    _shared.erase(db);
+    for(std::map<std::string,SharedSCPDatabase>::iterator it = SharedDBs.begin(); it != SharedDBs.end(); it++)
+    {
+        if(it->second.db == db)
+        {
+            if(!--it->second.refs)
+            {
+                DEBUG(logdebug("SCP: Last user of shared DB '%s' gone, deleting",db->GetName().c_str()));
+                delete db;
+                SharedDBs.erase(it);
+            }
+            return;
+        }
     }
+}
+
+uint32 SCPDatabaseMgr::GetMemoryUsage(bool shared)
+{
+    uint32 bytes = 0;
+    for(SCPDatabaseMap::_TypeIter it = _map.GetMap().begin(); it != _map.GetMap().end(); it++)
+        if((_shared.find(it->second) != _shared.end()) == shared)
+            bytes += it->second->GetMemoryUsage();
+    return bytes;
+}
+
+uint32 SCPDatabaseMgr::GetSharedMemoryUsage(void)
+{
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(SCPMutex);
+    uint32 bytes = 0;
+    for(std::map<std::string,SharedSCPDatabase>::iterator it = SharedDBs.begin(); it != SharedDBs.end(); it++)
+        bytes += it->second.db->GetMemoryUsage();
+    return bytes;
+}
+
+uint32 SCPDatabaseMgr::AutoLoadFile(const char *fn)
+{
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(SCPMutex);
+    return _ParseFile(fn, NULL);
+}
+
+// parses a .scp file into the DBs named in it by #dbname. if only is set, everything not belonging to that DB is skipped,
+// and nothing but only is touched; this is safe to call from the compile workers.
+uint32 SCPDatabaseMgr::_ParseFile(const char *fn, SCPDatabase *only)
+{
+    MappedFile mf;
+    uint32 stampsize = 0;
+    uint64 stamptime = 0;
+    GetFileStamp(fn, stampsize, stamptime);
+    if(!mf.Open(fn))
+        return 0;
 
-    std::string line,dbname,entry,value;
     SCPDatabase *db = NULL;
+    SCPEntryMap *section = NULL; // created when its first entry is found, empty sections do not make a row
     uint32 id = 0, sections = 0;
-    for(uint32 pos = 0; pos < size; pos++)
+    SCPTokenizer tok((const char*)mf.GetData(), mf.GetSize());
+    for(SCPTokenizer::Token t; (t = tok.Next()) != SCPTokenizer::END; )
     {
-        if(buf[pos] == '\n' || buf[pos] == 10 || buf[pos] == 13)
+        if(t == SCPTokenizer::ENTRY)
         {
-            if(line.empty())
-                continue;
-            while(line.size() && (line[0]==' ' || line[0]=='\t'))
-                line.erase(0,1);
-            if(line.size() < 2 || (line[0] == '/' && line[1] == '/'))
-            {
-                line.clear();
+            if(!db)
                 continue;
-            }
-            size_t eq = line.find("=");
-            if(eq != std::string::npos)
-            {
-                entry=stringToLower(line.substr(0,eq));
-                value=line.substr(eq+1,line.length()-1);
-
-                if(!stricmp(entry.c_str(),"#dbname") && value.size())
-                {
-                    dbname = value;
-                    db = GetDB(dbname,true); // create db if not existing
-                    FileRelation[fn] = dbname;
-                }
-                else if(db)
-                        db->fields[id][entry] = value;
-            }
-            else if(line[0]=='[')
-            {
-                id=(uint32)toInt(line.c_str()+1); // start reading after '['
-                sections++;
-            }
-            line.clear();
+            if(!section)
+                section = &db->fields[id];
+            (*section)[stringToLower(tok.Key())] = tok.Value();
+        }
+        else if(t == SCPTokenizer::SECTION)
+        {
+            id = (uint32)toInt(tok.Key()); // toInt() stops at the ']'
+            section = NULL;
+            sections++;
+        }
+        else if(only)
+        {
+            db = !stricmp(tok.Value().c_str(), only->_name.c_str()) ? only : NULL;
+            section = NULL;
         }
         else
-            line += buf[pos];
+        {
+            std::string dbname = tok.Value();
+            db = GetDB(dbname);
+            if(db && _shared.find(db) != _shared.end()) // shared DBs are read-only, load our own copy
+                _DropDB(dbname);
+            db = GetDB(dbname,true); // create db if not existing
+            section = NULL;
+            FileRelation[fn] = dbname;
+        }
     }
+    if(!db)
+        return sections;
+
+    // the stamps and hash are stored in the compacted file, to see later if the file changed
+    SCPSourceStamp& st = db->_stamps[fn];
+    st.size = stampsize;
+    st.mtime = stamptime;
+    MD5Hash md5;
+    md5.Update((uint8*)mf.GetData(), mf.GetSize());
+    md5.Finalize();
+    memcpy(st.md5, md5.GetDigest(), MD5_DIGEST_LENGTH);
     db->sources.insert(fn);
     return sections;
 }
@@ -259,13 +691,24 @@ uint32 SCPDatabaseMgr::GetDataTypeFromString(const char *s)
 
 bool SCPDatabaseMgr::Compact(const char *dbname, const char *outfile, uint32 compression)
 {
-    logdebug("Compacting database '%s' into file '%s'", dbname, outfile);
     SCPDatabase *db = GetDB(dbname);
     if(!db || db->fields.empty() || db->sources.empty())
     {
         logerror("Compact(\"%s\",\"%s\") failed, DB doesn't exist or is empty",dbname,outfile);
         return false;
     }
+    db->_name = dbname;
+    SCPFileWriter *w = _Compile(db, outfile, compression);
+    bool ok = w->Write();
+    delete w;
+    return ok;
+}
+
+// turns the text data of db into its compact form. returns the writer for the compacted file, which is not written yet.
+// only touches db, so different DBs can be compiled at the same time.
+SCPFileWriter *SCPDatabaseMgr::_Compile(SCPDatabase *db, const char *outfile, uint32 compression)
+{
+    logdebug("Compacting database '%s' into file '%s'", db->_name.c_str(), outfile);
     std::map<std::string, SCPFieldDef> fieldIdMap;
     std::map<uint32,uint32> idToSectionMap;
     ByteBuffer stringdata(5000);
@@ -388,39 +831,18 @@ bool SCPDatabaseMgr::Compact(const char *dbname, const char *outfile, uint32 com
     uint32 offsData, sizeData;
     uint32 offsStrings, sizeStrings;
 
-    // MD5 hashes of source files
-    SCPSourceList& src = db->sources;
+    // stamps and MD5 hashes of source files, taken when they were parsed
     ByteBuffer md5buf;
     nMD5 = 0;
-    for(SCPSourceList::iterator it = src.begin(); it != src.end(); it++)
+    for(SCPSourceStamps::iterator it = db->_stamps.begin(); it != db->_stamps.end(); it++)
     {
-        memblock *mb = Pointers.GetNoCreate(*it);
-        if(!mb)
-        {
-            // if we reach this point there was really some big f*** up
-            logerror("SCP Compact: memblock for file '%s' doesn't exist",it->c_str());
-            continue;
-        }
-
-        MD5Hash md5;
-        md5.Update(mb->ptr,mb->size);
-        md5.Finalize();
-        md5buf << *it;
-        md5buf.append(md5.GetDigest(),md5.GetLength());
+        md5buf << it->first;
+        md5buf << it->second.size << it->second.mtime; // cheap stamps, checked before the MD5
+        md5buf.append(it->second.md5,MD5_DIGEST_LENGTH);
         nMD5++;
     }
     sizeMD5 = md5buf.size();
 
-    // field types, sorted by IDs
-    ByteBuffer fieldbuf;
-    // put the entries and their type into ByteBuffer, sorted by their position in the membuf rows
-    // note that the first field in the data row is always the field id, so the values start from 1
-    for(std::map<std::string,SCPFieldDef>::iterator itf = fieldIdMap.begin(); itf != fieldIdMap.end(); itf++)
-    {
-        fieldbuf << itf->first << itf->second.id << itf->second.type; // entry name, id, type.
-    }
-    sizeFields = fieldbuf.size();
-
     // index -> ID lookup table, e.g. data with ID 500 will have field index 214, because some IDs in between are missing
     // it *could* be calculated at load-time from the existing data field, but this way is faster when random-accessing the file itself
     // (what we dont do anyway, for now)
@@ -432,6 +854,19 @@ bool SCPDatabaseMgr::Compact(const char *dbname, const char *outfile, uint32 com
     nIndexes = idToSectionMap.size();
     sizeIndexes = indexbuf.size();
 
+    // field types, sorted by IDs
+    ByteBuffer fieldbuf;
+    // put the entries and their type into ByteBuffer, sorted by their position in the membuf rows
+    // note that the first field in the data row is always the field id, so the values start from 1
+    for(std::map<std::string,SCPFieldDef>::iterator itf = fieldIdMap.begin(); itf != fieldIdMap.end(); itf++)
+    {
+        fieldbuf << itf->first << itf->second.id << itf->second.type; // entry name, id, type.
+    }
+    // pad so that the data block starts 4-byte aligned in an uncompressed file, which can then be used in place
+    while((sizeMD5 + sizeIndexes + fieldbuf.size()) % sizeof(uint32))
+        fieldbuf << uint8(0);
+    sizeFields = fieldbuf.size();
+
     // string data
     // -- most of it is handled somewhere above
     sizeStrings = stringdata.size();
@@ -450,9 +885,9 @@ bool SCPDatabaseMgr::Compact(const char *dbname, const char *outfile, uint32 com
     ByteBuffer hbuf(HEADER_SIZE);
     hbuf.append("SCPC",4); // identifier
 
-    uint32 flags = 0;
+    uint32 flags = SCP_FLAG_ALIGNED | SCP_FLAG_STAMPED;
 
-    hbuf << flags; // flags, placeholder; real value is put below
+    hbuf << flags; // compression flag is added by the writer
     hbuf << (uint32)0 << (uint32)0 << (uint32)0 << (uint32)0; // padding, not yet used
     hbuf << offsMD5 << nMD5 << sizeMD5;
     hbuf << offsIndexes << nIndexes << sizeIndexes;
@@ -460,7 +895,9 @@ bool SCPDatabaseMgr::Compact(const char *dbname, const char *outfile, uint32 com
     hbuf << offsData << section << sizeData;
     hbuf << offsStrings << nStrings << sizeStrings;
 
-    ZCompressor z;
+    SCPFileWriter *w = new SCPFileWriter(outfile, compression);
+    w->hbuf.append(hbuf);
+    ZCompressor& z = w->z;
     z.reserve(sizeMD5 + sizeIndexes + sizeFields + sizeData + sizeStrings);
     z.append(md5buf);
     z.append(indexbuf);
@@ -468,38 +905,15 @@ bool SCPDatabaseMgr::Compact(const char *dbname, const char *outfile, uint32 com
     z.append((uint8*)membuf, sizeData);
     z.append(stringdata);
 
-    if(compression)
-    {
-        z.Deflate(compression);
-        if(z.Compressed())
-        {
-            hbuf << z.RealSize();
-            flags |= SCP_FLAG_COMPRESSED;
-        }
-        else
-        {
-            logdebug("SCP Compact: Unable to compress '%s' (too small?)",outfile);
-        }
-    }
-
-    hbuf.put<uint32>(4,flags); // first 4 bytes are 'SCPC', then flags...
-
-    FILE *fh = fopen(outfile,"wb");
-    if(!fh)
-        return false;
-
-    fwrite(hbuf.contents(), hbuf.size(), 1, fh);
-    fwrite(z.contents(), z.size(), 1, fh);
-    fclose(fh);
-
-    if(!db)
-        db = GetDB(dbname,true); // create if not exist
-
     db->_compact = true;
-    db->_name = dbname;
 
     // drop all data no longer needed if the database is compacted
     db->DropTextData();
+    if(db->_file) // left over from a failed load
+    {
+        delete db->_file;
+        db->_file = NULL;
+    }
 
     // we keep the membuf, since the compiled data are now usable as if loaded directly from a file
     // associate it with the buffers used by the db accessing functions
@@ -509,12 +923,13 @@ bool SCPDatabaseMgr::Compact(const char *dbname, const char *outfile, uint32 com
     db->_intbuf = membuf; // <<-- do NOT drop the membuf, its still used and will be deleted with ~SCPDatabase()!!
     db->_fields_per_row = nFields;
     db->_rowcount = nRows;
-    db->_indexes = idToSectionMap;
     db->_fielddefs = fieldIdMap;
+    db->_rowids.resize(nRows);
     for(std::map<uint32,uint32>::iterator it = idToSectionMap.begin(); it != idToSectionMap.end(); it++)
-        db->_indexes_reverse[it->second] = it->first;
+        db->_rowids[it->second] = it->first;
+    db->_BuildIndexes(); // the sections were numbered in ID order, can't fail
 
-    return true;
+    return w;
 }
 
 void SCPDatabaseMgr::_FilterFiles(std::deque<std::string>& files, std::string dbname)
@@ -589,83 +1004,181 @@ void SCPDatabaseMgr::_FilterFiles(std::deque<std::string>& files, std::string db
 
 uint32 SCPDatabaseMgr::SearchAndLoad(const char *dbname, bool no_compiled)
 {
-    uint32 count = 0;
-    std::deque<std::string> goodfiles;
-    std::string ccpFile;
+    std::deque<std::string> names(1, dbname);
+    std::vector<uint32> counts;
+    _SearchAndLoad(names, no_compiled, counts);
+    return counts[0];
+}
 
-    for(std::deque<std::string>::iterator it = _paths.begin(); it != _paths.end(); it++)
+uint32 SCPDatabaseMgr::SearchAndLoad(const std::deque<std::string>& dbnames, bool no_compiled)
+{
+    std::vector<uint32> counts;
+    _SearchAndLoad(dbnames, no_compiled, counts);
+    uint32 total = 0;
+    for(uint32 i = 0; i < counts.size(); i++)
+        total += counts[i];
+    return total;
+}
+
+// counts receives the amount of source files of each DB, 0 if it could not be loaded.
+// DBs that must be compiled from source are collected first and then done in parallel.
+void SCPDatabaseMgr::_SearchAndLoad(const std::deque<std::string>& dbnames, bool no_compiled, std::vector<uint32>& counts)
+{
+    counts.assign(dbnames.size(), 0);
+    std::vector<SCPCompileJob> jobs;
+    std::vector<std::string> listing; // all files in the search paths, with path
+    bool listed = false;
+
+    // another instance might have loaded this already
+    ZThread::Guard<ZThread::FastRecursiveMutex> g(SCPMutex);
+    for(uint32 i = 0; i < dbnames.size(); i++)
     {
-        std::deque<std::string> files = GetFileList(*it);
-        sort(files.begin(),files.end()); // rough alphabetical sort
-        for(std::deque<std::string>::iterator itf = files.begin(); itf != files.end(); itf++)
+        const char *dbname = dbnames[i].c_str();
+        bool dup = false;
+        for(uint32 k = 0; k < i && !dup; k++)
+            dup = !stricmp(dbnames[k].c_str(), dbname);
+        if(dup)
+            continue;
+        if(!no_compiled && _AttachShared(dbname, counts[i]))
         {
-            std::string& fn = *itf;
-            if(fn.length() < 5)
-                continue;
-            std::string filepath = *it + fn;
+            logdebug("Using shared database '%s'", dbname);
+            continue;
+        }
+
+        if(!listed)
+        {
+            for(std::deque<std::string>::iterator it = _paths.begin(); it != _paths.end(); it++)
+            {
+                std::deque<std::string> files = GetFileList(*it);
+                sort(files.begin(),files.end()); // rough alphabetical sort
+                for(std::deque<std::string>::iterator itf = files.begin(); itf != files.end(); itf++)
+                    if(itf->length() >= 5)
+                        listing.push_back(*it + *itf);
+            }
+            listed = true;
+        }
+
+        std::deque<std::string> goodfiles;
+        std::string ccpFile, ccpName = std::string(dbname).append(".ccp");
+        for(std::vector<std::string>::iterator it = listing.begin(); it != listing.end(); it++)
+        {
+            std::string& filepath = *it;
+            const char *fn = filepath.c_str() + filepath.find_last_of('/') + 1;
             // check for special case: <dbname>.ccp in this directory? load it!
             // others must be checked only for MD5-match and if new files are there not yet recorded in MD5
-            if(!no_compiled && !stricmp(std::string(dbname).append(".ccp").c_str(), fn.c_str()))
+            if(!no_compiled && !stricmp(ccpName.c_str(), fn))
             {
                 ccpFile = filepath;
             }
-            else if(!stricmp(fn.c_str() + fn.length() - 4, ".scp"))
+            else if(!stricmp(filepath.c_str() + filepath.length() - 4, ".scp"))
             {
                 // skip 0-byte files
-                if(GetFileSize(filepath.c_str()))
+                uint32 size = 0;
+                uint64 mtime;
+                if(GetFileStamp(filepath.c_str(), size, mtime) && size)
                     goodfiles.push_back(filepath);
                 else
                     FileRelation[filepath] = ""; // empty files cant belong to a DB
             }
         }
+
+        // goodfiles stores a list of all scp files found, we need to remove those that are not required for this DB
+        _FilterFiles(goodfiles,dbname);
+
+        if(!goodfiles.size())
+        {
+            logerror("SCP: No files found that contain database [%s]", dbname);
+            continue;
+        }
+
+        // string only exists if CCP file was found and if it should no be skipped
+        if(ccpFile.size())
+        {
+            logdebug("Loading pre-compacted database '%s'", ccpFile.c_str());
+            DropDB(dbname); // if sth got loaded before, remove that
+            // load SCC database file
+            if(LoadCompactSCP((char*)ccpFile.c_str(), dbname, goodfiles.size()))
+            {
+                logdebug("Loaded '%s' -> %s",ccpFile.c_str(),dbname);
+                _ShareDB(dbname, goodfiles.size());
+                counts[i] = goodfiles.size();
+                continue;
+            }
+            else
+            {
+                logdetail("Pre-compacted SCC file for '%s' outdated, creating from SCP (%u files total)",dbname,goodfiles.size());
+            }
+        }
+
+        SCPCompileJob job;
+        job.dbname = dbname;
+        job.files = goodfiles;
+        job.db = NULL;
+        job.writer = NULL;
+        jobs.push_back(job);
     }
 
-    // goodfiles stores a list of all scp files found, we need to remove those that are not required for this DB
-    _FilterFiles(goodfiles,dbname);
+    if(jobs.empty())
+        return;
 
-    if(!goodfiles.size())
+    // this thread compiles too, the others are only started if there is more than one DB to do
+    uint32 next = 0;
+    ZThread::FastMutex jobmutex;
+    uint32 nthreads = jobs.size() < SCP_COMPILE_THREADS ? jobs.size() : SCP_COMPILE_THREADS;
+    std::vector<ZThread::Thread*> thr;
+    for(uint32 i = 1; i < nthreads; i++)
+        thr.push_back(new ZThread::Thread(new SCPCompileWorker(this, &jobs, &next, &jobmutex))); // the thread takes ownership of the worker
+    SCPCompileWorker(this, &jobs, &next, &jobmutex).run();
+    for(uint32 i = 0; i < thr.size(); i++)
     {
-        logerror("SCP: No files found that contain database [%s]", dbname);
-        return 0;
+        thr[i]->wait();
+        delete thr[i];
     }
 
-    // string only exists if CCP file was found and if it should no be skipped
-    if(ccpFile.size())
+    for(uint32 j = 0; j < jobs.size(); j++)
     {
-        logdebug("Loading pre-compacted database '%s'", ccpFile.c_str());
-        DropDB(dbname); // if sth got loaded before, remove that
-        // load SCC database file
-        if(LoadCompactSCP((char*)ccpFile.c_str(), dbname, goodfiles.size()))
-        {
-            logdebug("Loaded '%s' -> %s",ccpFile.c_str(),dbname);
-            return goodfiles.size();
-        }
-        else
+        SCPCompileJob& job = jobs[j];
+        const char *dbname = job.dbname.c_str();
+        if(!job.db)
         {
-            logdetail("Pre-compacted SCC file for '%s' outdated, creating from SCP (%u files total)",dbname,goodfiles.size());
+            logerror("Can't compact database %s, dropping it.", dbname);
+            DropDB(dbname);
+            continue;
         }
+        _DropDB(dbname); // the remains of a failed LoadCompactSCP(), or an older copy
+        _map.Assign(dbname, job.db);
+        logdetail("Database '%s' loaded from source and compacted with compression %u", dbname, _compr);
+        _ShareDB(dbname, job.files.size());
+        for(uint32 i = 0; i < dbnames.size(); i++)
+            if(dbnames[i] == job.dbname)
+                counts[i] = job.files.size();
+        // the DB is usable now, compress and write the file in the background
+        MemoryDataHolder::Execute(job.writer);
     }
+}
 
-    for(std::deque<std::string>::iterator it = goodfiles.begin(); it != goodfiles.end(); it++)
+// runs on a compile worker; must not touch anything but the job
+void SCPDatabaseMgr::_CompileJob(SCPCompileJob& job)
+{
+    SCPDatabase *db = new SCPDatabase();
+    db->_name = job.dbname;
+    for(std::deque<std::string>::iterator it = job.files.begin(); it != job.files.end(); it++)
     {
-        logdebug("File '%s' matching database '%s', loading", it->c_str(), dbname);
-        count++;
-        uint32 sections = AutoLoadFile((char*)it->c_str());
+        logdebug("File '%s' matching database '%s', loading", it->c_str(), job.dbname.c_str());
+        uint32 sections = _ParseFile(it->c_str(), db);
         logdebug("%u sections loaded", sections);
     }
-
-    char fn[100];
-    sprintf(fn,"./cache/%s.ccp",dbname);
-    if (!Compact(dbname, fn, _compr))
+    if(db->fields.empty() || db->sources.empty())
     {
-        logerror("Can't compact database %s, dropping it.", dbname);
-        DropDB(dbname);
-        return 0;
+        logerror("SCP: Database '%s' is empty",job.dbname.c_str());
+        delete db;
+        return;
     }
 
-    logdetail("Database '%s' loaded from source and compacted with compression %u", dbname, _compr);
-
-    return count;
+    char fn[100];
+    snprintf(fn,sizeof(fn),"./cache/%s.ccp",job.dbname.c_str());
+    job.writer = _Compile(db, fn, _compr);
+    job.db = db;
 }
 
 void SCPDatabaseMgr::AddSearchPath(const char *path)
@@ -700,25 +1213,26 @@ void SCPDatabaseMgr::AddSearchPath(const char *path)
     _paths.push_back(p);
 }
 
+// uncompressed, aligned files are mapped and used in place; nothing but the small index and field tables is parsed.
+// the sources are checked by size and mtime, their MD5 is only calculated if these changed.
 bool SCPDatabaseMgr::LoadCompactSCP(const char *fn, const char *dbname, uint32 nSourcefiles)
 {
-    uint32 filesize = GetFileSize(fn);
-    if(filesize < HEADER_SIZE)
+    MappedFile *mf = new MappedFile();
+    if(!mf->Open(fn))
     {
-        logerror("Database file '%s' is too small!",fn);
+        logerror("Error opening '%s'",fn);
+        delete mf;
         return false;
     }
-    std::fstream fh;
-    fh.open(fn, std::ios_base::in | std::ios_base::binary);
-    if(!fh.is_open())
+    if(mf->GetSize() < HEADER_SIZE)
     {
-        logerror("Error opening '%s'",fn);
+        logerror("Database file '%s' is too small!",fn);
+        delete mf;
         return false;
     }
 
-    ByteBuffer hbuf;
-    hbuf.resize(HEADER_SIZE);
-    fh.read((char*)hbuf.contents(), HEADER_SIZE);
+    ByteBuffer hbuf(HEADER_SIZE);
+    hbuf.append(mf->GetData(), HEADER_SIZE);
 
     char tag[4];
     uint32 flags, padding[4];
@@ -728,12 +1242,11 @@ bool SCPDatabaseMgr::LoadCompactSCP(const char *fn, const char *dbname, uint32 n
     uint32 offsData, nRows, sizeData;
     uint32 offsStrings, nStrings, sizeStrings;
 
-    uint32 realsize; // used when compressed
-
     hbuf.read((uint8*)&tag[0],4);
     if(memcmp(tag,"SCPC",4))
     {
         logerror("'%s' is not a compact database file!",fn);
+        delete mf;
         return false;
     }
     hbuf >> flags;
@@ -744,74 +1257,99 @@ bool SCPDatabaseMgr::LoadCompactSCP(const char *fn, const char *dbname, uint32 n
     hbuf >> offsData >> nRows >> sizeData;
     hbuf >> offsStrings >> nStrings >> sizeStrings;
 
-    // read some extra bytes depending on flags
-    if(flags & SCP_FLAG_COMPRESSED)
-        fh.read((char*)&realsize, sizeof(uint32));
-
+    // the data following the header; either in the mapped file or inflated into z
     ZCompressor z;
+    const uint8 *data = mf->GetData() + HEADER_SIZE;
     uint32 remain = sizeMD5 + sizeIndexes + sizeFields + sizeData + sizeStrings;
-    z.resize(remain);
-    fh.read((char*)z.contents(), remain);
-
-    fh.close(); // All data are read from the file now, it can safely be closed
-
     if(flags & SCP_FLAG_COMPRESSED)
     {
+        if(mf->GetSize() < HEADER_SIZE + sizeof(uint32))
+        {
+            logerror("Database file '%s' is too small!",fn);
+            delete mf;
+            return false;
+        }
+        uint32 realsize;
+        memcpy(&realsize, data, sizeof(uint32));
+        z.append(data + sizeof(uint32), mf->GetSize() - HEADER_SIZE - sizeof(uint32));
         z.Compressed(true);
         z.RealSize(realsize);
         z.Inflate();
-        if(z.Compressed())
+        if(z.Compressed() || z.size() < remain)
         {
             logerror("LoadCompactSCP: Unable to uncompress '%s'",fn);
+            delete mf;
             return false;
         }
+        data = z.contents();
+        mf->Close();
+    }
+    else if(mf->GetSize() - HEADER_SIZE < remain)
+    {
+        logerror("Database file '%s' is truncated!",fn);
+        delete mf;
+        return false;
+    }
+    if(offsMD5 + sizeMD5 > remain || offsIndexes + sizeIndexes > remain || offsFields + sizeFields > remain
+        || offsData + sizeData > remain || offsStrings + sizeStrings > remain || !nFields || nRows * nFields != sizeData / sizeof(uint32))
+    {
+        logerror("'%s' has wrong section offsets, can't load",fn);
+        delete mf;
+        return false;
     }
 
     SCPDatabase *db = GetDB(dbname,true);
     db->_name = dbname;
     db->_compact = true;
 
-    ByteBuffer md5buf(sizeMD5);
-    md5buf.resize(sizeMD5);
-    // read MD5 block
-    z.rpos(offsMD5);
-    if(z.rpos() == offsMD5)
-    {
-        z.read((uint8*)md5buf.contents(),sizeMD5);
-    }
-    else
+    // the sections are read from here on; one that is cut short throws, and the file is compiled again
+    try
     {
-        logerror("'%s' has wrong MD5 offset, can't load",fn);
-        return false;
-    }
+
+    ByteBuffer md5buf(sizeMD5);
+    md5buf.append(data + offsMD5, sizeMD5);
 
     for(uint32 i = 0; i < nMD5; i++)
     {
-        // read filename and MD5 hash from compiled database
+        // read filename, stamps and MD5 hash from compiled database
         uint8 buf[MD5_DIGEST_LENGTH];
         std::string refFn;
+        uint32 refSize = 0;
+        uint64 refTime = 0;
         md5buf >> refFn;
+        if(flags & SCP_FLAG_STAMPED)
+            md5buf >> refSize >> refTime;
         md5buf.read(buf,MD5_DIGEST_LENGTH);
 
-        // load the file referred to
-        uint32 refFileSize = GetFileSize(refFn.c_str());
-        FILE *refFile = fopen(refFn.c_str(), "rb");
-        if(!refFile)
+        uint32 refFileSize = 0;
+        uint64 refFileTime = 0;
+        if(!GetFileStamp(refFn.c_str(), refFileSize, refFileTime))
+        {
+            logdebug("Not loading '%s', file doesn't exist",fn);
+            delete mf;
+            return false;
+        }
+        if((flags & SCP_FLAG_STAMPED) && refFileSize == refSize && refFileTime == refTime)
+        {
+            logdebug("Stamp-check: '%s' -> OK",refFn.c_str());
+            continue;
+        }
+
+        // hash the file referred to
+        MappedFile refFile;
+        if(!refFile.Open(refFn.c_str()))
         {
             logdebug("Not loading '%s', file doesn't exist",fn);
+            delete mf;
             return false;
         }
-        uint8 *refFileBuf = new uint8[refFileSize];
-        fread(refFileBuf,sizeof(uint8),refFileSize,refFile);
-        fclose(refFile);
-        db->sources.insert(refFn);
-        Pointers.Assign(refFn, new memblock(refFileBuf,refFileSize));
         MD5Hash md5;
-        md5.Update(refFileBuf,refFileSize);
+        md5.Update((uint8*)refFile.GetData(),refFile.GetSize());
         md5.Finalize();
         if(memcmp(buf, md5.GetDigest(), MD5_DIGEST_LENGTH))
         {
             logdebug("MD5-check: '%s' has changed!", refFn.c_str());
+            delete mf;
             return false;
         }
         else
@@ -825,44 +1363,35 @@ bool SCPDatabaseMgr::LoadCompactSCP(const char *fn, const char *dbname, uint32 n
     if(nSourcefiles > nMD5)
     {
         logdebug("There are more source files existing then hashed in the CCP file, must recompact.");
+        delete mf;
         return false;
     }
     ASSERT(nMD5 == nSourcefiles); // if we didnt return until now, something isnt good
 
-    // everything good so far? we reached this point? then its likely that the rest of the file is ok, alloc remaining buffers
+    // everything good so far? we reached this point? then its likely that the rest of the file is ok
     ByteBuffer indexbuf(sizeIndexes);
     ByteBuffer fieldsbuf(sizeFields);
-    indexbuf.resize(sizeIndexes);
-    fieldsbuf.resize(sizeFields);
+    indexbuf.append(data + offsIndexes, sizeIndexes);
+    fieldsbuf.append(data + offsFields, sizeFields);
 
-    // read indexes block
-    z.rpos(offsIndexes);
-    if(z.rpos() == offsIndexes)
-        z.read((uint8*)indexbuf.contents(),sizeIndexes);
-    else
-    {
-        logerror("'%s' has wrong indexes offset, can't load",fn);
-        return false;
-    }
-
-    // read field definitions buf
-    z.rpos(offsFields);
-    if(z.rpos() == offsFields)
-        z.read((uint8*)fieldsbuf.contents(),sizeFields);
-    else
+    if(nIndexes != nRows)
     {
-        logerror("'%s' has wrong field defs offset, can't load",fn);
+        logerror("'%s' has %u indexes for %u rows, can't load",fn,nIndexes,nRows);
+        delete mf;
         return false;
     }
-
-    // main data and string blocks follow below
-
+    db->_rowids.resize(nRows);
     for(uint32 i = 0; i < nIndexes; i++)
     {
         uint32 field_id, row;
         indexbuf >> field_id >> row;
-        db->_indexes[field_id] = row;
-        db->_indexes_reverse[row] = field_id;
+        if(row >= nRows)
+        {
+            logerror("'%s' has a bad index entry, can't load",fn);
+            delete mf;
+            return false;
+        }
+        db->_rowids[row] = field_id;
     }
 
     for(uint32 i = 0; i < nFields - 1; i++) // the first field (index column) is never written to the file!
@@ -873,37 +1402,38 @@ bool SCPDatabaseMgr::LoadCompactSCP(const char *fn, const char *dbname, uint32 n
         db->_fielddefs[fieldn] = fieldd;
     }
 
-    // read main data block
-    ASSERT(nRows * nFields == sizeData / sizeof(uint32));
-    z.rpos(offsData);
-    if(z.rpos() == offsData)
-    {
-        db->_intbuf = new uint32[nRows * nFields];
-        z.read((uint8*)db->_intbuf, sizeData); // load this somewhat fast and without a for loop
     }
-    else
+    catch (ByteBufferException bbe)
     {
-        logerror("'%s' has wrong data offset, can't load",fn);
+        logerror("'%s' is corrupt, can't load: attempt to \"%s\" %u bytes at position %u out of total %u bytes",
+            fn, bbe.action, bbe.readsize, bbe.rpos, bbe.cursize);
+        delete mf;
         return false;
     }
 
-    // read strings
-    z.rpos(offsStrings);
-    if(z.rpos() == offsStrings)
+    // main data and string blocks: use them where they are if possible, copy otherwise
+    if(mf->IsOpen() && (flags & SCP_FLAG_ALIGNED) && !((HEADER_SIZE + offsData) % sizeof(uint32)))
     {
-        db->_stringbuf = new char[sizeStrings];
-        z.read((uint8*)db->_stringbuf,sizeStrings);
+        db->_file = mf;
+        db->_intbuf = (uint32*)(data + offsData);
+        db->_stringbuf = (char*)(data + offsStrings);
     }
     else
     {
-        logerror("'%s' has wrong strings offset, can't load",fn);
-        return false;
+        delete mf;
+        db->_intbuf = new uint32[nRows * nFields];
+        memcpy(db->_intbuf, data + offsData, sizeData);
+        db->_stringbuf = new char[sizeStrings];
+        memcpy(db->_stringbuf, data + offsStrings, sizeStrings);
     }
     db->_stringsize = sizeStrings;
     db->_rowcount = nRows;
     db->_fields_per_row = nFields;
-
-    db->DropTextData(); // delete pointers to file content created at md5 comparison
+    if(!db->_BuildIndexes())
+    {
+        logerror("'%s' has rows not sorted by ID, can't load",fn);
+        return false;
+    }
 
     // all fine, DB loaded
 
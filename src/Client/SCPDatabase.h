@@ -3,6 +3,7 @@
 
 #include "TypeStorage.h"
 #include "ZCompressor.h"
+#include "MappedFile.h"
 #include <set>
 
 enum SCPFieldTypes
@@ -14,7 +15,9 @@ enum SCPFieldTypes
 
 enum SCPFlags
 {
-    SCP_FLAG_COMPRESSED = 1
+    SCP_FLAG_COMPRESSED = 1,
+    SCP_FLAG_ALIGNED = 2, // the data block starts at a multiple of 4 bytes; if not compressed, the file is used in place
+    SCP_FLAG_STAMPED = 4  // source file entries have size and mtime before the MD5
 };
 
 struct SCPFieldDef
@@ -24,10 +27,35 @@ struct SCPFieldDef
 };
 
 #define SCP_INVALID_INT 0xFFFFFFFF
+#define SCP_COMPILE_THREADS 4 // max. threads compiling databases from source at once
+#define SCP_INDEX_MIN_ROWS 16 // GetFieldBy*Value() on smaller DBs just scans the rows, bigger ones build a hash index per column on first use
+
+// a field name and its id in the DB it was last used with. for code that looks up the same field over and over;
+// SCPDatabase::GetFieldId(SCPFieldHandle&) resolves the name only once per loaded DB.
+struct SCPFieldHandle
+{
+    SCPFieldHandle(const char *n) : name(n), gen(0), id(SCP_INVALID_INT), type(SCP_INVALID_INT) {}
+    const char *name;
+    uint32 gen; // generation of the data the id belongs to, see SCPDatabase::_gen
+    uint32 id;
+    uint32 type;
+};
+
+// taken from a source file when it is parsed, to see later if it changed
+struct SCPSourceStamp
+{
+    uint32 size;
+    uint64 mtime;
+    uint8 md5[16];
+};
 
 typedef std::map<std::string,std::string> SCPEntryMap;
 typedef std::map<uint32,SCPEntryMap> SCPFieldMap;
 typedef std::set<std::string> SCPSourceList;
+typedef std::map<std::string,SCPSourceStamp> SCPSourceStamps;
+
+class SCPFileWriter;
+struct SCPCompileJob;
 
 class SCPDatabase
 {
@@ -58,6 +86,18 @@ public:
     inline float GetFloat(uint32 index, uint32 entry) { float *t = (float*)GetPtrByField(index,entry); return t ? *t : 0; }
     uint32 GetFieldType(const char *entry);
     uint32 GetFieldId(const char *entry);
+    const SCPFieldDef *GetFieldDef(const char *entry);
+    inline uint32 GetFieldId(SCPFieldHandle& h)
+    {
+        if(h.gen != _gen)
+        {
+            const SCPFieldDef *d = GetFieldDef(h.name);
+            h.id = d ? d->id : SCP_INVALID_INT;
+            h.type = d ? d->type : SCP_INVALID_INT;
+            h.gen = _gen;
+        }
+        return h.id;
+    }
     inline void *GetRowByIndex(uint32 index) { return GetPtrByField(index,0); }
     uint32 GetFieldByUint32Value(const char *entry, uint32 val);
     uint32 GetFieldByUint32Value(uint32 entry, uint32 val);
@@ -68,13 +108,28 @@ public:
     // float value lookup not necessary
     inline uint32 GetFieldsCount(void) { return _fields_per_row; }
     inline uint32 GetRowsCount(void) { return _rowcount; }
+    uint32 GetMemoryUsage(void); // approx. bytes used by the compacted data
+
 
 
     void DumpStructureToFile(const char *fn);
 private:
+    struct FieldSlot
+    {
+        uint32 hash;
+        const char *name; // points into the _fielddefs key; NULL if the slot is empty
+        SCPFieldDef def;
+    };
+
+    bool _BuildIndexes(void);
+    void _DropValueIndexes(void);
+    uint32 _GetRow(uint32 index);
+    const uint32 *_GetValueIndex(uint32 field, bool str);
+
     // text data related
     SCPSourceList sources;
     SCPFieldMap fields;
+    SCPSourceStamps _stamps;
 
     // binary data related
     bool _compact;
@@ -84,8 +139,14 @@ private:
     char *_stringbuf;
     uint32 _stringsize;
     uint32 *_intbuf;
-    std::map<uint32,uint32> _indexes, _indexes_reverse; // stores index-to-rowID, rowID-to-index
+    MappedFile *_file; // if set, _stringbuf and _intbuf point into this file
+    uint32 _gen; // changes whenever other data are loaded, 0 if there are none
+    std::vector<uint32> _rowids; // row -> ID; the rows are sorted by ID
+    std::vector<uint32> _rowmap; // ID - _rowids[0] -> row, or SCP_INVALID_INT. empty if the IDs are too sparse, then _rowids is searched
     std::map<std::string,SCPFieldDef> _fielddefs;
+    std::vector<FieldSlot> _fieldhash; // open addressing over the _fielddefs names
+    std::vector<uint32*> _valindex, _strindex; // per field: hash of the values (or the strings they point to) -> first row. built on demand
+    uint32 _valmask; // size of a value index - 1
 };
 
 typedef TypeStorage<SCPDatabase> SCPDatabaseMap;
@@ -94,22 +155,37 @@ typedef TypeStorage<SCPDatabase> SCPDatabaseMap;
 class SCPDatabaseMgr
 {
     friend class SCPDatabase;
+    friend class SCPCompileWorker;
 public:
     SCPDatabaseMgr() : _compr(0) {}
+    ~SCPDatabaseMgr();
     SCPDatabase *GetDB(std::string n, bool create = false);
     uint32 AutoLoadFile(const char *fn);
-    inline void DropDB(std::string s) { _map.Delete(stringToLower(s)); }
+    void DropDB(std::string s);
     bool Compact(const char *dbname, const char *outfile, uint32 compression = 0);
     static uint32 GetDataTypeFromString(const char *s);
     uint32 SearchAndLoad(const char*,bool);
+    uint32 SearchAndLoad(const std::deque<std::string>& dbnames, bool no_compiled); // returns the total amount of source files
     void AddSearchPath(const char*);
     bool LoadCompactSCP(const char*, const char*, uint32);
     void SetCompression(uint32 c) { _compr = c; } // min=0, max=9
     uint32 GetCompression(void) { return _compr; }
+    uint32 GetMemoryUsage(bool shared); // approx. bytes used by own (false) or shared (true) databases
+    static uint32 GetSharedMemoryUsage(void); // approx. bytes used by all shared databases in this process
 
 private:
     void _FilterFiles(std::deque<std::string>& files, std::string dbname);
+    void _SearchAndLoad(const std::deque<std::string>& dbnames, bool no_compiled, std::vector<uint32>& counts);
+    uint32 _ParseFile(const char *fn, SCPDatabase *only);
+    void _CompileJob(SCPCompileJob& job);
+    static SCPFileWriter *_Compile(SCPDatabase *db, const char *outfile, uint32 compression);
+    void _DropDB(std::string key);
+    std::string _GetSharedKey(const char *dbname);
+    bool _AttachShared(const char *dbname, uint32& sources);
+    void _ShareDB(const char *dbname, uint32 sources);
+    void _ReleaseShared(SCPDatabase *db);
     SCPDatabaseMap _map;
+    std::set<SCPDatabase*> _shared; // databases in _map that are owned by the shared registry
     std::deque<std::string> _paths;
     uint32 _compr; // zlib compression level
 };
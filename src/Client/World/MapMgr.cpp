@@ -2,6 +2,10 @@
 #include "log.h"
 #include "MemoryDataHolder.h"
 #include "MapTile.h"
+#include "NavGrid.h"
+#include "NavGraph.h"
+#include "Pathfinder.h"
+#include "PathCache.h"
 #include "MapMgr.h"
 
 
@@ -10,31 +14,177 @@ char* MapMgr::MapID2Name(uint32 mid)
   if(!mapdb)
   {
       mapdb=_instance->dbmgr.GetDB("map");
+      if(!mapdb)
+          return (char*)"";
   }
-  uint32 name_id = mapdb->GetFieldId("name_general");
-  return mapdb->GetString(mid,name_id);
+  return mapdb->GetString(mid,mapdb->GetFieldId(_mapnamefield));
 
 }
 
 
-MapMgr::MapMgr(PseuInstance* _inst)
+// a finished tile request. tile is NULL if loading failed.
+struct MapTileLoadResult
+{
+    uint32 pos;
+    uint32 gen;
+    MapTile *tile;
+};
+
+// shared between the MapMgr and its loader jobs, which may outlive it
+struct MapTileInbox
+{
+    MapTileInbox() : refs(1), cancelled(false), instance(NULL) {}
+    void Release(void)
+    {
+        bool last;
+        {
+            ZThread::Guard<ZThread::FastMutex> g(mutex);
+            last = !--refs;
+        }
+        if(last)
+        {
+            for(std::deque<MapTileLoadResult>::iterator it = done.begin(); it != done.end(); it++)
+                delete it->tile;
+            delete this;
+        }
+    }
+
+    ZThread::FastMutex mutex;
+    uint32 refs;
+    bool cancelled; // set when the MapMgr is gone
+    PseuInstance *instance;
+    std::deque<MapTileLoadResult> done;
+};
+
+// load a tile from file and build a MapTile from it. returns NULL on error.
+// headless tiles keep only the terrain heights, which is all a bot without GUI needs.
+// they are mapped from the tile's .hmap file if there is an up to date one, otherwise the ADT is parsed
+// and the .hmap file written for the next time (and for all other instances and processes).
+static MapTile *LoadMapTile(const char *fn, const char *hfn, uint32 mapid, uint32 pos, bool headless)
+{
+    uint32 adtsize = MemoryDataHolder::GetFileSize(fn); // the .hmap file is rebuilt if the ADT size changed, e.g. by a client patch
+    if(headless)
+    {
+        MapTile *tile = new MapTile();
+        if(tile->LoadHeightMap(hfn, adtsize))
+        {
+            logdebug("MAPMGR: Mapped height map '%s'",hfn);
+            return tile;
+        }
+        delete tile;
+    }
+
+    MemoryDataHolder::MemoryDataResult mdr = MemoryDataHolder::GetFileBasic(fn);
+    if(!(mdr.flags & MemoryDataHolder::MDH_FILE_OK && mdr.data.size))
+    {
+        logerror("MAPMGR: Loading ADT '%s' failed!",fn);
+        return NULL;
+    }
+    ByteBuffer bb(mdr.data.size);
+    bb.append(mdr.data.ptr,mdr.data.size);
+    MemoryDataHolder::Delete(fn);
+    MapTile *tile = NULL;
+    ADTFile *adt = new ADTFile();
+    if(adt->LoadMem(bb))
+    {
+        logdebug("MAPMGR: Loaded ADT '%s'",fn);
+        tile = new MapTile();
+        tile->ImportFromADT(adt, headless, adtsize);
+        if(headless)
+        {
+            if(tile->GetHeightMap().Save(hfn))
+            {
+                tile->LoadHeightMap(hfn, adtsize); // use the shared pages instead of our own copy
+                PathCache::HeightMapWritten(mapid, pos);
+            }
+            else
+                logdebug("MAPMGR: Can't write height map '%s'",hfn);
+        }
+    }
+    else
+    {
+        logerror("MAPMGR: Error loading ADT '%s'",fn);//This should not happen!!
+    }
+    delete adt;
+    return tile;
+}
+
+// runs on the MemoryDataHolder loader threads; the finished tile is published by MapMgr::Update()
+class MapTileLoader : public ZThread::Runnable
+{
+public:
+    MapTileLoader(MapTileInbox *inbox, std::string fn, std::string hfn, uint32 mapid, uint32 pos, uint32 gen, bool headless)
+        : _inbox(inbox), _fn(fn), _hfn(hfn), _mapid(mapid), _headless(headless)
+    {
+        _res.pos = pos;
+        _res.gen = gen;
+        _res.tile = NULL;
+    }
+    void run(void)
+    {
+        _res.tile = LoadMapTile(_fn.c_str(), _hfn.c_str(), _mapid, _res.pos, _headless);
+        if(_res.tile)
+            _res.tile->GetNavGrid(); // here instead of in the main thread when a path is searched
+        {
+            ZThread::Guard<ZThread::FastMutex> g(_inbox->mutex);
+            if(!_inbox->cancelled)
+            {
+                _inbox->done.push_back(_res);
+                _res.tile = NULL;
+                _inbox->instance->WakeUp(); // the instance is alive as long as its MapMgr is
+            }
+        }
+        delete _res.tile;
+        _inbox->Release();
+    }
+
+private:
+    MapTileInbox *_inbox;
+    std::string _fn;
+    std::string _hfn;
+    uint32 _mapid;
+    bool _headless;
+    MapTileLoadResult _res;
+};
+
+
+MapMgr::MapMgr(PseuInstance* _inst) : _mapnamefield("name_general")
 {
     DEBUG(logdebug("Creating MapMgr with TILESIZE=%.3f CHUNKSIZE=%.3f UNITSIZE=%.3f",TILESIZE,CHUNKSIZE,UNITSIZE));
     _tiles = new MapTileStorage();
     _gridx = _gridy = _mapid = (-1);
     _mapsLoaded = false;
+    _gen = 0;
     _instance = _inst;
+    _headless = true;
     mapdb=_instance->dbmgr.GetDB("map");
+    _inbox = new MapTileInbox();
+    _inbox->instance = _inst;
+    _pathfinder = new Pathfinder();
 }
 
 MapMgr::~MapMgr()
 {
+    {
+        ZThread::Guard<ZThread::FastMutex> g(_inbox->mutex);
+        _inbox->cancelled = true;
+    }
+    _inbox->Release(); // loader jobs still running will delete it
     Flush();
     delete _tiles;
+    delete _pathfinder;
 }
 
-void MapMgr::Update(float x, float y, uint32 m)
+void MapMgr::Update(float x, float y, uint32 m, float vx, float vy)
 {
+    bool headless = _instance->GetGUI() == NULL;
+    if(_headless && !headless && _mapid != uint32(-1))
+    {
+        logdebug("MAPMGR: GUI attached, reloading tiles with full data");
+        Flush(); // the GUI needs the render data that headless tiles do not have
+    }
+    _headless = headless; // tiles loaded with full data stay when the GUI goes away
+
     if(m != _mapid)
     {
         Flush(); // we teleported to a new map, drop all loaded maps
@@ -61,49 +211,74 @@ void MapMgr::Update(float x, float y, uint32 m)
         }
 
         _mapid = m;
-        _gridx = _gridy = (-1); // must load tiles now
     }
     GridCoordPair gcoords = GetTransformGridCoordPair(x,y);
     if(gcoords.x != _gridx || gcoords.y != _gridy)
     {
         _gridx = gcoords.x;
         _gridy = gcoords.y;
-        _LoadNearTiles(_gridx,_gridy,m);
+        logdebug("MAPMGR: Loading near tiles for (%u, %u) map %u",_gridx,_gridy,m);
+        _RequestNearTiles(_gridx,_gridy);
         _UnloadOldTiles();
     }
-    _mapsLoaded = true; // at this point, everything should be loaded (if maps existing)
+
+    // if moving, make sure the tiles we are heading to are loaded before we get there.
+    // the lookahead is limited to the next tile, everything further away would be unloaded again anyway.
+    if(vx || vy)
+    {
+        GridCoordPair ahead = GetTransformGridCoordPair(x + vx * MAPMGR_PREFETCH_SECS, y + vy * MAPMGR_PREFETCH_SECS);
+        int32 ax = std::max(int32(_gridx) - 1, std::min(int32(_gridx) + 1, int32(ahead.x)));
+        int32 ay = std::max(int32(_gridy) - 1, std::min(int32(_gridy) + 1, int32(ahead.y)));
+        if(uint32(ax) != _gridx || uint32(ay) != _gridy)
+            _RequestNearTiles(ax,ay);
+    }
+
+    _PublishLoadedTiles();
+
+    bool loaded = _NearTilesDone();
+    if(loaded && !_mapsLoaded)
+    {
+        _mapsLoaded = true;
+        _instance->GetCondition(COND_MAP_LOADED)->broadcast(); // GUI might be waiting for this
+    }
+    else
+        _mapsLoaded = loaded;
 }
 
 void MapMgr::Flush(void)
 {
     _mapsLoaded = false;
-    for(uint32 i = 0; i < 4096; i++)
-        _tiles->UnloadMapTile(i);
+    {
+        ZThread::Guard<ZThread::FastMutex> g(_tilemutex);
+        for(uint32 i = 0; i < 4096; i++)
+            _tiles->UnloadMapTile(i);
+    }
+    _gen++; // tiles still loading will be dropped
+    _loading.reset();
+    _failed.reset();
+    _gridx = _gridy = (-1); // must load tiles again on next Update()
     logdebug("MAPMGR: Flushed all maps");
 }
 
-void MapMgr::_LoadNearTiles(uint32 gx, uint32 gy, uint32 m)
+void MapMgr::_RequestNearTiles(uint32 gx, uint32 gy)
 {
-    _mapsLoaded = false;
-    logdebug("MAPMGR: Loading near tiles for (%u, %u) map %u",gx,gy,m);
     for(uint32 v = gy-1; v <= gy+1; v++)
-    {
         for(uint32 h = gx-1; h <= gx+1; h++)
-        {
-            logdebug("MAPMGR: Loading tile x %u y %u on map %u",h,v,m);
-            _LoadTile(h,v,m);
-        }
-    }
+            _RequestTile(h,v);
 }
 
-void MapMgr::_LoadTile(uint32 gx, uint32 gy, uint32 m)
+// start loading a tile in the background, if not already loaded or loading
+void MapMgr::_RequestTile(uint32 gx, uint32 gy)
 {
+    if(gx >= 64 || gy >= 64)
+        return;
+    uint32 pos = gy*64 + gx;
+    if(_loading[pos] || _failed[pos] || _tiles->GetTile(pos))
+        return;
 
-    _mapsLoaded = false;
-    std::string mapname = MapID2Name(m);
-    logdebug("Mapname: %s",mapname.c_str());
+    std::string mapname = MapID2Name(_mapid);
     char buf[255];
-    MemoryDataHolder::MakeMapFilename(buf,m,mapname,gx,gy);
+    MemoryDataHolder::MakeMapFilename(buf,_mapid,mapname,gx,gy);
     if(!_tiles->TileExists(gx,gy))
     {
         if(MemoryDataHolder::FileExists(buf))
@@ -113,37 +288,92 @@ void MapMgr::_LoadTile(uint32 gx, uint32 gy, uint32 m)
         }
         else
         {
-            logerror("MAPMGR: Not loading MapTile (%u, %u) map %u, no entry in WDT tile map",gx,gy,m);
+            logdebug("MAPMGR: Not loading MapTile (%u, %u) map %u, no entry in WDT tile map",gx,gy,_mapid);
+            _failed[pos] = true;
             return;
         }
     }
 
-    if( !_tiles->GetTile(gx,gy) )
+    logdebug("MAPMGR: Requesting tile x %u y %u on map %u",gx,gy,_mapid);
+    _loading[pos] = true;
     {
-        MemoryDataHolder::MemoryDataResult mdr = MemoryDataHolder::GetFileBasic(buf);
-        if(mdr.flags & MemoryDataHolder::MDH_FILE_OK && mdr.data.size)
+        ZThread::Guard<ZThread::FastMutex> g(_inbox->mutex);
+        _inbox->refs++;
+    }
+    char hbuf[255];
+    MemoryDataHolder::MakeHeightMapFilename(hbuf,_mapid,gx,gy);
+    MemoryDataHolder::Execute(new MapTileLoader(_inbox, buf, hbuf, _mapid, pos, _gen, _headless));
+}
+
+// move the tiles built by the loader threads into the tile storage
+void MapMgr::_PublishLoadedTiles(void)
+{
+    std::deque<MapTileLoadResult> done;
+    {
+        ZThread::Guard<ZThread::FastMutex> g(_inbox->mutex);
+        if(_inbox->done.empty())
+            return;
+        done.swap(_inbox->done);
+    }
+    for(std::deque<MapTileLoadResult>::iterator it = done.begin(); it != done.end(); it++)
+    {
+        if(it->gen != _gen) // requested before the last Flush()
         {
-            ByteBuffer bb(mdr.data.size);
-            bb.append(mdr.data.ptr,mdr.data.size);
-            MemoryDataHolder::Delete(buf);
-            ADTFile *adt = new ADTFile();
-            if(adt->LoadMem(bb))
-            {
-              logdebug("MAPMGR: Loaded ADT '%s'",buf);
-              MapTile *tile = new MapTile();
-              tile->ImportFromADT(adt);
-              _tiles->SetTile(tile,gx,gy);
-            }
-            else
-            {
-              logerror("MAPMGR: Error loading ADT '%s'",buf);//This should not happen!!
-            }
-            delete adt;
-            logdebug("MAPMGR: Imported MapTile (%u, %u) for map %u",gx,gy,m);
+            delete it->tile;
+            continue;
+        }
+        uint32 gx = it->pos % 64, gy = it->pos / 64;
+        _loading[it->pos] = false;
+        if(!it->tile)
+        {
+            _failed[it->pos] = true;
+            continue;
+        }
+        // already loaded synchronously via GetTile(), or we moved away in the meantime
+        if(_tiles->GetTile(it->pos) || abs(int32(gx) - int32(_gridx)) > MAPMGR_KEEP_RADIUS || abs(int32(gy) - int32(_gridy)) > MAPMGR_KEEP_RADIUS)
+        {
+            delete it->tile;
+            continue;
         }
-        else
         {
-            logerror("MAPMGR: Loading ADT '%s' failed!",buf);
+            ZThread::Guard<ZThread::FastMutex> g(_tilemutex);
+            _tiles->SetTile(it->tile, it->pos);
+        }
+        logdebug("MAPMGR: Imported MapTile (%u, %u) for map %u",gx,gy,_mapid);
+    }
+}
+
+// true if no tile around the current one is still loading
+bool MapMgr::_NearTilesDone(void)
+{
+    for(uint32 v = _gridy-1; v <= _gridy+1; v++)
+        for(uint32 h = _gridx-1; h <= _gridx+1; h++)
+            if(h < 64 && v < 64 && _loading[v*64 + h])
+                return false;
+    return true;
+}
+
+// synchronous loading, only used by GetTile() with forceLoad
+void MapMgr::_LoadTile(uint32 gx, uint32 gy, uint32 m)
+{
+    std::string mapname = MapID2Name(m);
+    char buf[255];
+    MemoryDataHolder::MakeMapFilename(buf,m,mapname,gx,gy);
+    if(!_tiles->TileExists(gx,gy) && !MemoryDataHolder::FileExists(buf))
+    {
+        logerror("MAPMGR: Not loading MapTile (%u, %u) map %u, no entry in WDT tile map",gx,gy,m);
+        return;
+    }
+
+    if( !_tiles->GetTile(gx,gy) )
+    {
+        char hbuf[255];
+        MemoryDataHolder::MakeHeightMapFilename(hbuf,m,gx,gy);
+        if(MapTile *tile = LoadMapTile(buf, hbuf, m, gy*64 + gx, _headless))
+        {
+            ZThread::Guard<ZThread::FastMutex> g(_tilemutex);
+            _tiles->SetTile(tile,gx,gy);
+            logdebug("MAPMGR: Imported MapTile (%u, %u) for map %u",gx,gy,m);
         }
     }
     else
@@ -154,11 +384,12 @@ void MapMgr::_LoadTile(uint32 gx, uint32 gy, uint32 m)
 
 void MapMgr::_UnloadOldTiles(void)
 {
+    ZThread::Guard<ZThread::FastMutex> g(_tilemutex);
     for(int32 gy=0; gy<64; gy++)
     {
         for(int32 gx=0; gx<64; gx++)
         {
-            if( (int32(_gridx) < gx-1 || int32(_gridx) > gx+1) && (int32(_gridy) < gy-1 || int32(_gridy) > gy+1) )
+            if( abs(int32(_gridx) - gx) > MAPMGR_KEEP_RADIUS || abs(int32(_gridy) - gy) > MAPMGR_KEEP_RADIUS )
             {
                 if(_tiles->GetTile(gx,gy))
                 {
@@ -228,6 +459,51 @@ float MapMgr::GetZ(float x, float y)
     return INVALID_HEIGHT;
 }
 
+// consecutive positions on the same tile are passed to the tile in one go
+void MapMgr::GetZ(const float *xs, const float *ys, float *out, uint32 n)
+{
+    uint32 i = 0;
+    while(i < n)
+    {
+        GridCoordPair gcoords = GetTransformGridCoordPair(xs[i],ys[i]);
+        uint32 j = i + 1;
+        while(j < n)
+        {
+            GridCoordPair g = GetTransformGridCoordPair(xs[j],ys[j]);
+            if(g.x != gcoords.x || g.y != gcoords.y)
+                break;
+            j++;
+        }
+        MapTile *tile = gcoords.x < 64 && gcoords.y < 64 ? _tiles->GetTile(gcoords.x,gcoords.y) : NULL;
+        if(tile)
+            tile->GetZ(xs + i, ys + i, out + i, j - i);
+        else
+            for(uint32 k = i; k < j; k++)
+                out[k] = INVALID_HEIGHT;
+        i = j;
+    }
+}
+
+// main thread only, the tiles must not be unloaded during the search
+bool MapMgr::FindPath(float sx, float sy, float ex, float ey, std::vector<NavPoint>& path)
+{
+    uint32 t = getMSTime();
+    int32 snx = NavCoord(sx), sny = NavCoord(sy), enx = NavCoord(ex), eny = NavCoord(ey);
+    if(snx >= 0 && sny >= 0 && enx >= 0 && eny >= 0
+        && (abs(snx / NAVGRID_SIZE - enx / NAVGRID_SIZE) > NAVGRAPH_NEAR_TILES || abs(sny / NAVGRID_SIZE - eny / NAVGRID_SIZE) > NAVGRAPH_NEAR_TILES)
+        && PathCache::FindPath(_mapid, sx, sy, ex, ey, path))
+    {
+        logdebug("MAPMGR: Path (%.1f, %.1f) -> (%.1f, %.1f): found over the navgraph, %u points in %u ms",
+            sx, sy, ex, ey, path.size(), getMSTime() - t);
+        return true;
+    }
+    // without navgraph (no .hmap files) the end may still be on a loaded tile; if not, this fails at once
+    bool found = _pathfinder->FindPath(*_tiles, sx, sy, ex, ey, path);
+    logdebug("MAPMGR: Path (%.1f, %.1f) -> (%.1f, %.1f): %s, %u points, %u cells expanded in %u ms",
+        sx, sy, ex, ey, found ? "found" : "not found", path.size(), _pathfinder->GetExpandedCount(), getMSTime() - t);
+    return found;
+}
+
 std::string MapMgr::GetLoadedTilesString(void)
 {
     std::stringstream s;
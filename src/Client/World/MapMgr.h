@@ -1,11 +1,18 @@
 #ifndef MAPMGR_H
 #define MAPMGR_H
 
+#include <bitset>
 #include "PseuWoW.h"
 #include "SCPDatabase.h"
 
 class MapTileStorage;
 class MapTile;
+class Pathfinder;
+struct NavPoint;
+struct MapTileInbox;
+
+#define MAPMGR_PREFETCH_SECS 15.0f // prefetch the tiles we will be in after this time, if moving
+#define MAPMGR_KEEP_RADIUS 2 // tiles further away from the current tile are unloaded
 
 struct GridCoordPair
 {
@@ -20,9 +27,11 @@ class MapMgr
 public:
     MapMgr(PseuInstance*);
     ~MapMgr();
-    void Update(float,float,uint32);
+    void Update(float x, float y, uint32 m, float vx = 0, float vy = 0); // vx, vy: velocity in yards/sec, used for prefetching
     void Flush(void);
     float GetZ(float,float);
+    void GetZ(const float *xs, const float *ys, float *out, uint32 n); // INVALID_HEIGHT for positions on tiles not loaded
+    bool FindPath(float sx, float sy, float ex, float ey, std::vector<NavPoint>& path); // over the navgraph (see PathCache) if far, else over the loaded tiles
     static uint32 GetGridCoord(float f);
     static GridCoordPair GetTransformGridCoordPair(float x, float y);
     MapTile *GetTile(uint32 xg, uint32 yg, bool forceLoad = false);
@@ -34,17 +43,29 @@ public:
     std::string GetLoadedTilesString(void);
     inline uint32 GetGridX(void) { return _gridx; }
     inline uint32 GetGridY(void) { return _gridy; }
+    inline ZThread::FastMutex& GetTileMutex(void) { return _tilemutex; } // hold while using MapTiles from other threads
 
 private:
     PseuInstance *_instance;
     SCPDatabase* mapdb;
+    SCPFieldHandle _mapnamefield;
     MapTileStorage *_tiles;
+    Pathfinder *_pathfinder;
     void _LoadTile(uint32,uint32,uint32);
-    void _LoadNearTiles(uint32,uint32,uint32);
+    void _RequestTile(uint32,uint32);
+    void _RequestNearTiles(uint32,uint32);
+    void _PublishLoadedTiles(void);
+    bool _NearTilesDone(void);
     void _UnloadOldTiles(void);
     uint32 _mapid;
     uint32 _gridx,_gridy;
     bool _mapsLoaded;
+    ZThread::FastMutex _tilemutex; // guards the tile pointers against other threads (GUI); only the owner thread changes them
+    MapTileInbox *_inbox; // tiles built by the loader threads, waiting to be published
+    std::bitset<4096> _loading; // requested from the loader threads, result not yet published
+    std::bitset<4096> _failed; // not in the WDT or failed to load; not requested again until the map changes
+    uint32 _gen; // increased on Flush(); results of older requests are dropped
+    bool _headless; // no GUI attached, load tiles as compact height maps only
 };
 
 #endif
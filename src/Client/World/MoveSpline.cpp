@@ -0,0 +1,287 @@
+#include "common.h"
+#include "Object.h"
+#include "MoveSpline.h"
+
+#define SPLINE_MIN_SEGMENT 0.001f // shorter segments (e.g. repeated end points) are dropped
+#define SPLINE_COMPACT_MIN 1024 // points of removed splines kept before the arrays are compacted
+
+// uniform catmull-rom between b and c. with a = 2b - c and d = 2c - b it is a straight line.
+static inline float CatmullRom(float a, float b, float c, float d, float u)
+{
+    return b + u * (0.5f * (c - a) + u * ((a - 2.5f * b + 2.0f * c - 0.5f * d) + u * (1.5f * (b - c) + 0.5f * (d - a))));
+}
+
+MoveSplineStore::MoveSplineStore()
+{
+    _deadpoints = 0;
+}
+
+MoveSplineStore::~MoveSplineStore()
+{
+    for(uint32 i = 0; i < _obj.size(); i++)
+        _obj[i]->_splines = NULL;
+}
+
+void MoveSplineStore::Start(WorldObject *o, const WorldPosition *points, uint32 count, uint32 duration, uint32 elapsed, uint8 flags, float facing, uint32 now)
+{
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    if(o->_splines == this)
+        _Remove(o->_splineidx);
+
+    uint32 first = _px.size();
+    float len = 0;
+    for(uint32 k = 0; k < count; k++)
+    {
+        if(k)
+        {
+            float dx = points[k].x - _px.back(), dy = points[k].y - _py.back(), dz = points[k].z - _pz.back();
+            float d = sqrtf(dx * dx + dy * dy + dz * dz);
+            if(d < SPLINE_MIN_SEGMENT)
+                continue;
+            len += d;
+        }
+        _px.push_back(points[k].x);
+        _py.push_back(points[k].y);
+        _pz.push_back(points[k].z);
+        _pt.push_back(len); // converted to time below
+    }
+    uint32 used = _px.size() - first;
+    if(used < 2 || !duration || (elapsed >= duration && !(flags & MOVESPLINE_CYCLIC)))
+    {
+        // nothing to move along; put it where it ends up
+        if(used)
+        {
+            o->_wpos.x = _px.back();
+            o->_wpos.y = _py.back();
+            o->_wpos.z = _pz.back();
+        }
+        if(flags & MOVESPLINE_FACING)
+            o->_wpos.o = facing;
+        if(o->_grid)
+            o->_UpdateGridCell();
+        _px.resize(first);
+        _py.resize(first);
+        _pz.resize(first);
+        _pt.resize(first);
+        return;
+    }
+    for(uint32 k = first; k < first + used; k++)
+        _pt[k] *= duration / len;
+
+    o->_splines = this;
+    o->_splineidx = _obj.size();
+    _obj.push_back(o);
+    _start.push_back(now - elapsed);
+    _duration.push_back(duration);
+    _first.push_back(first);
+    _count.push_back(used);
+    _seg.push_back(0);
+    _evaltime.push_back(now - 1);
+    _facing.push_back(facing);
+    _flags.push_back(flags);
+}
+
+void MoveSplineStore::Stop(WorldObject *o)
+{
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    if(o->_splines == this)
+        _Remove(o->_splineidx);
+}
+
+// find the segment and the position in it for the time now. returns true if the end was reached.
+bool MoveSplineStore::_Locate(uint32 i, uint32 now, uint32& seg, float& u)
+{
+    int32 t = int32(now - _start[i]);
+    if(t < 0)
+        t = 0;
+    bool done = false;
+    if(uint32(t) >= _duration[i])
+    {
+        if(_flags[i] & MOVESPLINE_CYCLIC)
+            t %= _duration[i];
+        else
+            done = true;
+    }
+    const float *pt = &_pt[_first[i]];
+    uint32 last = _count[i] - 2; // last segment
+    if(done)
+    {
+        seg = last;
+        u = 1.0f;
+        return true;
+    }
+    float ft = float(t);
+    seg = _seg[i];
+    if(ft < pt[seg]) // wrapped around
+        seg = 0;
+    while(seg < last && pt[seg + 1] <= ft)
+        seg++;
+    _seg[i] = seg;
+    u = (ft - pt[seg]) / (pt[seg + 1] - pt[seg]);
+    return false;
+}
+
+void MoveSplineStore::_Controls(uint32 i, uint32 seg, float *p)
+{
+    uint32 b = _first[i] + seg, c = b + 1;
+    p[3] = _px[b]; p[4] = _py[b]; p[5] = _pz[b];
+    p[6] = _px[c]; p[7] = _py[c]; p[8] = _pz[c];
+    if(_flags[i] & MOVESPLINE_CATMULLROM)
+    {
+        uint32 a = seg ? b - 1 : b;
+        uint32 d = seg + 2 < _count[i] ? c + 1 : c;
+        p[0] = _px[a]; p[1] = _py[a]; p[2] = _pz[a];
+        p[9] = _px[d]; p[10] = _py[d]; p[11] = _pz[d];
+    }
+    else
+    {
+        for(uint32 k = 0; k < 3; k++)
+        {
+            p[k] = 2.0f * p[3 + k] - p[6 + k];
+            p[9 + k] = 2.0f * p[6 + k] - p[3 + k];
+        }
+    }
+}
+
+// the object faces the direction of the current segment, or the final angle once it arrived
+void MoveSplineStore::_Apply(uint32 i, float x, float y, float z, const float *p, bool done)
+{
+    WorldObject *o = _obj[i];
+    o->_wpos.x = x;
+    o->_wpos.y = y;
+    o->_wpos.z = z;
+    if(done && (_flags[i] & MOVESPLINE_FACING))
+        o->_wpos.o = _facing[i];
+    else if(p[6] != p[3] || p[7] != p[4])
+        o->_wpos.o = atan2f(p[7] - p[4], p[6] - p[3]);
+}
+
+void MoveSplineStore::Evaluate(WorldObject *o, uint32 now)
+{
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    if(o->_splines != this)
+        return;
+    uint32 i = o->_splineidx;
+    if(_evaltime[i] == now)
+        return;
+    uint32 seg;
+    float u, p[12];
+    bool done = _Locate(i, now, seg, u);
+    _Controls(i, seg, p);
+    _Apply(i, CatmullRom(p[0], p[3], p[6], p[9], u), CatmullRom(p[1], p[4], p[7], p[10], u), CatmullRom(p[2], p[5], p[8], p[11], u), p, done);
+    _evaltime[i] = now;
+}
+
+// three passes: find the segments and gather their control points into one array per component,
+// blend all of them in one loop the compiler can vectorize, then write the positions back.
+void MoveSplineStore::Update(uint32 now)
+{
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    uint32 n = _obj.size();
+    if(!n)
+        return;
+    _scratch.resize(n * 16);
+    float *s = &_scratch[0];
+    float *ctl[12];
+    for(uint32 k = 0; k < 12; k++)
+        ctl[k] = s + k * n;
+    float *u = s + 12 * n, *rx = s + 13 * n, *ry = s + 14 * n, *rz = s + 15 * n;
+
+    for(uint32 i = 0; i < n; i++)
+    {
+        uint32 seg;
+        float p[12];
+        if(_Locate(i, now, seg, u[i]))
+            _seg[i] = uint32(-1); // marks it as done for the last pass
+        _Controls(i, seg, p);
+        for(uint32 k = 0; k < 12; k++)
+            ctl[k][i] = p[k];
+    }
+
+    for(uint32 i = 0; i < n; i++)
+    {
+        rx[i] = CatmullRom(ctl[0][i], ctl[3][i], ctl[6][i], ctl[9][i], u[i]);
+        ry[i] = CatmullRom(ctl[1][i], ctl[4][i], ctl[7][i], ctl[10][i], u[i]);
+        rz[i] = CatmullRom(ctl[2][i], ctl[5][i], ctl[8][i], ctl[11][i], u[i]);
+    }
+
+    // backwards, so that removing a spline only moves one that was already handled
+    for(uint32 i = n; i-- > 0; )
+    {
+        float p[12];
+        for(uint32 k = 0; k < 12; k++)
+            p[k] = ctl[k][i];
+        bool done = _seg[i] == uint32(-1);
+        _Apply(i, rx[i], ry[i], rz[i], p, done);
+        _evaltime[i] = now;
+        WorldObject *o = _obj[i];
+        if(done)
+            _Remove(i);
+        if(o->_grid)
+            o->_UpdateGridCell();
+    }
+
+    if(_deadpoints >= SPLINE_COMPACT_MIN && _deadpoints * 2 > _px.size())
+        _Compact();
+}
+
+void MoveSplineStore::_Remove(uint32 i)
+{
+    _obj[i]->_splines = NULL;
+    _deadpoints += _count[i];
+    uint32 last = _obj.size() - 1;
+    if(i != last)
+    {
+        _obj[i] = _obj[last];
+        _obj[i]->_splineidx = i;
+        _start[i] = _start[last];
+        _duration[i] = _duration[last];
+        _first[i] = _first[last];
+        _count[i] = _count[last];
+        _seg[i] = _seg[last];
+        _evaltime[i] = _evaltime[last];
+        _facing[i] = _facing[last];
+        _flags[i] = _flags[last];
+    }
+    _obj.pop_back();
+    _start.pop_back();
+    _duration.pop_back();
+    _first.pop_back();
+    _count.pop_back();
+    _seg.pop_back();
+    _evaltime.pop_back();
+    _facing.pop_back();
+    _flags.pop_back();
+    if(_obj.empty()) // the usual way the point arrays get empty again
+    {
+        _px.clear();
+        _py.clear();
+        _pz.clear();
+        _pt.clear();
+        _deadpoints = 0;
+    }
+}
+
+void MoveSplineStore::_Compact(void)
+{
+    uint32 used = _px.size() - _deadpoints;
+    std::vector<float> px, py, pz, pt;
+    px.reserve(used);
+    py.reserve(used);
+    pz.reserve(used);
+    pt.reserve(used);
+    for(uint32 i = 0; i < _obj.size(); i++)
+    {
+        uint32 from = _first[i], to = from + _count[i];
+        _first[i] = px.size();
+        px.insert(px.end(), _px.begin() + from, _px.begin() + to);
+        py.insert(py.end(), _py.begin() + from, _py.begin() + to);
+        pz.insert(pz.end(), _pz.begin() + from, _pz.begin() + to);
+        pt.insert(pt.end(), _pt.begin() + from, _pt.begin() + to);
+    }
+    _px.swap(px);
+    _py.swap(py);
+    _pz.swap(pz);
+    _pt.swap(pt);
+    _deadpoints = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef _MOVESPLINE_H
+#define _MOVESPLINE_H
+
+#include "common.h"
+#include "World.h"
+
+class WorldObject;
+
+// MoveSplineStore::Start() flags
+#define MOVESPLINE_CATMULLROM 0x01 // smooth curve through the points, else straight lines
+#define MOVESPLINE_CYCLIC     0x02 // starts over when the end is reached
+#define MOVESPLINE_FACING     0x04 // turn to a fixed angle when the end is reached
+
+#define MOVESPLINE_MAX_POINTS 1000 // longer paths in packets are considered broken
+
+// movement splines of the objects the server moves for us (SMSG_MONSTER_MOVE, spline data of object updates).
+// the objects move through the points with constant speed, the time to get from one point to the next
+// is proportional to their distance.
+// all splines are kept in flat arrays, one per field. Update() advances all moving objects to a given time in one pass
+// and moves them in the ObjectGrid; WorldObject::GetPosition() & co. evaluate a single object on demand in between.
+// threadsafe, the GUI thread reads positions of moving objects.
+class MoveSplineStore
+{
+public:
+    MoveSplineStore();
+    ~MoveSplineStore();
+
+    // points: the path, starting at the position the object had when the move started.
+    // elapsed: msecs of the move that already passed at the time now.
+    void Start(WorldObject *o, const WorldPosition *points, uint32 count, uint32 duration, uint32 elapsed, uint8 flags, float facing, uint32 now);
+    void Stop(WorldObject *o); // the object stays where it was last evaluated
+    void Update(uint32 now); // finished splines are removed
+    void Evaluate(WorldObject *o, uint32 now);
+    inline uint32 GetCount(void) { return _obj.size(); }
+
+private:
+    bool _Locate(uint32 i, uint32 now, uint32& seg, float& u);
+    void _Controls(uint32 i, uint32 seg, float *p); // a.x a.y a.z b.x ... d.z
+    void _Apply(uint32 i, float x, float y, float z, const float *p, bool done);
+    void _Remove(uint32 i);
+    void _Compact(void);
+
+    // one entry per moving object
+    std::vector<WorldObject*> _obj;
+    std::vector<uint32> _start; // time the object was at the first point
+    std::vector<uint32> _duration;
+    std::vector<uint32> _first; // index of the first point
+    std::vector<uint32> _count; // amount of points, at least 2
+    std::vector<uint32> _seg; // segment found by the last evaluation, the search starts there
+    std::vector<uint32> _evaltime;
+    std::vector<float> _facing;
+    std::vector<uint8> _flags;
+
+    // points of all splines. _pt: msecs from the start of the spline
+    std::vector<float> _px, _py, _pz, _pt;
+    uint32 _deadpoints; // points of removed splines, until the next _Compact()
+
+    // Update() scratch: control points a..d and segment position u of every moving object, one array per component
+    std::vector<float> _scratch;
+
+    ZThread::FastMutex _mutex;
+};
+
+#endif
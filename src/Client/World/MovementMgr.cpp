@@ -1,6 +1,10 @@
+#include <algorithm>
 #include "PseuWoW.h"
 #include "WorldSession.h"
 #include "World.h"
+#include "MapMgr.h"
+#include "MapTile.h"
+#include "Pathfinder.h"
 #include "MovementMgr.h"
 #include "Player.h"
 #include "MovementInfo.h"
@@ -12,6 +16,7 @@ MovementMgr::MovementMgr()
     _optime = 0;
     _updatetime = 0;
     _moved = false;
+    _pathidx = 0;
 }
 
 MovementMgr::~MovementMgr()
@@ -135,6 +140,9 @@ void MovementMgr::Update(bool sendDirect)
         }
     }*/
 
+    if(!sendDirect && IsFollowingPath())
+        _UpdateFollowPath(timediff);
+
     // if we are moving, and 500ms have passed, send an heartbeat packet. just in case 500ms have passed but the packet is sent by another function, do not send here
     if( !sendDirect && (_moveFlags & MOVEMENTFLAG_ANY_MOVE_NOT_TURNING) && _optime + MOVE_HEARTBEAT_DELAY < getMSTime())
     {
@@ -144,6 +152,7 @@ void MovementMgr::Update(bool sendDirect)
         // the main thread will take care of really loading the maps; here we just tell our updated position
         if(World *world = _instance->GetWSession()->GetWorld())
         {
+            pos = _mychar->GetPosition(); // _UpdateFollowPath() may have moved us
             world->UpdatePos(pos.x, pos.y, world->GetMapId());
         }
     }
@@ -260,11 +269,160 @@ void MovementMgr::MoveJump(void)
     _BuildPacket(MSG_MOVE_JUMP);
 }
 
+bool MovementMgr::MoveTo(float x, float y)
+{
+    World *world = _instance->GetWSession()->GetWorld();
+    MapMgr *mmgr = world ? world->GetMapMgr() : NULL;
+    if(!mmgr)
+    {
+        logerror("MovementMgr: Can't search a path without maps, set UseMaps=1");
+        return false;
+    }
+    WorldPosition pos = _mychar->GetPosition();
+    std::vector<NavPoint> nav;
+    if(!mmgr->FindPath(pos.x, pos.y, x, y, nav))
+    {
+        logerror("MovementMgr: No path from (%.1f, %.1f) to (%.1f, %.1f)",pos.x,pos.y,x,y);
+        return false;
+    }
+    std::vector<WorldPosition> path(nav.size());
+    for(uint32 i = 0; i < nav.size(); i++)
+        path[i] = WorldPosition(nav[i].x, nav[i].y, nav[i].z == INVALID_HEIGHT ? pos.z : nav[i].z);
+    FollowPath(path);
+    return true;
+}
+
+// the first point is where we are; turning to the next one and starting to run is done right now,
+// the rest by Update()
+void MovementMgr::FollowPath(std::vector<WorldPosition>& path)
+{
+    _movemode = MOVEMODE_AUTO;
+    _path = path;
+    _pathidx = 1;
+    if(!IsFollowingPath())
+    {
+        StopFollowPath();
+        return;
+    }
+    WorldPosition pos = _mychar->GetPosition();
+    _FacePathPoint(pos);
+    _mychar->SetPosition(pos);
+    MoveSetFacing();
+    MoveStartForward();
+}
+
+void MovementMgr::StopFollowPath(void)
+{
+    _path.clear();
+    _pathidx = 0;
+    MoveStop();
+}
+
+void MovementMgr::_FacePathPoint(WorldPosition& pos)
+{
+    WorldPosition& to = _path[_pathidx];
+    if(to.x == pos.x && to.y == pos.y)
+        return;
+    pos.o = atan2(to.y - pos.y, to.x - pos.x); // same direction as in GetVelocity()
+    if(pos.o < 0)
+        pos.o += float(2 * M_PI);
+}
+
+// run along the path for the time passed, turning at the points.
+// the height comes from the terrain if its tile is loaded, else from the path points.
+void MovementMgr::_UpdateFollowPath(uint32 timediff)
+{
+    if(_movemode != MOVEMODE_AUTO) // the GUI took over
+    {
+        _path.clear();
+        _pathidx = 0;
+        return;
+    }
+    WorldPosition pos = _mychar->GetPosition();
+    float dist = _mychar->GetSpeed(MOVE_RUN) / 1000.0f * std::min(timediff, uint32(MOVE_PATH_MAX_STEP));
+    bool turned = false;
+    while(IsFollowingPath())
+    {
+        WorldPosition& to = _path[_pathidx];
+        float dx = to.x - pos.x, dy = to.y - pos.y;
+        float left = sqrt(dx*dx + dy*dy);
+        if(left > dist)
+        {
+            pos.x += dx / left * dist;
+            pos.y += dy / left * dist;
+            pos.z += (to.z - pos.z) * dist / left;
+            break;
+        }
+        pos.x = to.x;
+        pos.y = to.y;
+        pos.z = to.z;
+        dist -= left;
+        if(++_pathidx < _path.size())
+        {
+            _FacePathPoint(pos);
+            turned = true;
+        }
+    }
+    World *world = _instance->GetWSession()->GetWorld();
+    if(world && world->GetMapMgr())
+    {
+        float z;
+        world->GetMapMgr()->GetZ(&pos.x, &pos.y, &z, 1);
+        if(z != INVALID_HEIGHT)
+            pos.z = z;
+    }
+    _mychar->SetPosition(pos);
+
+    if(!IsFollowingPath())
+    {
+        logdebug("MovementMgr: Reached end of path at (%.1f, %.1f, %.1f)",pos.x,pos.y,pos.z);
+        StopFollowPath();
+    }
+    else if(turned)
+        MoveSetFacing();
+}
+
 bool MovementMgr::IsMoving(void)
 {
     return _moveFlags & MOVEMENTFLAG_ANY_MOVE;
 }
 
+// current velocity of MyCharacter in yards/sec; (0, 0) if not moving
+void MovementMgr::GetVelocity(float& vx, float& vy)
+{
+    vx = vy = 0;
+    if(!_mychar || !(_moveFlags & MOVEMENTFLAG_ANY_MOVE_NOT_TURNING))
+        return;
+    float o = _mychar->GetO();
+    float dx = 0, dy = 0;
+    if(_moveFlags & MOVEMENTFLAG_FORWARD)
+    {
+        dx += cos(o);
+        dy += sin(o);
+    }
+    if(_moveFlags & MOVEMENTFLAG_BACKWARD)
+    {
+        dx -= cos(o);
+        dy -= sin(o);
+    }
+    if(_moveFlags & MOVEMENTFLAG_STRAFE_LEFT)
+    {
+        dx += cos(o + float(M_PI/2));
+        dy += sin(o + float(M_PI/2));
+    }
+    if(_moveFlags & MOVEMENTFLAG_STRAFE_RIGHT)
+    {
+        dx += cos(o - float(M_PI/2));
+        dy += sin(o - float(M_PI/2));
+    }
+    float len = sqrt(dx*dx + dy*dy);
+    if(len < 0.001f) // forward + backward
+        return;
+    float speed = _mychar->GetSpeed((_moveFlags & MOVEMENTFLAG_BACKWARD) ? MOVE_WALKBACK : MOVE_RUN);
+    vx = dx / len * speed;
+    vy = dy / len * speed;
+}
+
 bool MovementMgr::IsTurning(void)
 {
     return _moveFlags & (MOVEMENTFLAG_TURN_LEFT | MOVEMENTFLAG_TURN_RIGHT);
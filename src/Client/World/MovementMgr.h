@@ -6,6 +6,7 @@
 
 #define MOVE_HEARTBEAT_DELAY 500
 #define MOVE_TURN_UPDATE_DIFF 0.15f // not sure about original/real value, but this seems good
+#define MOVE_PATH_MAX_STEP 250 // msecs; longer update gaps don't move us further along a path, like the client does on lags
 
 // --
 // -- MovementFlags and MovementInfo can be found in UpdateData.h
@@ -55,14 +56,22 @@ public:
     inline bool HasMoveFlag(uint32 flag) { return _moveFlags & flag; }
     bool IsMoved(void) { bool m = _moved; _moved = false; return m; } // true if the character moved since last call
     bool IsMoving(void); // any move?
+    void GetVelocity(float& vx, float& vy); // in yards/sec
     bool IsTurning(void); // spinning around?
     bool IsWalking(void); // walking straight forward/backward?
     bool IsStrafing(void); // strafing left/right?
     inline void SetFallTime(uint32 falltime){_falltime = falltime; }
+    bool MoveTo(float x, float y); // search a path (see MapMgr::FindPath()) and follow it. false if there is none
+    void FollowPath(std::vector<WorldPosition>& path); // run through the points, starting at the current position
+    void StopFollowPath(void); // stops moving, too
+    inline bool IsFollowingPath(void) { return _pathidx < _path.size(); }
+    inline uint32 GetPathSize(void) { return _path.size(); }
 
 
 private:
     void _BuildPacket(uint16);
+    void _UpdateFollowPath(uint32 timediff);
+    void _FacePathPoint(WorldPosition& pos);
     PseuInstance *_instance;
     MyCharacter *_mychar;
     uint32 _moveFlags; // server relevant flags (move forward/backward/swim/fly/jump/etc)
@@ -74,6 +83,8 @@ private:
     uint32 _falltime;
     UnitMoveType _movetype; // index used for speed selection
     bool _moved;
+    std::vector<WorldPosition> _path; // auto move mode: points to go through
+    uint32 _pathidx; // point we are going to next
 
 
 };
@@ -4,8 +4,31 @@
 #include "ObjMgr.h"
 #include "GUI/PseuGUI.h"
 
+#define OBJ_HASH_INITIAL_SIZE 256 // must be a power of 2
+
+// 64 bit finalizer mix, spreads sequential low-guids and the high-guid bits over the whole table
+static inline uint32 HashGUID(uint64 guid)
+{
+    guid ^= guid >> 33;
+    guid *= 0xFF51AFD7ED558CCDULL;
+    guid ^= guid >> 33;
+    guid *= 0xC4CEB9FE1A85EC53ULL;
+    guid ^= guid >> 33;
+    return (uint32)guid;
+}
+
+static inline uint64 MakeEntryKey(uint32 entry, uint8 tyid)
+{
+    return (uint64(tyid) << 32) | entry;
+}
+
 ObjMgr::ObjMgr()
 {
+    _instance = NULL;
+    _objcount = 0;
+    _mapid = 0;
+    _slots.resize(OBJ_HASH_INITIAL_SIZE);
+    memset(&_slots[0], 0, _slots.size() * sizeof(ObjectSlot));
     DEBUG(logdebug("DEBUG: ObjMgr created"));
 }
 
@@ -34,10 +57,18 @@ void ObjMgr::RemoveAll(void)
     {
         delete i->second;
     }
-    while(_obj.size())
+    for(uint32 i = 0; i < _slots.size() && _objcount; )
+    {
+        if(_slots[i].guid)
+            Remove(_slots[i].guid, true); // backshifting may move another object into this slot, so check it again
+        else
+            i++;
+    }
+    while(_depleted.size())
     {
-        Remove(_obj.begin()->first, true);
+        Remove(_depleted.begin()->first, true);
     }
+    _rangetrackers.clear();
     if(PseuGUI *gui = _instance->GetGUI())
     {
         // necessary that the pending-to-delete GUIDs just stored by deleting the objects above will be cleared
@@ -51,6 +82,16 @@ void ObjMgr::Remove(uint64 guid, bool del)
     Object *o = GetObj(guid, true); // here get also depleted objs and delete if necessary
     if(o)
     {
+        if(ObjectSlot *slot = _FindSlot(guid))
+        {
+            _Unlink(slot);
+            if(!del)
+                _depleted[guid] = o; // move into the depleted bucket
+        }
+        else if(del)
+        {
+            _depleted.erase(guid);
+        }
         o->_SetDepleted();
         if(!del)
             logdebug("ObjMgr: "I64FMT" '%s' -> depleted.",guid,o->GetName().c_str());
@@ -59,14 +100,11 @@ void ObjMgr::Remove(uint64 guid, bool del)
             gui->NotifyObjectDeletion(guid); // we have a gui, which must delete linked DrawObject
         if(del)
         {
-            _obj.erase(guid); // now delete the obj from the mgr
             delete o; // and delete the obj itself
         }
     }
     else
     {
-        _obj.erase(guid); // we can safely erase an object that does not exist
-                          // - if we reach this point there was a bug anyway
         logcustom(2,LRED,"ObjMgr::Remove("I64FMT") - not existing",guid);
     }
 }
@@ -75,10 +113,18 @@ void ObjMgr::Remove(uint64 guid, bool del)
 
 void ObjMgr::Add(Object *o)
 {
-    Object *ox = GetObj(o->GetGUID(),true); // if an object already exists in the mgr, store old ptr...
+    uint64 guid = o->GetGUID();
+    Object *ox = GetObj(guid,true); // if an object already exists in the mgr, store old ptr...
     if(o == ox)
         return; // if both pointers are the same, do nothing (already added and happy)
-    _obj[o->GetGUID()] = o; // ...assign new one...
+    if(ox) // ...unlink it from wherever it is stored...
+    {
+        if(ObjectSlot *slot = _FindSlot(guid))
+            _Unlink(slot);
+        else
+            _depleted.erase(guid);
+    }
+    _Link(o); // ...assign new one...
     if(ox) // and if != NULL, delete the old object (completely, from memory)
     {
         delete ox; // only delete pointer, everything else is already reserved for the just added new obj
@@ -92,29 +138,42 @@ Object *ObjMgr::GetObj(uint64 guid, bool also_depleted)
 {
     if(!guid)
         return NULL;
-    for(ObjectMap::iterator i = _obj.begin(); i!=_obj.end(); i++)
-        if(i->second->GetGUID() == guid)
-        {
-            if(i->second->_IsDepleted() && !also_depleted)
-                return NULL;
-            return i->second;
-        }
+    if(ObjectSlot *slot = _FindSlot(guid))
+        return slot->obj;
+    if(also_depleted && _depleted.size())
+    {
+        ObjectMap::iterator it = _depleted.find(guid);
+        if(it != _depleted.end())
+            return it->second;
+    }
     return NULL;
 }
 
-// iterate over all objects and assign a name to all matching the entry and typeid
+// assign a name to all objects matching the entry and typeid
 uint32 ObjMgr::AssignNameToObj(uint32 entry, uint8 type, std::string name)
 {
-    uint32 changed = 0;
-    for(ObjectMap::iterator it = _obj.begin(); it != _obj.end(); it++)
-    {
-        if(it->second->GetEntry() == entry && (it->second->GetTypeId() == type))
-        {
-            it->second->SetName(name);
-            changed++;
-        }
-    }
-    return changed;
+    ObjectSet *objs = GetObjectsByEntry(entry, type);
+    if(!objs)
+        return 0;
+    for(ObjectSet::iterator it = objs->begin(); it != objs->end(); it++)
+        (*it)->SetName(name);
+    return objs->size();
+}
+
+ObjectSet *ObjMgr::GetObjectsByEntry(uint32 entry, uint8 tyid)
+{
+    ObjectEntryIndex::iterator it = _byentry.find(MakeEntryKey(entry, tyid));
+    return it != _byentry.end() ? &it->second : NULL;
+}
+
+void ObjMgr::UpdateEntryIndex(Object *o)
+{
+    ObjectSlot *slot = _FindSlot(o->GetGUID());
+    if(!slot || slot->obj != o || slot->entry == o->GetEntry())
+        return;
+    _UnindexEntry(o, slot->entry);
+    slot->entry = o->GetEntry();
+    _IndexEntry(o, slot->entry);
 }
 
 void ObjMgr::ReNotifyGUI(void)
@@ -122,13 +181,110 @@ void ObjMgr::ReNotifyGUI(void)
     PseuGUI *gui = _instance->GetGUI();
     if(!gui)
         return;
-    for(ObjectMap::iterator it = _obj.begin(); it != _obj.end(); it++)
+    for(uint32 i = 0; i < _slots.size(); i++)
+        if(_slots[i].guid)
+            gui->NotifyObjectCreation(_slots[i].obj);
+}
+
+// -- GUID hash part --
+
+ObjectSlot *ObjMgr::_FindSlot(uint64 guid)
+{
+    uint32 mask = _slots.size() - 1;
+    for(uint32 i = HashGUID(guid) & mask; _slots[i].guid; i = (i + 1) & mask)
+        if(_slots[i].guid == guid)
+            return &_slots[i];
+    return NULL;
+}
+
+void ObjMgr::_Link(Object *o)
+{
+    if((_objcount + 1) * 4 > _slots.size() * 3) // keep load factor below 0.75
+        _GrowTable();
+
+    uint64 guid = o->GetGUID();
+    uint32 mask = _slots.size() - 1;
+    uint32 i = HashGUID(guid) & mask;
+    while(_slots[i].guid)
+        i = (i + 1) & mask;
+    _slots[i].guid = guid;
+    _slots[i].obj = o;
+    _slots[i].entry = o->GetEntry();
+    _objcount++;
+
+    _bytype[_TypeSet(o->GetTypeId())].insert(o);
+    _IndexEntry(o, _slots[i].entry);
+    if(o->IsWorldObject())
+    {
+        ((WorldObject*)o)->SetMapId(_mapid);
+        _grid.Add((WorldObject*)o);
+    }
+}
+
+// removes the object from the hash and all secondary indexes. does not delete it.
+void ObjMgr::_Unlink(ObjectSlot *slot)
+{
+    Object *o = slot->obj;
+    _bytype[_TypeSet(o->GetTypeId())].erase(o);
+    _UnindexEntry(o, slot->entry);
+    if(o->IsWorldObject())
+    {
+        _splines.Stop((WorldObject*)o); // depleted objects stay where they are
+        _grid.Remove((WorldObject*)o);
+    }
+
+    // backward shift deletion; keeps probe chains intact without tombstones
+    uint32 mask = _slots.size() - 1;
+    uint32 hole = slot - &_slots[0];
+    for(uint32 i = (hole + 1) & mask; _slots[i].guid; i = (i + 1) & mask)
     {
-        Object *o = it->second;
-        if(o->_IsDepleted())
+        uint32 home = HashGUID(_slots[i].guid) & mask;
+        // move the entry into the hole if its home position is not within (hole, i]
+        if(((i - home) & mask) >= ((i - hole) & mask))
+        {
+            _slots[hole] = _slots[i];
+            hole = i;
+        }
+    }
+    memset(&_slots[hole], 0, sizeof(ObjectSlot));
+    _objcount--;
+}
+
+void ObjMgr::_GrowTable(void)
+{
+    std::vector<ObjectSlot> old;
+    old.swap(_slots);
+    _slots.resize(old.size() * 2);
+    memset(&_slots[0], 0, _slots.size() * sizeof(ObjectSlot));
+    uint32 mask = _slots.size() - 1;
+    for(uint32 j = 0; j < old.size(); j++)
+    {
+        if(!old[j].guid)
             continue;
-        gui->NotifyObjectCreation(o);
+        uint32 i = HashGUID(old[j].guid) & mask;
+        while(_slots[i].guid)
+            i = (i + 1) & mask;
+        _slots[i] = old[j];
     }
+    DEBUG(logdebug("ObjMgr: GUID hash resized to %u slots (%u objects)",_slots.size(),_objcount));
+}
+
+void ObjMgr::_IndexEntry(Object *o, uint32 entry)
+{
+    if(entry)
+        _byentry[MakeEntryKey(entry, o->GetTypeId())].insert(o);
+}
+
+void ObjMgr::_UnindexEntry(Object *o, uint32 entry)
+{
+    if(!entry)
+        return;
+    ObjectEntryIndex::iterator it = _byentry.find(MakeEntryKey(entry, o->GetTypeId()));
+    if(it == _byentry.end())
+        return;
+    it->second.erase(o);
+    if(it->second.empty())
+        _byentry.erase(it);
 }
 
 
@@ -6,11 +6,24 @@
 #include "Item.h"
 #include "Unit.h"
 #include "GameObject.h"
+#include "ObjectGrid.h"
+#include "MoveSpline.h"
 
 typedef std::map<uint32,ItemProto*> ItemProtoMap;
 typedef std::map<uint32,CreatureTemplate*> CreatureTemplateMap;
 typedef std::map<uint32,GameobjectTemplate*> GOTemplateMap;
 typedef std::map<uint64,Object*> ObjectMap;
+typedef std::set<Object*> ObjectSet;
+typedef std::map<uint64,ObjectSet> ObjectEntryIndex; // key: (typeid << 32) | entry
+typedef std::map<std::string,ObjectRangeTracker> ObjectRangeTrackerMap;
+
+// one slot of the open-addressing GUID hash. guid 0 marks an empty slot.
+struct ObjectSlot
+{
+    uint64 guid;
+    Object *obj;
+    uint32 entry; // entry the object is currently indexed under
+};
 
 class PseuInstance;
 
@@ -63,16 +76,49 @@ public:
     void Add(Object*);
     void Remove(uint64 guid, bool del); // remove all objects with that guid (should be only 1 object in total anyway)
     Object *GetObj(uint64 guid, bool also_depleted = false);
-    inline uint32 GetObjectCount(void) { return _obj.size(); }
+    inline uint32 GetObjectCount(void) { return _objcount + _depleted.size(); }
+    inline uint32 GetActiveObjectCount(void) { return _objcount; }
+    inline uint32 GetDepletedObjectCount(void) { return _depleted.size(); }
     uint32 AssignNameToObj(uint32 entry, uint8 type, std::string name);
     void ReNotifyGUI(void);
+    void UpdateEntryIndex(Object*); // must be called after OBJECT_FIELD_ENTRY of an active object changed
+
+    // secondary indexes, only active (not depleted) objects are contained
+    inline ObjectSet& GetObjectsByTypeId(uint8 tyid) { return _bytype[_TypeSet(tyid)]; }
+    ObjectSet *GetObjectsByEntry(uint32 entry, uint8 tyid);
+    inline ObjectGrid& GetGrid(void) { return _grid; }
+    inline MoveSplineStore& GetSplines(void) { return _splines; }
+
+    // map newly added world objects are put on. the server only sends objects of the map we are on.
+    inline void SetMapId(uint32 mapid) { _mapid = mapid; }
+    inline uint32 GetMapId(void) { return _mapid; }
+
+    // named range trackers for scripts, created on first use
+    inline ObjectRangeTracker& GetRangeTracker(const std::string& name) { return _rangetrackers[name]; }
 
 private:
     ItemProtoMap _iproto;
     CreatureTemplateMap _creature_templ;
     GOTemplateMap _go_templ;
 
-    ObjectMap _obj;
+    // GUID hash (linear probing, power-of-2 sized) holding all active objects
+    ObjectSlot *_FindSlot(uint64 guid);
+    void _Link(Object*);
+    void _Unlink(ObjectSlot*);
+    void _GrowTable(void);
+    void _IndexEntry(Object*, uint32 entry);
+    void _UnindexEntry(Object*, uint32 entry);
+    static inline uint8 _TypeSet(uint8 tyid) { return tyid < TYPEID_MAX ? tyid : uint8(TYPEID_OBJECT); } // _bytype index
+
+    std::vector<ObjectSlot> _slots;
+    uint32 _objcount;
+    ObjectSet _bytype[TYPEID_MAX];
+    ObjectEntryIndex _byentry;
+    ObjectGrid _grid;
+    MoveSplineStore _splines;
+    uint32 _mapid;
+    ObjectRangeTrackerMap _rangetrackers;
+    ObjectMap _depleted; // objects removed from the world, but not yet deleted from memory
     std::set<uint32> _noitem;
     std::set<uint32> _reqpnames;
     std::set<uint32> _nocreature;
@@ -2,11 +2,15 @@
 #include "WorldSession.h"
 
 #include "Object.h"
+#include "ObjectGrid.h"
+#include "MoveSpline.h"
 
 Object::Object()
 {
     _depleted = false;
+    _haschanges = false;
     _uint32values=NULL;
+    _changed=NULL;
     _type=TYPE_OBJECT;
     _typeid=TYPEID_OBJECT;
     _valuescount=Object::maxvalues[_typeid]; // base class. this value will be set by derived classes
@@ -22,8 +26,18 @@ Object::~Object()
 
 void Object::_InitValues()
 {
-    _uint32values = new uint32[ _valuescount ];
-    memset(_uint32values, 0, _valuescount*sizeof(uint32));
+    uint32 words = (_valuescount + 31) >> 5;
+    _uint32values = new uint32[ _valuescount + words ];
+    memset(_uint32values, 0, (_valuescount + words)*sizeof(uint32));
+    _changed = _uint32values + _valuescount;
+}
+
+void Object::ClearChangedFields(void)
+{
+    if(!_haschanges)
+        return;
+    memset(_changed, 0, ((_valuescount + 31) >> 5)*sizeof(uint32));
+    _haschanges = false;
 }
 
 void Object::Create( uint64 guid )
@@ -41,20 +55,64 @@ WorldObject::WorldObject()
 {
     _depleted = false;
     _m = 0;
+    _grid = NULL;
+    _gridcell = 0;
+    _gridindex = 0;
+    _splines = NULL;
+    _splineidx = 0;
+}
+
+WorldObject::~WorldObject()
+{
+    // should have been removed by the ObjMgr already
+    if(_splines)
+        _splines->Stop(this);
+    if(_grid)
+        _grid->Remove(this);
 }
 
+// a position set from outside ends the current spline movement
 void WorldObject::SetPosition(float x, float y, float z, float o)
 {
+    if(_splines)
+        _StopSpline();
     _wpos.x = x;
     _wpos.y = y;
     _wpos.z = z;
     _wpos.o = o;
+    if(_grid)
+        _UpdateGridCell();
 }
 
 void WorldObject::SetPosition(float x, float y, float z, float o, uint16 _map)
 {
-    SetPosition(x,y,z,o);
     _m = _map;
+    SetPosition(x,y,z,o);
+}
+
+void WorldObject::SetMapId(uint16 mapid)
+{
+    _m = mapid;
+    if(_grid)
+        _UpdateGridCell();
+}
+
+void WorldObject::_UpdateGridCell(void)
+{
+    if(ObjectGrid *grid = _grid) // may be cleared by another thread meanwhile
+        grid->Move(this);
+}
+
+void WorldObject::_EvalSpline(void)
+{
+    if(MoveSplineStore *s = _splines) // same here
+        s->Evaluate(this, getMonotonicMSTime());
+}
+
+void WorldObject::_StopSpline(void)
+{
+    if(MoveSplineStore *s = _splines)
+        s->Stop(this);
 }
 
 float WorldObject::GetDistance(WorldObject* obj)
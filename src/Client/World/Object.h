@@ -100,6 +100,22 @@ public:
     {
         *((uint64*)&(_uint32values[ Object::updatefields[index].offset ])) = value;
     }
+    // sets a field from an update packet and marks it as changed, if the value is different. returns true if it was.
+    inline bool UpdateUInt32Value( uint16 offset, uint32 value )
+    {
+        if(_uint32values[ offset ] == value)
+            return false;
+        _uint32values[ offset ] = value;
+        _changed[ offset >> 5 ] |= 1u << (offset & 31);
+        _haschanges = true;
+        return true;
+    }
+
+    // fields changed by update packets since the last ClearChangedFields(), one bit per field offset
+    inline bool IsFieldChanged(uint16 offset) const { return offset < _valuescount && (_changed[offset >> 5] & (1u << (offset & 31))); }
+    inline bool HasChangedFields(void) const { return _haschanges; }
+    inline const uint32 *GetChangedMask(void) const { return _changed; } // (GetValuesCount() + 31) / 32 words
+    void ClearChangedFields(void);
 
     inline void SetName(std::string name) { _name = name; }
     inline std::string GetName(void) { return _name; }
@@ -126,28 +142,39 @@ protected:
         uint32 *_uint32values;
         float *_floatvalues;
     };
+    uint32 *_changed; // changed fields bitmask, allocated behind the values
     uint8 _type;
     uint8 _typeid;
     std::string _name;
     bool _depleted : 1; // true if the object was deleted from the objmgr, but not from memory
+    bool _haschanges : 1; // a bit in _changed is set
 
 };
 
 
+class ObjectGrid;
+class MoveSplineStore;
+
 class WorldObject : public Object
 {
+    friend class ObjectGrid;
+    friend class MoveSplineStore;
 public:
-    virtual ~WorldObject ( ) {}
+    virtual ~WorldObject ( );
     void SetPosition(float x, float y, float z, float o, uint16 _map);
     void SetPosition(float x, float y, float z, float o);
-    inline void SetPosition(WorldPosition& wp) { _wpos = wp; }
-    inline void SetPosition(WorldPosition& wp, uint16 mapid) { SetPosition(wp); _m = mapid; }
-    inline WorldPosition GetPosition(void) {return _wpos; }
-    inline WorldPosition *GetPositionPtr(void) {return &_wpos; }
-    inline float GetX(void) { return _wpos.x; }
-    inline float GetY(void) { return _wpos.y; }
-    inline float GetZ(void) { return _wpos.z; }
-    inline float GetO(void) { return _wpos.o; }
+    inline void SetPosition(WorldPosition& wp) { if(_splines) _StopSpline(); _wpos = wp; if(_grid) _UpdateGridCell(); }
+    inline void SetPosition(WorldPosition& wp, uint16 mapid) { _m = mapid; SetPosition(wp); }
+    // the position of an object moving along a spline is evaluated when it is requested
+    inline WorldPosition GetPosition(void) { _UpdateMovePos(); return _wpos; }
+    inline WorldPosition *GetPositionPtr(void) { _UpdateMovePos(); return &_wpos; } // only for changes that do not move the object, e.g. orientation
+    inline uint16 GetMapId(void) { return _m; }
+    void SetMapId(uint16 mapid);
+    inline float GetX(void) { _UpdateMovePos(); return _wpos.x; }
+    inline float GetY(void) { _UpdateMovePos(); return _wpos.y; }
+    inline float GetZ(void) { _UpdateMovePos(); return _wpos.z; }
+    inline float GetO(void) { _UpdateMovePos(); return _wpos.o; }
+    inline bool IsMoving(void) { return _splines != NULL; } // true if moving along a spline
     float GetDistance(WorldObject *obj);
     float GetDistance2d(float x, float y);
     float GetDistance(float x, float y, float z);
@@ -156,9 +183,23 @@ public:
 
 protected:
     WorldObject();
+    void _UpdateGridCell(void);
+    inline void _UpdateMovePos(void) { if(_splines) _EvalSpline(); }
+    void _EvalSpline(void);
+    void _StopSpline(void);
+
     WorldPosition _wpos; // coords, orientation
     uint16 _m; // map
 
+    // set by the ObjectGrid while the object is active
+    ObjectGrid *_grid;
+    uint64 _gridcell;
+    uint32 _gridindex; // index in the cell's object list
+
+    // set by the MoveSplineStore while the object moves along a spline
+    MoveSplineStore *_splines;
+    uint32 _splineidx;
+
 };
 
 inline uint32 GetValuesCountByTypeId(uint8 tid)
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include "common.h"
+#include "ObjectGrid.h"
+
+static inline int32 CellCoord(float f)
+{
+    float c = floorf(f * (1.0f / OBJECTGRID_CELL_SIZE));
+    if(!(c > -OBJECTGRID_MAX_CELL)) // also catches NaN
+        return -OBJECTGRID_MAX_CELL;
+    if(c > OBJECTGRID_MAX_CELL)
+        return OBJECTGRID_MAX_CELL;
+    return int32(c);
+}
+
+static inline uint64 MakeCellKey(uint32 map, int32 cx, int32 cy)
+{
+    return (uint64(map) << 40) | (uint64(uint32(cx + OBJECTGRID_MAX_CELL)) << 20) | uint64(uint32(cy + OBJECTGRID_MAX_CELL));
+}
+
+uint64 ObjectGrid::_CellKey(WorldObject *o)
+{
+    return MakeCellKey(o->GetMapId(), CellCoord(o->_wpos.x), CellCoord(o->_wpos.y));
+}
+
+static inline bool MatchesFilter(WorldObject *o, uint8 tyid, uint32 entry, WorldObject *except)
+{
+    return o != except && (tyid >= TYPEID_MAX || o->GetTypeId() == tyid) && (!entry || o->GetEntry() == entry);
+}
+
+// ordered by distance, for the heap of the nearest search
+struct GridCandidate
+{
+    float dist2;
+    WorldObject *obj;
+    inline bool operator<(const GridCandidate& c) const { return dist2 < c.dist2; }
+};
+
+ObjectGrid::ObjectGrid()
+{
+}
+
+ObjectGrid::~ObjectGrid()
+{
+    for(CellMap::iterator it = _cells.begin(); it != _cells.end(); it++)
+        for(uint32 i = 0; i < it->second.size(); i++)
+            it->second[i]->_grid = NULL;
+}
+
+void ObjectGrid::Add(WorldObject *o)
+{
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    if(o->_grid == this)
+        return;
+    o->_grid = this;
+    _Link(o, _CellKey(o));
+}
+
+void ObjectGrid::Remove(WorldObject *o)
+{
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    if(o->_grid != this)
+        return;
+    _Unlink(o);
+    o->_grid = NULL;
+}
+
+void ObjectGrid::Move(WorldObject *o)
+{
+    uint64 key = _CellKey(o);
+    if(key == o->_gridcell) // the usual case, the object moved within its cell
+        return;
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    if(o->_grid != this || key == o->_gridcell)
+        return;
+    _Unlink(o);
+    _Link(o, key);
+}
+
+void ObjectGrid::_Link(WorldObject *o, uint64 key)
+{
+    WorldObjectList& cell = _cells[key];
+    o->_gridcell = key;
+    o->_gridindex = cell.size();
+    cell.push_back(o);
+
+    uint32 map = uint32(key >> 40);
+    int32 cx = int32((key >> 20) & 0xFFFFF) - OBJECTGRID_MAX_CELL;
+    int32 cy = int32(key & 0xFFFFF) - OBJECTGRID_MAX_CELL;
+    MapInfoMap::iterator it = _maps.find(map);
+    if(it == _maps.end())
+    {
+        MapInfo& mi = _maps[map];
+        mi.minx = mi.maxx = cx;
+        mi.miny = mi.maxy = cy;
+        mi.count = 1;
+        return;
+    }
+    MapInfo& mi = it->second;
+    mi.minx = std::min(mi.minx, cx);
+    mi.maxx = std::max(mi.maxx, cx);
+    mi.miny = std::min(mi.miny, cy);
+    mi.maxy = std::max(mi.maxy, cy);
+    mi.count++;
+}
+
+// the occupied area of the map is not shrunk, it only limits how far a nearest search may go
+void ObjectGrid::_Unlink(WorldObject *o)
+{
+    CellMap::iterator it = _cells.find(o->_gridcell);
+    ASSERT(it != _cells.end());
+    WorldObjectList& cell = it->second;
+    WorldObject *last = cell.back();
+    cell[o->_gridindex] = last;
+    last->_gridindex = o->_gridindex;
+    cell.pop_back();
+    _maps[uint32(o->_gridcell >> 40)].count--;
+}
+
+uint32 ObjectGrid::GetObjectsInRange(uint32 map, float x, float y, float radius, WorldObjectList& out, uint8 tyid /* = TYPEID_MAX */,
+                                     uint32 entry /* = 0 */, WorldObject *except /* = NULL */)
+{
+    uint32 found = 0;
+    float r2 = radius * radius;
+    int32 x1 = CellCoord(x - radius), x2 = CellCoord(x + radius);
+    int32 y1 = CellCoord(y - radius), y2 = CellCoord(y + radius);
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    for(int32 cx = x1; cx <= x2; cx++)
+    {
+        for(int32 cy = y1; cy <= y2; cy++)
+        {
+            CellMap::iterator it = _cells.find(MakeCellKey(map, cx, cy));
+            if(it == _cells.end())
+                continue;
+            WorldObjectList& cell = it->second;
+            for(uint32 i = 0; i < cell.size(); i++)
+            {
+                WorldObject *o = cell[i];
+                float dx = o->_wpos.x - x, dy = o->_wpos.y - y;
+                if(dx * dx + dy * dy <= r2 && MatchesFilter(o, tyid, entry, except))
+                {
+                    out.push_back(o);
+                    found++;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+// searches the cells in rings around the center cell. every object in ring r is at least as far away
+// as the border of the square of rings 0..r-1, so the search can stop once the k-th nearest object found
+// so far is closer than that, or all objects of the map were looked at.
+uint32 ObjectGrid::GetNearestObjects(uint32 map, float x, float y, uint32 count, float maxradius, WorldObjectList& out,
+                                     uint8 tyid /* = TYPEID_MAX */, uint32 entry /* = 0 */, WorldObject *except /* = NULL */)
+{
+    if(!count)
+        return 0;
+    std::vector<GridCandidate> best; // max-heap of the nearest objects so far
+    float max2 = maxradius > 0 ? maxradius * maxradius : -1;
+    int32 cx = CellCoord(x), cy = CellCoord(y);
+    ZThread::Guard<ZThread::FastMutex> g(_mutex);
+    MapInfoMap::iterator mit = _maps.find(map);
+    if(mit == _maps.end())
+        return 0;
+    const MapInfo& mi = mit->second;
+    int32 maxring = std::max(std::max(cx - mi.minx, mi.maxx - cx), std::max(cy - mi.miny, mi.maxy - cy));
+    uint32 seen = 0;
+    for(int32 r = 0; r <= maxring && seen < mi.count; r++)
+    {
+        if(r)
+        {
+            float lo = std::min(std::min(x - (cx - r + 1) * OBJECTGRID_CELL_SIZE, (cx + r) * OBJECTGRID_CELL_SIZE - x),
+                                std::min(y - (cy - r + 1) * OBJECTGRID_CELL_SIZE, (cy + r) * OBJECTGRID_CELL_SIZE - y));
+            float lo2 = lo * lo;
+            if(max2 >= 0 && lo2 > max2)
+                break;
+            if(best.size() == count && lo2 >= best.front().dist2)
+                break;
+        }
+        int32 rx1 = std::max(cx - r, mi.minx), rx2 = std::min(cx + r, mi.maxx);
+        int32 ry1 = std::max(cy - r, mi.miny), ry2 = std::min(cy + r, mi.maxy);
+        for(int32 ix = rx1; ix <= rx2; ix++)
+        {
+            // only the cells on the border of the ring: whole first and last column, top and bottom cell of the others
+            bool edge = ix == cx - r || ix == cx + r;
+            for(int32 iy = ry1; iy <= ry2; iy++)
+            {
+                if(!edge && iy != cy - r && iy != cy + r)
+                {
+                    if(iy < cy + r)
+                        iy = cy + r - 1; // skip the inner rings
+                    continue;
+                }
+                CellMap::iterator it = _cells.find(MakeCellKey(map, ix, iy));
+                if(it == _cells.end())
+                    continue;
+                WorldObjectList& cell = it->second;
+                seen += cell.size();
+                for(uint32 i = 0; i < cell.size(); i++)
+                {
+                    WorldObject *o = cell[i];
+                    if(!MatchesFilter(o, tyid, entry, except))
+                        continue;
+                    GridCandidate c;
+                    float dx = o->_wpos.x - x, dy = o->_wpos.y - y;
+                    c.dist2 = dx * dx + dy * dy;
+                    c.obj = o;
+                    if(max2 >= 0 && c.dist2 > max2)
+                        continue;
+                    if(best.size() < count)
+                    {
+                        best.push_back(c);
+                        std::push_heap(best.begin(), best.end());
+                    }
+                    else if(c.dist2 < best.front().dist2)
+                    {
+                        std::pop_heap(best.begin(), best.end());
+                        best.back() = c;
+                        std::push_heap(best.begin(), best.end());
+                    }
+                }
+            }
+        }
+    }
+    std::sort_heap(best.begin(), best.end());
+    for(uint32 i = 0; i < best.size(); i++)
+        out.push_back(best[i].obj);
+    return best.size();
+}
+
+void ObjectRangeTracker::Update(ObjectGrid& grid, WorldObject *center, float radius, std::vector<uint64>& entered, std::vector<uint64>& left,
+                                uint8 tyid /* = TYPEID_MAX */, uint32 entry /* = 0 */)
+{
+    WorldObjectList objs;
+    grid.GetObjectsInRange(center->GetMapId(), center->GetX(), center->GetY(), radius, objs, tyid, entry, center);
+    std::vector<uint64> now(objs.size());
+    for(uint32 i = 0; i < objs.size(); i++)
+        now[i] = objs[i]->GetGUID();
+    std::sort(now.begin(), now.end());
+    std::set_difference(now.begin(), now.end(), _inrange.begin(), _inrange.end(), std::back_inserter(entered));
+    std::set_difference(_inrange.begin(), _inrange.end(), now.begin(), now.end(), std::back_inserter(left));
+    _inrange.swap(now);
+}
@@ -0,0 +1,71 @@
+#ifndef _OBJECTGRID_H
+#define _OBJECTGRID_H
+
+#include "common.h"
+#include "Object.h"
+
+// edge length of a grid cell in yards, 1/16 of an ADT tile
+#define OBJECTGRID_CELL_SIZE (533.33333f / 16.0f)
+// cell coords are clamped to +-this, far more than a map can have
+#define OBJECTGRID_MAX_CELL ((1 << 19) - 1)
+
+typedef std::vector<WorldObject*> WorldObjectList;
+
+// uniform spatial hash over the active world objects, one set of cells per map.
+// objects are moved between cells by WorldObject::SetPosition() only if they crossed a cell border.
+// distances are measured in 2D between the object centers, the bounding radius is not taken into account.
+// objects moving along a spline are found at their position of the last MoveSplineStore::Update().
+// the type/entry filters of the queries accept TYPEID_MAX and 0 for "any".
+// all functions are threadsafe (the GUI thread moves our own char); the queries return pointers that are
+// valid as long as the objects are not removed from the ObjMgr, which happens in the main thread only.
+class ObjectGrid
+{
+public:
+    ObjectGrid();
+    ~ObjectGrid();
+
+    void Add(WorldObject *o);
+    void Remove(WorldObject *o);
+    void Move(WorldObject *o); // must be called after the position or map of o changed
+
+    // appends all matching objects within radius to out, unsorted. returns the amount of objects appended.
+    uint32 GetObjectsInRange(uint32 map, float x, float y, float radius, WorldObjectList& out, uint8 tyid = TYPEID_MAX, uint32 entry = 0, WorldObject *except = NULL);
+    // appends up to count matching objects nearest to x/y, nearest first. maxradius 0 means no limit.
+    uint32 GetNearestObjects(uint32 map, float x, float y, uint32 count, float maxradius, WorldObjectList& out, uint8 tyid = TYPEID_MAX, uint32 entry = 0, WorldObject *except = NULL);
+
+    inline uint32 GetCellCount(void) { return _cells.size(); }
+
+private:
+    // occupied area and amount of objects of one map, to know when a nearest search can stop
+    struct MapInfo
+    {
+        int32 minx, maxx, miny, maxy;
+        uint32 count;
+    };
+    typedef std::map<uint64,WorldObjectList> CellMap;
+    typedef std::map<uint32,MapInfo> MapInfoMap;
+
+    static uint64 _CellKey(WorldObject *o); // uses the stored position, never evaluates a spline
+    void _Link(WorldObject *o, uint64 key);
+    void _Unlink(WorldObject *o);
+
+    CellMap _cells; // key: (map << 40) | (cx << 20) | cy, cells are kept when they get empty
+    MapInfoMap _maps;
+    ZThread::FastMutex _mutex;
+};
+
+// remembers the guids of the objects found around a point by the last Update(),
+// to tell which objects came into or went out of range since then.
+// objects removed from the ObjMgr in between are reported as gone out of range.
+class ObjectRangeTracker
+{
+public:
+    void Update(ObjectGrid& grid, WorldObject *center, float radius, std::vector<uint64>& entered, std::vector<uint64>& left, uint8 tyid = TYPEID_MAX, uint32 entry = 0);
+    inline void Reset(void) { _inrange.clear(); }
+    inline uint32 GetCount(void) { return _inrange.size(); }
+
+private:
+    std::vector<uint64> _inrange; // sorted
+};
+
+#endif
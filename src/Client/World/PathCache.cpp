@@ -0,0 +1,198 @@
+#include <map>
+#include "common.h"
+#include "MapTile.h"
+#include "NavGrid.h"
+#include "NavGraph.h"
+#include "PathCache.h"
+
+namespace PathCache
+{
+    // a remembered search. key: map id (12 bits) and the global coords of the start and end cells (13 bits each).
+    // linked into the LRU list, most recently used first
+    struct CacheEntry
+    {
+        uint64 key;
+        std::vector<NavPoint> path;
+    };
+    typedef std::list<CacheEntry> EntryList;
+
+    // the graph of a map. searches on it are done one after another, searches on other maps and cache hits
+    // don't wait for them. may be dropped by FlushCache() while in use, then the last user deletes it.
+    struct GraphSlot
+    {
+        GraphSlot(uint32 mapid) : graph(mapid, "./data/maps"), users(0), dropped(false) {} // where MemoryDataHolder keeps the .hmap files
+        NavGraph graph;
+        ZThread::FastMutex lock; // held during searches, which may build missing .nav files
+        uint32 users; // FindPath() calls using it
+        bool dropped;
+        std::vector<uint32> written; // tiles whose .hmap file was written since the last search, see HeightMapWritten()
+        MapTileStorage heights; // for the ends of remembered paths, separate from the graph's tiles so hits don't wait for searches
+        ZThread::FastMutex heightlock;
+    };
+
+    ZThread::FastMutex mutex; // guards everything below, not held during searches
+    std::map<uint32, GraphSlot*> graphs; // map id -> graph
+    EntryList lru;
+    std::map<uint64, EntryList::iterator> entries;
+    uint32 cacheLimit = PATHCACHE_DEFAULT_SIZE;
+    uint64 statHits = 0, statMisses = 0, statEvictions = 0;
+
+    // height at the given position, from the slot's own tile mappings. INVALID_HEIGHT if the tile has no height map
+    static float _GetZ(GraphSlot *slot, float x, float y)
+    {
+        int32 nx = NavCoord(x), ny = NavCoord(y);
+        if(nx < 0 || ny < 0)
+            return INVALID_HEIGHT;
+        uint32 pos = NavTilePos(nx, ny);
+        ZThread::Guard<ZThread::FastMutex> g(slot->heightlock);
+        MapTile *tile = slot->heights.GetTile(pos);
+        if(!tile)
+        {
+            char fn[512];
+            sprintf(fn, "./data/maps/%u_%u_%u.hmap", slot->graph.GetMapId(), pos % 64, pos / 64);
+            tile = new MapTile();
+            if(!tile->LoadHeightMap(fn, 0))
+            {
+                delete tile;
+                return INVALID_HEIGHT;
+            }
+            slot->heights.SetTile(tile, pos);
+        }
+        return tile->GetZ(x, y);
+    }
+
+    // the slot is not used anymore by this call; mutex must be held
+    static void _Release(GraphSlot *slot)
+    {
+        if(!--slot->users && slot->dropped)
+            delete slot;
+    }
+
+    static void _Trim(void)
+    {
+        while(entries.size() > cacheLimit)
+        {
+            entries.erase(lru.back().key);
+            lru.pop_back();
+            statEvictions++;
+        }
+    }
+
+    bool FindPath(uint32 mapid, float sx, float sy, float ex, float ey, std::vector<NavPoint>& path)
+    {
+        path.clear();
+        int32 snx = NavCoord(sx), sny = NavCoord(sy), enx = NavCoord(ex), eny = NavCoord(ey);
+        if(snx < 0 || sny < 0 || enx < 0 || eny < 0)
+            return false;
+        uint64 key = (uint64(mapid & 0xFFF) << 52) | (uint64(snx) << 39) | (uint64(sny) << 26) | (uint64(enx) << 13) | uint64(eny);
+        GraphSlot *slot;
+        bool hit;
+        {
+            ZThread::Guard<ZThread::FastMutex> g(mutex);
+            std::map<uint64, EntryList::iterator>::iterator it = entries.find(key);
+            hit = it != entries.end();
+            if(hit)
+            {
+                statHits++;
+                lru.splice(lru.begin(), lru, it->second);
+                path = it->second->path;
+            }
+            else
+                statMisses++;
+            GraphSlot *&s = graphs[mapid];
+            if(!s)
+                s = new GraphSlot(mapid);
+            slot = s;
+            slot->users++;
+        }
+
+        if(hit)
+        {
+            // same cells, but the ends can be on a slope or on another level of the cell
+            path.front().x = sx;
+            path.front().y = sy;
+            path.back().x = ex;
+            path.back().y = ey;
+            float sz = _GetZ(slot, sx, sy), ez = _GetZ(slot, ex, ey);
+            if(sz != INVALID_HEIGHT)
+                path.front().z = sz;
+            if(ez != INVALID_HEIGHT)
+                path.back().z = ez;
+            ZThread::Guard<ZThread::FastMutex> g(mutex);
+            _Release(slot);
+            return true;
+        }
+
+        bool found;
+        {
+            ZThread::Guard<ZThread::FastMutex> g(slot->lock);
+            std::vector<uint32> written;
+            {
+                ZThread::Guard<ZThread::FastMutex> g2(mutex);
+                written.swap(slot->written);
+            }
+            for(uint32 i = 0; i < written.size(); i++)
+                slot->graph.TileChanged(written[i]);
+            found = slot->graph.FindPath(sx, sy, ex, ey, path);
+        }
+
+        ZThread::Guard<ZThread::FastMutex> g(mutex);
+        _Release(slot);
+        // failed searches are not remembered, a later one may find a way over tiles that got their .hmap file meanwhile
+        if(found && cacheLimit && entries.find(key) == entries.end()) // another search for the same cells may have been faster
+        {
+            CacheEntry e;
+            e.key = key;
+            lru.push_front(e);
+            lru.front().path = path;
+            entries[key] = lru.begin();
+            _Trim();
+        }
+        return found;
+    }
+
+    void HeightMapWritten(uint32 mapid, uint32 pos)
+    {
+        ZThread::Guard<ZThread::FastMutex> g(mutex);
+        std::map<uint32, GraphSlot*>::iterator it = graphs.find(mapid);
+        if(it == graphs.end())
+            return;
+        it->second->written.push_back(pos);
+        ZThread::Guard<ZThread::FastMutex> g2(it->second->heightlock);
+        it->second->heights.UnloadMapTile(pos);
+    }
+
+    void SetCacheLimit(uint32 paths)
+    {
+        ZThread::Guard<ZThread::FastMutex> g(mutex);
+        cacheLimit = paths;
+        _Trim();
+        logdetail("PathCache: Remembering up to %u paths.", paths);
+    }
+
+    void GetCacheStats(CacheStats& st)
+    {
+        ZThread::Guard<ZThread::FastMutex> g(mutex);
+        st.hits = statHits;
+        st.misses = statMisses;
+        st.evictions = statEvictions;
+        st.paths = entries.size();
+        st.limit = cacheLimit;
+        st.graphs = graphs.size();
+    }
+
+    void FlushCache(void)
+    {
+        ZThread::Guard<ZThread::FastMutex> g(mutex);
+        lru.clear();
+        entries.clear();
+        for(std::map<uint32, GraphSlot*>::iterator it = graphs.begin(); it != graphs.end(); it++)
+        {
+            if(it->second->users)
+                it->second->dropped = true;
+            else
+                delete it->second;
+        }
+        graphs.clear();
+    }
+}
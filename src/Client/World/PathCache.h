@@ -0,0 +1,34 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include "common.h"
+#include "Pathfinder.h"
+
+// paths kept by default, see PathCacheSize in PseuWoW.conf
+#define PATHCACHE_DEFAULT_SIZE 256
+
+// long path searches over the navgraphs of the extracted maps (see NavGraph), for all instances of the process.
+// one NavGraph per map is kept, and the most recently found paths; a path is reused for a search that starts
+// and ends in the same cells, with the exact start and end and their heights put in. searches without result are not remembered.
+// threadsafe; searches on the same map are done one after another. a search that builds missing .nav files
+// holds up only other searches on its map, not cache hits or searches on other maps.
+namespace PathCache
+{
+    struct CacheStats
+    {
+        uint64 hits;     // FindPath() calls answered by a remembered path
+        uint64 misses;   // FindPath() calls that had to search
+        uint64 evictions; // paths dropped to stay below the limit
+        uint32 paths;    // paths remembered
+        uint32 limit;    // max. paths remembered
+        uint32 graphs;   // maps with a NavGraph
+    };
+
+    bool FindPath(uint32 mapid, float sx, float sy, float ex, float ey, std::vector<NavPoint>& path); // like Pathfinder::FindPath()
+    void HeightMapWritten(uint32 mapid, uint32 pos); // a .hmap file was written (pos: gy * 64 + gx), the graph looks at it again
+    void SetCacheLimit(uint32 paths);
+    void GetCacheStats(CacheStats&);
+    void FlushCache(void); // drop all paths and graphs
+}
+
+#endif
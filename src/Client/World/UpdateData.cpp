@@ -9,7 +9,6 @@
 #include "Corpse.h"
 #include "DynamicObject.h"
 #include "ObjMgr.h"
-#include "UpdateMask.h"
 #include "MovementInfo.h"
 
 
@@ -29,7 +28,7 @@ void WorldSession::_HandleCompressedUpdateObjectOpcode(WorldPacket& recvPacket)
     }
     WorldPacket wp;
     wp.SetOpcode(recvPacket.GetOpcode());
-    wp.append(z.contents(),z.size());
+    wp.swap(z); // take over the inflated data, no need to copy it
 
     _HandleUpdateObjectOpcode(wp);
 }
@@ -40,6 +39,11 @@ void WorldSession::_HandleUpdateObjectOpcode(WorldPacket& recvPacket)
     uint8 hasTransport;
     uint32 usize, ublocks, readblocks=0;
     uint64 uguid;
+
+    // changes of a packet that could not be read to the end (see HandlePacket()) are reported on their own,
+    // not together with the changes of this one
+    _NotifyValueChanges();
+
     recvPacket >> ublocks; // >> hasTransport;
     if(GetInstance()->GetConf()->client <= CLIENT_TBC)
       recvPacket >> hasTransport;
@@ -234,12 +238,15 @@ void WorldSession::_HandleUpdateObjectOpcode(WorldPacket& recvPacket)
                     DumpPacket(recvPacket, recvPacket.rpos(),buf);
                 }
 
+                _NotifyValueChanges();
                 return;
             }
         } // switch
 	readblocks++;
     } // while
 
+    _NotifyValueChanges(); // all blocks are handled, the objects are complete now
+
 } // func
 
 void WorldSession::_MovementUpdate(uint8 objtypeid, uint64 uguid, WorldPacket& recvPacket)
@@ -332,25 +339,40 @@ void WorldSession::_MovementUpdate(uint8 objtypeid, uint64 uguid, WorldPacket& r
         {
             logdev("MovementUpdate: MOVEMENTFLAG_SPLINE_ENABLED!");
             //checked for 3.3.5
-            //We do not do anything with the spline stuff so far, it just needs to be read to be skipped correctly
+            //the path is the whole spline, the object is timepassed msecs into it
             uint32 splineflags, timepassed, duration, id, effect_start_time, path_nodes;
-            uint8 spline_mode;
-            float facing_angle,facing_x,facing_y,facing_z, duration_mod, duration_next, vertical_acceleration;
+            uint8 spline_mode, movesplineflags = 0;
+            float facing_angle = 0,facing_x,facing_y,facing_z, duration_mod, duration_next, vertical_acceleration;
             float x,y,z;
             uint64 facing_target;
             recvPacket >> splineflags;
             if(splineflags & SF_Final_Angle)
+            {
               recvPacket >> facing_angle;
-            if(splineflags & SF_Final_Point)
+              movesplineflags |= MOVESPLINE_FACING;
+            }
+            else if(splineflags & SF_Final_Target)
+              recvPacket >> facing_target;
+            else if(splineflags & SF_Final_Point)
               recvPacket >> facing_x >> facing_y >> facing_z;
             recvPacket >> timepassed >> duration >> id >> duration_mod >> duration_next >> vertical_acceleration >> effect_start_time;
             recvPacket >> path_nodes;
+            std::vector<WorldPosition> path(path_nodes < MOVESPLINE_MAX_POINTS ? path_nodes : 0);
             for(uint32 i = 0;i<path_nodes;i++)
             {
               recvPacket >> x >> y >> z;
+              if(i < path.size())
+                path[i] = WorldPosition(x, y, z);
             }
             recvPacket >> spline_mode;
             recvPacket >> x >> y >> z; // FinalDestination
+
+            if(splineflags & (SF_Flying | SF_Catmullrom))
+                movesplineflags |= MOVESPLINE_CATMULLROM;
+            if(splineflags & SF_Cyclic)
+                movesplineflags |= MOVESPLINE_CYCLIC;
+            if(obj && obj->IsWorldObject() && path.size())
+                objmgr.GetSplines().Start((WorldObject*)obj, &path[0], path.size(), duration, timepassed, movesplineflags, facing_angle, getMonotonicMSTime());
         }
     }
     else // !UPDATEFLAG_LIVING
@@ -435,11 +457,47 @@ void WorldSession::_MovementUpdate(uint8 objtypeid, uint64 uguid, WorldPacket& r
     }
 }
 
+static inline uint32 CountBits(uint32 m)
+{
+#if COMPILER == COMPILER_GNU
+    return __builtin_popcount(m);
+#else
+    m = m - ((m >> 1) & 0x55555555);
+    m = (m & 0x33333333) + ((m >> 2) & 0x33333333);
+    return (((m + (m >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#endif
+}
+
+// index of the lowest set bit, m must not be 0
+static inline uint32 LowestBit(uint32 m)
+{
+#if COMPILER == COMPILER_GNU
+    return __builtin_ctz(m);
+#else
+    static const uint8 debruijn[32] =
+    {
+        0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+        31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+    };
+    return debruijn[((m & -m) * 0x077CB531U) >> 27];
+#endif
+}
+
+// packet data has no alignment, memcpy compiles to a plain load where that is allowed
+static inline uint32 ReadWord(const uint8 *p)
+{
+    uint32 w;
+    memcpy(&w, p, sizeof(uint32));
+    return w;
+}
+
+// the mask and values are read in place, only the set bits are visited.
+// values that differ from the current ones are marked as changed in the object (see _NotifyValueChanges())
 void WorldSession::_ValuesUpdate(uint64 uguid, WorldPacket& recvPacket)
 {
     Object *obj = objmgr.GetObj(uguid);
     uint8 blockcount,tyid;
-    uint32 value, masksize, valuesCount;
+    uint32 masksize, valuesCount, setbits = 0;
 
     if(obj)
     {
@@ -454,36 +512,72 @@ void WorldSession::_ValuesUpdate(uint64 uguid, WorldPacket& recvPacket)
         valuesCount = GetValuesCountByTypeId(tyid);
     }
 
-
     recvPacket >> blockcount;
     masksize = blockcount << 2; // each sizeof(uint32) == <4> * sizeof(uint8) // 1<<2 == <4>
-    UpdateMask umask;
-    uint32 *updateMask = new uint32[blockcount];
-    umask.SetCount(masksize);
-    recvPacket.read((uint8*)updateMask, masksize);
-    umask.SetMask(updateMask);
-    //delete [] updateMask; // will be deleted at ~UpdateMask() !!!!
+    size_t pos = recvPacket.rpos();
+    if(pos + masksize > recvPacket.size())
+        throw ByteBufferException("read-mask", pos, recvPacket.wpos(), masksize, recvPacket.size());
+    const uint8 *mask = recvPacket.contents() + pos;
+    for(uint32 w = 0; w < blockcount; w++)
+        setbits += CountBits(ReadWord(mask + (w << 2)));
+    // every set bit is followed by a value; check once that they are all there
+    if(pos + masksize + (setbits << 2) > recvPacket.size())
+        throw ByteBufferException("read-values", pos + masksize, recvPacket.wpos(), setbits << 2, recvPacket.size());
+    const uint8 *values = mask + masksize;
     logdev("ValuesUpdate TypeId=%u GUID="I64FMT" pObj=%X Blocks=%u Masksize=%u",tyid,uguid,obj,blockcount,masksize);
-    // just in case the object does not exist, and we have really a container instead of an item, and a value in
-    // the container fields is set, THEN we have a problem. this should never be the case; it can be fixed in a
-    // more correct way if there is the need.
-    // (-> valuesCount smaller then it should be might skip a few bytes and corrupt the packet)
-    for (uint32 i = 0; i < valuesCount; i++)
+
+    // values of unknown objects are dropped. bits beyond the object's fields (e.g. container fields if
+    // we have an item instead, which should never be the case) are skipped, but their values still read.
+    if(obj)
     {
-        if (umask.GetBit(i))
+        uint16 entryofs = Object::updatefields[OBJECT_FIELD_ENTRY].offset;
+        bool wasChanged = obj->HasChangedFields(), entryChanged = false;
+        for(uint32 w = 0; w < blockcount; w++)
         {
-            if(obj)
+            for(uint32 m = ReadWord(mask + (w << 2)); m; m &= m - 1)
             {
-                recvPacket >> value;
-                obj->SetUInt32Value(i, value);  //It does not matter what type of value we are setting, just copy the bytes
+                uint32 i = (w << 5) + LowestBit(m);
+                uint32 value = ReadWord(values);
+                values += sizeof(uint32);
+                if(i >= valuesCount)
+                    continue;
+                //It does not matter what type of value we are setting, just copy the bytes
+                if(obj->UpdateUInt32Value(i, value) && i == entryofs)
+                    entryChanged = true;
                 DEBUG(logdev("%u %u",i,value));
             }
-            else
-            {
-                recvPacket >> value; // drop the value, since object doesnt exist (always 4 bytes)
-            }
         }
+        if(entryChanged)
+            objmgr.UpdateEntryIndex(obj); // entry is usually set with the create block, after the object was added
+        if(!wasChanged && obj->HasChangedFields())
+            _valuesChanged.push_back(uguid);
+    }
+    recvPacket.rpos(pos + masksize + (setbits << 2));
+}
+
+// runs _onvalueschanged for every object whose fields were changed by the last update packet,
+// then forgets the changes
+void WorldSession::_NotifyValueChanges(void)
+{
+    if(_valuesChanged.empty())
+        return;
+    bool script = GetInstance()->GetScripts()->ScriptExists("_onvalueschanged");
+    for(uint32 i = 0; i < _valuesChanged.size(); i++)
+    {
+        Object *obj = objmgr.GetObj(_valuesChanged[i], true);
+        // an object removed and created again within one packet can be queued twice
+        if(!obj || !obj->HasChangedFields())
+            continue;
+        if(script && !obj->_IsDepleted())
+        {
+            CmdSet Set;
+            Set.defaultarg = toString(_valuesChanged[i]);
+            Set.arg[0] = toString(obj->GetTypeId());
+            GetInstance()->GetScripts()->RunScript("_onvalueschanged", &Set);
+        }
+        obj->ClearChangedFields();
     }
+    _valuesChanged.clear();
 }
 
 void WorldSession::_QueryObjectInfo(uint64 guid)
@@ -42,7 +42,10 @@ void World::Update(void)
 
     if(_mapmgr)
     {
-        _mapmgr->Update(_x,_y,_mapId);
+        float vx = 0, vy = 0;
+        if(_movemgr)
+            _movemgr->GetVelocity(vx,vy); // to prefetch tiles in the direction we are moving
+        _mapmgr->Update(_x,_y,_mapId,vx,vy);
     }
     if(_movemgr)
     {
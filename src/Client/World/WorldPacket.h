@@ -7,15 +7,24 @@
 class WorldPacket : public ByteBuffer
 {
 public:
-    WorldPacket() { ByteBuffer(10); _opcode=0; }
-    WorldPacket(uint32 r) { reserve(r); _opcode=0; }
-    WorldPacket(uint16 opcode, uint32 r) { _opcode=opcode; reserve(r); }
-    WorldPacket(uint16 opcode) { _opcode=opcode; reserve(10); }
+    WorldPacket() { ByteBuffer(10); _opcode=0; _slabref=false; }
+    WorldPacket(uint32 r) { reserve(r); _opcode=0; _slabref=false; }
+    WorldPacket(uint16 opcode, uint32 r) { _opcode=opcode; reserve(r); _slabref=false; }
+    WorldPacket(uint16 opcode) { _opcode=opcode; reserve(10); _slabref=false; }
+    WorldPacket(const WorldPacket& p) : ByteBuffer(p) { _opcode=p._opcode; _slabref=false; } // a copy never references the socket slab
+#ifdef BYTEBUFFER_HAS_MOVE
+    WorldPacket(WorldPacket&& p) : ByteBuffer(static_cast<ByteBuffer&&>(p)) { _opcode=p._opcode; _slabref=p._slabref; p._slabref=false; }
+#endif
     inline void SetOpcode(uint16 opcode) { _opcode=opcode; }
     inline uint16 GetOpcode(void) { return _opcode; }
 
+    // true while the packet holds a reference to the WorldSocket's receive slab (see WorldSession::RecyclePacket)
+    inline void SetSlabRef(bool b) { _slabref=b; }
+    inline bool HasSlabRef(void) { return _slabref; }
+
 private:
     uint16 _opcode;
+    bool _slabref;
 
 };
 
@@ -28,7 +28,7 @@ uint32 Object::maxvalues[TYPEID_MAX];
 UpdateField Object::updatefields[UPDATEFIELDS_NAME_COUNT];
 uint8 MovementInfo::_c=CLIENT_UNKNOWN;
 
-WorldSession::WorldSession(PseuInstance *in)
+WorldSession::WorldSession(PseuInstance *in) : _delayedPkts(getMonotonicMSTime())
 {
     logdebug("-> Starting WorldSession 0x%X from instance 0x%X",this,in); // should never output a null ptr
     _instance = in;
@@ -41,9 +41,11 @@ WorldSession::WorldSession(PseuInstance *in)
     _sh.SetAutoCloseSockets(false);
     objmgr.SetInstance(in);
     _lag_ms = 0;
+    _pingtime = 0;
     //...
 
     _SetupObjectFields();
+    _BuildOpcodeTable();
     MovementInfo::_c=in->GetConf()->client;
 
     in->GetScripts()->RunScriptIfExists("_onworldsessioncreate");
@@ -73,21 +75,25 @@ WorldSession::~WorldSession()
 
     _instance->GetScripts()->RunScriptIfExists("_onworldsessiondelete");
 
-    logdebug("~WorldSession(): %u packets left unhandled, and %u delayed. deleting.",pktQueue.size(),delayedPktQueue.size());
+    logdebug("~WorldSession(): %u packets left unhandled, and %u delayed. deleting.",pktQueue.size() + recvPktQueue.size(),_delayedPkts.Size());
     WorldPacket *packet;
-    // clear the queue
+    // clear the queues
+    while(recvPktQueue.size())
+    {
+        packet = recvPktQueue.front();
+        recvPktQueue.pop_front();
+        RecyclePacket(packet); // drops the reference to the socket's receive buffer
+    }
     while(pktQueue.size())
     {
         packet = pktQueue.next();
         delete packet;
     }
     // clear the delayed queue
-    while(delayedPktQueue.size())
-    {
-        packet = delayedPktQueue.back().pkt;
-        delayedPktQueue.pop_back();
+    while(_delayedPkts.PopAny(packet))
         delete packet;
-    }
+    for(uint32 i = 0; i < _pktPool.size(); i++)
+        delete _pktPool[i];
 
     if(_channels)
         delete _channels;
@@ -134,6 +140,35 @@ void WorldSession::_LoadCache(void)
 void WorldSession::AddToPktQueue(WorldPacket *pkt)
 {
     pktQueue.add(pkt);
+    GetInstance()->WakeUp();
+}
+
+WorldPacket *WorldSession::AcquirePacket(void)
+{
+    if(_pktPool.empty())
+        return new WorldPacket();
+    WorldPacket *pkt = _pktPool.back();
+    _pktPool.pop_back();
+    return pkt;
+}
+
+// handled packets end up here. they are kept for reuse, so the packet objects and their buffers do not need to be reallocated.
+void WorldSession::RecyclePacket(WorldPacket *pkt)
+{
+    if(pkt->HasSlabRef())
+    {
+        pkt->SetSlabRef(false);
+        if(_socket)
+            _socket->ReleaseSlabRef();
+    }
+    if(_pktPool.size() >= WORLDSESSION_PACKET_POOL_SIZE)
+    {
+        delete pkt;
+        return;
+    }
+    pkt->clear();
+    pkt->SetOpcode(0);
+    _pktPool.push_back(pkt);
 }
 
 void WorldSession::SendWorldPacket(WorldPacket &pkt)
@@ -169,7 +204,13 @@ void WorldSession::Update(void)
         delete pkt;
     }
 
-    // while there are packets on the queue, handle them
+    // while there are packets on the queues, handle them
+    while(recvPktQueue.size())
+    {
+        WorldPacket *pkt = recvPktQueue.front();
+        recvPktQueue.pop_front();
+        HandleWorldPacket(pkt);
+    }
     while(pktQueue.size())
     {
         HandleWorldPacket(pktQueue.next());
@@ -180,41 +221,28 @@ void WorldSession::Update(void)
 
     _DoTimedActions();
 
+    objmgr.GetSplines().Update(getMonotonicMSTime());
+
     if(_world)
         _world->Update();
 }
 
-// this func will delete the WorldPacket after it is handled!
+// this func will recycle the WorldPacket after it is handled!
 void WorldSession::HandleWorldPacket(WorldPacket *packet)
 {
-    static DefScriptPackage *sc = GetInstance()->GetScripts();
-    static OpcodeHandler *table = _GetOpcodeHandlerTable();
+    DefScriptPackage *sc = GetInstance()->GetScripts();
+    if(_opcodeScriptGen != sc->GetScriptGeneration()) // scripts were (un)loaded since the last packet
+        _UpdateOpcodeScriptFlags();
 
-    bool known = false;
-    uint16 hpos;
-    for (hpos = 0; table[hpos].handler != NULL; hpos++)
-    {
-        if (table[hpos].opcode == packet->GetOpcode())
-        {
-            known=true;
-            break;
-        }
-    }
+    // the socket drops anything above MAX_OPCODE_ID, but spoofed/delayed packets might not be checked
+    bool inrange = packet->GetOpcode() <= MAX_OPCODE_ID;
+    OpcodeHandlerFunc handler = inrange ? _opcodeHandlers[packet->GetOpcode()] : NULL;
+    uint8 flags = inrange ? _opcodeFlags[packet->GetOpcode()] : 0;
 
-    bool hideOpcode = false;
-    bool disabledOpcode = IsOpcodeDisabled(packet->GetOpcode());
-    if(disabledOpcode && GetInstance()->GetConf()->hideDisabledOpcodes)
-        hideOpcode = true;
-
-    // TODO: Maybe make table or something with all the frequently opcodes
-    if (GetInstance()->GetConf()->hidefreqopcodes)
-    {
-        switch(packet->GetOpcode())
-        {
-            case SMSG_MONSTER_MOVE:
-            hideOpcode = true;
-        }
-    }
+    bool known = handler != NULL;
+    bool disabledOpcode = flags & OPCODE_FLAG_DISABLED;
+    bool hideOpcode = (disabledOpcode && GetInstance()->GetConf()->hideDisabledOpcodes)
+                   || ((flags & OPCODE_FLAG_FREQUENT) && GetInstance()->GetConf()->hidefreqopcodes);
 
     if( (known && GetInstance()->GetConf()->showopcodes==1)
         || ((!known) && GetInstance()->GetConf()->showopcodes==2)
@@ -233,10 +261,10 @@ void WorldSession::HandleWorldPacket(WorldPacket *packet)
     {
         // if there is a script attached to that opcode, call it now.
         // note: the pkt rpos needs to be reset by the scripts!
-        std::string scname = "opcode::";
-        scname += stringToLower(GetOpcodeName(packet->GetOpcode()));
-        if(sc->ScriptExists(scname))
+        if(flags & OPCODE_FLAG_SCRIPT)
         {
+            std::string scname = "opcode::";
+            scname += stringToLower(GetOpcodeName(packet->GetOpcode()));
             std::string pktname = "PACKET::";
             pktname += GetOpcodeName(packet->GetOpcode());
             GetInstance()->GetScripts()->bytebuffers.Assign(pktname,packet);
@@ -248,7 +276,7 @@ void WorldSession::HandleWorldPacket(WorldPacket *packet)
         if(known && !disabledOpcode)
         {
             packet->rpos(0);
-            (this->*table[hpos].handler)(*packet);
+            (this->*handler)(*packet);
         }
     }
     catch (ByteBufferException bbe)
@@ -259,7 +287,7 @@ void WorldSession::HandleWorldPacket(WorldPacket *packet)
         logerror("WorldSession: ByteBufferException");
         logerror("ByteBuffer reported: %s", errbuf);
         // copied from below
-        logerror("Data: pktsize=%u, handler=0x%X queuesize=%u",packet->size(),table[hpos].handler,pktQueue.size());
+        logerror("Data: pktsize=%u, handler=0x%X queuesize=%u",packet->size(),handler,pktQueue.size());
         logerror("Packet Hexdump:");
         logerror("%s",toHexDump((uint8*)packet->contents(),packet->size(),true).c_str());
 
@@ -269,7 +297,7 @@ void WorldSession::HandleWorldPacket(WorldPacket *packet)
     catch (...)
     {
         logerror("Exception while handling opcode %u [%s]!",packet->GetOpcode(),GetOpcodeName(packet->GetOpcode()));
-        logerror("Data: pktsize=%u, handler=0x%X queuesize=%u",packet->size(),table[hpos].handler,pktQueue.size());
+        logerror("Data: pktsize=%u, handler=0x%X queuesize=%u",packet->size(),handler,pktQueue.size());
         logerror("Packet Hexdump:");
         logerror("%s",toHexDump((uint8*)packet->contents(),packet->size(),true).c_str());
 
@@ -277,11 +305,11 @@ void WorldSession::HandleWorldPacket(WorldPacket *packet)
             DumpPacket(*packet, packet->rpos(), "unknown exception");
     }
 
-    delete packet;
+    RecyclePacket(packet);
 }
 
 
-OpcodeHandler *WorldSession::_GetOpcodeHandlerTable() const
+OpcodeHandler *WorldSession::_GetOpcodeHandlerTable()
 {
     static OpcodeHandler table[] =
     {
@@ -365,36 +393,75 @@ OpcodeHandler *WorldSession::_GetOpcodeHandlerTable() const
     return table;
 }
 
+// the handler table flattened into a direct-indexed array. it is the same for every session,
+// so it is built only once per process and shared (saves memory when running many instances).
+const OpcodeHandlerFunc *WorldSession::_GetOpcodeHandlers(void)
+{
+    static OpcodeHandlerFunc handlers[MAX_OPCODE_ID + 1];
+    static bool built = false;
+    static ZThread::FastMutex mut;
+
+    ZThread::Guard<ZThread::FastMutex> g(mut);
+    if(!built)
+    {
+        for(uint32 i = 0; i <= MAX_OPCODE_ID; i++)
+            handlers[i] = NULL;
+        for(OpcodeHandler *table = _GetOpcodeHandlerTable(); table->handler != NULL; table++)
+        {
+            if(table->opcode <= MAX_OPCODE_ID)
+                handlers[table->opcode] = table->handler;
+        }
+        built = true;
+    }
+    return handlers;
+}
+
+void WorldSession::_BuildOpcodeTable(void)
+{
+    _opcodeHandlers = _GetOpcodeHandlers();
+    memset(_opcodeFlags, 0, sizeof(_opcodeFlags));
+    // opcodes spammed by the server; hidden from the opcode output if hidefreqopcodes is set
+    _opcodeFlags[SMSG_MONSTER_MOVE] |= OPCODE_FLAG_FREQUENT;
+
+    _UpdateOpcodeScriptFlags();
+}
+
+// re-check which opcodes have an "opcode::<name>" script attached
+void WorldSession::_UpdateOpcodeScriptFlags(void)
+{
+    DefScriptPackage *sc = GetInstance()->GetScripts();
+    for(uint32 i = 0; i <= MAX_OPCODE_ID; i++)
+    {
+        std::string scname = "opcode::";
+        scname += stringToLower(GetOpcodeName(i));
+        if(sc->ScriptExists(scname))
+            _opcodeFlags[i] |= OPCODE_FLAG_SCRIPT;
+        else
+            _opcodeFlags[i] &= ~OPCODE_FLAG_SCRIPT;
+    }
+    _opcodeScriptGen = sc->GetScriptGeneration();
+}
+
 void WorldSession::_DelayWorldPacket(WorldPacket& pkt, uint32 ms)
 {
     DEBUG(logdebug("DelayWorldPacket (%s, size: %u, ms: %u)",GetOpcodeName(pkt.GetOpcode()),pkt.size(),ms));
     // need to copy the packet, because the current packet will be deleted after it got handled
-    WorldPacket *pktcopy = new WorldPacket(pkt.GetOpcode(),pkt.size());
+    WorldPacket *pktcopy = AcquirePacket();
+    pktcopy->SetOpcode(pkt.GetOpcode());
     pktcopy->append(pkt.contents(),pkt.size());
-    delayedPktQueue.push_back(DelayedWorldPacket(pktcopy,ms));
+    _delayedPkts.Add(getMonotonicMSTime() + ms, pktcopy);
     DEBUG(logdebug("-> WP ptr = 0x%X",pktcopy));
 }
 
+// packets delayed again while being handled are not due before the next call, see TimerWheel::_Insert()
 void WorldSession::_HandleDelayedPackets(void)
 {
-    if(delayedPktQueue.size())
+    uint32 now = getMonotonicMSTime();
+    WorldPacket *pkt;
+    while(_delayedPkts.Pop(now, pkt))
     {
-        DelayedPacketQueue copy(delayedPktQueue);
-        delayedPktQueue.clear(); // clear original, since it might be filled up by newly delayed packets, which would cause endless loop
-        while(copy.size())
-        {
-            DelayedWorldPacket d = copy.front();
-            copy.pop_front(); // remove packet from front
-            if(clock() >= d.when) // if its time to handle this packet, do so
-            {
-                DEBUG(logdebug("Handling delayed packet (%s [%u], size: %u, ptr: 0x%X)",GetOpcodeName(d.pkt->GetOpcode()),d.pkt->GetOpcode(),d.pkt->size(),d.pkt));
-                HandleWorldPacket(d.pkt);
-            }
-            else
-            {
-                delayedPktQueue.push_back(d); // and if not, put it again onto the queue
-            }
-        }
+        DEBUG(logdebug("Handling delayed packet (%s [%u], size: %u, ptr: 0x%X)",GetOpcodeName(pkt->GetOpcode()),pkt->GetOpcode(),pkt->size(),pkt));
+        HandleWorldPacket(pkt);
     }
 }
 
@@ -402,13 +469,14 @@ void WorldSession::_HandleDelayedPackets(void)
 void WorldSession::AddSendWorldPacket(WorldPacket *pkt)
 {
     sendPktQueue.add(pkt);
+    GetInstance()->WakeUp();
 }
 void WorldSession::AddSendWorldPacket(WorldPacket& pkt)
 {
     WorldPacket *wp = new WorldPacket(pkt.GetOpcode(),pkt.size());
     if(pkt.size())
         wp->append(pkt.contents(),pkt.size());
-    sendPktQueue.add(wp);
+    AddSendWorldPacket(wp);
 }
 
 void WorldSession::SetTarget(uint64 guid)
@@ -439,12 +507,11 @@ void WorldSession::_OnLeaveWorld(void)
 
 void WorldSession::_DoTimedActions(void)
 {
-    static clock_t pingtime=0;
     if(InWorld())
     {
-        if(pingtime < clock())
+        if(_pingtime < clock())
         {
-            pingtime=clock() + 30*CLOCKS_PER_SEC;
+            _pingtime=clock() + 30*CLOCKS_PER_SEC;
             SendPing(clock());
         }
         //...
@@ -453,7 +520,7 @@ void WorldSession::_DoTimedActions(void)
 
 std::string WorldSession::DumpPacket(WorldPacket& pkt, int errpos, const char *errstr)
 {
-    static std::map<uint32,uint32> opstore;
+    std::map<uint32,uint32>& opstore = _dumpCount;
     std::stringstream s;
     s << "TIMESTAMP: " << getDateString() << "\n";
     s << "OPCODE: " << pkt.GetOpcode() << " " << GetOpcodeName(pkt.GetOpcode()) << "\n";
@@ -783,6 +850,7 @@ void WorldSession::PreloadDataBeforeEnterWorld(PlayerEnum& pl)
 {
     log("Loading data before entering world...");
     _LoadCache(); // we are about to login, so we need cache data
+    objmgr.SetMapId(pl._mapId);
     if(MapMgr *mmgr = GetWorld()->GetMapMgr())
     {
         mmgr->Update(pl._x, pl._y, pl._mapId); // make it load the map files
@@ -1327,6 +1395,7 @@ void WorldSession::_HandleNewWorldOpcode(WorldPacket& recvPacket)
     // TODO: clear action buttons
 
     // clear world data and load required maps
+    objmgr.SetMapId(mapid);
     _world->Clear();
     _world->UpdatePos(x,y,mapid);
     _world->Update();
@@ -1577,6 +1646,9 @@ void WorldSession::_HandleLoginVerifyWorldOpcode(WorldPacket& recvPacket)
     uint32 m;
     recvPacket >> m >> x >> y >> z >> o;
     logdebug("LoginVerifyWorld: map=%u x=%f y=%f z=%f o=%f",m,x,y,z,o);
+    objmgr.SetMapId(m);
+    if(MyCharacter *my = GetMyChar())
+        my->SetMapId(m);
     _OnEnterWorld();
     // update the world as soon as the server confirmed that we are where we are.
     _world->UpdatePos(x,y,m);
@@ -1813,20 +1885,18 @@ void WorldSession::_HandleMonsterMoveOpcode(WorldPacket& recvPacket)
     if (!obj || !obj->IsWorldObject())
         return;
 
-    uint8 unk, type;
-    uint32 time, flags, movetime, waypoints;
-    float x, y, z;
-    if(GetInstance()->GetConf()->client > CLIENT_TBC)
+    WorldObject *wo = (WorldObject*)obj;
+    uint8 client = GetInstance()->GetConf()->client;
+    uint8 unk, type, splflags = 0;
+    uint32 id, flags, movetime, waypoints;
+    float x, y, z, facing = 0;
+    if(client > CLIENT_TBC)
       recvPacket >> unk;
 
-    recvPacket >> x >> y >> z >> time >> type;
-
-    float oldx = ((WorldObject*)obj)->GetX(),
-          oldy = ((WorldObject*)obj)->GetY();
-    float o = atan2f(y - oldy, x - oldx);
-    // not much good, better than nothing
+    recvPacket >> x >> y >> z >> id >> type;
 
-    ((WorldObject*)obj)->SetPosition(x, y, z, o);
+    // the object is where the move starts, no matter where we thought it was
+    wo->SetPosition(x, y, z, wo->GetO());
     switch(type)
     {
         case 0: break; // normal packet
@@ -1840,19 +1910,59 @@ void WorldSession::_HandleMonsterMoveOpcode(WorldPacket& recvPacket)
             recvPacket >> unkguid;
             break;
         case 4:
-            float angle;
-            recvPacket >> angle;
+            recvPacket >> facing;
+            splflags |= MOVESPLINE_FACING;
             break;
     }
 
     //  movement flags, time between waypoints, number of waypoints
-    recvPacket >> flags >> movetime >> waypoints;
+    recvPacket >> flags;
+    if(client > CLIENT_TBC && (flags & SF_Animation))
+    {
+        uint8 anim;
+        uint32 animstart;
+        recvPacket >> anim >> animstart;
+    }
+    recvPacket >> movetime;
+    if(client > CLIENT_TBC && (flags & SF_Parabolic))
+    {
+        float vertaccel;
+        uint32 effectstart;
+        recvPacket >> vertaccel >> effectstart;
+    }
+    recvPacket >> waypoints;
+    if(!waypoints || waypoints > MOVESPLINE_MAX_POINTS)
+        return;
+
+    // the path starts where the object is. since 3.0, points of linear paths are sent as destination
+    // followed by the points in between, packed relative to the middle of start and destination.
+    std::vector<WorldPosition> path(waypoints + 1);
+    path[0] = WorldPosition(x, y, z);
+    if(client <= CLIENT_TBC || (flags & (SF_Flying | SF_Catmullrom)))
+    {
+        for(uint32 i = 1; i <= waypoints; i++)
+            recvPacket >> path[i].x >> path[i].y >> path[i].z;
+        if(client > CLIENT_TBC)
+            splflags |= MOVESPLINE_CATMULLROM;
+    }
+    else
+    {
+        WorldPosition& dest = path[waypoints];
+        recvPacket >> dest.x >> dest.y >> dest.z;
+        float mx = (x + dest.x) * 0.5f, my = (y + dest.y) * 0.5f, mz = (z + dest.z) * 0.5f;
+        for(uint32 i = 1; i < waypoints; i++)
+        {
+            uint32 packed;
+            recvPacket >> packed;
+            path[i].x = mx - float(int32(packed << 21) >> 21) * 0.25f;
+            path[i].y = my - float(int32(packed << 10) >> 21) * 0.25f;
+            path[i].z = mz - float(int32(packed) >> 22) * 0.25f;
+        }
+    }
+    if(client > CLIENT_TBC && (flags & SF_Cyclic))
+        splflags |= MOVESPLINE_CYCLIC;
 
-    /*
-    // waypoint data
-    for (uint32 i = 0; i < waypoints; i++)
-        recvPacket >> x >> y >> z;
-    */
+    objmgr.GetSplines().Start(wo, &path[0], path.size(), movetime, 0, splflags, facing, getMonotonicMSTime());
 }
 
 // TODO: delete world on LogoutComplete once implemented
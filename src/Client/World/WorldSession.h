@@ -2,7 +2,6 @@
 #define _WORLDSESSION_H
 
 #include <deque>
-#include <bitset>
 
 #include "common.h"
 #include "PseuWoW.h"
@@ -13,6 +12,9 @@
 #include "ObjMgr.h"
 #include "CacheHandler.h"
 #include "Opcodes.h"
+#include "TimerWheel.h"
+
+#define WORLDSESSION_PACKET_POOL_SIZE 64 // max. amount of handled packets kept for reuse
 
 class WorldSocket;
 class WorldPacket;
@@ -31,12 +33,14 @@ struct WhoListEntry
     uint32 zoneId;
 };
 
-struct DelayedWorldPacket
+typedef void (WorldSession::*OpcodeHandlerFunc)(WorldPacket& recvPacket);
+
+// per-session opcode state. the handlers themselves are in a table shared by all sessions.
+enum OpcodeFlags
 {
-    DelayedWorldPacket() { pkt = NULL; when = clock(); }
-    DelayedWorldPacket(WorldPacket *p, uint32 ms) { pkt = p; when = ms + clock(); }
-    WorldPacket *pkt;
-    clock_t when;
+    OPCODE_FLAG_SCRIPT   = 0x01, // cached: "opcode::<name>" script exists
+    OPCODE_FLAG_DISABLED = 0x02,
+    OPCODE_FLAG_FREQUENT = 0x04 // hidden from output if hidefreqopcodes is set
 };
 
 // helper used for GUI
@@ -52,7 +56,7 @@ struct CharacterListExt
 
 typedef std::vector<WhoListEntry> WhoList;
 typedef std::vector<CharacterListExt> CharList;
-typedef std::deque<DelayedWorldPacket> DelayedPacketQueue;
+typedef std::deque<WorldPacket*> WorldPacketQueue;
 
 class WorldSession
 {
@@ -67,6 +71,9 @@ public:
     inline SCPDatabaseMgr& GetDBMgr(void) { return GetInstance()->dbmgr; }
 
     void AddToPktQueue(WorldPacket *pkt);
+    inline void AddToRecvQueue(WorldPacket *pkt) { recvPktQueue.push_back(pkt); } // only from the session thread (WorldSocket)
+    WorldPacket *AcquirePacket(void);
+    void RecyclePacket(WorldPacket *pkt);
     void Update(void);
     void Start(void);
     inline bool MustDie(void) { return _mustdie; }
@@ -76,6 +83,8 @@ public:
     void AddSendWorldPacket(WorldPacket& pkt);
     inline bool InWorld(void) { return _logged; }
     inline uint32 GetLagMS(void) { return _lag_ms; }
+    inline SocketHandler& GetSocketHandler(void) { return _sh; }
+    inline uint32 GetDelayedPacketWait(void) { return _delayedPkts.GetNextDelay(getMonotonicMSTime()); } // msecs, uint32(-1) if none
 
     void SetTarget(uint64 guid);
     inline uint64 GetTarget(void) { return GetMyChar() ? GetMyChar()->GetTarget() : 0; }
@@ -108,9 +117,9 @@ public:
 
     void HandleWorldPacket(WorldPacket*);
 
-    inline void DisableOpcode(uint16 opcode) { _disabledOpcodes[opcode] = true; }
-    inline void EnableOpcode(uint16 opcode) { _disabledOpcodes[opcode] = false; }
-    inline bool IsOpcodeDisabled(uint16 opcode) { return _disabledOpcodes[opcode]; }
+    inline void DisableOpcode(uint16 opcode) { _opcodeFlags[opcode] |= OPCODE_FLAG_DISABLED; }
+    inline void EnableOpcode(uint16 opcode) { _opcodeFlags[opcode] &= ~OPCODE_FLAG_DISABLED; }
+    inline bool IsOpcodeDisabled(uint16 opcode) { return _opcodeFlags[opcode] & OPCODE_FLAG_DISABLED; }
 
     PlayerNameCache plrNameCache;
     ObjMgr objmgr;
@@ -118,7 +127,10 @@ public:
 
 private:
 
-    OpcodeHandler *_GetOpcodeHandlerTable(void) const;
+    static OpcodeHandler *_GetOpcodeHandlerTable(void);
+    static const OpcodeHandlerFunc *_GetOpcodeHandlers(void);
+    void _BuildOpcodeTable(void);
+    void _UpdateOpcodeScriptFlags(void);
 
     // Helpers
     void _OnEnterWorld(void); // = login
@@ -169,6 +181,7 @@ private:
     // helper functions to keep SMSG_(COMPRESSED_)UPDATE_OBJECT easy to handle
 	void _MovementUpdate(uint8 objtypeid, uint64 guid, WorldPacket& recvPacket); // Helper for _HandleUpdateObjectOpcode
     void _ValuesUpdate(uint64 uguid, WorldPacket& recvPacket); // ...
+    void _NotifyValueChanges(void);
     void _QueryObjectInfo(uint64 guid);
 
     void _LoadCache(void);
@@ -176,7 +189,9 @@ private:
     PseuInstance *_instance;
     WorldSocket *_socket;
     ZThread::LockedQueue<WorldPacket*,ZThread::FastMutex> pktQueue, sendPktQueue;
-    DelayedPacketQueue delayedPktQueue;
+    WorldPacketQueue recvPktQueue; // packets read by our own socket; no locking needed
+    std::vector<WorldPacket*> _pktPool; // handled packets, ready for reuse
+    TimerWheel<WorldPacket*> _delayedPkts; // packets that could not be handled yet, by monotonic msecs they are due
     bool _logged,_mustdie; // world status
     SocketHandler _sh; // handles the WorldSocket
     Channel *_channels;
@@ -185,7 +200,12 @@ private:
     WhoList _whoList;
     CharList _charList;
     uint32 _lag_ms;
-    std::bitset<MAX_OPCODE_ID> _disabledOpcodes;
+    clock_t _pingtime; // when the next ping is due
+    std::map<uint32,uint32> _dumpCount; // per opcode, packets dumped so far
+    std::vector<uint64> _valuesChanged; // objects with changed fields, not notified yet
+    const OpcodeHandlerFunc *_opcodeHandlers; // shared, direct-indexed by opcode; NULL if unknown
+    uint8 _opcodeFlags[MAX_OPCODE_ID + 1]; // OpcodeFlags
+    uint32 _opcodeScriptGen; // script generation the script flags were built for
 
 };
 
@@ -10,13 +10,27 @@ WorldSocket::WorldSocket(SocketHandler &h, WorldSession *s) : TcpSocket(h)
 {
     _session = s;
     _gothdr = false;
+    _hdrdecrypted = false;
     _ok=false;
+    _slab = (uint8*)malloc(WORLDSOCKET_SLAB_SIZE);
+    _slabsize = WORLDSOCKET_SLAB_SIZE;
+    _slabpos = _slablen = 0;
+    _slabrefs = 0;
 
     //Dummy functions for unencrypted packets on WorldSocket
     pDecryptRecv = &AuthCrypt::DecryptRecvDummy;
     pEncryptSend = &AuthCrypt::EncryptSendDummy;
 }
 
+WorldSocket::~WorldSocket()
+{
+    if(_slabrefs)
+        logerror("~WorldSocket(): %u packets still reference the receive buffer!",_slabrefs);
+    for(uint32 i = 0; i < _retired.size(); i++)
+        free(_retired[i]);
+    free(_slab);
+}
+
 bool WorldSocket::IsOk(void)
 {
     return _ok;
@@ -52,75 +66,100 @@ void WorldSocket::OnException()
 
 void WorldSocket::OnRead()
 {
-    TcpSocket::OnRead();
-    if(!ibuf.GetLength())
+    // read straight into the slab instead of going through TcpSocket's ibuf ring
+    _PrepareSlab();
+    int n = recv(GetSocket(), (char*)_slab + _slablen, _slabsize - _slablen, MSG_NOSIGNAL);
+    if (n == -1)
+    {
+        Handler().LogError(this, "read", Errno, StrError(Errno), LOG_LEVEL_FATAL);
+        SetCloseAndDelete(true);
+        SetLost();
+        return;
+    }
+    else if (!n)
     {
-        this->CloseAndDelete();
+        Handler().LogError(this, "read", 0, "read returns 0", LOG_LEVEL_FATAL);
+        SetCloseAndDelete(true);
+        SetLost();
         return;
     }
-    while(ibuf.GetLength() > 0) // when all packets from the current ibuf are transformed into WorldPackets the remaining len will be zero
+    _slablen += n;
+
+    while(_slablen > _slabpos) // when all packets from the current slab are transformed into WorldPackets the remaining len will be zero
     {
+        uint8 *data = _slab + _slabpos;
+        uint32 avail = _slablen - _slabpos;
 
         if(_gothdr) // already got header, this packet has to be the data part
         {
             ASSERT(_remaining > 0); // case pktsize==0 is handled below
-            if(ibuf.GetLength() < _remaining)
+            if(avail < _remaining)
             {
-                DEBUG(logdebug("Delaying WorldPacket generation, bufsize is %u but should be >= %u",ibuf.GetLength(),_remaining));
+                DEBUG(logdebug("Delaying WorldPacket generation, bufsize is %u but should be >= %u",avail,_remaining));
                 break;
             }
             _gothdr=false;
-            WorldPacket *wp = new WorldPacket(_remaining);
-            wp->resize(_remaining);
-            ibuf.Read((char*)wp->contents(),_remaining);
-            wp->SetOpcode(_opcode);
-            GetSession()->AddToPktQueue(wp);
+            _QueuePacket(data, _remaining);
+            _slabpos += _remaining;
         }
         else // no pending header stored, so this packet must be a header
         {
-            if(ibuf.GetLength() < sizeof(ServerPktHeader))
-            {
-                DEBUG(logdebug("Delaying header reading, bufsize is %u but should be >= %u",ibuf.GetLength(),sizeof(ServerPktHeader)));
-                break;
-            }
-
+            // headers are decrypted in place. the crypt is a stream cipher, so every byte must be decrypted exactly once.
             if(GetSession()->GetInstance()->GetConf()->client > CLIENT_TBC)//Funny, old sources have this in TBC already...
             {
-              // read first byte and check if size is 3 or 2 bytes
-              uint8 firstSizeByte;
-              ibuf.Read((char*)&firstSizeByte, 1);
-              (_crypt.*pDecryptRecv)(&firstSizeByte, 1);
-              if (firstSizeByte & 0x80) // got large packet
+              // decrypt first byte and check if size is 3 or 2 bytes
+              if(!_hdrdecrypted)
+              {
+                  (_crypt.*pDecryptRecv)(data, 1);
+                  _hdrdecrypted = true;
+              }
+              if (data[0] & 0x80) // got large packet
               {
+                  if(avail < sizeof(ServerPktHeaderBig))
+                  {
+                      DEBUG(logdebug("Delaying header reading, bufsize is %u but should be >= %u",avail,sizeof(ServerPktHeaderBig)));
+                      break;
+                  }
+                  (_crypt.*pDecryptRecv)(data + 1, sizeof(ServerPktHeaderBig) - 1); // decrypt 2 of 3 bytes (first one already decrypted above) of size, and cmd
                   ServerPktHeaderBig hdr;
-                  ibuf.Read(((char*)&hdr) + 1, sizeof(ServerPktHeaderBig) - 1); // read *big* header, except first byte
-                  (_crypt.*pDecryptRecv)(((uint8*)&hdr) + 1, sizeof(ServerPktHeaderBig) - 1); // decrypt 2 of 3 bytes (first one already decrypted above) of size, and cmd
-                  hdr.size[0] = firstSizeByte; // assign missing first byte
+                  memcpy(&hdr, data, sizeof(ServerPktHeaderBig));
 
                   uint32 realsize = ((hdr.size[0]&0x7F) << 16) | (hdr.size[1] << 8) | hdr.size[2];
                   _remaining = realsize - 2;
                   _opcode = hdr.cmd;
+                  _slabpos += sizeof(ServerPktHeaderBig);
               }
               else // "normal" packet
               {
+                  if(avail < sizeof(ServerPktHeader))
+                  {
+                      DEBUG(logdebug("Delaying header reading, bufsize is %u but should be >= %u",avail,sizeof(ServerPktHeader)));
+                      break;
+                  }
+                  (_crypt.*pDecryptRecv)(data + 1, sizeof(ServerPktHeader) - 1); // decrypt all except first
                   ServerPktHeader hdr;
-                  ibuf.Read(((char*)&hdr) + 1, sizeof(ServerPktHeader) - 1); // read header, except first byte
-                  (_crypt.*pDecryptRecv)(((uint8*)&hdr) + 1, sizeof(ServerPktHeader) - 1); // decrypt all except first
-                  hdr.size |= firstSizeByte; // add already decrypted first byte
+                  memcpy(&hdr, data, sizeof(ServerPktHeader));
 
                   _remaining = ntohs(hdr.size) - 2;
                   _opcode = hdr.cmd;
+                  _slabpos += sizeof(ServerPktHeader);
               }
+              _hdrdecrypted = false;
             }
             else
             {
+              if(avail < sizeof(ServerPktHeader))
+              {
+                  DEBUG(logdebug("Delaying header reading, bufsize is %u but should be >= %u",avail,sizeof(ServerPktHeader)));
+                  break;
+              }
+              (_crypt.*pDecryptRecv)(data, sizeof(ServerPktHeader)); // decrypt all
               ServerPktHeader hdr;
-              ibuf.Read(((char*)&hdr), sizeof(ServerPktHeader)); // read header
-              (_crypt.*pDecryptRecv)(((uint8*)&hdr), sizeof(ServerPktHeader)); // decrypt all
+              memcpy(&hdr, data, sizeof(ServerPktHeader));
 
               _remaining = ntohs(hdr.size) - 2;
               _opcode = hdr.cmd;
-
+              _slabpos += sizeof(ServerPktHeader);
             }
 
             if(_opcode > MAX_OPCODE_ID)
@@ -135,9 +174,7 @@ void WorldSocket::OnRead()
             // the header is fine, now check if there are more data
             if(_remaining == 0) // this is a packet with no data (like CMSG_NULL_ACTION)
             {
-                WorldPacket *wp = new WorldPacket;
-                wp->SetOpcode(_opcode);
-                GetSession()->AddToPktQueue(wp);
+                _QueuePacket(NULL, 0);
             }
             else // there is a data part to fetch
             {
@@ -147,6 +184,66 @@ void WorldSocket::OnRead()
     }
 }
 
+// make sure there is room for the next recv() and that a pending packet body will end up contiguous.
+// this replaces the wrap-around of a ring buffer: the unparsed rest is moved to the slab start instead.
+void WorldSocket::_PrepareSlab(void)
+{
+    uint32 pending = _slablen - _slabpos;
+    uint32 want = pending + WORLDSOCKET_MIN_READ;
+    if(_gothdr && _remaining + WORLDSOCKET_MIN_READ > want)
+        want = _remaining + WORLDSOCKET_MIN_READ;
+
+    if(!_slabrefs) // nothing points into the slab, it can be compacted and resized freely
+    {
+        if(_slabpos)
+        {
+            memmove(_slab, _slab + _slabpos, pending);
+            _slabpos = 0;
+            _slablen = pending;
+        }
+        if(want > _slabsize)
+        {
+            _slab = (uint8*)realloc(_slab, want);
+            _slabsize = want;
+        }
+    }
+    else if(_slabsize - _slabpos < want) // packets still reference the slab, continue in a new one
+    {
+        uint32 newsize = want > _slabsize ? want : _slabsize;
+        uint8 *newslab = (uint8*)malloc(newsize);
+        memcpy(newslab, _slab + _slabpos, pending);
+        _retired.push_back(_slab);
+        _slab = newslab;
+        _slabsize = newsize;
+        _slabpos = 0;
+        _slablen = pending;
+    }
+}
+
+void WorldSocket::_QueuePacket(uint8 *data, uint32 size)
+{
+    WorldPacket *wp = GetSession()->AcquirePacket();
+    wp->SetOpcode(_opcode);
+    if(size)
+    {
+        wp->setExternal(data, size);
+        wp->SetSlabRef(true);
+        _slabrefs++;
+    }
+    GetSession()->AddToRecvQueue(wp);
+}
+
+void WorldSocket::ReleaseSlabRef(void)
+{
+    ASSERT(_slabrefs > 0);
+    if(--_slabrefs == 0)
+    {
+        for(uint32 i = 0; i < _retired.size(); i++)
+            free(_retired[i]);
+        _retired.clear();
+    }
+}
+
 void WorldSocket::SendWorldPacket(WorldPacket &pkt)
 {
     if(!_ok)
@@ -4,6 +4,9 @@
 #include "Network/TcpSocket.h"
 #include "SysDefs.h"
 
+#define WORLDSOCKET_SLAB_SIZE 65536 // initial size of the receive slab, grows if a packet does not fit
+#define WORLDSOCKET_MIN_READ 4096   // free space to keep at the slab end for each recv() call
+
 class WorldSession;
 class BigNumber;
 
@@ -46,6 +49,7 @@ class WorldSocket : public TcpSocket
 {
 public:
     WorldSocket(SocketHandler &h, WorldSession *s);
+    ~WorldSocket();
     WorldSession *GetSession(void) { return _session; }
     bool IsOk();
     
@@ -57,18 +61,32 @@ public:
 
     void SendWorldPacket(WorldPacket &pkt);
     void InitCrypt(BigNumber *);
+    void ReleaseSlabRef(void); // called when a packet pointing into the receive slab was handled
 
 private:
+    void _PrepareSlab(void);
+    void _QueuePacket(uint8 *data, uint32 size);
+
     WorldSession *_session;
     AuthCrypt _crypt;
     void (AuthCrypt::*pInit)(BigNumber *);
     void (AuthCrypt::*pDecryptRecv)(uint8 *, size_t);
     void (AuthCrypt::*pEncryptSend)(uint8 *, size_t);
     bool _gothdr; // true if only the header was recieved yet
+    bool _hdrdecrypted; // true if the first header byte is already decrypted (client > TBC)
     uint16 _opcode; // stores the last recieved opcode
     uint32 _remaining; // bytes amount of the next data packet
     bool _ok;
 
+    // contiguous receive buffer. packets are decrypted and parsed in place and handed out as views,
+    // so the unparsed rest may only be moved to the front while no packet references the slab.
+    uint8 *_slab;
+    uint32 _slabsize; // allocated bytes
+    uint32 _slabpos; // start of unparsed data
+    uint32 _slablen; // end of received data
+    uint32 _slabrefs; // packets currently pointing into a slab
+    std::vector<uint8*> _retired; // replaced slabs that were still referenced; freed when _slabrefs drops to 0
+
 };
 
 #endif
@@ -3,10 +3,13 @@
 #include "common.h"
 #include "main.h"
 #include "PseuWoW.h"
+#include "InstanceHost.h"
+#include "Bench.h"
 #include "MemoryDataHolder.h"
 
 
 std::list<PseuInstanceRunnable*> instanceList; // TODO: move this to a "Master" class later
+volatile sig_atomic_t hostStopRequest = 0; // only used in host mode (-host <instance list>): set by the signal handler, see PseuInstanceHost::Run()
 
 
 void _HookSignals(void)
@@ -60,6 +63,8 @@ void quitproc(void)
     {
         (*i)->GetInstance()->Stop();
     }
+    if(hostStopRequest != 2)
+        hostStopRequest = 1;
 }
 
 void abortproc(void)
@@ -70,6 +75,7 @@ void abortproc(void)
         (*i)->GetInstance()->SetFastQuit(true);
         (*i)->GetInstance()->Stop();
     }
+    hostStopRequest = 2;
 }
 
 void _new_handler(void)
@@ -102,13 +108,28 @@ int main(int argc, char* argv[])
         _HookSignals();
         MemoryDataHolder::Init();
 
-        // 1 instance is enough for now
-        PseuInstanceRunnable *r=new PseuInstanceRunnable();
-        ZThread::Thread t(r);
-        instanceList.push_back(r);
-        t.setPriority((ZThread::Priority)2);
-        //...
-        t.wait();
+        if(argc > 2 && !stricmp(argv[1], "-host"))
+        {
+            // run all instances from the given list in this process
+            PseuInstanceHost *host = new PseuInstanceHost();
+            if(host->LoadConfig(argv[2]))
+                host->Run(&hostStopRequest);
+            delete host;
+        }
+        else if(argc > 2 && !stricmp(argv[1], "-bench"))
+        {
+            RunBench(argc, argv);
+        }
+        else
+        {
+            // 1 instance is enough for now
+            PseuInstanceRunnable *r=new PseuInstanceRunnable();
+            ZThread::Thread t(r);
+            instanceList.push_back(r);
+            t.setPriority((ZThread::Priority)2);
+            //...
+            t.wait();
+        }
         //...
         log_close();
         MemoryDataHolder::Shutdown();
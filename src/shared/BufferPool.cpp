@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include "BufferPool.h"
+
+#if COMPILER == COMPILER_MICROSOFT
+#  include <windows.h>
+#  define THREADLOCAL __declspec(thread)
+#  define ATOMIC_ADD(v,n) InterlockedExchangeAdd64((volatile LONGLONG*)&(v), (LONGLONG)(n))
+#  define SPIN_TRYLOCK(l) (InterlockedExchange(&(l), 1) == 0)
+#  define SPIN_UNLOCK(l) InterlockedExchange(&(l), 0)
+   typedef volatile LONG spinlock_t;
+#else
+#  define THREADLOCAL __thread
+#  define ATOMIC_ADD(v,n) __sync_fetch_and_add(&(v), (uint64)(n))
+#  define SPIN_TRYLOCK(l) (__sync_lock_test_and_set(&(l), 1) == 0)
+#  define SPIN_UNLOCK(l) __sync_lock_release(&(l))
+   typedef volatile int spinlock_t;
+#endif
+
+namespace BufferPool
+{
+    // shared free list of one size class. the blocks are linked through their first bytes.
+    struct SharedList
+    {
+        spinlock_t lock;
+        void *head;
+        uint32 count;
+    };
+
+    SharedList shared[SIZE_CLASSES];
+    volatile uint64 statAllocs = 0, statFrees = 0, statThreadHits = 0, statSharedHits = 0, statMallocs = 0, statBytesInUse = 0, statBytesCached = 0;
+
+    // blocks kept in a thread's cache are lost when the thread exits; there are only a few long living threads, so thats acceptable.
+    THREADLOCAL void *threadCache[SIZE_CLASSES][THREAD_CACHE_BLOCKS];
+    THREADLOCAL uint32 threadCount[SIZE_CLASSES];
+
+    // the lists are only held for a few instructions, so spinning is cheaper than a mutex here
+    inline void Lock(SharedList& sl)
+    {
+        while(!SPIN_TRYLOCK(sl.lock))
+            ;
+    }
+
+    inline void Unlock(SharedList& sl)
+    {
+        SPIN_UNLOCK(sl.lock);
+    }
+
+    // returns the size class index for a block of given size, or -1 if it is too big to be pooled
+    inline int SizeClass(size_t size)
+    {
+        int c = 0;
+        while((size_t(1) << (c + MIN_BLOCK_SHIFT)) < size)
+            if(++c >= SIZE_CLASSES)
+                return -1;
+        return c;
+    }
+
+    void *Alloc(size_t size, size_t *capacity)
+    {
+        ATOMIC_ADD(statAllocs, 1);
+        int c = SizeClass(size);
+        if(c < 0)
+        {
+            ATOMIC_ADD(statMallocs, 1);
+            ATOMIC_ADD(statBytesInUse, size);
+            *capacity = size;
+            return malloc(size);
+        }
+        size_t blocksize = size_t(1) << (c + MIN_BLOCK_SHIFT);
+        *capacity = blocksize;
+        ATOMIC_ADD(statBytesInUse, blocksize);
+
+        if(threadCount[c])
+        {
+            ATOMIC_ADD(statThreadHits, 1);
+            return threadCache[c][--threadCount[c]];
+        }
+
+        SharedList& sl = shared[c];
+        void *p = NULL;
+        if(sl.head) // unlocked peek; checked again below
+        {
+            Lock(sl);
+            p = sl.head;
+            if(p)
+            {
+                sl.head = *(void**)p;
+                sl.count--;
+            }
+            Unlock(sl);
+        }
+        if(p)
+        {
+            ATOMIC_ADD(statSharedHits, 1);
+            ATOMIC_ADD(statBytesCached, -int64(blocksize));
+            return p;
+        }
+
+        ATOMIC_ADD(statMallocs, 1);
+        return malloc(blocksize);
+    }
+
+    void Free(void *p, size_t capacity)
+    {
+        if(!p)
+            return;
+        ATOMIC_ADD(statFrees, 1);
+        ATOMIC_ADD(statBytesInUse, -int64(capacity));
+        int c = SizeClass(capacity);
+        if(c < 0 || (size_t(1) << (c + MIN_BLOCK_SHIFT)) != capacity) // not one of our blocks
+        {
+            free(p);
+            return;
+        }
+
+        if(threadCount[c] < THREAD_CACHE_BLOCKS)
+        {
+            threadCache[c][threadCount[c]++] = p;
+            return;
+        }
+
+        SharedList& sl = shared[c];
+        bool cached = false;
+        Lock(sl);
+        if(sl.count < (uint32(SHARED_CACHE_BYTES) >> (c + MIN_BLOCK_SHIFT)))
+        {
+            *(void**)p = sl.head;
+            sl.head = p;
+            sl.count++;
+            cached = true;
+        }
+        Unlock(sl);
+
+        if(cached)
+            ATOMIC_ADD(statBytesCached, capacity);
+        else
+            free(p);
+    }
+
+    void GetStats(Stats& st)
+    {
+        st.allocs = statAllocs;
+        st.frees = statFrees;
+        st.threadHits = statThreadHits;
+        st.sharedHits = statSharedHits;
+        st.mallocs = statMallocs;
+        st.bytesInUse = statBytesInUse;
+        st.bytesCached = statBytesCached;
+    }
+
+    void Trim(void)
+    {
+        for(int c = 0; c < SIZE_CLASSES; c++)
+        {
+            SharedList& sl = shared[c];
+            Lock(sl);
+            void *p = sl.head;
+            uint32 n = sl.count;
+            sl.head = NULL;
+            sl.count = 0;
+            Unlock(sl);
+
+            ATOMIC_ADD(statBytesCached, -int64(uint64(n) << (c + MIN_BLOCK_SHIFT)));
+            while(p)
+            {
+                void *next = *(void**)p;
+                free(p);
+                p = next;
+            }
+        }
+    }
+};
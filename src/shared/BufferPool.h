@@ -0,0 +1,39 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <stddef.h>
+#include "SysDefs.h"
+
+// size-classed block allocator used for ByteBuffer (and thus WorldPacket) storage.
+// every thread keeps a few blocks per size class for itself, the rest is shared between threads.
+// blocks bigger than the biggest class are passed straight to malloc/free.
+namespace BufferPool
+{
+    enum
+    {
+        MIN_BLOCK_SHIFT = 6,  // smallest class: 64 bytes
+        MAX_BLOCK_SHIFT = 16, // biggest class: 64 KB
+        SIZE_CLASSES = MAX_BLOCK_SHIFT - MIN_BLOCK_SHIFT + 1,
+        THREAD_CACHE_BLOCKS = 8, // per class and thread
+        SHARED_CACHE_BYTES = 4 * 1024 * 1024 // per class
+    };
+
+    struct Stats
+    {
+        uint64 allocs;       // Alloc() calls
+        uint64 frees;        // Free() calls
+        uint64 threadHits;   // served from the calling thread's cache
+        uint64 sharedHits;   // served from the shared cache
+        uint64 mallocs;      // had to go to malloc (cache empty or block too big)
+        uint64 bytesInUse;   // capacity of all blocks currently handed out
+        uint64 bytesCached;  // capacity of all blocks held in the shared caches
+    };
+
+    // returns a block of at least size bytes. *capacity receives the usable size, which must be passed to Free() again.
+    void *Alloc(size_t size, size_t *capacity);
+    void Free(void *p, size_t capacity);
+    void GetStats(Stats&);
+    void Trim(void); // give all blocks in the shared caches back to the system
+};
+
+#endif
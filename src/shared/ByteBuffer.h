@@ -19,15 +19,22 @@
 #ifndef _BYTEBUFFER_H
 #define _BYTEBUFFER_H
 
+#include <stdlib.h>
 #include <vector>
 #include <list>
 #include <map>
 #include <string>
+#include <algorithm>
+#include "BufferPool.h"
 #if defined( __GNUC__ ) && (__GNUC__ * 10000 + __GNUC_MINOR__ * 100)>=40300
   #include <cstring>
   #include <stdio.h>
 #endif
 
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1600)
+#  define BYTEBUFFER_HAS_MOVE
+#endif
+
 class ByteBufferException
 {
 public:
@@ -52,22 +59,88 @@ class ByteBuffer
 
         const static size_t DEFAULT_SIZE = 0xFF;
 
-        ByteBuffer(): _rpos(0), _wpos(0)
+        ByteBuffer(): _rpos(0), _wpos(0), _data(NULL), _size(0), _capacity(0), _external(false)
+        {
+            reserve(DEFAULT_SIZE);
+        }
+        ByteBuffer(size_t res): _rpos(0), _wpos(0), _data(NULL), _size(0), _capacity(0), _external(false)
         {
-            _storage.reserve(DEFAULT_SIZE);
+            reserve(res);
         }
-        ByteBuffer(size_t res): _rpos(0), _wpos(0)
+        ByteBuffer(const ByteBuffer &buf): _rpos(buf._rpos), _wpos(buf._wpos), _data(NULL), _size(0), _capacity(0), _external(false)
         {
-            _storage.reserve(res);
+            _assign(buf.contents(), buf.size());
+        }
+#ifdef BYTEBUFFER_HAS_MOVE
+        ByteBuffer(ByteBuffer &&buf): _rpos(0), _wpos(0), _data(NULL), _size(0), _capacity(0), _external(false)
+        {
+            swap(buf);
+        }
+        ByteBuffer &operator=(ByteBuffer &&buf)
+        {
+            if(this != &buf)
+            {
+                _release();
+                _size = 0;
+                _rpos = _wpos = 0;
+                swap(buf);
+            }
+            return *this;
+        }
+#endif
+        ~ByteBuffer()
+        {
+            _release();
+        }
+        ByteBuffer &operator=(const ByteBuffer &buf)
+        {
+            if(this != &buf)
+            {
+                _size = 0;
+                _assign(buf.contents(), buf.size());
+                _rpos = buf._rpos;
+                _wpos = buf._wpos;
+            }
+            return *this;
         }
-        ByteBuffer(const ByteBuffer &buf): _rpos(buf._rpos), _wpos(buf._wpos), _storage(buf._storage) { }
 
         void clear()
         {
-            _storage.clear();
+            if(_external) // drop the reference, keep nothing
+            {
+                _data = NULL;
+                _capacity = 0;
+                _external = false;
+            }
+            _size = 0;
             _rpos = _wpos = 0;
         }
 
+        // let the buffer use memory it does not own (read-only view, e.g. into a socket receive buffer).
+        // the memory must stay valid until clear() is called or the buffer is destroyed.
+        // anything that writes to or grows the buffer makes a private copy first.
+        void setExternal(const uint8 *src, size_t len)
+        {
+            _release();
+            _data = (uint8*)src;
+            _size = _capacity = len;
+            _external = true;
+            _rpos = 0;
+            _wpos = len;
+        }
+        inline bool isExternal() const { return _external; }
+
+        // exchange contents and positions with another buffer without copying any data
+        void swap(ByteBuffer &buf)
+        {
+            std::swap(_rpos, buf._rpos);
+            std::swap(_wpos, buf._wpos);
+            std::swap(_data, buf._data);
+            std::swap(_size, buf._size);
+            std::swap(_capacity, buf._capacity);
+            std::swap(_external, buf._external);
+        }
+
         template <typename T> void append(T value)
         {
             append((uint8 *)&value, sizeof(value));
@@ -195,7 +268,7 @@ class ByteBuffer
 
         size_t rpos(size_t rpos)
         {
-            _rpos = rpos < _storage.capacity() ? rpos : _storage.capacity();
+            _rpos = rpos < _capacity ? rpos : _capacity;
             return _rpos;
         };
 
@@ -206,7 +279,7 @@ class ByteBuffer
 
         size_t wpos(size_t wpos)
         {
-            _wpos = wpos < _storage.capacity() ? wpos : _storage.capacity();
+            _wpos = wpos < _capacity ? wpos : _capacity;
             return _wpos;
         }
 
@@ -220,14 +293,14 @@ class ByteBuffer
         {
             if(pos + sizeof(T) > size())
                 throw ByteBufferException("read", pos, _wpos, sizeof(T), size());
-            return *((T*)&_storage[pos]);
+            return *((T*)&_data[pos]);
         }
 
         void read(uint8 *dest, size_t len)
         {
             if (_rpos + len <= size())
             {
-                memcpy(dest, &_storage[_rpos], len);
+                memcpy(dest, &_data[_rpos], len);
             }
             else
             {
@@ -236,19 +309,19 @@ class ByteBuffer
             _rpos += len;
         }
 
-        const uint8 *contents() const { return &_storage[0]; };
+        const uint8 *contents() const { return _data; };
 
-        inline size_t size() const { return _storage.size(); };
+        inline size_t size() const { return _size; };
 
         void resize(size_t newsize)
         {
-            _storage.resize(newsize);
+            _resize(newsize);
             _rpos = 0;
             _wpos = size();
         };
         void reserve(size_t ressize)
         {
-            if (ressize > size()) _storage.reserve(ressize);
+            if (ressize > size()) _reserve(ressize);
         };
 
         void append(const std::string& str)
@@ -262,9 +335,9 @@ class ByteBuffer
         void append(const uint8 *src, size_t cnt)
         {
             if (!cnt) return;
-            if (_storage.size() < _wpos + cnt)
-                _storage.resize(_wpos + cnt);
-            memcpy(&_storage[_wpos], src, cnt);
+            if (_size < _wpos + cnt)
+                _resize(_wpos + cnt);
+            memcpy(&_data[_wpos], src, cnt);
             _wpos += cnt;
         }
         void append(const ByteBuffer& buffer)
@@ -293,8 +366,8 @@ class ByteBuffer
 
         void appendPackGUID(uint64 guid)
         {
-            if (_storage.size() < _wpos + sizeof(guid) + 1)
-                _storage.resize(_wpos + sizeof(guid) + 1);
+            if (_size < _wpos + sizeof(guid) + 1)
+                _resize(_wpos + sizeof(guid) + 1);
 
             size_t mask_position = wpos();
             *this << uint8(0);
@@ -302,7 +375,7 @@ class ByteBuffer
             {
                 if(guid & 0xFF)
                 {
-                    _storage[mask_position] |= uint8(1 << i);
+                    _data[mask_position] |= uint8(1 << i);
                     *this << uint8(guid & 0xFF);
                 }
 
@@ -312,7 +385,9 @@ class ByteBuffer
 
         void put(size_t pos, const uint8 *src, size_t cnt)
         {
-            memcpy(&_storage[pos], src, cnt);
+            if(_external) // never write into memory we don't own
+                _reserve(_size);
+            memcpy(&_data[pos], src, cnt);
         }
         void print_storage()
         {
@@ -463,7 +538,53 @@ class ByteBuffer
     protected:
 
         size_t _rpos, _wpos;
-        std::vector<uint8> _storage;
+
+    private:
+        // grow the storage to at least newcap bytes. external memory is copied into own storage first.
+        // storage comes from the BufferPool, so the capacity is rounded up to its block size.
+        void _reserve(size_t newcap)
+        {
+            if(newcap <= _capacity && !_external)
+                return;
+            if(newcap < _size)
+                newcap = _size;
+            size_t cap;
+            uint8 *p = (uint8*)BufferPool::Alloc(newcap ? newcap : 1, &cap);
+            if(_size)
+                memcpy(p, _data, _size);
+            _release();
+            _data = p;
+            _capacity = cap;
+        }
+        // same semantics as std::vector::resize(): new bytes are zeroed, growth is geometric
+        void _resize(size_t newsize)
+        {
+            if(newsize > _capacity || _external)
+                _reserve(newsize > _capacity * 2 ? newsize : _capacity * 2);
+            if(newsize > _size)
+                memset(_data + _size, 0, newsize - _size);
+            _size = newsize;
+        }
+        void _assign(const uint8 *src, size_t len)
+        {
+            if(len > _capacity || _external)
+                _reserve(len);
+            if(len)
+                memcpy(_data, src, len);
+            _size = len;
+        }
+        void _release()
+        {
+            if(_data && !_external)
+                BufferPool::Free(_data, _capacity);
+            _data = NULL;
+            _capacity = 0;
+            _external = false;
+        }
+
+        uint8 *_data;
+        size_t _size, _capacity;
+        bool _external;
 };
 
 template <typename T> ByteBuffer &operator<<(ByteBuffer &b, std::vector<T> v)
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include "common.h"
+#include "HeightMap.h"
+#include "MappedFile.h"
+
+// quantize n heights (relative to base) into out. minz and step receive the absolute height of value 0 and the height per step.
+static void QuantizeHeights(const float *h, uint32 n, float base, uint16 *out, float& minz, float& step)
+{
+    float lo = h[0], hi = h[0];
+    for(uint32 i = 1; i < n; i++)
+    {
+        if(h[i] < lo)
+            lo = h[i];
+        else if(h[i] > hi)
+            hi = h[i];
+    }
+    minz = base + lo;
+    step = (hi - lo) / 65535.0f;
+    for(uint32 i = 0; i < n; i++)
+        out[i] = step > 0.0f ? uint16((h[i] - lo) / step + 0.5f) : 0;
+}
+
+HeightMap::HeightMap()
+{
+    _hdr = NULL;
+    _liquid = NULL;
+    _buf = NULL;
+    _file = NULL;
+}
+
+HeightMap::~HeightMap()
+{
+    Clear();
+}
+
+void HeightMap::Clear(void)
+{
+    delete [] _buf;
+    delete _file;
+    _buf = NULL;
+    _file = NULL;
+    _hdr = NULL;
+    _liquid = NULL;
+}
+
+void HeightMap::BuildFromADT(ADTFile *adt, uint32 adtsize)
+{
+    Clear();
+    uint32 liquids = 0;
+    for(uint32 ch = 0; ch < CHUNKS_PER_TILE; ch++)
+        if(adt->_chunks[ch].haswater)
+            liquids++;
+
+    _buf = new uint8[sizeof(HeightMapHeader) + liquids * sizeof(MapChunkLiquid)];
+    HeightMapHeader *hdr = (HeightMapHeader*)_buf;
+    MapChunkLiquid *lq = (MapChunkLiquid*)(hdr + 1);
+    memset(hdr, 0, sizeof(HeightMapHeader)); // no uninitialized padding bytes in saved files
+    hdr->magic = HEIGHTMAP_MAGIC;
+    hdr->version = HEIGHTMAP_VERSION;
+    hdr->headersize = sizeof(HeightMapHeader);
+    hdr->adtsize = adtsize;
+    hdr->liquids = liquids;
+    hdr->xbase = adt->_chunks[0].hdr.xbase;
+    hdr->ybase = adt->_chunks[0].hdr.ybase;
+    hdr->hbase = adt->_chunks[0].hdr.zbase;
+
+    uint32 l = 0;
+    for(uint32 ch = 0; ch < CHUNKS_PER_TILE; ch++)
+    {
+        ADTMapChunk& ac = adt->_chunks[ch];
+        MapChunkHeights& hc = hdr->heights[ch];
+        hc.basex = ac.hdr.xbase;
+        hc.basey = ac.hdr.ybase;
+        // vertices are stored as 9 rough, 8 fine, 9 rough, ... ; rough and fine share one range.
+        // the quantized values are stored in the same order: all rough ones, then all fine ones.
+        float v[9*9 + 8*8];
+        uint32 fcnt=0, rcnt=0;
+        while(true) //9*9 + 8*8
+        {
+            for(uint32 h=0; h<9; h++, rcnt++)
+                v[rcnt] = ac.vertices[fcnt+rcnt];
+            if(rcnt+fcnt >= 145)
+                break;
+            for(uint32 h=0; h<8; h++, fcnt++)
+                v[9*9 + fcnt] = ac.vertices[fcnt+rcnt];
+        }
+        uint16 q[9*9 + 8*8];
+        QuantizeHeights(v, 9*9 + 8*8, ac.hdr.zbase, q, hc.minz, hc.step);
+        memcpy(hc.rough, q, sizeof(hc.rough));
+        memcpy(hc.fine, q + 9*9, sizeof(hc.fine));
+
+        if(ac.haswater)
+        {
+            float lh[9*9];
+            for(uint32 i = 0; i < 81; i++)
+                lh[i] = ac.lqvertex[i].h;
+            memset(&lq[l], 0, sizeof(MapChunkLiquid));
+            lq[l].level = ac.waterlevel;
+            QuantizeHeights(lh, 9*9, 0.0f, lq[l].h, lq[l].minz, lq[l].step);
+            hdr->liquidIdx[ch] = (int16)l;
+            l++;
+        }
+        else
+            hdr->liquidIdx[ch] = -1;
+    }
+
+    _hdr = hdr;
+    _liquid = lq;
+}
+
+bool HeightMap::Load(const char *fn, uint32 adtsize)
+{
+    Clear();
+    MappedFile *mf = new MappedFile();
+    if(!mf->Open(fn))
+    {
+        delete mf;
+        return false;
+    }
+    const HeightMapHeader *hdr = (const HeightMapHeader*)mf->GetData();
+    if(mf->GetSize() < sizeof(HeightMapHeader)
+        || hdr->magic != HEIGHTMAP_MAGIC || hdr->version != HEIGHTMAP_VERSION || hdr->headersize != sizeof(HeightMapHeader)
+        || mf->GetSize() != sizeof(HeightMapHeader) + hdr->liquids * sizeof(MapChunkLiquid)
+        || (adtsize && hdr->adtsize && adtsize != hdr->adtsize))
+    {
+        logdebug("HeightMap: '%s' is outdated or invalid", fn);
+        delete mf;
+        return false;
+    }
+    for(uint32 i = 0; i < CHUNKS_PER_TILE; i++)
+    {
+        if(hdr->liquidIdx[i] >= int16(hdr->liquids))
+        {
+            logerror("HeightMap: '%s' is corrupt", fn);
+            delete mf;
+            return false;
+        }
+    }
+    _file = mf;
+    _hdr = hdr;
+    _liquid = (const MapChunkLiquid*)(hdr + 1);
+    return true;
+}
+
+// writes to a temp file first, so that other processes never map a half written file
+bool HeightMap::Save(const char *fn)
+{
+    if(!_hdr)
+        return false;
+    std::string tmps = MakeTempFilename(fn, this);
+    const char *tmp = tmps.c_str();
+    FILE *fh = fopen(tmp, "wb");
+    if(!fh)
+        return false;
+    bool ok = fwrite(_hdr, GetDataSize(), 1, fh) == 1;
+    ok = fclose(fh) == 0 && ok;
+#if PLATFORM == PLATFORM_WIN32
+    remove(fn); // rename() does not overwrite here
+#endif
+    if(!ok || rename(tmp, fn) != 0)
+    {
+        remove(tmp);
+        return false;
+    }
+    return true;
+}
+
+uint32 HeightMap::GetDataSize(void)
+{
+    return _hdr ? sizeof(HeightMapHeader) + _hdr->liquids * sizeof(MapChunkLiquid) : 0;
+}
+
+uint32 HeightMap::GetChecksum(void)
+{
+    if(!_hdr)
+        return 0;
+    // FNV-1a, starting behind adtsize
+    const uint8 *p = (const uint8*)&_hdr->liquids;
+    const uint8 *end = (const uint8*)_hdr + GetDataSize();
+    uint32 h = 2166136261u;
+    for( ; p < end; p++)
+        h = (h ^ *p) * 16777619u;
+    return h ? h : 1; // 0 means "no height map"
+}
+
+uint32 HeightMap::GetMemoryUsage(void)
+{
+    return _buf ? GetDataSize() : 0;
+}
@@ -0,0 +1,76 @@
+#ifndef HEIGHTMAP_H
+#define HEIGHTMAP_H
+
+#include "ADTFile.h"
+
+class MappedFile;
+
+#define HEIGHTMAP_MAGIC 0x50414D48 // "HMAP"
+#define HEIGHTMAP_VERSION 1
+
+// heights of one chunk, quantized to 16 bits between the lowest and highest point of the chunk.
+// this is all GetZ() needs; ~300 bytes instead of ~18 KB for a full MapChunk.
+struct MapChunkHeights
+{
+    float basex,basey;
+    float minz; // absolute height of the lowest vertex
+    float step; // height per quantization step
+    uint16 rough[9*9];
+    uint16 fine[8*8];
+    inline float GetRough(uint32 i) const { return minz + rough[i] * step; }
+    inline float GetFine(uint32 i) const { return minz + fine[i] * step; }
+};
+
+// liquid heights of one chunk, quantized like MapChunkHeights. only stored for chunks that have liquid.
+struct MapChunkLiquid
+{
+    float level;
+    float minz;
+    float step;
+    uint16 h[9*9];
+    inline float Get(uint32 i) const { return minz + h[i] * step; }
+};
+
+// layout of a .hmap file, followed by 'liquids' MapChunkLiquid structs.
+// the file is used as it is, without any parsing, so it can only be read on the kind of system that wrote it
+// (byte order, float format, struct padding). files written by another system are rejected and rebuilt.
+struct HeightMapHeader
+{
+    uint32 magic;
+    uint32 version;
+    uint32 headersize; // sizeof(HeightMapHeader) of the writer, catches different padding
+    uint32 adtsize; // size of the ADT file this was built from, to detect outdated files. 0 if unknown.
+    uint32 liquids;
+    float xbase, ybase, hbase;
+    MapChunkHeights heights[CHUNKS_PER_TILE]; // same order as the ADT chunks
+    int16 liquidIdx[CHUNKS_PER_TILE]; // index of the chunk's MapChunkLiquid, -1 if it has none
+};
+
+// the terrain heights of one map tile, either built from an ADT file or mapped read-only from a .hmap file.
+// mapped height maps cost no private memory and are shared by everyone using the same file.
+class HeightMap
+{
+public:
+    HeightMap();
+    ~HeightMap();
+    void BuildFromADT(ADTFile *adt, uint32 adtsize);
+    bool Load(const char *fn, uint32 adtsize); // adtsize 0: accept any
+    bool Save(const char *fn);
+    void Clear(void);
+    inline bool IsLoaded(void) { return _hdr != NULL; }
+    inline bool IsMapped(void) { return _file != NULL; }
+    inline const HeightMapHeader *GetHeader(void) { return _hdr; }
+    inline const MapChunkHeights *GetChunkHeights(uint32 i) { return &_hdr->heights[i]; }
+    inline const MapChunkLiquid *GetChunkLiquid(uint32 i) { int16 l = _hdr->liquidIdx[i]; return l < 0 ? NULL : &_liquid[l]; }
+    uint32 GetMemoryUsage(void); // private memory only
+    uint32 GetDataSize(void); // size of header and liquid data
+    uint32 GetChecksum(void); // of the terrain data, to detect changes. the ADT size is not included.
+
+private:
+    const HeightMapHeader *_hdr;
+    const MapChunkLiquid *_liquid;
+    uint8 *_buf; // own data, if built from an ADT
+    MappedFile *_file; // if loaded from a file
+};
+
+#endif
@@ -1,10 +1,34 @@
 #include "MPQFile.h"
 
 // MPQ file to be opened
+// the listfile is not needed; files are opened by name and ReadFile() tells StormLib the names it needs
 MPQFile::MPQFile(const char *fn)
 {
     _mpq = NULL;
-    _isopen = SFileOpenArchive(fn,0,0,&_mpq);
+    _clone = false;
+    _isopen = SFileOpenArchive(fn,0,MPQ_OPEN_NO_LISTFILE | MPQ_OPEN_NO_ATTRIBUTES | MPQ_OPEN_READ_ONLY,&_mpq);
+}
+
+// open the archive file again, for use by another thread. StormLib keeps the read position in the archive's file stream,
+// so threads must not share a stream, but the (big) hash and file tables are only read and can be shared.
+// the clone must be closed before the original.
+MPQFile *MPQFile::Clone(void)
+{
+    MPQFile *c = new MPQFile();
+    c->_mpq = NULL;
+    c->_clone = true;
+    c->_isopen = false;
+    if(!_isopen)
+        return c;
+    TMPQArchive *orig = (TMPQArchive*)_mpq;
+    TFileStream *stream = FileStream_OpenFile(orig->pStream->szFileName, false);
+    if(!stream)
+        return c;
+    TMPQArchive *ha = new TMPQArchive(*orig);
+    ha->pStream = stream;
+    c->_mpq = ha;
+    c->_isopen = true;
+    return c;
 }
 
 MPQFile::~MPQFile()
@@ -31,6 +55,20 @@ ByteBuffer MPQFile::ReadFile(const char *fn)
     return bb;
 }
 
+// read a whole file of given uncompressed size straight into dest.
+// StormLib must know the file's name already (see MPQHelper::_ReadFile), otherwise it changes the file table to store a guessed one.
+// threadsafe then, if every thread uses its own Clone().
+bool MPQFile::ReadFile(const char *fn, uint8 *dest, uint32 size)
+{
+    HANDLE fh;
+    if(!SFileOpenFileEx(_mpq, fn, 0, &fh))
+        return false;
+    DWORD bytes = 0;
+    SFileReadFile(fh, dest, size, &bytes, NULL);
+    SFileCloseFile(fh);
+    return bytes == size;
+}
+
 uint32 MPQFile::GetFileSize(const char *fn)
 {
     HANDLE fh;
@@ -43,7 +81,16 @@ uint32 MPQFile::GetFileSize(const char *fn)
 
 void MPQFile::Close(void)
 {
-	if(_isopen)
+    if(!_isopen)
+        return;
+    _isopen = false;
+    if(_clone)
+    {
+        TMPQArchive *ha = (TMPQArchive*)_mpq;
+        FileStream_Close(ha->pStream);
+        delete ha;
+    }
+    else
 		FreeMPQArchive((TMPQArchive*&)_mpq);
 }
 
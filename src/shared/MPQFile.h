@@ -12,14 +12,19 @@ public:
     MPQFile(const char*);
 	~MPQFile();
     inline bool IsOpen(void) { return _isopen; }
+    inline TMPQArchive *GetArchive(void) { return (TMPQArchive*)_mpq; }
+    MPQFile *Clone(void);
     ByteBuffer ReadFile(const char*);
+    bool ReadFile(const char *fn, uint8 *dest, uint32 size);
     uint32 GetFileSize(const char*);
     bool HasFile(const char*);
 	void Close(void);
 
 private:
+    MPQFile() {}
     HANDLE _mpq;
     bool _isopen;
+    bool _clone; // shares the tables of another MPQFile, only the file stream is our own
 
 };
 
@@ -6,6 +6,63 @@
 
 #define DATADIR "Data"
 
+#if COMPILER == COMPILER_MICROSOFT
+#  define THREADLOCAL __declspec(thread)
+#  define SPIN_TRYLOCK(l) (InterlockedExchange(&(l), 1) == 0)
+#  define SPIN_UNLOCK(l) InterlockedExchange(&(l), 0)
+   typedef volatile LONG spinlock_t;
+#else
+#  define THREADLOCAL __thread
+#  define SPIN_TRYLOCK(l) (__sync_lock_test_and_set(&(l), 1) == 0)
+#  define SPIN_UNLOCK(l) __sync_lock_release(&(l))
+   typedef volatile int spinlock_t;
+#endif
+
+struct MPQThreadList;
+
+// the archive handles of one thread, opened when the thread first reads from an archive.
+// kept until the MPQHelper is destroyed, also if the thread exits earlier.
+struct MPQThreadArchives
+{
+    MPQHelper *owner;
+    std::vector<MPQFile*> files; // same order as MPQHelper::_files, NULL if not opened yet
+    MPQThreadArchives *next; // handles of other MPQHelpers used by the same thread
+    MPQThreadList *list; // the thread's list this is linked into
+};
+
+// the handles of all MPQHelpers a thread read from. created when a thread reads for the first time and kept
+// until the process ends, since there are only a few long living threads. the MPQHelper destructor unlinks its
+// handles from the lists of all threads.
+struct MPQThreadList
+{
+    MPQThreadArchives *first;
+};
+
+static THREADLOCAL MPQThreadList *threadList = NULL;
+
+// guards MPQHelper::_threadArchives, the thread lists and the file names in the shared file tables.
+// held only for a few instructions.
+static spinlock_t mpqLock = 0;
+
+static inline void MPQLock(void)
+{
+    while(!SPIN_TRYLOCK(mpqLock))
+        ;
+}
+
+static inline void MPQUnlock(void)
+{
+    SPIN_UNLOCK(mpqLock);
+}
+
+static inline uint32 RoundUpPow2(uint32 n)
+{
+    uint32 p = 1;
+    while(p < n)
+        p <<= 1;
+    return p;
+}
+
 
 MPQHelper::MPQHelper()
 {
@@ -64,44 +121,207 @@ void MPQHelper::Init()
     {
         if(::FileExists(*it))
         {
-            _files.push_back(new MPQFile((*it).c_str()));
+            MPQFile *mpq = new MPQFile((*it).c_str());
+            if(mpq->IsOpen())
+                _files.push_back(mpq);
+            else
+                delete mpq;
         }
     }
+    _BuildIndex();
 }
 
 MPQHelper::~MPQHelper()
 {
-    for(std::list<MPQFile*>::iterator it=_files.begin(); it != _files.end(); it++)
+    MPQLock();
+    for(uint32 i = 0; i < _threadArchives.size(); i++)
+    {
+        MPQThreadArchives **pp = &_threadArchives[i]->list->first;
+        while(*pp != _threadArchives[i])
+            pp = &(*pp)->next;
+        *pp = _threadArchives[i]->next;
+    }
+    MPQUnlock();
+    for(uint32 i = 0; i < _threadArchives.size(); i++)
     {
-        (*it)->Close();
-        delete *it;
+        for(uint32 a = 0; a < _threadArchives[i]->files.size(); a++)
+            delete _threadArchives[i]->files[a]; // clones must be closed first
+        delete _threadArchives[i];
     }
+    for(uint32 i = 0; i < _files.size(); i++)
+        delete _files[i];
 }
 
-ByteBuffer MPQHelper::ExtractFile(const char* fn)
+// merge the hash tables of all archives. a file is taken from the first archive that has it, in the locale set in StormLib
+// or else the neutral one, like StormLib itself chooses. entries that can not be opened or are empty are skipped,
+// then the file is looked for in the next archive.
+void MPQHelper::_BuildIndex(void)
 {
-    ByteBuffer bb;
-    for(std::list<MPQFile*>::iterator i = _files.begin(); i != _files.end(); i++)
+    _index.clear();
+    uint32 total = 0;
+    for(uint32 a = 0; a < _files.size(); a++)
     {
-        MPQFile *mpq = *i;
-        if(mpq->IsOpen() && mpq->HasFile(fn) && mpq->GetFileSize(fn) > 0)
+        TMPQArchive *ha = _files[a]->GetArchive();
+        if(!ha->pHashTable)
         {
-           // printf("MPQE: Using %s from %s\n",fn,i->c_str());
-            bb = mpq->ReadFile(fn);
-            return bb;
+            logdetail("MPQHelper: Archive %u has no hash table, not using a file index", a);
+            return;
         }
+        total += ha->dwFileTableSize;
     }
-    return bb; // will be empty if returned here
+    if(!total)
+        return;
+
+    IndexEntry empty;
+    memset(&empty, 0, sizeof(empty));
+    _index.resize(RoundUpPow2(total + total / 2), empty); // may be much less files due to the same files in different archives
+    uint32 mask = _index.size() - 1, count = 0;
+    for(uint32 a = 0; a < _files.size(); a++)
+    {
+        TMPQArchive *ha = _files[a]->GetArchive();
+        for(uint32 h = 0; h < ha->pHeader->dwHashTableSize; h++)
+        {
+            const TMPQHash& hash = ha->pHashTable[h];
+            if(hash.dwBlockIndex >= ha->dwFileTableSize || (hash.lcLocale && hash.lcLocale != lcFileLocale))
+                continue;
+            const TFileEntry& fe = ha->pFileTable[hash.dwBlockIndex];
+            if(!(fe.dwFlags & MPQ_FILE_EXISTS) || (fe.dwFlags & ~MPQ_FILE_VALID_FLAGS) || !fe.dwFileSize)
+                continue;
+            uint32 i = hash.dwName1 & mask;
+            while(_index[i].size && (_index[i].name1 != hash.dwName1 || _index[i].name2 != hash.dwName2))
+                i = (i + 1) & mask;
+            IndexEntry& e = _index[i];
+            if(e.size && (e.archive != a || e.locale || !hash.lcLocale))
+                continue; // already found in an archive with higher priority, or in the better locale
+            if(!e.size)
+                count++;
+            e.name1 = hash.dwName1;
+            e.name2 = hash.dwName2;
+            e.size = fe.dwFileSize;
+            e.block = hash.dwBlockIndex;
+            e.archive = a;
+            e.locale = hash.lcLocale;
+        }
+    }
+    logdetail("MPQHelper: Indexed %u files in %u archives", count, _files.size());
 }
 
-bool MPQHelper::FileExists(const char *fn)
+// returns the index entry of a file, or NULL if no archive has it. tmp is used if there is no index.
+const MPQHelper::IndexEntry *MPQHelper::_Find(const char *fn, IndexEntry& tmp)
+{
+    if(_index.size())
+    {
+        uint32 name1 = HashString(fn, MPQ_HASH_NAME_A);
+        uint32 name2 = HashString(fn, MPQ_HASH_NAME_B);
+        uint32 mask = _index.size() - 1;
+        for(uint32 i = name1 & mask; _index[i].size; i = (i + 1) & mask)
+            if(_index[i].name1 == name1 && _index[i].name2 == name2)
+                return &_index[i];
+        return NULL;
+    }
+    for(uint32 a = 0; a < _files.size(); a++)
+    {
+        TMPQArchive *ha = _files[a]->GetArchive();
+        TFileEntry *fe = GetFileEntryLocale(ha, fn, lcFileLocale);
+        if(fe && (fe->dwFlags & MPQ_FILE_EXISTS) && !(fe->dwFlags & ~MPQ_FILE_VALID_FLAGS) && fe->dwFileSize)
+        {
+            tmp.size = fe->dwFileSize;
+            tmp.block = fe - ha->pFileTable;
+            tmp.archive = a;
+            return &tmp;
+        }
+    }
+    return NULL;
+}
+
+MPQFile *MPQHelper::_GetThreadArchive(uint32 a)
+{
+    if(!threadList)
+    {
+        threadList = new MPQThreadList();
+        threadList->first = NULL;
+    }
+    MPQLock(); // another MPQHelper may be unlinking its handles from our list
+    MPQThreadArchives *ta = threadList->first;
+    while(ta && ta->owner != this)
+        ta = ta->next;
+    MPQUnlock();
+    if(!ta)
+    {
+        ta = new MPQThreadArchives();
+        ta->owner = this;
+        ta->files.resize(_files.size(), NULL);
+        ta->list = threadList;
+        MPQLock();
+        ta->next = threadList->first;
+        threadList->first = ta;
+        _threadArchives.push_back(ta);
+        MPQUnlock();
+    }
+    if(!ta->files[a])
+        ta->files[a] = _files[a]->Clone();
+    return ta->files[a];
+}
+
+bool MPQHelper::_ReadFile(const char *fn, const IndexEntry& e, uint8 *dest)
 {
-    for(std::list<MPQFile*>::iterator i = _files.begin(); i != _files.end(); i++)
+    MPQFile *mpq = _GetThreadArchive(e.archive);
+    if(!mpq->IsOpen())
+        return false;
+    // StormLib needs to know the name of a file to open it without guessing one (the listfile is not loaded)
+    TFileEntry *fe = _files[e.archive]->GetArchive()->pFileTable + e.block;
+    if(!fe->szFileName)
     {
-        if((*i)->IsOpen() && (*i)->HasFile(fn) && (*i)->GetFileSize(fn) > 0)
-            return true;
+        MPQLock();
+        if(!fe->szFileName)
+            AllocateFileName(fe, fn);
+        MPQUnlock();
     }
-    return false;
+    return mpq->ReadFile(fn, dest, e.size);
+}
+
+ByteBuffer MPQHelper::ExtractFile(const char* fn)
+{
+    ByteBuffer bb;
+    IndexEntry tmp;
+    const IndexEntry *e = _Find(fn, tmp);
+    if(e)
+    {
+        bb.resize(e->size);
+        if(!_ReadFile(fn, *e, (uint8*)bb.contents()))
+            bb.clear();
+    }
+    return bb; // will be empty if the file was not found
+}
+
+bool MPQHelper::ExtractFile(const char *fn, uint8 *&buf, uint32& size)
+{
+    IndexEntry tmp;
+    const IndexEntry *e = _Find(fn, tmp);
+    if(!e)
+        return false;
+    buf = new uint8[e->size];
+    if(!_ReadFile(fn, *e, buf))
+    {
+        delete [] buf;
+        buf = NULL;
+        return false;
+    }
+    size = e->size;
+    return true;
+}
+
+bool MPQHelper::FileExists(const char *fn)
+{
+    IndexEntry tmp;
+    return _Find(fn, tmp) != NULL;
+}
+
+uint32 MPQHelper::GetFileSize(const char *fn)
+{
+    IndexEntry tmp;
+    const IndexEntry *e = _Find(fn, tmp);
+    return e ? e->size : 0;
 }
 
 
@@ -4,7 +4,11 @@
 #define MAX_PATCH_NUMBER 9
 
 class MPQFile;
+struct MPQThreadArchives;
 
+// the MPQ archives of the client, highest priority (newest patch) first.
+// Init() builds one index over the files of all archives, so finding the archive that holds a file takes one hash lookup.
+// reading is threadsafe and threads do not wait for each other; every thread reads through its own file handles.
 class MPQHelper
 {
 public:
@@ -12,10 +16,27 @@ public:
     ~MPQHelper();
     void Init();
     ByteBuffer ExtractFile(const char*);
+    bool ExtractFile(const char *fn, uint8 *&buf, uint32& size); // buf is allocated with new[], the caller deletes it
     bool FileExists(const char*);
+    uint32 GetFileSize(const char*); // uncompressed size, 0 if the file is not there
 private:
-    std::list<MPQFile*> _files;
+    struct IndexEntry
+    {
+        uint32 name1, name2; // MPQ name hashes of the file
+        uint32 size; // uncompressed size, 0 for unused entries
+        uint32 block; // index into the archive's file table
+        uint16 archive;
+        uint16 locale;
+    };
+    void _BuildIndex(void);
+    const IndexEntry *_Find(const char *fn, IndexEntry& tmp);
+    bool _ReadFile(const char *fn, const IndexEntry& e, uint8 *dest);
+    MPQFile *_GetThreadArchive(uint32 a);
+
+    std::vector<MPQFile*> _files; // the archives that could be opened, in order of priority
     std::list<std::string> _patches;
+    std::vector<IndexEntry> _index; // open addressing, size is a power of 2. empty if some archive has no classic hash table.
+    std::vector<MPQThreadArchives*> _threadArchives; // of all threads, closed on destruction
 };
 
 #endif
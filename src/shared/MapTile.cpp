@@ -1,21 +1,39 @@
+#include <algorithm>
 #include "common.h"
 #include "MapTile.h"
 #include "log.h"
 #include "MemoryDataHolder.h"
+#include "NavGrid.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define MAPTILE_USE_SSE2
+#endif
 
 MapTile::MapTile()
 {
+    _chunks = NULL;
+    _nav = NULL;
 }
 
 MapTile::~MapTile()
 {
+    delete [] _chunks;
+    delete _nav;
 }
 
-void MapTile::ImportFromADT(ADTFile *adt)
+void MapTile::ImportFromADT(ADTFile *adt, bool headless /* = false */, uint32 adtsize /* = 0 */)
 {
+    if(!headless && !_chunks)
+        _chunks = new MapChunk[CHUNKS_PER_TILE];
+
+    // the quantized height maps, always needed
+    _hmap.BuildFromADT(adt, adtsize);
+    delete _nav;
+    _nav = NULL;
 
-    // import the height map
-    for(uint32 ch=0; ch<CHUNKS_PER_TILE; ch++)
+    // full chunk data, for rendering
+    for(uint32 ch=0; ch<CHUNKS_PER_TILE && _chunks; ch++)
     {
         _chunks[ch].baseheight = adt->_chunks[ch].hdr.zbase; // ADT files store (x/z) as ground coords and (y) as the height!
         _chunks[ch].basex = adt->_chunks[ch].hdr.xbase; // here converting it to (x/y) on ground and basehight as actual height.
@@ -70,6 +88,15 @@ void MapTile::ImportFromADT(ADTFile *adt)
         */
     }
 
+    _xbase = _hmap.GetHeader()->xbase;
+    _ybase = _hmap.GetHeader()->ybase;
+    _hbase = _hmap.GetHeader()->hbase;
+
+    DEBUG(logdebug("MapTile first chunk base: h=%f x=%f y=%f",_hbase,_xbase,_ybase));
+
+    if(headless) // models and sounds are only needed by the GUI
+        return;
+
     // copy over doodads and do some transformations
     DEBUG(logdebug("%u doodads", adt->_doodadsp.size()));
     for(uint32 i = 0; i < adt->_doodadsp.size(); i++)
@@ -121,12 +148,43 @@ void MapTile::ImportFromADT(ADTFile *adt)
 
     // copy sound emitters
     _soundemm = adt->_soundemm;
+}
 
-    _xbase = _chunks[0].basex;
-    _ybase = _chunks[0].basey;
-    _hbase = _chunks[0].baseheight;
+// map the heights from a .hmap file. returns false if there is none or it is outdated.
+bool MapTile::LoadHeightMap(const char *fn, uint32 adtsize)
+{
+    if(!_hmap.Load(fn, adtsize))
+        return false;
+    delete _nav;
+    _nav = NULL;
+    _xbase = _hmap.GetHeader()->xbase;
+    _ybase = _hmap.GetHeader()->ybase;
+    _hbase = _hmap.GetHeader()->hbase;
+    return true;
+}
 
-    DEBUG(logdebug("MapTile first chunk base: h=%f x=%f y=%f",_hbase,_xbase,_ybase));
+uint32 MapTile::GetMemoryUsage(void)
+{
+    uint32 size = sizeof(MapTile) + _hmap.GetMemoryUsage();
+    if(_nav)
+        size += sizeof(NavGrid);
+    if(_chunks)
+    {
+        size += CHUNKS_PER_TILE * sizeof(MapChunk);
+        size += _doodads.capacity() * sizeof(Doodad) + _wmo_data.capacity() * sizeof(WorldMapObject);
+        size += _soundemm.capacity() * sizeof(MCSE_chunk);
+    }
+    return size;
+}
+
+const NavGrid *MapTile::GetNavGrid(void)
+{
+    if(!_nav && _hmap.IsLoaded())
+    {
+        _nav = new NavGrid();
+        _nav->Build(_hmap);
+    }
+    return _nav;
 }
 
 void MapTileStorage::_DebugDump(void)
@@ -145,41 +203,102 @@ void MapTileStorage::_DebugDump(void)
     printf(out.c_str());
 }
 
-// get approx Z position for world position (x,y).
+// height at position (u, v) inside the grid cell (i, j) of a chunk; u and v go from 0 to 1 along x and y.
+// a cell is made of 4 triangles between its rough corner vertices and the fine vertex in its center.
+// for the triangle towards the u-edge with corners p0, p1 the plane works out as
+//   h = m + 2*|u - 0.5| * ((p0 + p1)/2 - m) + (p1 - p0) * (v - 0.5)
+// and the same with u and v swapped for the triangles towards the v-edges.
+// written with selects instead of branches, and mirrored by the SSE version in MapTile::GetZ(xs, ys, out, n).
+static inline float CellZ(float a, float b, float c, float d, float m, float u, float v)
+{
+    float du = u - 0.5f, dv = v - 0.5f;
+    float adu = fabsf(du), adv = fabsf(dv);
+    float p0 = du < 0.0f ? a : c; // corners of the u-edge (v = 0 and v = 1)
+    float p1 = du < 0.0f ? b : d;
+    float q0 = dv < 0.0f ? a : b; // corners of the v-edge (u = 0 and u = 1)
+    float q1 = dv < 0.0f ? c : d;
+    float hu = m + 2.0f * adu * ((p0 + p1) * 0.5f - m) + (p1 - p0) * dv;
+    float hv = m + 2.0f * adv * ((q0 + q1) * 0.5f - m) + (q1 - q0) * du;
+    return adu >= adv ? hu : hv;
+}
+
+// fetch the 4 corner and the center height of a grid cell. cx and cy are the cell coords on the tile (0..127).
+inline void MapTile::_GetCell(uint32 cx, uint32 cy, float *h)
+{
+    const MapChunkHeights& ch = *_hmap.GetChunkHeights((cx >> 3) * 16 + (cy >> 3));
+    uint32 i = cx & 7, j = cy & 7;
+    h[0] = ch.GetRough(i * 9 + j);
+    h[1] = ch.GetRough(i * 9 + j + 1);
+    h[2] = ch.GetRough((i + 1) * 9 + j);
+    h[3] = ch.GetRough((i + 1) * 9 + j + 1);
+    h[4] = ch.GetFine(i * 8 + j);
+}
+
+// get exact Z position of the terrain mesh at world position (x,y). returns INVALID_HEIGHT if (x,y) is not on this tile.
 float MapTile::GetZ(float x, float y)
 {
-    float bx,by;
-    float real_z;
-    bx = _chunks[0].basex; // world base coords of tile
-    by = _chunks[0].basey;
-    uint32 chx = (uint32)fabs((bx - x) / CHUNKSIZE); // get chunk id for given coords
-    uint32 chy = (uint32)fabs((by - y) / CHUNKSIZE);
-    if( chx > 15 || chy > 15)
-    {
-        logerror("MapTile::GetZ() wrong chunk indexes (%d, %d) for (%f, %f)",chx,chy,x,y);
-        logerror(" - These coords are NOT on this tile!");
+    float rx = (_xbase - x) * (1.0f / UNITSIZE); // position in grid cells from the tile corner, 0..128
+    float ry = (_ybase - y) * (1.0f / UNITSIZE);
+    if(!(rx >= 0.0f && rx <= 128.0f && ry >= 0.0f && ry <= 128.0f)) // also catches NaN
         return INVALID_HEIGHT;
-    }
-    MapChunk& ch = _chunks[chx*16 + chy];
-    uint32 vx,vy; // get vertex position (0,0) ... (8,8);
-    vy = (uint32)floor((fabs(ch.basey - y) / (CHUNKSIZE/16.0f)) + 0.5f);
-    if (vy % 2 == 0)
-    {
-        vx = (uint32)floor((fabs(ch.basex - x) / (CHUNKSIZE/8.0f)) + 0.5f);
-        real_z = ch.hmap_rough[vx*9 + (vy/2)] + ch.baseheight;
-    }
-    else if (vy % 2 != 0)
-    {
-        vx = (uint32)floor((fabs(ch.basex - x) / (CHUNKSIZE/7.0f)) ); //edit: removed + 0.5f
-        real_z = ch.hmap_fine[vx*8 + ((vy-1)/2)] + ch.baseheight;
-    }
-    if(vx > 8 || vy > 17)
+    uint32 cx = std::min(uint32(rx), uint32(127));
+    uint32 cy = std::min(uint32(ry), uint32(127));
+    float h[5];
+    _GetCell(cx, cy, h);
+    return CellZ(h[0], h[1], h[2], h[3], h[4], rx - cx, ry - cy);
+}
+
+// batch version, for path and line of sight sampling. positions not on this tile get INVALID_HEIGHT.
+void MapTile::GetZ(const float *xs, const float *ys, float *out, uint32 n)
+{
+    uint32 k = 0;
+#ifdef MAPTILE_USE_SSE2
+    const __m128 xb = _mm_set1_ps(_xbase), yb = _mm_set1_ps(_ybase), scale = _mm_set1_ps(1.0f / UNITSIZE);
+    const __m128 zero = _mm_setzero_ps(), half = _mm_set1_ps(0.5f), two = _mm_set1_ps(2.0f);
+    const __m128 lim = _mm_set1_ps(128.0f), maxcell = _mm_set1_ps(127.0f), invalid = _mm_set1_ps(INVALID_HEIGHT);
+    const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    for(; k + 4 <= n; k += 4)
     {
-        logerror("MapTile::GetZ() wrong vertex indexes (%d, %d) for chunk (%d, %d) for (%f, %f) chunkpos (%f, %f) tile (%f, %f)",vx,vy,chx,chy,x,y,ch.basex,ch.basey,bx,by);
-        return INVALID_HEIGHT;
-    }
+        __m128 rx = _mm_mul_ps(_mm_sub_ps(xb, _mm_loadu_ps(xs + k)), scale);
+        __m128 ry = _mm_mul_ps(_mm_sub_ps(yb, _mm_loadu_ps(ys + k)), scale);
+        __m128 valid = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(rx, zero), _mm_cmple_ps(rx, lim)),
+                                  _mm_and_ps(_mm_cmpge_ps(ry, zero), _mm_cmple_ps(ry, lim)));
+        rx = _mm_and_ps(rx, valid); // invalid lanes look up cell (0, 0) and are replaced at the end
+        ry = _mm_and_ps(ry, valid);
+        __m128 fx = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(rx)), maxcell);
+        __m128 fy = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(ry)), maxcell);
+        __m128 u = _mm_sub_ps(rx, fx), v = _mm_sub_ps(ry, fy);
 
-    return real_z;
+        int32 cx[4], cy[4];
+        _mm_storeu_si128((__m128i*)cx, _mm_cvttps_epi32(fx));
+        _mm_storeu_si128((__m128i*)cy, _mm_cvttps_epi32(fy));
+        float h[5][4], cell[5];
+        for(uint32 l = 0; l < 4; l++)
+        {
+            _GetCell(cx[l], cy[l], cell);
+            for(uint32 c = 0; c < 5; c++)
+                h[c][l] = cell[c];
+        }
+        __m128 a = _mm_loadu_ps(h[0]), b = _mm_loadu_ps(h[1]), c = _mm_loadu_ps(h[2]), d = _mm_loadu_ps(h[3]), m = _mm_loadu_ps(h[4]);
+
+        __m128 du = _mm_sub_ps(u, half), dv = _mm_sub_ps(v, half);
+        __m128 adu = _mm_and_ps(du, absmask), adv = _mm_and_ps(dv, absmask);
+        __m128 uneg = _mm_cmplt_ps(du, zero), vneg = _mm_cmplt_ps(dv, zero);
+        __m128 p0 = _mm_or_ps(_mm_and_ps(uneg, a), _mm_andnot_ps(uneg, c));
+        __m128 p1 = _mm_or_ps(_mm_and_ps(uneg, b), _mm_andnot_ps(uneg, d));
+        __m128 q0 = _mm_or_ps(_mm_and_ps(vneg, a), _mm_andnot_ps(vneg, b));
+        __m128 q1 = _mm_or_ps(_mm_and_ps(vneg, c), _mm_andnot_ps(vneg, d));
+        __m128 hu = _mm_add_ps(_mm_add_ps(m, _mm_mul_ps(_mm_mul_ps(two, adu), _mm_sub_ps(_mm_mul_ps(_mm_add_ps(p0, p1), half), m))),
+                               _mm_mul_ps(_mm_sub_ps(p1, p0), dv));
+        __m128 hv = _mm_add_ps(_mm_add_ps(m, _mm_mul_ps(_mm_mul_ps(two, adv), _mm_sub_ps(_mm_mul_ps(_mm_add_ps(q0, q1), half), m))),
+                               _mm_mul_ps(_mm_sub_ps(q1, q0), du));
+        __m128 uside = _mm_cmpge_ps(adu, adv);
+        __m128 z = _mm_or_ps(_mm_and_ps(uside, hu), _mm_andnot_ps(uside, hv));
+        _mm_storeu_ps(out + k, _mm_or_ps(_mm_and_ps(valid, z), _mm_andnot_ps(valid, invalid)));
+    }
+#endif
+    for(; k < n; k++)
+        out[k] = GetZ(xs[k], ys[k]);
 }
 
 void MapTile::DebugDumpToFile(void)
@@ -196,7 +315,7 @@ void MapTile::DebugDumpToFile(void)
             {
                 for(uint32 vx=0;vx<9;vx++)
                 {
-                    z = _chunks[cy*16 + cx].hmap_rough[vy*9 + vx] + _chunks[cy*16 + cx].baseheight;
+                    z = _hmap.GetChunkHeights(cy*16 + cx)->GetRough(vy*9 + vx);
                     p = (uint32)z;
                     uint32 pos = 17 + (p/10);
                     if(pos > strlen(f)-1)
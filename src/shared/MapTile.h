@@ -5,6 +5,9 @@
 
 #include "WDTFile.h"
 #include "ADTFile.h"
+#include "HeightMap.h"
+
+class NavGrid;
 
 #define TILESIZE (533.33333f)
 #define CHUNKSIZE ((TILESIZE) / 16.0f)
@@ -13,13 +16,12 @@
 
 #define INVALID_HEIGHT -99999.0f
 
-// individual chunks of a map
+// individual chunks of a map, with everything needed for rendering. only present if the tile was loaded with a GUI attached.
 class MapChunk
 {
 public:
     float hmap_rough[9*9];
     float hmap_fine[8*8];
-    float hmap[17*17]; // combined rough and fine hmap
     float basex,basey,baseheight,lqheight;
     float hmap_lq[9*9]; // liquid (water, lava) height map
     std::vector<std::string> texlayer;
@@ -47,15 +49,26 @@ struct WorldMapObject
 
 // generic map tile class. stores the information previously stored in an ADT file
 // in an easier to use form.
+// a headless tile (no GUI attached) keeps only the quantized height and liquid grids;
+// chunk render data, doodads, WMOs and sound emitters are not imported.
+// the heights of a headless tile can also come straight from a mapped .hmap file, without any ADT parsing.
 class MapTile
 {
 public:
     MapTile();
     ~MapTile();
-    void ImportFromADT(ADTFile*);
+    void ImportFromADT(ADTFile*, bool headless = false, uint32 adtsize = 0);
+    bool LoadHeightMap(const char *fn, uint32 adtsize); // headless only
+    inline HeightMap& GetHeightMap(void) { return _hmap; }
+    const NavGrid *GetNavGrid(void); // built on first use
     float GetZ(float,float);
+    void GetZ(const float *xs, const float *ys, float *out, uint32 n);
     void DebugDumpToFile(void);
-    inline MapChunk *GetChunk(uint32 x, uint32 y) { return &_chunks[y * 16 + x]; }
+    inline bool IsHeadless(void) { return _chunks == NULL; }
+    inline MapChunk *GetChunk(uint32 x, uint32 y) { return _chunks ? &_chunks[y * 16 + x] : NULL; }
+    inline const MapChunkHeights *GetChunkHeights(uint32 x, uint32 y) { return _hmap.GetChunkHeights(y * 16 + x); }
+    inline const MapChunkLiquid *GetChunkLiquid(uint32 x, uint32 y) { return _hmap.GetChunkLiquid(y * 16 + x); }
+    uint32 GetMemoryUsage(void); // approx. bytes used
     inline float GetBaseX(void) { return _xbase; }
     inline float GetBaseY(void) { return _ybase; }
     inline float GetBaseHeight(void) { return _hbase; }
@@ -67,7 +80,11 @@ public:
     inline WorldMapObject *GetWMO(uint32 i) { return &_wmo_data[i]; }
 
 private:
-    MapChunk _chunks[256]; // 16x16
+    inline void _GetCell(uint32 cx, uint32 cy, float *h);
+
+    HeightMap _hmap;
+    NavGrid *_nav; // walkability, for the Pathfinder
+    MapChunk *_chunks; // 16x16, NULL if headless
     std::vector<std::string> _textures;
     std::vector<std::string> _wmos;
     std::vector<std::string> _models;
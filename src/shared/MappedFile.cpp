@@ -0,0 +1,78 @@
+#include "MappedFile.h"
+
+#if PLATFORM == PLATFORM_WIN32
+#   include <windows.h>
+#else
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+    _data = NULL;
+    _size = 0;
+#if PLATFORM == PLATFORM_WIN32
+    _fh = _mh = NULL;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const char *fn)
+{
+    Close();
+#if PLATFORM == PLATFORM_WIN32
+    HANDLE fh = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(fh == INVALID_HANDLE_VALUE)
+        return false;
+    DWORD size = ::GetFileSize(fh, NULL);
+    HANDLE mh = size ? CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    void *p = mh ? MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if(!p)
+    {
+        if(mh)
+            CloseHandle(mh);
+        CloseHandle(fh);
+        return false;
+    }
+    _fh = fh;
+    _mh = mh;
+    _size = size;
+    _data = (const uint8*)p;
+#else
+    int fd = open(fn, O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && st.st_size > 0)
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays valid
+    if(p == MAP_FAILED)
+        return false;
+    _size = st.st_size;
+    _data = (const uint8*)p;
+#endif
+    return true;
+}
+
+void MappedFile::Close(void)
+{
+    if(!_data)
+        return;
+#if PLATFORM == PLATFORM_WIN32
+    UnmapViewOfFile((LPCVOID)_data);
+    CloseHandle((HANDLE)_mh);
+    CloseHandle((HANDLE)_fh);
+    _fh = _mh = NULL;
+#else
+    munmap((void*)_data, _size);
+#endif
+    _data = NULL;
+    _size = 0;
+}
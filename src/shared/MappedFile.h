@@ -0,0 +1,28 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include "common.h"
+
+// maps a whole file read-only into memory. the pages are backed by the OS file cache,
+// so every mapping of the same file (in this or any other process) uses the same physical memory.
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+    bool Open(const char *fn);
+    void Close(void);
+    inline bool IsOpen(void) { return _data != NULL; }
+    inline const uint8 *GetData(void) { return _data; }
+    inline uint32 GetSize(void) { return _size; }
+
+private:
+    const uint8 *_data;
+    uint32 _size;
+#if PLATFORM == PLATFORM_WIN32
+    void *_fh;
+    void *_mh;
+#endif
+};
+
+#endif
@@ -1,6 +1,5 @@
 #include <fstream>
 #include "MemoryDataHolder.h"
-#include "TypeStorage.h"
 #include "zthread/Condition.h"
 #include "zthread/Task.h"
 #include "zthread/PoolExecutor.h"
@@ -11,12 +10,33 @@
 namespace MemoryDataHolder
 {
     class DataLoaderRunnable;
+
+    // a file held in memory or beeing loaded. files that are loaded, but not referenced, are also linked into
+    // the LRU list, most recently used first; they are evicted from its end once the cache is too big.
+    struct CacheEntry
+    {
+        CacheEntry(const std::string& n, uint32 h) : name(n), hash(h), refs(0), failed(false), loader(NULL), chain(NULL), lruprev(NULL), lrunext(NULL) {}
+        std::string name;
+        uint32 hash;
+        uint32 refs;
+        bool failed; // the threaded load failed; the entry is kept until the references taken for it are dropped
+        memblock mb; // empty while loading or failed
+        DataLoaderRunnable *loader; // set while a loader thread works on the file
+        CacheEntry *chain; // next entry in the same hash bucket
+        CacheEntry *lruprev, *lrunext;
+    };
+
     ZThread::PoolExecutor *executor = NULL;
 
-    ZThread::FastMutex mutex;
-    TypeStorage<memblock> storage;
-    TypeStorage<DataLoaderRunnable> loaders;
-    TypeStorage<uint32> refs;
+    ZThread::FastMutex mutex; // guards the cache and the counters below
+    std::vector<CacheEntry*> buckets; // hashed by file name, size is a power of 2
+    uint32 entryCount = 0;
+    CacheEntry *lruFirst = NULL, *lruLast = NULL;
+    uint32 cacheBytes = 0, unusedBytes = 0;
+    uint32 cacheLimit = MDH_DEFAULT_CACHE_MB * 1024 * 1024;
+    bool trimQueued = false;
+    uint64 statHits = 0, statMisses = 0, statEvictions = 0;
+
     bool alwaysSingleThreaded = false;
 
     bool loadFromMPQ = false;
@@ -57,6 +77,9 @@ namespace MemoryDataHolder
 
     void SetUseMPQ(std::string loc)
     {
+        // all instances in this process share the same MPQ set, only the first call counts
+        if(loadFromMPQ)
+            return;
         loadFromMPQ=true;
         SetLocale(loc.c_str());
         mpq.Init();
@@ -76,6 +99,11 @@ namespace MemoryDataHolder
         else
             sprintf(fn,"./data/maps/%u.wdt",(uint16)mid);
     }
+    // preprocessed terrain heights, see HeightMap. always on disk, also when the ADTs come from the MPQs.
+    void MakeHeightMapFilename(char* fn, uint32 mid, uint32 x, uint32 y)
+    {
+        sprintf(fn,"./data/maps/%u_%u_%u.hmap",(uint16)mid,(uint16)x,(uint16)y);
+    }
     void MakeTextureFilename(char* fn, std::string fname)
     {
         if(loadFromMPQ)
@@ -111,116 +139,312 @@ namespace MemoryDataHolder
         }
     }
 
+    // FNV-1a
+    inline uint32 HashName(const std::string& s)
+    {
+        uint32 h = 2166136261U;
+        for(uint32 i = 0; i < s.size(); i++)
+            h = (h ^ uint8(s[i])) * 16777619U;
+        return h;
+    }
+
+    // the functions below expect the mutex to be held
+
+    CacheEntry *_Find(const std::string& s, uint32 h)
+    {
+        if(buckets.empty())
+            return NULL;
+        for(CacheEntry *e = buckets[h & (buckets.size() - 1)]; e; e = e->chain)
+            if(e->hash == h && e->name == s)
+                return e;
+        return NULL;
+    }
+
+    CacheEntry *_NewEntry(const std::string& s, uint32 h)
+    {
+        if(entryCount >= buckets.size()) // keep at most one entry per bucket on average
+        {
+            std::vector<CacheEntry*> old;
+            old.swap(buckets);
+            buckets.resize(old.size() ? old.size() * 2 : 256, NULL);
+            for(uint32 i = 0; i < old.size(); i++)
+            {
+                CacheEntry *next;
+                for(CacheEntry *e = old[i]; e; e = next)
+                {
+                    next = e->chain;
+                    CacheEntry *& b = buckets[e->hash & (buckets.size() - 1)];
+                    e->chain = b;
+                    b = e;
+                }
+            }
+        }
+        CacheEntry *e = new CacheEntry(s, h);
+        CacheEntry *& b = buckets[h & (buckets.size() - 1)];
+        e->chain = b;
+        b = e;
+        entryCount++;
+        return e;
+    }
+
+    // unlinks the entry from the index; the caller deletes it
+    void _RemoveEntry(CacheEntry *e)
+    {
+        CacheEntry **pp = &buckets[e->hash & (buckets.size() - 1)];
+        while(*pp != e)
+            pp = &(*pp)->chain;
+        *pp = e->chain;
+        entryCount--;
+    }
+
+    void _LruPushFront(CacheEntry *e)
+    {
+        e->lruprev = NULL;
+        e->lrunext = lruFirst;
+        if(lruFirst)
+            lruFirst->lruprev = e;
+        else
+            lruLast = e;
+        lruFirst = e;
+        unusedBytes += e->mb.size;
+    }
+
+    void _LruUnlink(CacheEntry *e)
+    {
+        if(e->lruprev)
+            e->lruprev->lrunext = e->lrunext;
+        else
+            lruFirst = e->lrunext;
+        if(e->lrunext)
+            e->lrunext->lruprev = e->lruprev;
+        else
+            lruLast = e->lruprev;
+        unusedBytes -= e->mb.size;
+    }
+
+    // hit on a loaded file: take a reference, or just mark it as recently used
+    memblock _Use(CacheEntry *e, bool ref_counted)
+    {
+        if(!e->refs)
+            _LruUnlink(e);
+        if(ref_counted)
+            e->refs++;
+        if(!e->refs)
+            _LruPushFront(e);
+        return e->mb;
+    }
+
+    // put freshly loaded data into an entry that has none yet
+    void _Store(CacheEntry *e, memblock mb, bool ref_counted)
+    {
+        e->mb = mb;
+        e->failed = false;
+        cacheBytes += mb.size;
+        if(ref_counted)
+            e->refs++;
+        if(!e->refs)
+            _LruPushFront(e);
+    }
+
+    // returns true if the caller has to run _Trim() after releasing the mutex
+    bool _NeedTrim(void)
+    {
+        if(trimQueued || cacheBytes <= cacheLimit || !lruLast)
+            return false;
+        trimQueued = true;
+        return true;
+    }
+
+    // evict the least recently used unreferenced files until the cache fits into its limit (or drop all of them).
+    // the memory is freed after the mutex was released.
+    void _Trim(bool all)
+    {
+        std::vector<CacheEntry*> dropped;
+        {
+            ZThread::Guard<ZThread::FastMutex> g(mutex);
+            trimQueued = false;
+            uint32 limit = all ? 0 : cacheLimit;
+            while(lruLast && cacheBytes > limit)
+            {
+                CacheEntry *e = lruLast;
+                _LruUnlink(e);
+                _RemoveEntry(e);
+                cacheBytes -= e->mb.size;
+                statEvictions++;
+                dropped.push_back(e);
+            }
+        }
+        for(uint32 i = 0; i < dropped.size(); i++)
+        {
+            DEBUG(logdev("MDH: Evicting '%s' (%s)", dropped[i]->name.c_str(), FilesizeFormat(dropped[i]->mb.size).c_str()));
+            dropped[i]->mb.free();
+            delete dropped[i];
+        }
+    }
+
+    // eviction is not done by the thread that dropped the last reference; that one is usually busy with more important things
+    class CacheTrimmer : public ZThread::Runnable
+    {
+    public:
+        void run(void) { _Trim(false); }
+    };
+
+    uint32 GetCacheSize(void)
+    {
+        ZThread::Guard<ZThread::FastMutex> g(mutex);
+        return cacheBytes;
+    }
+
+    void SetCacheLimit(uint32 bytes)
+    {
+        bool trim;
+        {
+            ZThread::Guard<ZThread::FastMutex> g(mutex);
+            cacheLimit = bytes;
+            trim = _NeedTrim();
+        }
+        logdetail("MemoryDataHolder: Caching up to %s of file data.", FilesizeFormat(bytes).c_str());
+        if(trim)
+            _Trim(false);
+    }
+
+    void GetCacheStats(CacheStats& st)
+    {
+        ZThread::Guard<ZThread::FastMutex> g(mutex);
+        st.hits = statHits;
+        st.misses = statMisses;
+        st.evictions = statEvictions;
+        st.files = st.pinned = 0;
+        for(uint32 i = 0; i < buckets.size(); i++)
+            for(CacheEntry *e = buckets[i]; e; e = e->chain)
+                if(e->mb.ptr)
+                {
+                    st.files++;
+                    if(e->refs)
+                        st.pinned++;
+                }
+        st.bytes = cacheBytes;
+        st.unused = unusedBytes;
+        st.limit = cacheLimit;
+    }
+
+    void FlushCache(void)
+    {
+        _Trim(true);
+    }
+
     bool FileExists(std::string fname)
     {
         logdebug("%s",fname.c_str());
         if(loadFromMPQ)
             return mpq.FileExists(fname.c_str());
         else
-            return GetFileSize(fname.c_str());
+            return ::GetFileSize(fname.c_str());
 
     }
 
+    uint32 GetFileSize(std::string fname)
+    {
+        if(loadFromMPQ)
+            return mpq.GetFileSize(fname.c_str());
+        return ::GetFileSize(fname.c_str());
+    }
+
+    // reads a whole file from the MPQs or from disk. mb stays empty if that fails.
+    void _LoadFile(std::string name, memblock& mb)
+    {
+        if(loadFromMPQ)
+        {
+            DEBUG(logdev("DataLoaderRunnable: Reading From MPQ '%s'...", name.c_str()));
+            if(!mpq.ExtractFile(name.c_str(), mb.ptr, mb.size)) // decompressed right into our buffer
+            {
+                logerror("DataLoaderRunnable: Error opening file in MPQ: '%s'", name.c_str());
+                return;
+            }
+        }
+        else
+        {
+            _FixFileName(name);
+            uint32 size = ::GetFileSize(name.c_str());
+            std::ifstream fh;
+            // couldnt open file if size is 0
+            if(size)
+                fh.open(name.c_str(), std::ios_base::in | std::ios_base::binary);
+            if(!fh.is_open())
+            {
+                logerror("DataLoaderRunnable: Error opening file: '%s'", name.c_str());
+                return;
+            }
+            DEBUG(logdev("DataLoaderRunnable: Reading '%s'... (%s)", name.c_str(), FilesizeFormat(size).c_str()));
+            mb.alloc(size);
+            fh.read((char*)mb.ptr, size);
+            fh.close();
+        }
+        DEBUG(logdev("DataLoaderRunnable: Done with '%s' (%s)", name.c_str(), FilesizeFormat(mb.size).c_str()));
+    }
 
     class DataLoaderRunnable : public ZThread::Runnable
     {
     public:
-        DataLoaderRunnable()
+        DataLoaderRunnable(CacheEntry *e) : _entry(e), _name(e->name)
         {
-            _threaded = false;
         }
         ~DataLoaderRunnable()
         {
             DEBUG(logdev("~DataLoaderRunnable(%s) 0x%X", _name.c_str(), this));
         }
-        void SetStores(TypeStorage<memblock> *mem, TypeStorage<DataLoaderRunnable> *ldrs)
-        {
-            _storage = mem;
-            _loaders = ldrs;
-        }
         // the threaded part
         void run()
         {
-            memblock *mb = new memblock();
-            if(loadFromMPQ)
-            {
-                if(!mpq.FileExists(_name.c_str()))
-                {
-                    ZThread::Guard<ZThread::FastMutex> g(_mut);
-                    logerror("DataLoaderRunnable: Error opening file in MPQ: '%s'", _name.c_str());
-                    _loaders->Unlink(_name);
-                    DoCallbacks(_name, MDH_FILE_ERROR); // call callback func, 'false' to indicate file couldnt be loaded
-                    delete mb;
-                    return;
-                }
-                DEBUG(logdev("DataLoaderRunnable: Reading From MPQ'%s'... (%s)", _name.c_str(), FilesizeFormat(mb->size).c_str()));
-                const ByteBuffer& bb = mpq.ExtractFile(_name.c_str());
-//                 fh.read((char*)mb->ptr, mb->size);
-                if(!bb.size())
-                {
-                    ZThread::Guard<ZThread::FastMutex> g(_mut);
-                    logerror("DataLoaderRunnable: Error opening file in MPQ: '%s'", _name.c_str());
-                    _loaders->Unlink(_name);
-                    DoCallbacks(_name, MDH_FILE_ERROR); // call callback func, 'false' to indicate file couldnt be loaded
-                    delete mb;
-                    return;
-                }
+            memblock mb, dup;
+            _LoadFile(_name, mb);
 
-                mb->size=bb.size();
-                mb->alloc(mb->size);
-
-                memcpy((char*)mb->ptr,(char*)bb.contents(),bb.size());
+            CallbackStore cbs;
+            CacheEntry *dropped = NULL;
+            uint32 rf;
+            bool trim;
+            {
+                ZThread::Guard<ZThread::FastMutex> g(mutex);
+                cbs.swap(_callbacks); // no more callbacks can be added once the entry has no loader
+                _entry->loader = NULL;
+                if(_entry->mb.ptr) // a non-threaded GetFile() was faster
                 {
-                    ZThread::Guard<ZThread::FastMutex> g(_mut);
-                    _storage->Assign(_name, mb);
-                    _loaders->Unlink(_name); // must be unlinked after the file is fully loaded, but before the callbacks are processed!
+                    dup = mb;
+                    rf = MDH_FILE_OK | MDH_FILE_ALREADY_EXIST;
                 }
-                DEBUG(logdev("DataLoaderRunnable: Done with '%s' (%s)", _name.c_str(), FilesizeFormat(mb->size).c_str()));
-                DoCallbacks(_name, MDH_FILE_OK | MDH_FILE_JUST_LOADED);
-            }
-            else
-            {
-                _FixFileName(_name);
-
-                mb->size = GetFileSize(_name.c_str());
-                // couldnt open file if size is 0
-                if(!mb->size)
+                else if(mb.ptr)
                 {
-                    ZThread::Guard<ZThread::FastMutex> g(_mut);
-                    logerror("DataLoaderRunnable: Error opening file: '%s'", _name.c_str());
-                    _loaders->Unlink(_name);
-                    DoCallbacks(_name, MDH_FILE_ERROR); // call callback func, 'false' to indicate file couldnt be loaded
-                    delete mb;
-                    return;
+                    _Store(_entry, mb, false); // the references were counted when the callbacks were added
+                    rf = MDH_FILE_OK | MDH_FILE_JUST_LOADED;
                 }
-                mb->alloc(mb->size);
-                std::ifstream fh;
-                fh.open(_name.c_str(), std::ios_base::in | std::ios_base::binary);
-                if(!fh.is_open())
+                else
                 {
+                    if(_entry->refs) // whoever got MDH_FILE_LOADING will still Delete() the file
+                        _entry->failed = true;
+                    else
                     {
-                        ZThread::Guard<ZThread::FastMutex> g(_mut);
-                        logerror("DataLoaderRunnable: Error opening file: '%s'", _name.c_str());
-                        _loaders->Unlink(_name);
+                        _RemoveEntry(_entry);
+                        dropped = _entry;
                     }
-                    mb->free();
-                    delete mb;
-                    DoCallbacks(_name, MDH_FILE_ERROR);
-                    return;
+                    rf = MDH_FILE_ERROR;
                 }
-                DEBUG(logdev("DataLoaderRunnable: Reading '%s'... (%s)", _name.c_str(), FilesizeFormat(mb->size).c_str()));
-                fh.read((char*)mb->ptr, mb->size);
-                fh.close();
-                {
-                    ZThread::Guard<ZThread::FastMutex> g(_mut);
-                    _storage->Assign(_name, mb);
-                    _loaders->Unlink(_name); // must be unlinked after the file is fully loaded, but before the callbacks are processed!
-                }
-                DEBUG(logdev("DataLoaderRunnable: Done with '%s' (%s)", _name.c_str(), FilesizeFormat(mb->size).c_str()));
-                DoCallbacks(_name, MDH_FILE_OK | MDH_FILE_JUST_LOADED);
+                trim = _NeedTrim();
             }
+            dup.free();
+            delete dropped;
+
+            for(CallbackStore::iterator it = cbs.begin(); it != cbs.end(); it++)
+            {
+                if(it->cond)
+                    it->cond->broadcast();
+                if(it->func)
+                    (*(it->func))(it->ptr, _name, rf);
+            }
+            if(trim)
+                _Trim(false); // we are a loader thread already
         }
 
+        // must be called with the mutex held
         inline void AddCallback(callback_func func, void *ptr = NULL, ZThread::Condition *cond = NULL)
         {
             callback_struct cbs;
@@ -229,71 +453,28 @@ namespace MemoryDataHolder
             cbs.cond = cond;
             _callbacks.push_back(cbs);
         }
-        inline void DoCallbacks(std::string fn, uint32 flags)
-        {
-            for(CallbackStore::iterator it = _callbacks.begin(); it != _callbacks.end(); it++)
-            {
-                if(it->cond)
-                    it->cond->broadcast();
-                if(it->func)
-                    (*(it->func))(it->ptr, fn, flags);
-            }
-        }
-        inline void SetThreaded(bool t)
-        {
-            _threaded = t;
-        }
-        inline bool IsThreaded(void)
-        {
-            return _threaded;
-        }
-        inline void SetName(std::string n)
-        {
-            _name = n;
-        }
-        inline void SetMPQName(std::string n)
-        {
-            _MPQname = n;
-        }
-
-       CallbackStore _callbacks;
-       bool _threaded;
-       std::string _name;
-       std::string _MPQname;
-       ZThread::FastMutex _mut;
-       TypeStorage<memblock> *_storage;
-       TypeStorage<DataLoaderRunnable> *_loaders;
 
+    private:
+        CacheEntry *_entry;
+        std::string _name;
+        CallbackStore _callbacks;
     };
 
 
     MemoryDataResult GetFile(std::string s, bool threaded, callback_func func, void *ptr, ZThread::Condition *cond, bool ref_counted)
     {
-        mutex.acquire(); // we need exclusive access, other threads might unload the requested file during checking
-
         if(alwaysSingleThreaded)
             threaded = false;
+        uint32 h = HashName(s);
 
-        // manage reference counter
-        uint32 *refcount = refs.GetNoCreate(s);
-        if(!refcount)
-        {
-            refcount = new uint32;
-            *refcount = ref_counted ? 1 : 0;
-            refs.Assign(s,refcount);
-        }
-        else
-        {
-            if(ref_counted)
-            {
-                (*refcount)++;
-            }
-        }
-
-        if(memblock *mb = storage.GetNoCreate(s))
+        mutex.acquire(); // we need exclusive access, other threads might evict the requested file during checking
+        CacheEntry *e = _Find(s, h);
+        if(e && e->mb.ptr)
         {
             DEBUG(logdev("MDH: Reusing '%s' from memory",s.c_str()));
             // the file was requested some other time, is still present in memory and the pointer can simply be returned...
+            statHits++;
+            memblock mb = _Use(e, ref_counted);
             mutex.release(); // everything ok, mutex can be unloaded safely
             // execute callback and broadcast condition (must check for MDH_FILE_ALREADY_EXIST in callback func)
             uint32 rf = MDH_FILE_OK | MDH_FILE_ALREADY_EXIST;
@@ -302,57 +483,96 @@ namespace MemoryDataHolder
             if(cond)
                 cond->broadcast();
 
-            return MemoryDataResult(*mb, rf);
+            return MemoryDataResult(mb, rf);
         }
-        else
+        statMisses++;
+
+        if(threaded)
         {
-            DataLoaderRunnable *ldr = loaders.GetNoCreate(s);
+            if(!e)
+                e = _NewEntry(s, h);
+            if(ref_counted)
+                e->refs++;
+            DataLoaderRunnable *ldr = e->loader;
             DEBUG(logdev("MDH: Found Loader 0x%X for '%s'",ldr,s.c_str()));
-            if(ldr == NULL)
+            bool start = !ldr;
+            if(start)
             {
-                // no loader thread is working on that file...
-                ldr = loaders.Get(s);
-                ldr->SetStores(&storage,&loaders);
-                ldr->AddCallback(func,ptr,cond); // not threadsafe!
-
-                mutex.release(); // the mutex can be released safely now
+                e->failed = false; // try again
+                ldr = e->loader = new DataLoaderRunnable(e);
+            }
+            ldr->AddCallback(func,ptr,cond); // if a loader is already existing, add callbacks to that loader.
+            mutex.release();
 
-                ldr->SetThreaded(threaded);
-                ldr->SetName(s); // here we set the filename the thread should load
+            if(start)
+            {
+                ZThread::Task task(ldr);
+                executor->execute(task);
+            }
+            return MemoryDataResult(memblock(), MDH_FILE_LOADING);
+        }
 
-                if(threaded)
+        // load the file right here. this is done also if a loader thread is working on it already,
+        // waiting for that one could deadlock if we are a loader thread ourselves and it is still queued.
+        mutex.release();
+        memblock mb, dup;
+        _LoadFile(s, mb);
+        uint32 rf = MDH_FILE_JUST_LOADED;
+        if(mb.ptr)
+        {
+            rf |= MDH_FILE_OK;
+            bool trim;
+            {
+                ZThread::Guard<ZThread::FastMutex> g(mutex);
+                e = _Find(s, h);
+                if(e && e->mb.ptr) // someone else was faster, use the data already there
                 {
-                    ZThread::Task task(ldr);
-                    executor->execute(task);
+                    dup = mb;
+                    mb = _Use(e, ref_counted);
                 }
                 else
                 {
-                    ldr->run(); // will exit after the whole file is loaded and the callbacks were run
-                    delete ldr;
-                    memblock *mbret = storage.GetNoCreate(s);
-                    DEBUG(logdev("Non-threaded loader returning memblock at 0x%X",mbret));
-                    uint32 rf = MDH_FILE_JUST_LOADED;
-                    if(mbret)
-                        rf |= MDH_FILE_OK;
-                    return MemoryDataResult(mbret ? *mbret : memblock(), rf);
+                    if(!e)
+                        e = _NewEntry(s, h);
+                    _Store(e, mb, ref_counted);
                 }
+                trim = _NeedTrim();
             }
-            else // if a loader is already existing, add callbacks to that loader.
-            {
-                ldr->AddCallback(func,ptr,cond);
-                mutex.release();
-            }
+            dup.free();
+            if(trim)
+                Execute(new CacheTrimmer);
+        }
+        DEBUG(logdev("Non-threaded loader returning memblock at 0x%X",mb.ptr));
+        if(func)
+            (*func)(ptr, s, rf);
+        if(cond)
+            cond->broadcast();
+        return MemoryDataResult(mb, rf);
+    }
+
+    void Execute(ZThread::Runnable *job)
+    {
+        if(alwaysSingleThreaded)
+        {
+            job->run();
+            delete job;
+        }
+        else
+        {
+            ZThread::Task task(job); // takes ownership
+            executor->execute(task);
         }
-        return MemoryDataResult(memblock(), MDH_FILE_LOADING); // we reach this point only in multithreaded mode
     }
 
     bool IsLoaded(std::string s)
     {
         ZThread::Guard<ZThread::FastMutex> g(mutex);
-        return storage.Exists(s);
+        CacheEntry *e = _Find(s, HashName(s));
+        return e && e->mb.ptr;
     }
 
-    // ensure the file is present in memory, but do not touch the reference counter
+    // ensure the file is present in memory, but do not touch the reference counter.
+    // the file is kept in the cache like any other unreferenced file.
     void BackgroundLoadFile(std::string s)
     {
         GetFile(s, true, NULL, NULL, NULL, false);
@@ -361,40 +581,31 @@ namespace MemoryDataHolder
 
     bool Delete(std::string s)
     {
-        ZThread::Guard<ZThread::FastMutex> g(mutex);
-        uint32 *refcount = refs.GetNoCreate(s);
-        if(!refcount)
-        {
-            logerror("MemoryDataHolder:Delete(\"%s\"): no refcount", s.c_str());
-            return false;
-        }
-        else
+        bool trim;
         {
-            if(*refcount > 0)
-                (*refcount)--;
-            DEBUG(logdev("MemoryDataHolder::Delete(\"%s\"): refcount dropped to %u", s.c_str(), *refcount));
-        }
-        if(!*refcount)
-        {
-            refs.Delete(s);
-            if(memblock *mb = storage.GetNoCreate(s))
+            ZThread::Guard<ZThread::FastMutex> g(mutex);
+            CacheEntry *e = _Find(s, HashName(s));
+            if(!e || !e->refs)
             {
-                DEBUG(logdev("MemoryDataHolder:: deleting 0x%X (size %s)", mb->ptr, FilesizeFormat(mb->size).c_str()));
-                mb->free();
-                storage.Delete(s);
-                return true;
+                logerror("MemoryDataHolder:Delete(\"%s\"): no refcount", s.c_str());
+                return false;
             }
-            else
+            e->refs--;
+            DEBUG(logdev("MemoryDataHolder::Delete(\"%s\"): refcount dropped to %u", s.c_str(), e->refs));
+            if(!e->refs && e->failed)
             {
-                logerror("MemoryDataHolder::Delete(\"%s\"): no buf existing",s.c_str());
-                return false;
+                _RemoveEntry(e);
+                delete e;
+                return true;
             }
+            if(e->refs || !e->mb.ptr) // still in use or loading
+                return true;
+            _LruPushFront(e); // keep it around until it is evicted
+            trim = _NeedTrim();
         }
+        if(trim)
+            Execute(new CacheTrimmer);
         return true;
     }
 
-
-
-
-
 };
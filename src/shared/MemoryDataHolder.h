@@ -6,8 +6,13 @@
 namespace ZThread
 {
     class Condition;
+    class Runnable;
 };
 
+// files nobody holds a reference to are kept in memory until all files together take more than this many MB.
+// see DataCacheSize in PseuWoW.conf
+#define MDH_DEFAULT_CACHE_MB 64
+
 namespace MemoryDataHolder
 {
     enum ResultFlags
@@ -45,23 +50,44 @@ namespace MemoryDataHolder
         uint32 flags; // see ResultFlags enum
     };
 
+    struct CacheStats
+    {
+        uint64 hits;       // GetFile() calls served from memory
+        uint64 misses;     // GetFile() calls that had to load the file or wait for it
+        uint64 evictions;  // unreferenced files dropped to stay below the limit
+        uint32 files;      // files held in memory
+        uint32 pinned;     // ... of which are referenced
+        uint32 bytes;      // size of all files held in memory
+        uint32 unused;     // ... of which are unreferenced and may be evicted
+        uint32 limit;      // max. bytes held before unreferenced files are evicted
+    };
+
     void Init(void);
     void Shutdown(void);
     void SetThreadCount(uint32);
     void SetUseMPQ(std::string);
+    uint32 GetCacheSize(void); // bytes of file data currently held in memory
+    void SetCacheLimit(uint32 bytes);
+    void GetCacheStats(CacheStats&);
+    void FlushCache(void); // drop all unreferenced files
     //Helper functions to compensate for directory structure differences between Pseu and MPQ
     void MakeMapFilename(char*,uint32,std::string,uint32,uint32);
     void MakeWDTFilename(char*,uint32,std::string);
+    void MakeHeightMapFilename(char*,uint32,uint32,uint32);
     void MakeTextureFilename(char*, std::string);
     void MakeModelFilename(char*, std::string);
     void MakeWMOFilename(char*, std::string);
     bool FileExists(std::string);
+    uint32 GetFileSize(std::string); // from the MPQs or from disk, 0 if the file is not there
 
+    // a file stays in memory while it is referenced; every ref_counted GetFile() must be matched by a Delete().
+    // the data returned by a GetFile() that is not ref_counted may be evicted at any time.
     MemoryDataResult GetFile(std::string s, bool threaded = false, callback_func func = NULL,void *ptr = NULL, ZThread::Condition *cond = NULL, bool ref_counted = true);
-    inline MemoryDataResult GetFileBasic(std::string s) { return GetFile(s, false, NULL, NULL, NULL, false); }
+    inline MemoryDataResult GetFileBasic(std::string s) { return GetFile(s); }
     bool IsLoaded(std::string);
     void BackgroundLoadFile(std::string);
-    bool Delete(std::string);
+    void Execute(ZThread::Runnable *job); // run job on the loader threads (e.g. to decode a file after loading it). job is deleted when done.
+    bool Delete(std::string); // drops one reference. unreferenced files stay cached until they are evicted.
 };
 
 #endif
@@ -0,0 +1,541 @@
+#include <algorithm>
+#include <cfloat>
+#include <queue>
+#include "common.h"
+#include "MapTile.h"
+#include "NavGrid.h"
+#include "NavGraph.h"
+
+#define NAVGRAPH_START 0xFFFFFFFE // abstract node keys of start and end; entrances are (pos << 16) | index
+#define NAVGRAPH_END   0xFFFFFFFF
+
+typedef std::pair<float, uint32> NavQueueEntry; // f or distance, key
+typedef std::priority_queue<NavQueueEntry, std::vector<NavQueueEntry>, std::greater<NavQueueEntry> > NavQueue;
+
+// neighbour tile on side s: 0: +nx, 1: -nx, 2: +ny, 3: -ny. s ^ 1 is the opposite side. -1 if outside the map
+static int32 NavNeighbour(uint32 pos, uint32 s)
+{
+    uint32 tx = pos / 64, ty = pos % 64;
+    switch(s)
+    {
+        case 0: return tx < 63 ? int32(pos + 64) : -1;
+        case 1: return tx > 0 ? int32(pos - 64) : -1;
+        case 2: return ty < 63 ? int32(pos + 1) : -1;
+        default: return ty > 0 ? int32(pos - 1) : -1;
+    }
+}
+
+// local cell k along the border to side s. NavBorderDir[s]: the step over that border
+static inline uint32 NavBorderCell(uint32 s, uint32 k)
+{
+    const uint32 last = NAVGRID_SIZE - 1;
+    switch(s)
+    {
+        case 0: return last * NAVGRID_SIZE + k;
+        case 1: return k;
+        case 2: return k * NAVGRID_SIZE + last;
+        default: return k * NAVGRID_SIZE;
+    }
+}
+
+static const uint32 NavBorderDir[4] = { 0, 4, 2, 6 };
+
+NavGraph::NavGraph(uint32 mapid, const char *dir)
+{
+    _mapid = mapid;
+    _dir = dir;
+    _expanded = 0;
+    _refined = 0;
+    _search = 0;
+    _lastuse.resize(4096, 0);
+    _graphs.resize(4096, NULL);
+    _startnode.search = 0;
+    _endnode.search = 0;
+}
+
+NavGraph::~NavGraph()
+{
+    for(uint32 i = 0; i < _graphs.size(); i++)
+        delete _graphs[i];
+}
+
+void NavGraph::_MakeFilename(char *fn, uint32 pos, const char *ext)
+{
+    sprintf(fn, "%s/%u_%u_%u.%s", _dir.c_str(), _mapid, pos % 64, pos / 64, ext); // same names as MemoryDataHolder uses
+}
+
+// the tile at pos, mapped if it was not yet. NULL if it has no height map
+MapTile *NavGraph::_MapTile(uint32 pos)
+{
+    MapTile *tile = _tiles.GetTile(pos);
+    _lastuse[pos] = _search;
+    if(tile || _missing[pos])
+        return tile;
+    char fn[512];
+    _MakeFilename(fn, pos, "hmap");
+    tile = new MapTile();
+    if(!tile->LoadHeightMap(fn, 0))
+    {
+        delete tile;
+        _missing[pos] = true;
+        return NULL;
+    }
+    _tiles.SetTile(tile, pos);
+    _mapped.push_back(pos);
+    return tile;
+}
+
+// unmap the tiles not used for the longest time; only between searches, the Pathfinder keeps pointers to them
+void NavGraph::_Trim(void)
+{
+    if(_mapped.size() <= NAVGRAPH_MAX_TILES)
+        return;
+    std::vector<std::pair<uint32, uint32> > use; // last use, tile
+    for(uint32 i = 0; i < _mapped.size(); i++)
+        use.push_back(std::make_pair(_lastuse[_mapped[i]], _mapped[i]));
+    std::sort(use.begin(), use.end());
+    uint32 drop = _mapped.size() - NAVGRAPH_MAX_TILES;
+    _mapped.clear();
+    for(uint32 i = 0; i < use.size(); i++)
+    {
+        if(i < drop)
+            _tiles.UnloadMapTile(use[i].second);
+        else
+            _mapped.push_back(use[i].second);
+    }
+}
+
+// forget that the tile had no height map, and the graphs built with the old one; its neighbours' graphs
+// store its checksum too. they are loaded again and rebuilt if outdated.
+void NavGraph::TileChanged(uint32 pos)
+{
+    if(pos >= 4096)
+        return;
+    _missing[pos] = false;
+    if(_tiles.GetTile(pos))
+    {
+        _tiles.UnloadMapTile(pos);
+        _mapped.erase(std::remove(_mapped.begin(), _mapped.end(), pos), _mapped.end());
+    }
+    _checksums.erase(pos);
+    _DropGraph(pos);
+    for(uint32 s = 0; s < 4; s++)
+    {
+        int32 n = NavNeighbour(pos, s);
+        if(n >= 0)
+            _DropGraph(n);
+    }
+}
+
+void NavGraph::_DropGraph(uint32 pos)
+{
+    delete _graphs[pos];
+    _graphs[pos] = NULL;
+    _graphdone[pos] = false;
+}
+
+uint32 NavGraph::_Checksum(uint32 pos)
+{
+    std::map<uint32, uint32>::iterator it = _checksums.find(pos);
+    if(it != _checksums.end())
+        return it->second;
+    MapTile *tile = _MapTile(pos);
+    uint32 sum = tile ? tile->GetHeightMap().GetChecksum() : 0;
+    _checksums[pos] = sum;
+    return sum;
+}
+
+void NavGraph::_GetChecksums(uint32 pos, uint32 *sums)
+{
+    sums[0] = _Checksum(pos);
+    for(uint32 s = 0; s < 4; s++)
+    {
+        int32 n = NavNeighbour(pos, s);
+        sums[s + 1] = n < 0 ? 0 : _Checksum(n);
+    }
+}
+
+NavGraph::TileGraph *NavGraph::_GetGraph(uint32 pos)
+{
+    if(_graphdone[pos])
+        return _graphs[pos];
+    TileGraph *tg = NULL;
+    if(_Checksum(pos))
+    {
+        tg = new TileGraph();
+        if(!_Load(pos, *tg))
+        {
+            _Build(pos, *tg);
+            if(!_Save(pos, *tg))
+                logdebug("NavGraph: Could not save graph of tile %u of map %u", pos, _mapid);
+        }
+        AbsNode unused = { 0, 0, 0, false };
+        tg->nodes.resize(tg->cells.size(), unused);
+    }
+    _graphs[pos] = tg;
+    _graphdone[pos] = true;
+    return tg;
+}
+
+// search state of an abstract node, reset if it is from an older search
+NavGraph::AbsNode& NavGraph::_Node(uint32 key)
+{
+    AbsNode& n = key == NAVGRAPH_START ? _startnode : key == NAVGRAPH_END ? _endnode : _graphs[key >> 16]->nodes[key & 0xFFFF];
+    if(n.search != _search)
+    {
+        n.g = FLT_MAX;
+        n.parent = 0;
+        n.search = _search;
+        n.closed = false;
+    }
+    return n;
+}
+
+// distances from the local cell 'from' to all cells of the tile, without leaving it.
+// reverse: distances to 'from' instead. standing: 'from' can be left in every direction, like the start of a Pathfinder search.
+void NavGraph::_Dijkstra(const NavGrid *grid, uint32 from, bool reverse, bool standing, std::vector<float>& dist)
+{
+    dist.assign(NAVGRID_SIZE * NAVGRID_SIZE, FLT_MAX);
+    dist[from] = 0;
+    NavQueue open;
+    open.push(NavQueueEntry(0.0f, from));
+    while(!open.empty())
+    {
+        NavQueueEntry e = open.top();
+        open.pop();
+        uint32 c = e.second;
+        if(e.first > dist[c])
+            continue; // already done over a shorter way
+        int32 cx = c / NAVGRID_SIZE, cy = c % NAVGRID_SIZE;
+        uint16 cell = grid->Get(cx, cy);
+        if(standing && c == from)
+            cell |= NAVGRID_DIRS;
+        for(uint32 d = 0; d < 8; d++)
+        {
+            // a step needs the same bits in both directions, so searching backwards only changes the cost
+            if(!(cell & (1 << d)))
+                continue;
+            int32 nx = cx + NavDirX[d], ny = cy + NavDirY[d];
+            if(uint32(nx) >= NAVGRID_SIZE || uint32(ny) >= NAVGRID_SIZE)
+                continue;
+            uint16 nc = grid->Get(nx, ny);
+            if(!(nc & (1 << ((d + 4) & 7))))
+                continue;
+            float g = e.first + NavStepCost(d, reverse ? cell : nc);
+            uint32 n = nx * NAVGRID_SIZE + ny;
+            if(g < dist[n])
+            {
+                dist[n] = g;
+                open.push(NavQueueEntry(g, n));
+            }
+        }
+    }
+}
+
+// entrances of a tile and the costs between them. the entrances to a neighbour are found the same way from both sides,
+// so every entrance has a partner cell on the other side of the border that is an entrance too.
+void NavGraph::_Build(uint32 pos, TileGraph& tg)
+{
+    const NavGrid *grid = _MapTile(pos)->GetNavGrid();
+    std::map<uint16, uint8> found; // cell -> sides
+    for(uint32 s = 0; s < 4; s++)
+    {
+        int32 npos = NavNeighbour(pos, s);
+        MapTile *ntile = npos < 0 ? NULL : _MapTile(npos);
+        if(!ntile)
+            continue;
+        const NavGrid *ngrid = ntile->GetNavGrid();
+        uint32 d = NavBorderDir[s], nd = (d + 4) & 7;
+        int32 start = -1;
+        for(uint32 k = 0; k <= NAVGRID_SIZE; k++)
+        {
+            bool open = false;
+            if(k < NAVGRID_SIZE)
+            {
+                uint32 c = NavBorderCell(s, k), nc = NavBorderCell(s ^ 1, k);
+                open = (grid->Get(c / NAVGRID_SIZE, c % NAVGRID_SIZE) & (1 << d))
+                    && (ngrid->Get(nc / NAVGRID_SIZE, nc % NAVGRID_SIZE) & (1 << nd));
+            }
+            if(open && start < 0)
+                start = k;
+            else if(!open && start >= 0)
+            {
+                uint32 len = k - start;
+                if(len >= NAVGRAPH_WIDE_ENTRANCE)
+                {
+                    found[NavBorderCell(s, start)] |= 1 << s;
+                    found[NavBorderCell(s, k - 1)] |= 1 << s;
+                }
+                else
+                    found[NavBorderCell(s, start + len / 2)] |= 1 << s;
+                start = -1;
+            }
+        }
+    }
+
+    tg.cells.clear();
+    tg.sides.clear();
+    for(std::map<uint16, uint8>::iterator it = found.begin(); it != found.end(); it++)
+    {
+        tg.cells.push_back(it->first);
+        tg.sides.push_back(it->second);
+    }
+    uint32 n = tg.cells.size();
+    tg.costs.resize(n * n);
+    for(uint32 i = 0; i < n; i++)
+    {
+        _Dijkstra(grid, tg.cells[i], false, false, _dist);
+        for(uint32 j = 0; j < n; j++)
+            tg.costs[i * n + j] = _dist[tg.cells[j]];
+    }
+}
+
+bool NavGraph::_Load(uint32 pos, TileGraph& tg)
+{
+    char fn[512];
+    _MakeFilename(fn, pos, "nav");
+    FILE *fh = fopen(fn, "rb");
+    if(!fh)
+        return false;
+    NavGraphHeader hdr;
+    uint32 sums[5];
+    _GetChecksums(pos, sums);
+    bool ok = fread(&hdr, sizeof(hdr), 1, fh) == 1
+        && hdr.magic == NAVGRAPH_MAGIC && hdr.version == NAVGRAPH_VERSION && hdr.headersize == sizeof(NavGraphHeader)
+        && !memcmp(hdr.checksums, sums, sizeof(sums))
+        && hdr.entrances <= 4 * NAVGRID_SIZE;
+    if(ok)
+    {
+        uint32 n = hdr.entrances;
+        tg.cells.resize(n);
+        tg.sides.resize(n);
+        tg.costs.resize(n * n);
+        ok = !n || (fread(&tg.cells[0], sizeof(uint16), n, fh) == n
+            && fread(&tg.sides[0], sizeof(uint8), n, fh) == n
+            && fread(&tg.costs[0], sizeof(float), n * n, fh) == n * n);
+        for(uint32 i = 0; ok && i < n; i++)
+            ok = tg.cells[i] < NAVGRID_SIZE * NAVGRID_SIZE && (!i || tg.cells[i - 1] < tg.cells[i]);
+    }
+    fclose(fh);
+    if(!ok)
+        logdebug("NavGraph: '%s' is outdated or invalid", fn);
+    return ok;
+}
+
+// writes to a temp file first, like HeightMap::Save()
+bool NavGraph::_Save(uint32 pos, TileGraph& tg)
+{
+    char fn[512];
+    _MakeFilename(fn, pos, "nav");
+    std::string tmps = MakeTempFilename(fn, this);
+    const char *tmp = tmps.c_str();
+    NavGraphHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = NAVGRAPH_MAGIC;
+    hdr.version = NAVGRAPH_VERSION;
+    hdr.headersize = sizeof(NavGraphHeader);
+    _GetChecksums(pos, hdr.checksums);
+    hdr.entrances = tg.cells.size();
+    FILE *fh = fopen(tmp, "wb");
+    if(!fh)
+        return false;
+    uint32 n = hdr.entrances;
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fh) == 1;
+    if(ok && n)
+    {
+        ok = fwrite(&tg.cells[0], sizeof(uint16), n, fh) == n
+            && fwrite(&tg.sides[0], sizeof(uint8), n, fh) == n
+            && fwrite(&tg.costs[0], sizeof(float), n * n, fh) == n * n;
+    }
+    ok = fclose(fh) == 0 && ok;
+#if PLATFORM == PLATFORM_WIN32
+    remove(fn); // rename() does not overwrite here
+#endif
+    if(!ok || rename(tmp, fn) != 0)
+    {
+        remove(tmp);
+        return false;
+    }
+    return true;
+}
+
+uint32 NavGraph::BuildAll(void)
+{
+    uint32 built = 0;
+    for(uint32 pos = 0; pos < 4096; pos++)
+    {
+        if(!_Checksum(pos))
+            continue;
+        TileGraph tg;
+        if(!_Load(pos, tg))
+        {
+            _Build(pos, tg);
+            if(_Save(pos, tg))
+                built++;
+            else
+                logerror("NavGraph: Could not save graph of tile %u of map %u", pos, _mapid);
+        }
+        _Trim();
+    }
+    return built;
+}
+
+bool NavGraph::FindPath(float sx, float sy, float ex, float ey, std::vector<NavPoint>& path)
+{
+    path.clear();
+    _expanded = 0;
+    _refined = 0;
+    _Trim();
+    _search++;
+    int32 snx = NavCoord(sx), sny = NavCoord(sy), enx = NavCoord(ex), eny = NavCoord(ey);
+    if(snx < 0 || sny < 0 || enx < 0 || eny < 0)
+        return false;
+    uint32 spos = NavTilePos(snx, sny), epos = NavTilePos(enx, eny);
+    int32 stx = spos / 64, sty = spos % 64, etx = epos / 64, ety = epos % 64;
+
+    if(abs(stx - etx) <= NAVGRAPH_NEAR_TILES && abs(sty - ety) <= NAVGRAPH_NEAR_TILES)
+    {
+        // close enough for the cells, and the entrances would only make the path longer
+        for(int32 tx = std::max(std::min(stx, etx) - 1, 0); tx <= std::min(std::max(stx, etx) + 1, 63); tx++)
+            for(int32 ty = std::max(std::min(sty, ety) - 1, 0); ty <= std::min(std::max(sty, ety) + 1, 63); ty++)
+                _MapTile(tx * 64 + ty);
+        _refined = 1;
+        return _pathfinder.FindPath(_tiles, sx, sy, ex, ey, path);
+    }
+
+    TileGraph *sg = _GetGraph(spos), *eg = _GetGraph(epos);
+    if(!sg || !eg)
+        return false;
+    const NavGrid *egrid = _MapTile(epos)->GetNavGrid();
+    uint32 ecell = (enx % NAVGRID_SIZE) * NAVGRID_SIZE + eny % NAVGRID_SIZE;
+    if(!(egrid->Get(enx % NAVGRID_SIZE, eny % NAVGRID_SIZE) & NAVGRID_DIRS))
+        return false;
+    std::vector<float> startcosts(sg->cells.size()), endcosts(eg->cells.size());
+    _Dijkstra(_MapTile(spos)->GetNavGrid(), (snx % NAVGRID_SIZE) * NAVGRID_SIZE + sny % NAVGRID_SIZE, false, true, _dist);
+    for(uint32 i = 0; i < sg->cells.size(); i++)
+        startcosts[i] = _dist[sg->cells[i]];
+    _Dijkstra(egrid, ecell, true, false, _dist);
+    for(uint32 i = 0; i < eg->cells.size(); i++)
+        endcosts[i] = _dist[eg->cells[i]];
+
+    // A* over the entrances
+    NavQueue open;
+    _Node(NAVGRAPH_START).g = 0;
+    open.push(NavQueueEntry(NavOctile(snx, sny, enx, eny), NAVGRAPH_START));
+    bool found = false;
+    while(!open.empty())
+    {
+        uint32 key = open.top().second;
+        open.pop();
+        AbsNode& cur = _Node(key);
+        if(cur.closed)
+            continue;
+        cur.closed = true;
+        if(key == NAVGRAPH_END)
+        {
+            found = true;
+            break;
+        }
+        _expanded++;
+        float g = cur.g;
+
+        // edges of the current node: (key, cost)
+        std::vector<std::pair<uint32, float> > edges;
+        if(key == NAVGRAPH_START)
+        {
+            for(uint32 i = 0; i < sg->cells.size(); i++)
+                if(startcosts[i] < FLT_MAX)
+                    edges.push_back(std::make_pair((spos << 16) | i, startcosts[i]));
+        }
+        else
+        {
+            uint32 pos = key >> 16, i = key & 0xFFFF;
+            TileGraph *tg = _GetGraph(pos);
+            uint32 n = tg->cells.size();
+            for(uint32 j = 0; j < n; j++)
+                if(j != i && tg->costs[i * n + j] < FLT_MAX)
+                    edges.push_back(std::make_pair((pos << 16) | j, tg->costs[i * n + j]));
+            for(uint32 s = 0; s < 4; s++)
+            {
+                if(!(tg->sides[i] & (1 << s)))
+                    continue;
+                int32 npos = NavNeighbour(pos, s);
+                TileGraph *ng = npos < 0 ? NULL : _GetGraph(npos);
+                if(!ng)
+                    continue;
+                uint32 c = tg->cells[i];
+                uint16 partner = s < 2 ? NavBorderCell(s ^ 1, c % NAVGRID_SIZE) : NavBorderCell(s ^ 1, c / NAVGRID_SIZE);
+                std::vector<uint16>::iterator p = std::lower_bound(ng->cells.begin(), ng->cells.end(), partner);
+                if(p != ng->cells.end() && *p == partner && (ng->sides[p - ng->cells.begin()] & (1 << (s ^ 1))))
+                    edges.push_back(std::make_pair((uint32(npos) << 16) | uint32(p - ng->cells.begin()), 1.0f));
+            }
+            if(pos == epos && endcosts[i] < FLT_MAX)
+                edges.push_back(std::make_pair(uint32(NAVGRAPH_END), endcosts[i]));
+        }
+
+        for(uint32 k = 0; k < edges.size(); k++)
+        {
+            uint32 nkey = edges[k].first;
+            float ng = g + edges[k].second;
+            AbsNode& n = _Node(nkey);
+            if(n.closed || n.g <= ng)
+                continue;
+            n.g = ng;
+            n.parent = key;
+            float h = 0;
+            if(nkey != NAVGRAPH_END)
+            {
+                uint32 npos = nkey >> 16, c = _graphs[npos]->cells[nkey & 0xFFFF];
+                h = NavOctile((npos / 64) * NAVGRID_SIZE + c / NAVGRID_SIZE, (npos % 64) * NAVGRID_SIZE + c % NAVGRID_SIZE, enx, eny);
+            }
+            open.push(NavQueueEntry(ng + h, nkey));
+        }
+    }
+    if(!found)
+        return false;
+
+    // the cells to go through, as global keys
+    std::vector<uint32> cells;
+    for(uint32 key = NAVGRAPH_END; ; key = _Node(key).parent)
+    {
+        if(key == NAVGRAPH_END)
+            cells.push_back(NavKey(enx, eny));
+        else if(key == NAVGRAPH_START)
+        {
+            cells.push_back(NavKey(snx, sny));
+            break;
+        }
+        else
+        {
+            uint32 pos = key >> 16, c = _graphs[pos]->cells[key & 0xFFFF];
+            cells.push_back(NavKey((pos / 64) * NAVGRID_SIZE + c / NAVGRID_SIZE, (pos % 64) * NAVGRID_SIZE + c % NAVGRID_SIZE));
+        }
+    }
+    std::reverse(cells.begin(), cells.end());
+    return _Refine(cells, sx, sy, ex, ey, path);
+}
+
+// the cell paths between the entrances found. consecutive cells are either on the same tile or partners over a border.
+bool NavGraph::_Refine(const std::vector<uint32>& cells, float sx, float sy, float ex, float ey, std::vector<NavPoint>& path)
+{
+    std::vector<NavPoint> seg;
+    for(uint32 k = 0; k + 1 < cells.size(); k++)
+    {
+        int32 ax = cells[k] >> 13, ay = cells[k] & 0x1FFF, bx = cells[k + 1] >> 13, by = cells[k + 1] & 0x1FFF;
+        uint32 bpos = NavTilePos(bx, by);
+        float fx = k ? NavCellCenter(ax) : sx, fy = k ? NavCellCenter(ay) : sy;
+        float tx = k + 2 < cells.size() ? NavCellCenter(bx) : ex, ty = k + 2 < cells.size() ? NavCellCenter(by) : ey;
+        if(NavTilePos(ax, ay) != bpos) // never the first or last pair, start and end are connected to entrances of their own tile
+        {
+            NavPoint p = { tx, ty, _MapTile(bpos)->GetZ(tx, ty) };
+            path.push_back(p);
+            continue;
+        }
+        _refined++;
+        _MapTile(bpos); // the Pathfinder only sees mapped tiles
+        if(!_pathfinder.FindPath(_tiles, fx, fy, tx, ty, seg))
+            return false;
+        path.insert(path.end(), seg.begin() + (path.empty() ? 0 : 1), seg.end());
+    }
+    return true;
+}
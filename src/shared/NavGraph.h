@@ -0,0 +1,96 @@
+#ifndef NAVGRAPH_H
+#define NAVGRAPH_H
+
+#include <map>
+#include <bitset>
+#include "common.h"
+#include "MapTile.h"
+#include "Pathfinder.h"
+
+class NavGrid;
+
+#define NAVGRAPH_MAGIC 0x4856414E // "NAVH"
+#define NAVGRAPH_VERSION 1
+#define NAVGRAPH_WIDE_ENTRANCE 6 // border openings at least this wide get an entrance at both ends, narrower ones one in the middle
+#define NAVGRAPH_MAX_TILES 128 // height maps (and their nav grids) kept between searches, the least recently used ones are dropped
+#define NAVGRAPH_NEAR_TILES 1 // start and end at most this many tiles apart are searched on the cells directly
+
+// layout of a .nav file, followed by uint16 cells[entrances], uint8 sides[entrances], float costs[entrances * entrances].
+// written and read as it is, like a .hmap file.
+struct NavGraphHeader
+{
+    uint32 magic;
+    uint32 version;
+    uint32 headersize; // sizeof(NavGraphHeader) of the writer
+    uint32 checksums[5]; // HeightMap::GetChecksum() of the tile and its 4 neighbours, 0 if missing. the graph is rebuilt if one changed.
+    uint32 entrances;
+};
+
+// hierarchical path search over all tiles of a map that have a .hmap file, not only the loaded ones.
+// every tile is one cluster: where the border to a neighbour tile can be crossed, entrance cells are placed on both sides
+// of it, and the costs of the shortest ways between the entrances of a tile, staying within the tile, are computed once.
+// a search looks for a way over the entrances first, then for the cell paths between them with a Pathfinder,
+// so its cost depends on the number of tiles on the way and not on the number of cells.
+// the graphs are saved as .nav files next to the .hmap files; missing or outdated ones are built when needed.
+// paths are up to a few percent longer than the shortest one, they go through the entrances.
+// the height maps are mapped read-only by the NavGraph itself. not threadsafe.
+class NavGraph
+{
+public:
+    NavGraph(uint32 mapid, const char *dir); // dir: where the .hmap files are, without trailing '/'
+    ~NavGraph();
+    // like Pathfinder::FindPath(), over the cells if start and end are close
+    bool FindPath(float sx, float sy, float ex, float ey, std::vector<NavPoint>& path);
+    uint32 BuildAll(void); // builds the graphs of all tiles that have none or an outdated one. returns the amount built.
+    void TileChanged(uint32 pos); // the .hmap file of tile pos was written, look at it again. not during a search.
+    inline uint32 GetMapId(void) { return _mapid; }
+    inline uint32 GetExpandedCount(void) { return _expanded; } // entrances expanded by the last search
+    inline uint32 GetRefinedCount(void) { return _refined; } // cell searches of the last search
+
+private:
+    struct AbsNode // search state of an entrance
+    {
+        float g;
+        uint32 parent; // key
+        uint32 search; // the state is only valid if this is the current search
+        bool closed;
+    };
+    struct TileGraph
+    {
+        std::vector<uint16> cells; // entrances, local cx * NAVGRID_SIZE + cy, sorted
+        std::vector<uint8> sides; // per entrance: bit s set if it is an entrance to the neighbour on side s
+        std::vector<float> costs; // from entrance i to j at [i * n + j], FLT_MAX if there is no way within the tile
+        std::vector<AbsNode> nodes;
+    };
+
+    MapTile *_MapTile(uint32 pos);
+    uint32 _Checksum(uint32 pos);
+    TileGraph *_GetGraph(uint32 pos);
+    void _Build(uint32 pos, TileGraph& tg);
+    bool _Load(uint32 pos, TileGraph& tg);
+    bool _Save(uint32 pos, TileGraph& tg);
+    void _DropGraph(uint32 pos);
+    void _GetChecksums(uint32 pos, uint32 *sums);
+    void _MakeFilename(char *fn, uint32 pos, const char *ext);
+    void _Dijkstra(const NavGrid *grid, uint32 from, bool reverse, bool standing, std::vector<float>& dist);
+    bool _Refine(const std::vector<uint32>& cells, float sx, float sy, float ex, float ey, std::vector<NavPoint>& path);
+    void _Trim(void);
+    AbsNode& _Node(uint32 key);
+
+    uint32 _mapid;
+    std::string _dir;
+    MapTileStorage _tiles;
+    std::vector<uint32> _mapped; // tiles in _tiles
+    std::vector<uint32> _lastuse; // per tile, the search it was last used by
+    uint32 _search; // searches done
+    std::bitset<4096> _missing; // no .hmap file
+    std::map<uint32, uint32> _checksums;
+    std::vector<TileGraph*> _graphs; // NULL for tiles without height map
+    std::bitset<4096> _graphdone; // _graphs[pos] is valid
+    AbsNode _startnode, _endnode;
+    Pathfinder _pathfinder;
+    std::vector<float> _dist; // _Dijkstra() scratch
+    uint32 _expanded, _refined;
+};
+
+#endif
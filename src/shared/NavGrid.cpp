@@ -0,0 +1,73 @@
+#include <algorithm>
+#include "common.h"
+#include "MapTile.h"
+#include "NavGrid.h"
+
+const int32 NavDirX[8] = { 1, 1, 0, -1, -1, -1,  0,  1 };
+const int32 NavDirY[8] = { 0, 1, 1,  1,  0, -1, -1, -1 };
+
+void NavGrid::Build(HeightMap& hmap)
+{
+    const float axismax = NAVGRID_MAX_SLOPE * UNITSIZE * 0.5f; // max. height difference from the center to an edge
+    const float diagmax = NAVGRID_MAX_SLOPE * UNITSIZE * 0.70710678f; // ... and to a corner
+    for(uint32 ch = 0; ch < CHUNKS_PER_TILE; ch++)
+    {
+        const MapChunkHeights& hc = *hmap.GetChunkHeights(ch);
+        const MapChunkLiquid *lc = hmap.GetChunkLiquid(ch);
+        uint32 cx0 = (ch / 16) * 8, cy0 = (ch % 16) * 8;
+        for(uint32 i = 0; i < 8; i++)
+        {
+            for(uint32 j = 0; j < 8; j++)
+            {
+                // r[a][b]: corner (i + a, j + b)
+                float r[2][2];
+                r[0][0] = hc.GetRough(i * 9 + j);
+                r[0][1] = hc.GetRough(i * 9 + j + 1);
+                r[1][0] = hc.GetRough((i + 1) * 9 + j);
+                r[1][1] = hc.GetRough((i + 1) * 9 + j + 1);
+                float m = hc.GetFine(i * 8 + j);
+                uint16 cell = 0;
+                if(lc)
+                {
+                    float lq = std::max(std::max(lc->Get(i * 9 + j), lc->Get(i * 9 + j + 1)),
+                                        std::max(lc->Get((i + 1) * 9 + j), lc->Get((i + 1) * 9 + j + 1)));
+                    if(lq - m > NAVGRID_MAX_WATER_DEPTH)
+                    {
+                        _cells[(cx0 + i) * NAVGRID_SIZE + cy0 + j] = NAVGRID_WATER; // no way out
+                        continue;
+                    }
+                    if(lq > m)
+                        cell |= NAVGRID_WATER;
+                }
+                for(uint32 d = 0; d < 8; d++)
+                {
+                    int32 a = NavDirX[d], b = NavDirY[d];
+                    float h, maxdiff;
+                    if(a && b)
+                    {
+                        h = r[a > 0][b > 0];
+                        maxdiff = diagmax;
+                    }
+                    else
+                    {
+                        h = a ? (r[a > 0][0] + r[a > 0][1]) * 0.5f : (r[0][b > 0] + r[1][b > 0]) * 0.5f;
+                        maxdiff = axismax;
+                    }
+                    if(fabsf(h - m) <= maxdiff)
+                        cell |= 1 << d;
+                }
+                _cells[(cx0 + i) * NAVGRID_SIZE + cy0 + j] = cell;
+            }
+        }
+    }
+}
+
+// cells that can be left in at least one direction
+uint32 NavGrid::GetWalkableCount(void) const
+{
+    uint32 n = 0;
+    for(uint32 i = 0; i < NAVGRID_SIZE * NAVGRID_SIZE; i++)
+        if(_cells[i] & NAVGRID_DIRS)
+            n++;
+    return n;
+}
@@ -0,0 +1,75 @@
+#ifndef NAVGRID_H
+#define NAVGRID_H
+
+#include "common.h"
+#include "MapTile.h"
+
+#define NAVGRID_SIZE 128 // cells per tile edge, one cell per fine height vertex
+#define NAV_MAP_CELLS (64 * NAVGRID_SIZE) // cells per map edge
+#define NAVGRID_MAX_SLOPE 1.2f // height per distance, ~50 degrees
+#define NAVGRID_MAX_WATER_DEPTH 1.5f // deeper liquid would make us swim, which the MovementMgr can't do
+#define NAVGRID_WATER 0x100 // cell flag: shallow liquid, slow to walk through
+#define NAVGRID_DIRS 0xFF // cell bits 0-7: the directions in which the cell can be left
+#define NAVGRID_WATER_COST 3.0f // walking through shallow liquid costs this much more than over land
+
+// the 8 step directions of the grid, in cell coords. d and (d + 4) & 7 are opposite, odd ones are diagonal.
+// the first coord runs along the world x axis (decreasing x), the second along y, like MapTile::GetZ().
+extern const int32 NavDirX[8];
+extern const int32 NavDirY[8];
+
+// cost of a step in direction d onto a cell with state 'to'
+inline float NavStepCost(uint32 d, uint16 to)
+{
+    return ((d & 1) ? 1.41421356f : 1.0f) * ((to & NAVGRID_WATER) ? NAVGRID_WATER_COST : 1.0f);
+}
+
+// global cell coord of a world coord, -1 if outside the map
+inline int32 NavCoord(float f)
+{
+    float c = (ZEROPOINT - f) * (1.0f / UNITSIZE);
+    if(!(c >= 0.0f && c < float(NAV_MAP_CELLS))) // also catches NaN
+        return -1;
+    return int32(c);
+}
+
+inline float NavCellCenter(int32 n)
+{
+    return ZEROPOINT - (n + 0.5f) * UNITSIZE;
+}
+
+// key of a global cell
+inline uint32 NavKey(int32 nx, int32 ny)
+{
+    return (uint32(nx) << 13) | uint32(ny);
+}
+
+// tile storage index of a global cell. tile x runs along world y, see MapMgr::GetTransformGridCoordPair()
+inline uint32 NavTilePos(int32 nx, int32 ny)
+{
+    return (nx / NAVGRID_SIZE) * 64 + ny / NAVGRID_SIZE;
+}
+
+// octile distance, the cost of the shortest way without obstacles
+inline float NavOctile(int32 ax, int32 ay, int32 bx, int32 by)
+{
+    int32 dx = abs(ax - bx), dy = abs(ay - by);
+    return dx > dy ? dx + 0.41421356f * dy : dy + 0.41421356f * dx;
+}
+
+// walkability of one map tile, derived from its height map.
+// every cell stores which of its 8 neighbours it can be left towards: the slope from the cell center
+// to the edge (or corner) it is left through must be walkable. a step between two cells is possible
+// if both halves of it are, so a step over a tile border only needs the grids of both tiles.
+// cells with deep liquid can't be left at all.
+class NavGrid
+{
+public:
+    void Build(HeightMap& hmap);
+    inline uint16 Get(uint32 cx, uint32 cy) const { return _cells[cx * NAVGRID_SIZE + cy]; }
+    uint32 GetWalkableCount(void) const;
+
+private:
+    uint16 _cells[NAVGRID_SIZE * NAVGRID_SIZE];
+};
+
+#endif
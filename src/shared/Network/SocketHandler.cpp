@@ -35,6 +35,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "PoolSocket.h"
 #include "ResolvSocket.h"
 #include "ResolvServer.h"
+#ifdef SOCKETS_USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#endif
 
 #ifdef _DEBUG
 #define DEB(x) x
@@ -57,9 +61,15 @@ SocketHandler::SocketHandler(StdLog *p)
 ,m_resolver(NULL)
 ,m_auto_close_sockets(true)
 {
+#ifdef SOCKETS_USE_EPOLL
+    m_epoll = epoll_create(SOCKETHANDLER_EPOLL_EVENTS);
+    if (m_epoll == -1)
+        LogError(NULL, "epoll_create", Errno, StrError(Errno), LOG_LEVEL_FATAL);
+#else
     FD_ZERO(&m_rfds);
     FD_ZERO(&m_wfds);
     FD_ZERO(&m_efds);
+#endif
 }
 
 
@@ -88,6 +98,10 @@ SocketHandler::~SocketHandler()
     }
     if (m_resolver)
         delete m_resolver;
+#ifdef SOCKETS_USE_EPOLL
+    if (m_epoll != -1)
+        close(m_epoll);
+#endif
 }
 
 
@@ -137,13 +151,82 @@ void SocketHandler::Get(SOCKET s,bool& r,bool& w,bool& e)
 {
     if (s >= 0)
     {
+#ifdef SOCKETS_USE_EPOLL
+        std::map<SOCKET,unsigned int>::iterator it = m_events.find(s);
+        unsigned int ev = it != m_events.end() ? it -> second : 0;
+        r = (ev & EPOLLIN) ? true : false;
+        w = (ev & EPOLLOUT) ? true : false;
+        e = (ev & EPOLLPRI) ? true : false;
+#else
         r = FD_ISSET(s, &m_rfds) ? true : false;
         w = FD_ISSET(s, &m_wfds) ? true : false;
         e = FD_ISSET(s, &m_efds) ? true : false;
+#endif
     }
 }
 
 
+#ifdef SOCKETS_USE_EPOLL
+void SocketHandler::Set(SOCKET s,bool bRead,bool bWrite,bool bException)
+{
+    if (s < 0 || m_epoll == -1)
+        return;
+    std::map<SOCKET,unsigned int>::iterator it = m_events.find(s);
+    if (!bRead && !bWrite && !bException)
+    {
+        if (it != m_events.end())
+        {
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, s, NULL); // fails harmlessly if the socket is already closed
+            m_events.erase(it);
+        }
+        m_pending_read.erase(s);
+        return;
+    }
+    unsigned int mask = (bRead ? (unsigned int)EPOLLIN : 0u) | (bWrite ? (unsigned int)EPOLLOUT : 0u) | (bException ? (unsigned int)EPOLLPRI : 0u);
+    if (it != m_events.end() && it -> second == mask)
+        return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = mask | EPOLLET;
+    ev.data.fd = s;
+    // the kernel drops closed descriptors on its own, so our map may be out of date if a socket number got reused
+    int op = it != m_events.end() ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(m_epoll, op, s, &ev) == -1)
+    {
+        op = (op == EPOLL_CTL_MOD) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        if (epoll_ctl(m_epoll, op, s, &ev) == -1)
+        {
+            LogError(NULL, "epoll_ctl", Errno, StrError(Errno), LOG_LEVEL_FATAL);
+            return;
+        }
+    }
+    m_events[s] = mask;
+}
+
+
+int SocketHandler::GetPollFd()
+{
+    return m_epoll;
+}
+
+
+bool SocketHandler::HasPendingReads()
+{
+    return !m_pending_read.empty() || !m_add.empty();
+}
+#else
+int SocketHandler::GetPollFd()
+{
+    return -1;
+}
+
+
+bool SocketHandler::HasPendingReads()
+{
+    return !m_add.empty();
+}
+
+
 void SocketHandler::Set(SOCKET s,bool bRead,bool bWrite,bool bException)
 {
     if (s >= 0)
@@ -183,14 +266,18 @@ void SocketHandler::Set(SOCKET s,bool bRead,bool bWrite,bool bException)
         }
     }
 }
+#endif
 
 
 int SocketHandler::Select(long sec,long usec)
 {
-    struct timeval tv;
     int n;
 
+#ifdef SOCKETS_USE_EPOLL
+    while (m_add.size())
+#else
     while (m_add.size() && m_sockets.size() < FD_SETSIZE )
+#endif
     {
         socket_m::iterator it = m_add.begin();
         SOCKET s = (*it).first;
@@ -212,6 +299,28 @@ int SocketHandler::Select(long sec,long usec)
         m_add.erase(it);
     }
 
+#ifdef SOCKETS_USE_EPOLL
+    struct epoll_event events[SOCKETHANDLER_EPOLL_EVENTS];
+    int timeout = m_pending_read.empty() ? (int)(sec * 1000 + (usec + 999) / 1000) : 0;
+    n = epoll_wait(m_epoll, events, SOCKETHANDLER_EPOLL_EVENTS, timeout);
+    m_ready.clear();
+    if (n == -1 && Errno == EINTR)
+        n = 0;
+    if (n == -1)
+    {
+        LogError(NULL, "epoll_wait", Errno, StrError(Errno));
+    }
+    else
+    {
+        for (int i = 0; i < n; i++)
+            m_ready[events[i].data.fd] |= events[i].events;
+        for (std::set<SOCKET>::iterator it = m_pending_read.begin(); it != m_pending_read.end(); it++)
+            m_ready[*it] |= EPOLLIN;
+        m_pending_read.clear();
+        n = (int)m_ready.size();
+    }
+#else
+    struct timeval tv;
 #ifdef __APPLE_CC__
     fd_set rfds;
     fd_set wfds;
@@ -255,7 +364,8 @@ int SocketHandler::Select(long sec,long usec)
             exit(-1);)
     #endif
     }
-    else
+#endif // SOCKETS_USE_EPOLL
+    if (n != -1)
 //	if (n > 0)
     {
         for (socket_m::iterator it2 = m_sockets.begin(); it2 != m_sockets.end(); it2++)
@@ -292,7 +402,22 @@ int SocketHandler::Select(long sec,long usec)
                 else
                 if (n > 0)
                 {
-                    if (FD_ISSET(i, &rfds))
+#ifdef SOCKETS_USE_EPOLL
+                    std::map<SOCKET,unsigned int>::iterator rit = m_ready.find(i);
+                    unsigned int ev = rit != m_ready.end() ? rit -> second : 0;
+                    unsigned int mask = m_events.count(i) ? m_events[i] : 0;
+                    // errors and hangups are reported as readable/writable, as select() does
+                    if (ev & (EPOLLERR | EPOLLHUP))
+                        ev |= mask & (EPOLLIN | EPOLLOUT);
+                    bool bRead = (ev & EPOLLIN) && (mask & EPOLLIN);
+                    bool bWrite = (ev & EPOLLOUT) && (mask & EPOLLOUT);
+                    bool bException = (ev & EPOLLPRI) ? true : false;
+#else
+                    bool bRead = FD_ISSET(i, &rfds) ? true : false;
+                    bool bWrite = FD_ISSET(i, &wfds) ? true : false;
+                    bool bException = FD_ISSET(i, &efds) ? true : false;
+#endif
+                    if (bRead)
                     {
                         TcpSocket *tcp = (TcpSocket *)(p);
 //TcpSocket *tcp = dynamic_cast<TcpSocket *>(p);
@@ -313,9 +438,15 @@ int SocketHandler::Select(long sec,long usec)
                             }
 //							p -> Touch();
                         }
+#ifdef SOCKETS_USE_EPOLL
+// edge triggered: data left in the socket will not be reported again, so read it with the next call
+                        int avail = 0;
+                        if (!p -> CloseAndDelete() && ioctl(i, FIONREAD, &avail) == 0 && avail > 0)
+                            m_pending_read.insert(i);
+#endif
 // UnlockWrite (call OnWrite if saved size == 0 && total output buffer size > 0)
                     }
-                    if (FD_ISSET(i, &wfds))
+                    if (bWrite)
                     {
                         if (p -> Connecting())
                         {
@@ -351,7 +482,7 @@ int SocketHandler::Select(long sec,long usec)
 //								p -> Touch();
                         }
                     }
-                    if (FD_ISSET(i, &efds))
+                    if (bException)
                     {
                         p -> OnException();
                     }
@@ -373,6 +504,9 @@ int SocketHandler::Select(long sec,long usec)
                 if (!m_slave && p -> IsDetach())
                 {
                     Set(p -> GetSocket(), false, false, false);
+#ifdef SOCKETS_USE_EPOLL
+                    m_pending_read.erase((*it3).first);
+#endif
                     p -> DetachSocket();
                     m_sockets.erase(it3);
                     repeat = true;
@@ -418,6 +552,9 @@ int SocketHandler::Select(long sec,long usec)
                     {
                         delete p;
                     }
+#ifdef SOCKETS_USE_EPOLL
+                    m_pending_read.erase((*it3).first);
+#endif
                     m_sockets.erase(it3);
                     repeat = true;
                     break;
@@ -24,11 +24,19 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define _SOCKETHANDLER_H
 
 #include <map>
+#include <set>
 #include <string>
 
 #include "socket_include.h"
 #include "StdLog.h"
 
+// on linux, sockets are watched with edge triggered epoll instead of select(). this removes the FD_SETSIZE limit
+// and lets the owner block on GetPollFd() until there is something to do.
+#if defined(__linux__) && !defined(SOCKETS_NO_EPOLL)
+#  define SOCKETS_USE_EPOLL
+#  define SOCKETHANDLER_EPOLL_EVENTS 64
+#endif
+
 class Socket;
 class PoolSocket;
 class ResolvServer;
@@ -52,6 +60,10 @@ class SocketHandler
 /** Set read/write/exception file descriptor sets (fd_set). */
         void Set(SOCKET s,bool bRead,bool bWrite,bool bException = true);
         int Select(long sec,long usec);
+/** File descriptor that becomes readable when Select() has work to do, -1 if not supported (select backend). */
+        int GetPollFd();
+/** True if sockets still have unread data and the next Select() must not block. */
+        bool HasPendingReads();
         bool Valid(Socket *);
 /** Override and return false to deny all incoming connections. */
         virtual bool OkToAccept();
@@ -104,9 +116,16 @@ class SocketHandler
         std::string m_host;                       // local
         ipaddr_t m_ip;                            // local
         std::string m_addr;                       // local
+#ifdef SOCKETS_USE_EPOLL
+        int m_epoll;
+        std::map<SOCKET,unsigned int> m_events;   // registered epoll event mask
+        std::map<SOCKET,unsigned int> m_ready;    // events reported by the last epoll_wait()
+        std::set<SOCKET> m_pending_read;          // sockets that still had data after OnRead()
+#else
         fd_set m_rfds;
         fd_set m_wfds;
         fd_set m_efds;
+#endif
         int m_preverror;
         bool m_slave;
 #ifdef IPPROTO_IPV6
@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <cfloat>
+#include "common.h"
+#include "MapTile.h"
+#include "NavGrid.h"
+#include "Pathfinder.h"
+
+#define PATHFINDER_HASH_MIN 256 // initial hash table size in node blocks, power of 2
+#define PATHFINDER_TIE_BREAK 1.001f // slightly overestimating h prefers cells closer to the end among equal f; paths are at most 0.1% longer
+#define PATHFINDER_SMOOTH_AHEAD 16 // corners looked ahead when cutting corners
+
+// step direction for (dx + 1) * 3 + (dy + 1)
+static const int8 NavDirIndex[9] = { 5, 4, 3, 6, -1, 2, 7, 0, 1 };
+
+static float NavZ(MapTileStorage& tiles, float x, float y)
+{
+    int32 nx = NavCoord(x), ny = NavCoord(y);
+    MapTile *tile = nx < 0 || ny < 0 ? NULL : tiles.GetTile(NavTilePos(nx, ny));
+    return tile ? tile->GetZ(x, y) : INVALID_HEIGHT;
+}
+
+NavArena::NavArena()
+{
+    _cur = 0;
+    _used = 0;
+}
+
+NavArena::~NavArena()
+{
+    for(uint32 i = 0; i < _blocks.size(); i++)
+        delete [] _blocks[i].mem;
+}
+
+void *NavArena::Alloc(uint32 size)
+{
+    size = (size + 7) & ~7;
+    while(_cur < _blocks.size() && _used + size > _blocks[_cur].size)
+    {
+        _cur++;
+        _used = 0;
+    }
+    if(_cur == _blocks.size())
+    {
+        Block b;
+        b.size = std::max(size, uint32(NAVARENA_BLOCK_SIZE));
+        b.mem = new uint8[b.size];
+        _blocks.push_back(b);
+        _used = 0;
+    }
+    void *p = _blocks[_cur].mem + _used;
+    _used += size;
+    return p;
+}
+
+void NavArena::Reset(void)
+{
+    _cur = 0;
+    _used = 0;
+}
+
+uint32 NavArena::GetCapacity(void)
+{
+    uint32 n = 0;
+    for(uint32 i = 0; i < _blocks.size(); i++)
+        n += _blocks[i].size;
+    return n;
+}
+
+Pathfinder::Pathfinder()
+{
+    _tiles = NULL;
+    _lastpos = uint32(-1);
+    _lastgrid = NULL;
+    _hash = NULL;
+    _hashmask = 0;
+    _blockcount = 0;
+    _lastblock = NULL;
+    _maxnodes = PATHFINDER_MAX_NODES;
+    _expanded = 0;
+}
+
+// state of a cell; 0 (blocked) if outside the map or on a tile that is not loaded
+uint16 Pathfinder::_Cell(int32 nx, int32 ny)
+{
+    if(uint32(nx) >= NAV_MAP_CELLS || uint32(ny) >= NAV_MAP_CELLS)
+        return 0;
+    uint32 pos = NavTilePos(nx, ny);
+    if(pos != _lastpos)
+    {
+        MapTile *tile = _tiles->GetTile(pos);
+        _lastgrid = tile ? tile->GetNavGrid() : NULL;
+        _lastpos = pos;
+    }
+    return _lastgrid ? _lastgrid->Get(nx % NAVGRID_SIZE, ny % NAVGRID_SIZE) : 0;
+}
+
+static inline uint32 NavHash(uint32 key)
+{
+    uint32 h = key * 0x9E3779B1;
+    return h ^ (h >> 16);
+}
+
+// the node of a cell, created if it was not looked at before
+inline Pathfinder::Node *Pathfinder::_GetNode(int32 nx, int32 ny)
+{
+    uint32 bkey = (uint32(nx >> 3) << 10) | uint32(ny >> 3);
+    NodeBlock *b = _lastblock && _lastblock->key == bkey ? _lastblock : _GetBlock(bkey, nx, ny);
+    _lastblock = b;
+    return &b->nodes[(nx & 7) * 8 + (ny & 7)];
+}
+
+Pathfinder::NodeBlock *Pathfinder::_GetBlock(uint32 bkey, int32 nx, int32 ny)
+{
+    uint32 i = NavHash(bkey) & _hashmask;
+    while(_hash[i])
+    {
+        if(_hash[i]->key == bkey)
+            return _hash[i];
+        i = (i + 1) & _hashmask;
+    }
+    NodeBlock *b = (NodeBlock*)_arena.Alloc(sizeof(NodeBlock));
+    b->key = bkey;
+    int32 bx = nx & ~7, by = ny & ~7;
+    for(uint32 k = 0; k < 64; k++)
+    {
+        Node& n = b->nodes[k];
+        n.key = NavKey(bx + (k >> 3), by + (k & 7));
+        n.g = FLT_MAX;
+        n.f = FLT_MAX;
+        n.parent = NULL;
+        n.heapidx = -2; // not looked at yet
+    }
+    _hash[i] = b;
+    if(++_blockcount * 2 > _hashmask)
+        _GrowHash();
+    return b;
+}
+
+// the old table stays in the arena until the search is done
+void Pathfinder::_GrowHash(void)
+{
+    NodeBlock **old = _hash;
+    uint32 oldsize = _hashmask + 1;
+    _hashmask = oldsize * 2 - 1;
+    _hash = (NodeBlock**)_arena.Alloc((_hashmask + 1) * sizeof(NodeBlock*));
+    memset(_hash, 0, (_hashmask + 1) * sizeof(NodeBlock*));
+    for(uint32 k = 0; k < oldsize; k++)
+    {
+        if(!old[k])
+            continue;
+        uint32 i = NavHash(old[k]->key) & _hashmask;
+        while(_hash[i])
+            i = (i + 1) & _hashmask;
+        _hash[i] = old[k];
+    }
+}
+
+void Pathfinder::_HeapUp(uint32 i)
+{
+    Node *n = _heap[i];
+    while(i)
+    {
+        uint32 p = (i - 1) / 2;
+        if(_heap[p]->f <= n->f)
+            break;
+        _heap[i] = _heap[p];
+        _heap[i]->heapidx = i;
+        i = p;
+    }
+    _heap[i] = n;
+    n->heapidx = i;
+}
+
+Pathfinder::Node *Pathfinder::_HeapPop(void)
+{
+    Node *top = _heap[0];
+    Node *n = _heap.back();
+    _heap.pop_back();
+    top->heapidx = -1;
+    uint32 size = _heap.size();
+    if(!size)
+        return top;
+    uint32 i = 0;
+    while(true)
+    {
+        uint32 c = i * 2 + 1;
+        if(c >= size)
+            break;
+        if(c + 1 < size && _heap[c + 1]->f < _heap[c]->f)
+            c++;
+        if(n->f <= _heap[c]->f)
+            break;
+        _heap[i] = _heap[c];
+        _heap[i]->heapidx = i;
+        i = c;
+    }
+    _heap[i] = n;
+    n->heapidx = i;
+    return top;
+}
+
+bool Pathfinder::FindPath(MapTileStorage& tiles, float sx, float sy, float ex, float ey, std::vector<NavPoint>& path)
+{
+    path.clear();
+    _tiles = &tiles;
+    _lastpos = uint32(-1);
+    _lastgrid = NULL;
+    _expanded = 0;
+    int32 snx = NavCoord(sx), sny = NavCoord(sy), enx = NavCoord(ex), eny = NavCoord(ey);
+    if(snx < 0 || sny < 0 || enx < 0 || eny < 0)
+        return false;
+    if(!(_Cell(enx, eny) & NAVGRID_DIRS)) // nothing can be reached from the end, so it can't be reached either
+        return false;
+
+    _arena.Reset();
+    _heap.clear();
+    _hashmask = PATHFINDER_HASH_MIN - 1;
+    _blockcount = 0;
+    _lastblock = NULL;
+    _hash = (NodeBlock**)_arena.Alloc(PATHFINDER_HASH_MIN * sizeof(NodeBlock*));
+    memset(_hash, 0, PATHFINDER_HASH_MIN * sizeof(NodeBlock*));
+
+    uint32 endkey = NavKey(enx, eny);
+    Node *start = _GetNode(snx, sny);
+    start->g = 0;
+    start->f = NavOctile(snx, sny, enx, eny) * PATHFINDER_TIE_BREAK;
+    _heap.push_back(start);
+    start->heapidx = 0;
+    Node *found = NULL;
+    while(!_heap.empty())
+    {
+        Node *cur = _HeapPop();
+        if(cur->key == endkey)
+        {
+            found = cur;
+            break;
+        }
+        if(++_expanded > _maxnodes)
+            break;
+        int32 cx = cur->key >> 13, cy = cur->key & 0x1FFF;
+        uint16 cell = _Cell(cx, cy);
+        if(cur == start)
+            cell |= NAVGRID_DIRS; // we may stand somewhere too steep to walk, but can still get away from there
+        for(uint32 d = 0; d < 8; d++)
+        {
+            if(!(cell & (1 << d)))
+                continue;
+            int32 nx = cx + NavDirX[d], ny = cy + NavDirY[d];
+            uint16 nc = _Cell(nx, ny);
+            if(!(nc & (1 << ((d + 4) & 7))))
+                continue;
+            float g = cur->g + NavStepCost(d, nc);
+            Node *n = _GetNode(nx, ny);
+            if(g >= n->g)
+                continue;
+            n->f = g + (n->g == FLT_MAX ? NavOctile(nx, ny, enx, eny) * PATHFINDER_TIE_BREAK : n->f - n->g);
+            n->g = g;
+            n->parent = cur;
+            if(n->heapidx < 0) // new, or closed and found again over a shorter way
+            {
+                _heap.push_back(n);
+                n->heapidx = _heap.size() - 1;
+            }
+            _HeapUp(n->heapidx);
+        }
+    }
+    if(!found)
+        return false;
+
+    _cells.clear();
+    for(Node *n = found; n; n = n->parent)
+        _cells.push_back(n->key);
+    std::reverse(_cells.begin(), _cells.end());
+    _Simplify(_cells);
+
+    path.resize(_cells.size() < 2 ? 2 : _cells.size());
+    for(uint32 i = 1; i + 1 < path.size(); i++)
+    {
+        path[i].x = NavCellCenter(_cells[i] >> 13);
+        path[i].y = NavCellCenter(_cells[i] & 0x1FFF);
+    }
+    path.front().x = sx;
+    path.front().y = sy;
+    path.back().x = ex;
+    path.back().y = ey;
+    for(uint32 i = 0; i < path.size(); i++)
+        path[i].z = NavZ(tiles, path[i].x, path[i].y);
+    return true;
+}
+
+// true if the straight line between two cell centers can be walked. every cell the line touches is visited,
+// stepping over the edge it crosses, or diagonally if it goes exactly through a corner.
+// shallow liquid is avoided, the search only went through it if there was no better way.
+bool Pathfinder::_LineWalkable(uint32 from, uint32 to)
+{
+    int32 x = from >> 13, y = from & 0x1FFF;
+    int32 tx = to >> 13, ty = to & 0x1FFF;
+    int32 dx = abs(tx - x), dy = abs(ty - y);
+    int32 sx = tx > x ? 1 : -1, sy = ty > y ? 1 : -1;
+    int32 ix = 0, iy = 0;
+    uint16 cell = _Cell(x, y);
+    while(ix < dx || iy < dy)
+    {
+        // which edge comes first: the next x edge at (0.5 + ix) / dx of the way, the next y edge at (0.5 + iy) / dy
+        int32 ex = (1 + 2 * ix) * dy, ey = (1 + 2 * iy) * dx, mx = 0, my = 0;
+        if(ex <= ey)
+        {
+            mx = sx;
+            ix++;
+        }
+        if(ey <= ex)
+        {
+            my = sy;
+            iy++;
+        }
+        uint32 d = NavDirIndex[(mx + 1) * 3 + my + 1];
+        uint16 next = _Cell(x + mx, y + my);
+        if(!(cell & (1 << d)) || !(next & (1 << ((d + 4) & 7))) || (next & NAVGRID_WATER))
+            return false;
+        x += mx;
+        y += my;
+        cell = next;
+    }
+    return true;
+}
+
+// keep only the cells where the direction changes, then skip all corners that can be cut in a straight line
+void Pathfinder::_Simplify(std::vector<uint32>& cells)
+{
+    if(cells.size() < 3)
+        return;
+    uint32 k = 1;
+    for(uint32 i = 1; i + 1 < cells.size(); i++)
+    {
+        uint32 a = cells[i - 1], b = cells[i], c = cells[i + 1];
+        if(b - a != c - b) // key differences are the same for the same step
+            cells[k++] = b;
+    }
+    cells[k++] = cells.back();
+    cells.resize(k);
+
+    k = 1;
+    uint32 i = 0;
+    while(i + 1 < cells.size())
+    {
+        uint32 j = std::min(i + PATHFINDER_SMOOTH_AHEAD, uint32(cells.size() - 1));
+        while(j > i + 1 && !_LineWalkable(cells[i], cells[j]))
+            j--;
+        cells[k++] = cells[j];
+        i = j;
+    }
+    cells.resize(k);
+}
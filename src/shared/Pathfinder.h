@@ -0,0 +1,93 @@
+#ifndef PATHFINDER_H
+#define PATHFINDER_H
+
+#include "common.h"
+
+class MapTileStorage;
+class NavGrid;
+
+#define PATHFINDER_MAX_NODES 250000 // default limit of cells expanded by one search, ~15 tiles
+#define NAVARENA_BLOCK_SIZE (256 * 1024)
+
+struct NavPoint
+{
+    float x, y, z;
+};
+
+// bump allocator for the data of one path search. Reset() frees everything at once
+// and keeps the memory blocks for the next search, so a search allocates nothing once the blocks are there.
+class NavArena
+{
+public:
+    NavArena();
+    ~NavArena();
+    void *Alloc(uint32 size); // 8 byte aligned
+    void Reset(void);
+    uint32 GetCapacity(void); // bytes held
+
+private:
+    struct Block
+    {
+        uint8 *mem;
+        uint32 size;
+    };
+    std::vector<Block> _blocks;
+    uint32 _cur; // block allocations are made from
+    uint32 _used; // bytes used in that block
+};
+
+// A* over the NavGrids of the loaded map tiles, 8 directions, octile distance heuristic.
+// cells on tiles that are not loaded count as blocked.
+// the cell states are allocated from the arena in blocks of 8x8 cells, found by an open addressing hash table;
+// so the cost of a search depends on the cells it looks at and not on the size of the map,
+// and most neighbours of a cell are in the block it is in.
+// one instance per thread; MapTile::GetNavGrid() builds missing grids, the tiles must not be unloaded during a search.
+class Pathfinder
+{
+public:
+    Pathfinder();
+    // path: cleared, then the points to walk through from (sx, sy) to (ex, ey), both included, with terrain heights.
+    // straight runs and corners that can be cut are removed. returns false if there is no path or the search
+    // expanded more than the max. amount of cells.
+    bool FindPath(MapTileStorage& tiles, float sx, float sy, float ex, float ey, std::vector<NavPoint>& path);
+    inline void SetMaxNodes(uint32 n) { _maxnodes = n; }
+    inline uint32 GetExpandedCount(void) { return _expanded; } // cells expanded by the last search
+    inline uint32 GetArenaSize(void) { return _arena.GetCapacity(); }
+
+private:
+    struct Node
+    {
+        uint32 key; // (nx << 13) | ny, global cell coords
+        float g, f;
+        Node *parent;
+        int32 heapidx; // -1: closed
+    };
+    struct NodeBlock
+    {
+        uint32 key; // (nx >> 3 << 10) | (ny >> 3)
+        Node nodes[64];
+    };
+
+    uint16 _Cell(int32 nx, int32 ny);
+    Node *_GetNode(int32 nx, int32 ny);
+    NodeBlock *_GetBlock(uint32 bkey, int32 nx, int32 ny);
+    void _GrowHash(void);
+    void _HeapUp(uint32 i);
+    Node *_HeapPop(void);
+    bool _LineWalkable(uint32 from, uint32 to);
+    void _Simplify(std::vector<uint32>& cells);
+
+    MapTileStorage *_tiles;
+    uint32 _lastpos; // tile of the last _Cell() lookup, to skip the tile storage for neighbouring cells
+    const NavGrid *_lastgrid;
+
+    NavArena _arena;
+    NodeBlock **_hash;
+    uint32 _hashmask, _blockcount;
+    NodeBlock *_lastblock;
+    std::vector<Node*> _heap; // open list, binary heap on f
+    std::vector<uint32> _cells; // the found path, as cell keys
+    uint32 _maxnodes, _expanded;
+};
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef _TIMERWHEEL_H
+#define _TIMERWHEEL_H
+
+#include <vector>
+#include "SysDefs.h"
+
+// hierarchical timer wheel with 1 ms resolution. times are absolute msecs of a wrapping clock like getMonotonicMSTime().
+// level 0 has one slot per msec for the next 256 msecs, the higher levels hold timers further away in coarser slots,
+// which are moved down when their time comes. adding, removing and expiring a timer is O(1). Pop() steps
+// over every msec since the last step, but only looks at one slot per msec, and skips the steps if there are no timers.
+// timers more than ~18 hours ahead are kept in the last level until they come into range.
+template <class T> class TimerWheel
+{
+public:
+    enum
+    {
+        L0_BITS = 8,
+        LN_BITS = 6,
+        LEVELS = 4,
+        L0_SLOTS = 1 << L0_BITS,
+        LN_SLOTS = 1 << LN_BITS,
+        LISTS = L0_SLOTS + (LEVELS - 1) * LN_SLOTS + 1, // all slots + the list of expired timers
+        READY = LISTS - 1,
+        MAX_DELTA = (1 << (L0_BITS + (LEVELS - 1) * LN_BITS)) - 1
+    };
+
+    TimerWheel(uint32 now);
+    uint32 Add(uint32 when, const T& data); // returns the id of the timer
+    void Remove(uint32 id); // id must belong to a timer that was neither removed nor popped
+    bool Pop(uint32 now, T& data); // get the next timer due at now, in order of expiry
+    bool PopAny(T& data); // get and remove any timer, due or not
+    uint32 GetNextDelay(uint32 now); // msecs until the next timer might be due (never too late), or uint32(-1) if empty
+    inline uint32 Size(void) { return _count; }
+
+private:
+    struct Node
+    {
+        T data;
+        uint32 when;
+        uint32 prev, next; // circular list, the first LISTS nodes are the list heads
+    };
+
+    void _Advance(uint32 now);
+    void _Insert(uint32 id);
+    void _Link(uint32 id, uint32 list);
+    void _Unlink(uint32 id);
+    inline bool _Empty(uint32 list) { return _nodes[list].next == list; }
+    inline uint32 _Slot(uint32 level, uint32 t)
+    {
+        return level ? L0_SLOTS + (level - 1) * LN_SLOTS + ((t >> (L0_BITS + (level - 1) * LN_BITS)) & (LN_SLOTS - 1)) : (t & (L0_SLOTS - 1));
+    }
+
+    std::vector<Node> _nodes;
+    std::vector<uint32> _free;
+    uint32 _current; // next msec to be processed
+    uint32 _count;
+};
+
+template <class T> TimerWheel<T>::TimerWheel(uint32 now)
+{
+    _nodes.resize(LISTS);
+    for(uint32 i = 0; i < LISTS; i++)
+        _nodes[i].prev = _nodes[i].next = i;
+    _current = now;
+    _count = 0;
+}
+
+template <class T> void TimerWheel<T>::_Link(uint32 id, uint32 list)
+{
+    Node& n = _nodes[id];
+    n.next = list;
+    n.prev = _nodes[list].prev;
+    _nodes[n.prev].next = id;
+    _nodes[list].prev = id;
+}
+
+template <class T> void TimerWheel<T>::_Unlink(uint32 id)
+{
+    Node& n = _nodes[id];
+    _nodes[n.prev].next = n.next;
+    _nodes[n.next].prev = n.prev;
+}
+
+// put a timer into the slot matching its distance to _current. timers already due go to the current slot,
+// so that a timer added while expired ones are handled does not run before the next Advance().
+template <class T> void TimerWheel<T>::_Insert(uint32 id)
+{
+    uint32 when = _nodes[id].when;
+    int32 delta = int32(when - _current);
+    if(delta < 0)
+    {
+        delta = 0;
+        when = _current;
+    }
+    uint32 level = 0;
+    if(uint32(delta) > uint32(MAX_DELTA))
+        when = _current + MAX_DELTA; // moved down again when the slot is reached
+    while(level < LEVELS - 1 && uint32(delta) >= (1U << (L0_BITS + level * LN_BITS)))
+        level++;
+    _Link(id, _Slot(level, when));
+}
+
+template <class T> uint32 TimerWheel<T>::Add(uint32 when, const T& data)
+{
+    uint32 id;
+    if(_free.size())
+    {
+        id = _free.back();
+        _free.pop_back();
+    }
+    else
+    {
+        id = _nodes.size();
+        _nodes.resize(id + 1);
+    }
+    _nodes[id].data = data;
+    _nodes[id].when = when;
+    _Insert(id);
+    _count++;
+    return id;
+}
+
+template <class T> void TimerWheel<T>::Remove(uint32 id)
+{
+    _Unlink(id);
+    _nodes[id].data = T();
+    _free.push_back(id);
+    _count--;
+}
+
+template <class T> void TimerWheel<T>::_Advance(uint32 now)
+{
+    if(!_count)
+    {
+        if(int32(now - _current) >= 0)
+            _current = now + 1;
+        return;
+    }
+    while(int32(now - _current) >= 0)
+    {
+        // entering a new round of a level: move the timers of its next slot down
+        for(uint32 level = 1; level < LEVELS; level++)
+        {
+            if(_current & ((1U << (L0_BITS + (level - 1) * LN_BITS)) - 1))
+                break;
+            uint32 list = _Slot(level, _current);
+            while(!_Empty(list))
+            {
+                uint32 id = _nodes[list].next;
+                _Unlink(id);
+                _Insert(id);
+            }
+        }
+        uint32 list = _Slot(0, _current);
+        while(!_Empty(list))
+        {
+            uint32 id = _nodes[list].next;
+            _Unlink(id);
+            _Link(id, READY);
+        }
+        _current++;
+    }
+}
+
+template <class T> bool TimerWheel<T>::Pop(uint32 now, T& data)
+{
+    if(_Empty(READY))
+        _Advance(now);
+    if(_Empty(READY))
+        return false;
+    uint32 id = _nodes[READY].next;
+    data = _nodes[id].data;
+    Remove(id);
+    return true;
+}
+
+template <class T> bool TimerWheel<T>::PopAny(T& data)
+{
+    for(uint32 list = 0; list < LISTS; list++)
+    {
+        if(_Empty(list))
+            continue;
+        uint32 id = _nodes[list].next;
+        data = _nodes[id].data;
+        Remove(id);
+        return true;
+    }
+    return false;
+}
+
+// level 0 slots hold timers of exactly one msec. for the other levels, the time their next used slot is moved down
+// is returned, which is the earliest any of its timers can be due.
+template <class T> uint32 TimerWheel<T>::GetNextDelay(uint32 now)
+{
+    if(!_count)
+        return uint32(-1);
+    if(!_Empty(READY))
+        return 0;
+    uint32 next = _current + MAX_DELTA;
+    for(uint32 i = 0; i < L0_SLOTS; i++)
+    {
+        if(!_Empty(_Slot(0, _current + i)))
+        {
+            next = _current + i;
+            break;
+        }
+    }
+    for(uint32 level = 1; level < LEVELS; level++)
+    {
+        uint32 shift = L0_BITS + (level - 1) * LN_BITS;
+        for(uint32 i = 0; i <= LN_SLOTS; i++)
+        {
+            uint32 t = ((_current >> shift) + i) << shift;
+            if(int32(t - _current) < 0) // this round's slot was already moved down
+                continue;
+            if(!_Empty(_Slot(level, t)))
+            {
+                if(int32(t - next) < 0)
+                    next = t;
+                break;
+            }
+        }
+    }
+    int32 left = int32(next - now);
+    return left > 0 ? uint32(left) : 0;
+}
+
+#endif
@@ -99,19 +99,19 @@ void ZCompressor::Inflate(void)
 
     uLongf origsize=_real_size;
     int8 result;
-    uint8 *target=new uint8[_real_size];
+    ByteBuffer target(_real_size); // pooled storage, swapped in below instead of copied
+    target.resize(_real_size);
     wpos(0);
     rpos(0);
-    result = uncompress(target, &origsize, (uint8*)contents(), size());
+    result = uncompress((uint8*)target.contents(), &origsize, (uint8*)contents(), size());
     if( result!=Z_OK || origsize!=_real_size)
     {
         logerror("ZCompressor: Inflate error! result=%d cursize=%u origsize=%u realsize=%u\n",result,size(),origsize,_real_size);
-        delete [] target;
         return;
     }
-    clear();
-    append(target,origsize);
-    delete [] target;
+    swap(target);
+    rpos(0);
+    wpos(origsize);
     _real_size=0;
     _iscompressed=false;
 
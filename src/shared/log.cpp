@@ -4,12 +4,345 @@
 
 #if PLATFORM == PLATFORM_WIN32
 #include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
 #endif
 
+#if COMPILER == COMPILER_MICROSOFT
+#  define THREADLOCAL __declspec(thread)
+#  define ATOMIC_INC(v) (InterlockedIncrement((volatile LONG*)&(v)) - 1)
+#  define ATOMIC_DEC(v) InterlockedDecrement((volatile LONG*)&(v))
+#  define CAS_PTR(p,o,n) (InterlockedCompareExchangePointer((PVOID volatile*)&(p), (n), (o)) == (o))
+#  define SPIN_TRYLOCK(l) (InterlockedExchange(&(l), 1) == 0)
+#  define SPIN_UNLOCK(l) InterlockedExchange(&(l), 0)
+#  define MEMORY_BARRIER() MemoryBarrier()
+   typedef volatile LONG spinlock_t;
+#else
+#  define THREADLOCAL __thread
+#  define ATOMIC_INC(v) __sync_fetch_and_add(&(v), 1)
+#  define ATOMIC_DEC(v) __sync_fetch_and_sub(&(v), 1)
+#  define CAS_PTR(p,o,n) __sync_bool_compare_and_swap(&(p), (o), (n))
+#  define SPIN_TRYLOCK(l) (__sync_lock_test_and_set(&(l), 1) == 0)
+#  define SPIN_UNLOCK(l) __sync_lock_release(&(l))
+#  define MEMORY_BARRIER() __sync_synchronize()
+   typedef volatile int spinlock_t;
+#endif
+
+// format a log line into text. uses a stack buffer, longer lines go to the heap.
+#define LOG_FORMAT(fmt) \
+    char _buf[LOG_LINE_SIZE]; \
+    std::vector<char> _big; \
+    const char *text = _buf; \
+    { \
+        va_list ap; \
+        va_start(ap, fmt); \
+        int len = vsnprintf(_buf, sizeof(_buf), fmt, ap); \
+        va_end(ap); \
+        size_t size = sizeof(_buf); \
+        while(len < 0 || size_t(len) >= size) /* MSVC returns -1 if the buffer is too small */ \
+        { \
+            size = len < 0 ? size * 2 : len + 1; \
+            _big.resize(size); \
+            va_start(ap, fmt); \
+            len = vsnprintf(&_big[0], size, fmt, ap); \
+            va_end(ap); \
+            text = &_big[0]; \
+        } \
+    }
+
+enum LogRecordFlags
+{
+    LOGREC_STDERR = 0x01,
+    LOGREC_MORE   = 0x02, // the line continues in the next record
+    LOGREC_URGENT = 0x04  // flush as soon as written (errors)
+};
+
+// one piece of a log line in async mode
+struct LogRecord
+{
+    uint32 seq; // order of the line among all threads, taken when its first record is queued (see _log_enqueue())
+    uint32 time;
+    uint8 color;
+    uint8 flags;
+    uint16 len;
+    char text[LOG_RECORD_SIZE - 12];
+};
+
+// records logged by one thread. the thread is the only one to write head, the writer thread the only one to write tail,
+// so no locking is needed.
+struct LogRing
+{
+    LogRecord rec[LOG_RING_RECORDS];
+    volatile uint32 head; // records written
+    volatile uint32 tail; // records consumed
+    spinlock_t owned; // 1 while a thread logs into the ring
+    LogRing *next;
+};
+
 FILE *logfile = NULL;
 uint8 loglevel = 0;
 bool logtime = false;
 
+// async mode state. a thread gets a ring when it logs for the first time. when it exits, the ring is given back
+// and taken over by the next new thread, so there are never more rings than threads logging at the same time.
+// rings are never removed from logrings, the writer walks the list without locking.
+volatile bool logasync = false;
+volatile bool logstop = false;
+volatile bool logflushreq = false;
+uint32 logflushms = LOG_DEFAULT_FLUSH_MS;
+volatile uint32 logseq = 0;
+volatile uint32 logenqueuing = 0; // threads that saw logasync set and may be queueing a line right now
+LogRing *volatile logrings = NULL;
+THREADLOCAL LogRing *threadRing = NULL;
+spinlock_t logasynclock = 0;
+#if PLATFORM == PLATFORM_WIN32
+HANDLE logthread = NULL;
+#else
+pthread_t logthread;
+#endif
+
+static inline void _log_sleep(uint32 ms)
+{
+#if PLATFORM == PLATFORM_WIN32
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+// same formats as GetTimeString() and getDateString(), for a given time
+static void _log_timestrings(time_t t, char *timestr, char *datestr)
+{
+    tm* aTm = localtime(&t);
+    sprintf(timestr,"%02d:%02d:%02d", aTm->tm_hour,aTm->tm_min,aTm->tm_sec);
+    sprintf(datestr,"%-4d-%02d-%02d %02d:%02d:%02d ",aTm->tm_year+1900,aTm->tm_mon+1,aTm->tm_mday,aTm->tm_hour,aTm->tm_min,aTm->tm_sec);
+}
+
+static void _log_begin(bool stdout_stream, Color color, const char *timestr, const char *datestr)
+{
+    _log_setcolor(stdout_stream,color);
+    if(logtime)
+        printf("%s ", timestr);
+    if(logfile)
+        fputs(datestr, logfile);
+}
+
+static void _log_text(bool stdout_stream, const char *text, size_t len)
+{
+    fwrite(text, 1, len, stdout_stream ? stdout : stderr);
+    if(logfile)
+        fwrite(text, 1, len, logfile);
+}
+
+static void _log_end(bool stdout_stream)
+{
+    _log_resetcolor(stdout_stream);
+    fputs("\n", stdout_stream ? stdout : stderr);
+    if(logfile)
+        fputs("\n", logfile);
+}
+
+// called in the exiting thread. a thread that logs again after this (from a later TLS destructor) gets a ring again
+#if PLATFORM == PLATFORM_WIN32
+static void WINAPI _log_release(void *p)
+#else
+static void _log_release(void *p)
+#endif
+{
+    threadRing = NULL;
+    SPIN_UNLOCK(((LogRing*)p)->owned); // records still queued in it are written as usual
+}
+
+// have _log_release() called when the thread exits. without fiber local storage (before Vista) the rings are kept.
+static void _log_watchthread(LogRing *r)
+{
+#if PLATFORM == PLATFORM_WIN32
+#  if _WIN32_WINNT >= 0x0600
+    static volatile LONG flsinit = 0;
+    static volatile DWORD fls = FLS_OUT_OF_INDEXES;
+    if(!InterlockedCompareExchange(&flsinit, 1, 0))
+        fls = FlsAlloc(_log_release);
+    if(fls != FLS_OUT_OF_INDEXES) // a thread racing the first one may not see it allocated yet, its ring is kept then
+        FlsSetValue(fls, r);
+#  endif
+#else
+    static pthread_key_t key;
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    struct KeyInit { static void run(void) { pthread_key_create(&key, _log_release); } };
+    pthread_once(&once, KeyInit::run);
+    pthread_setspecific(key, r);
+#endif
+}
+
+static LogRing *_log_register(void)
+{
+    LogRing *r;
+    for(r = logrings; r; r = r->next)
+        if(SPIN_TRYLOCK(r->owned)) // left by an exited thread
+            break;
+    if(!r)
+    {
+        r = new LogRing;
+        r->head = r->tail = 0;
+        r->owned = 1;
+        do
+            r->next = logrings;
+        while(!CAS_PTR(logrings, r->next, r));
+    }
+    threadRing = r;
+    _log_watchthread(r);
+    return r;
+}
+
+static void _log_enqueue(bool stdout_stream, Color color, const char *text, bool urgent)
+{
+    LogRing *r = threadRing ? threadRing : _log_register();
+    uint32 seq = 0;
+    uint32 t = (uint32)time(NULL);
+    size_t len = strlen(text), pos = 0;
+    do
+    {
+        while(r->head - r->tail >= LOG_RING_RECORDS) // full, wait for the writer
+            _log_sleep(1);
+        LogRecord& rec = r->rec[r->head % LOG_RING_RECORDS];
+        size_t n = len - pos < sizeof(rec.text) ? len - pos : sizeof(rec.text);
+        memcpy(rec.text, text + pos, n);
+        pos += n;
+        rec.time = t;
+        rec.color = color;
+        rec.len = n;
+        rec.flags = (stdout_stream ? 0 : LOGREC_STDERR) | (pos < len ? LOGREC_MORE : 0) | (urgent ? LOGREC_URGENT : 0);
+        // the writer orders the lines by the seq of their first record. it is taken right before that record
+        // is published, not before formatting and copying, so the order of lines from different threads matches
+        // the order in which they were queued. only two lines queued within a few instructions of each other
+        // (or with the thread preempted between these two steps) can still come out swapped.
+        if(pos == n) // first record
+            seq = ATOMIC_INC(logseq);
+        rec.seq = seq;
+        MEMORY_BARRIER(); // the record must be complete before the writer can see it
+        r->head++;
+    }
+    while(pos < len);
+}
+
+static void _log_write(bool stdout_stream, Color color, const char *text, bool urgent = false)
+{
+    if(logasync)
+    {
+        // announce ourselves before checking again, so that log_setasync(false) waits for us
+        ATOMIC_INC(logenqueuing);
+        if(logasync)
+        {
+            _log_enqueue(stdout_stream, color, text, urgent);
+            ATOMIC_DEC(logenqueuing);
+            return;
+        }
+        ATOMIC_DEC(logenqueuing);
+    }
+    char timestr[16], datestr[32];
+    _log_timestrings(time(NULL), timestr, datestr);
+    _log_begin(stdout_stream, color, timestr, datestr);
+    _log_text(stdout_stream, text, strlen(text));
+    _log_end(stdout_stream);
+    if(logfile)
+        fflush(logfile);
+    fflush(stdout);
+}
+
+// write all complete lines queued so far, in order of their seq. returns the amount of lines written.
+static uint32 _log_drain(bool& urgent)
+{
+    static time_t lasttime = 0;
+    static char timestr[16], datestr[32];
+    uint32 lines = 0;
+    while(true)
+    {
+        LogRing *best = NULL;
+        uint32 bestseq = 0;
+        for(LogRing *r = logrings; r; r = r->next)
+        {
+            if(r->tail == r->head)
+                continue;
+            MEMORY_BARRIER();
+            uint32 s = r->rec[r->tail % LOG_RING_RECORDS].seq;
+            if(!best || int32(s - bestseq) < 0)
+            {
+                best = r;
+                bestseq = s;
+            }
+        }
+        if(!best)
+            return lines;
+
+        LogRecord *rec = &best->rec[best->tail % LOG_RING_RECORDS];
+        bool out = !(rec->flags & LOGREC_STDERR);
+        if(rec->time != lasttime || !lines)
+        {
+            lasttime = rec->time;
+            _log_timestrings(lasttime, timestr, datestr);
+        }
+        _log_begin(out, (Color)rec->color, timestr, datestr);
+        while(true)
+        {
+            _log_text(out, rec->text, rec->len);
+            uint8 flags = rec->flags;
+            urgent = urgent || (flags & LOGREC_URGENT);
+            MEMORY_BARRIER(); // done reading before the record is given back
+            best->tail++;
+            if(!(flags & LOGREC_MORE))
+                break;
+            while(best->tail == best->head) // rest of the line not yet written
+                _log_sleep(0);
+            MEMORY_BARRIER();
+            rec = &best->rec[best->tail % LOG_RING_RECORDS];
+        }
+        _log_end(out);
+        lines++;
+    }
+}
+
+static void _log_flushall(void)
+{
+    if(logfile)
+        fflush(logfile);
+    fflush(stdout);
+    fflush(stderr);
+}
+
+#if PLATFORM == PLATFORM_WIN32
+static DWORD WINAPI _log_writer(LPVOID)
+#else
+static void *_log_writer(void*)
+#endif
+{
+    uint32 lastflush = getMonotonicMSTime();
+    bool dirty = false;
+    while(true)
+    {
+        bool urgent = false;
+        bool stop = logstop; // read before draining, so that nothing logged before the request is missed
+        bool flushreq = logflushreq;
+        MEMORY_BARRIER();
+        uint32 lines = _log_drain(urgent);
+        dirty = dirty || lines;
+        uint32 now = getMonotonicMSTime();
+        if(dirty && (urgent || flushreq || stop || now - lastflush >= logflushms))
+        {
+            _log_flushall();
+            lastflush = now;
+            dirty = false;
+        }
+        if(flushreq && !lines)
+            logflushreq = false;
+        if(stop && !lines)
+            break;
+        if(!lines)
+            _log_sleep(LOG_WRITER_IDLE_MS);
+    }
+    return 0;
+}
+
 void log_prepare(const char *fn, const char *mode = NULL)
 {
     if(!mode)
@@ -32,196 +365,112 @@ void log_setlogtime(bool b)
     logtime = b;
 }
 
+// in async mode, log calls only queue the formatted line, and a background thread writes it to console and logfile.
+// console and logfile are flushed every flushms msecs then, and right after an error was written.
+void log_setasync(bool b, uint32 flushms)
+{
+    while(!SPIN_TRYLOCK(logasynclock))
+        _log_sleep(1);
+    logflushms = flushms;
+    if(b && !logasync)
+    {
+        logstop = false;
+        bool ok;
+#if PLATFORM == PLATFORM_WIN32
+        logthread = CreateThread(NULL, 0, _log_writer, NULL, 0, NULL);
+        ok = logthread != NULL;
+#else
+        ok = pthread_create(&logthread, NULL, _log_writer, NULL) == 0;
+#endif
+        logasync = ok;
+    }
+    else if(!b && logasync)
+    {
+        logasync = false;
+        MEMORY_BARRIER();
+        // new lines are written directly now. let the writer take the lines still being queued, then stop it.
+        while(logenqueuing)
+            _log_sleep(1);
+        logstop = true;
+#if PLATFORM == PLATFORM_WIN32
+        WaitForSingleObject(logthread, INFINITE);
+        CloseHandle(logthread);
+#else
+        pthread_join(logthread, NULL);
+#endif
+    }
+    SPIN_UNLOCK(logasynclock);
+}
+
+// wait until everything logged so far is written and flushed
+void log_flush(void)
+{
+    if(!logasync)
+        return;
+    logflushreq = true;
+    while(logflushreq && logasync)
+        _log_sleep(1);
+}
+
 void log(const char *str, ...)
 {
     if(!str)
         return;
-    va_list ap;
-    _log_setcolor(true,GREY);
-    if(logtime)
-        printf("%s ", GetTimeString().c_str());
-    va_start(ap, str);
-    vprintf( str, ap );
-    va_end(ap);
-    _log_resetcolor(true);
-
-    printf("\n");
-
-    if(logfile)
-    {
-        fprintf(logfile, "%s", getDateString().c_str());
-        va_start(ap, str);
-        vfprintf(logfile, str, ap);
-        fprintf(logfile, "\n" );
-        va_end(ap);
-        fflush(logfile);
-    }
-    fflush(stdout);
+    LOG_FORMAT(str);
+    _log_write(true,GREY,text);
 }
 
 void logdetail(const char *str, ...)
 {
     if(!str || loglevel < 1)
         return;
-    va_list ap;
-    _log_setcolor(true,LCYAN);
-    if(logtime)
-        printf("%s ", GetTimeString().c_str());
-    va_start(ap, str);
-    vprintf( str, ap );
-    va_end(ap);
-    _log_resetcolor(true);
-
-    printf("\n");
-
-    if(logfile)
-    {
-        fprintf(logfile, "%s", getDateString().c_str());
-        va_start(ap, str);
-        vfprintf(logfile, str, ap);
-        fprintf(logfile, "\n" );
-        va_end(ap);
-        fflush(logfile);
-    }
-    fflush(stdout);
+    LOG_FORMAT(str);
+    _log_write(true,LCYAN,text);
 }
 
 void logdebug(const char *str, ...)
 {
     if(!str || loglevel < 2)
         return;
-    va_list ap;
-    _log_setcolor(true,LBLUE);
-    if(logtime)
-        printf("%s ", GetTimeString().c_str());
-    va_start(ap, str);
-    vprintf( str, ap );
-    va_end(ap);
-    _log_resetcolor(true);
-
-
-    printf("\n");
-
-    if(logfile)
-    {
-        fprintf(logfile, "%s", getDateString().c_str());
-        va_start(ap, str);
-        vfprintf(logfile, str, ap);
-        fprintf(logfile, "\n" );
-        va_end(ap);
-        fflush(logfile);
-    }
-    fflush(stdout);
+    LOG_FORMAT(str);
+    _log_write(true,LBLUE,text);
 }
 
 void logdev(const char *str, ...)
 {
 	if(!str || loglevel < 3)
 		return;
-	va_list ap;
-	_log_setcolor(true,LMAGENTA);
-    if(logtime)
-        printf("%s ", GetTimeString().c_str());
-	va_start(ap, str);
-	vprintf( str, ap );
-	va_end(ap);
-	_log_resetcolor(true);
-
-
-	printf("\n");
-
-	if(logfile)
-	{
-		fprintf(logfile, "%s", getDateString().c_str());
-		va_start(ap, str);
-		vfprintf(logfile, str, ap);
-		fprintf(logfile, "\n" );
-		va_end(ap);
-		fflush(logfile);
-	}
-	fflush(stdout);
+    LOG_FORMAT(str);
+    _log_write(true,LMAGENTA,text);
 }
 
 void logerror(const char *str, ...)
 {
-    va_list ap;
-    _log_setcolor(false,LRED);
-    if(logtime)
-        printf("%s ", GetTimeString().c_str());
-    va_start(ap, str);
-    vfprintf( stderr,  str, ap );
-    va_end(ap);
-    _log_resetcolor(false);
-
-    fprintf(stderr,"\n");
-
-    if(logfile)
-    {
-        fprintf(logfile, "%s", getDateString().c_str());
-        va_start(ap, str);
-        vfprintf(logfile, str, ap);
-        fprintf(logfile, "\n" );
-        va_end(ap);
-        fflush(logfile);
-    }
-    fflush(stdout);
+    LOG_FORMAT(str);
+    _log_write(false,LRED,text,true);
 }
 
 void logcritical(const char *str, ...)
 {
-    va_list ap;
-    _log_setcolor(false,RED);
-    if(logtime)
-        printf("%s ", GetTimeString().c_str());
-    va_start(ap, str);
-    vfprintf( stderr, str, ap );
-    va_end(ap);
-    _log_resetcolor(false);
-
-    fprintf(stderr,"\n");
-
-    if(logfile)
-    {
-        fprintf(logfile, "%s", getDateString().c_str());
-        va_start(ap, str);
-        vfprintf(logfile, str, ap);
-        fprintf(logfile, "\n" );
-        va_end(ap);
-        fflush(logfile);
-    }
-    fflush(stdout);
+    LOG_FORMAT(str);
+    _log_write(false,RED,text,true);
+    log_flush(); // the process might be about to die
 }
 
 void logcustom(uint8 lvl, Color color, const char *str, ...)
 {
     if(!str || loglevel < lvl)
         return;
-    va_list ap;
-    _log_setcolor(true,color);
-    if(logtime)
-        printf("%s ", GetTimeString().c_str());
-    va_start(ap, str);
-    vprintf( str, ap );
-    va_end(ap);
-    _log_resetcolor(true);
-
-    printf("\n");
-
-    if(logfile)
-    {
-        fprintf(logfile, "%s", getDateString().c_str());
-        va_start(ap, str);
-        vfprintf(logfile, str, ap);
-        fprintf(logfile, "\n" );
-        va_end(ap);
-        fflush(logfile);
-    }
-    fflush(stdout);
+    LOG_FORMAT(str);
+    _log_write(true,color,text);
 }
 
 void log_close()
 {
-	fclose(logfile);
+    log_setasync(false);
+    if(logfile)
+        fclose(logfile);
+    logfile = NULL;
 }
 
 void _log_setcolor(bool stdout_stream, Color color)
@@ -1,6 +1,12 @@
 #ifndef _LOG_H
 #define _LOG_H
 
+#define LOG_LINE_SIZE 1024 // lines are formatted on the stack up to this size
+#define LOG_RECORD_SIZE 128 // async mode: bytes per queued record, longer lines use more than one
+#define LOG_RING_RECORDS 1024 // async mode: records per thread; a thread that fills its ring waits for the writer
+#define LOG_DEFAULT_FLUSH_MS 250
+#define LOG_WRITER_IDLE_MS 2
+
 enum Color
 {
     BLACK,
@@ -23,6 +29,8 @@ enum Color
 void log_prepare(const char *fn, const char *mode);
 void log_setloglevel(uint8 lvl);
 void log_setlogtime(bool b);
+void log_setasync(bool b, uint32 flushms = LOG_DEFAULT_FLUSH_MS);
+void log_flush(void);
 void log(const char *str, ...);
 void logdetail(const char *str, ...);
 void logdebug(const char *str, ...);
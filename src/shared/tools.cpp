@@ -11,6 +11,8 @@
 #   include <mmsystem.h>
 #   include <time.h>
 #   include <direct.h>
+#   include <sys/types.h>
+#   include <sys/stat.h>
 #else
 #   include <sys/dir.h>
 #   include <sys/stat.h>
@@ -18,6 +20,7 @@
 #       include <time.h>
 #   endif
 #   include <sys/timeb.h>
+#   include <time.h>
 #   include <unistd.h>
 #endif
 
@@ -214,6 +217,33 @@ uint32 getMSTime(void)
     return time_in_ms;
 }
 
+// msecs since an arbitrary point, not affected by changes of the system time. wraps around after ~49 days.
+uint32 getMonotonicMSTime(void)
+{
+#if PLATFORM == PLATFORM_WIN32
+    return GetTickCount();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint32(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
+}
+
+// resident memory of this process in bytes, or 0 if unknown on this platform
+uint64 GetProcessMemoryUsage(void)
+{
+#if PLATFORM == PLATFORM_WIN32
+    return 0;
+#else
+    uint64 size = 0, resident = 0;
+    std::ifstream f("/proc/self/statm");
+    if(!f.is_open())
+        return 0;
+    f >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
 uint32 GetFileSize(const char* sFileName)
 {
     if(!sFileName || !*sFileName)
@@ -229,6 +259,26 @@ uint32 GetFileSize(const char* sFileName)
     return end_pos - begin_pos;
 }
 
+// size and last modification time (in seconds) of a file, without opening it. false if it does not exist.
+// cheap way to see if a file changed since an earlier call.
+bool GetFileStamp(const char* sFileName, uint32& size, uint64& mtime)
+{
+    if(!sFileName || !*sFileName)
+        return false;
+#if PLATFORM == PLATFORM_WIN32
+    struct _stat64 st;
+    if(_stat64(sFileName, &st))
+        return false;
+#else
+    struct stat st;
+    if(stat(sFileName, &st))
+        return false;
+#endif
+    size = (uint32)st.st_size;
+    mtime = (uint64)st.st_mtime;
+    return true;
+}
+
 // fix filenames for linux ( '/' instead of windows '\')
 void _FixFileName(std::string& str)
 {
@@ -263,12 +313,12 @@ std::string NormalizeFilename(std::string s)
     return s;
 }
 
-std::string FilesizeFormat(uint32 b)
+std::string FilesizeFormat(uint64 b)
 {
-    char buf[15];
+    char buf[32];
     if (b < 1024)
     {
-        sprintf(buf,"%lu B",b);
+        sprintf(buf,"%u B",uint32(b));
     }
     else if(b < 1024*1024)
     {
@@ -342,3 +392,17 @@ std::string GetAbsolutePath(const char *filename)
 
     return p;
 }
+
+//! Returns a name to write fn under before renaming it, unique among all writers of all processes.
+//! owner is the object that writes the file.
+std::string MakeTempFilename(const char *fn, const void *owner)
+{
+    char buf[32];
+#if PLATFORM == PLATFORM_WIN32
+    uint32 pid = GetCurrentProcessId();
+#else
+    uint32 pid = getpid();
+#endif
+    sprintf(buf, ".%u.%p.tmp", pid, owner);
+    return std::string(fn) + buf;
+}
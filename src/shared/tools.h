@@ -22,13 +22,17 @@ std::deque<std::string> GetFileList(std::string);
 bool FileExists(std::string);
 bool CreateDir(const char*);
 uint32 getMSTime(void);
+uint32 getMonotonicMSTime(void);
+uint64 GetProcessMemoryUsage(void);
 uint32 GetFileSize(const char*);
+bool GetFileStamp(const char*, uint32& size, uint64& mtime);
 void _FixFileName(std::string&);
 std::string _PathToFileName(std::string);
 std::string NormalizeFilename(std::string);
-std::string FilesizeFormat(uint32);
+std::string FilesizeFormat(uint64);
 std::string GetWorkingDir(void);
 bool SetWorkingDir(const char*);
 std::string GetAbsolutePath(const char*);
+std::string MakeTempFilename(const char *fn, const void *owner);
 
 #endif
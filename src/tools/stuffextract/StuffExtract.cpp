@@ -7,6 +7,11 @@
 #include "MPQHelper.h"
 #include "dbcfile.h"
 #include "ADTFile.h"
+#include "HeightMap.h"
+#include "MapTile.h"
+#include "NavGrid.h"
+#include "NavGraph.h"
+#include "Pathfinder.h"
 #include "WDTFile.h"
 #include "StuffExtract.h"
 #include "DBCFieldData.h"
@@ -27,7 +32,7 @@ std::set<NameAndAlt> soundFileSet;
 MPQHelper mpq;
 
 // default config; SCPs are done always
-bool doMaps=true, doSounds=false, doTextures=false, doWmos=false, doWmogroups=false, doModels=false, doMd5=true, doAutoclose=false;
+bool doMaps=true, doNavGraphs=true, doSounds=false, doTextures=false, doWmos=false, doWmogroups=false, doModels=false, doMd5=true, doAutoclose=false;
 
 
 
@@ -35,6 +40,14 @@ int main(int argc, char *argv[])
 {
     char input[200];
     printf("StuffExtract [version %u]\n",SE_VERSION);
+    if(argc >= 4 && !stricmp(argv[1],"-pathbench"))
+        return RunPathBench(argc, argv);
+    if(argc >= 4 && !stricmp(argv[1],"-getzbench"))
+        return RunGetZBench(argc, argv);
+    if(argc >= 3 && !stricmp(argv[1],"-logbench"))
+        return RunLogBench(argc, argv);
+    if(argc >= 5 && !stricmp(argv[1],"-mpqbench"))
+        return RunMPQBench(argc, argv);
     printf("Use -help or -? to display help about command line arguments and config.\n\n");
     ProcessCmdArgs(argc, argv);
     PrintConfig();
@@ -97,6 +110,7 @@ void ProcessCmdArgs(int argc, char *argv[])
 
             what = argv[i]+1; // skip first byte (+/-)
             if     (!stricmp(what,"maps"))        doMaps = on;
+            else if(!stricmp(what,"navgraphs"))   doNavGraphs = on;
             else if(!stricmp(what,"textures"))    doTextures = on;
             else if(!stricmp(what,"wmos"))        doWmos = on;
             else if(!stricmp(what,"wmogroups"))   doWmogroups = on;
@@ -128,6 +142,7 @@ void ProcessCmdArgs(int argc, char *argv[])
     if(!doMaps)
     {
         doWmos = false;
+        doNavGraphs = false;
     }
     if(!doWmos)
     {
@@ -146,6 +161,7 @@ void ProcessCmdArgs(int argc, char *argv[])
 void PrintConfig(void)
 {
     printf("config: Do maps:      %s\n",doMaps?"yes":"no");
+    printf("config: Do navgraphs: %s\n",doNavGraphs?"yes":"no");
     printf("config: Do textures:  %s\n",doTextures?"yes":"no");
     printf("config: Do wmos:      %s\n",doWmos?"yes":"no");
     printf("config: Do wmogroups: %s\n",doWmogroups?"yes":"no");
@@ -161,6 +177,7 @@ void PrintHelp(void)
     printf("Use + or - to turn a feature on or off.\n");
     printf("Features are:\n");
     printf("maps      - map extraction\n");
+    printf("navgraphs - precompute the graphs for long path searches (requires maps extraction)\n");
     printf("textures  - extract textures\n");
     printf("wmos      - extract map WMOs (requires maps extraction)\n");
     printf("wmogroups - extract map WMO group files (requires maps and wmos extraction)\n");
@@ -175,7 +192,378 @@ void PrintHelp(void)
     printf("Examples:\n");
     printf("stuffextract +sounds +md5 -maps +autoclose -locale:enGB\n");
     printf("stuffextract +md5 -wmos -sounds -locale:auto -autoclose\n");
-    printf("\nDefault is: +maps -sounds -textures -wmos -models +md5 -autoclose\n");
+    printf("\nDefault is: +maps +navgraphs -sounds -textures -wmos -models +md5 -autoclose\n");
+    printf("\nstuffextract -pathbench <mapid> <paths> [<mapsdir>]\n");
+    printf("searches paths over the extracted height maps of a map and prints the paths per second,\n");
+    printf("for short paths on the cells and for long ones over the navgraphs.\n");
+    printf("\nstuffextract -getzbench <mapid> <lookups> [<mapsdir>]\n");
+    printf("looks up terrain heights at random positions of the extracted height maps and prints the lookups per second.\n");
+    printf("\nstuffextract -logbench <lines> [<logfile>]\n");
+    printf("writes debug lines to the console and <logfile>, synchronously and with async logging, and prints\n");
+    printf("the lines per second to stderr. redirect stdout, the lines go to the console too.\n");
+    printf("\nstuffextract -mpqbench <locale> <threads> <filelist>\n");
+    printf("reads the files listed in <filelist> (one MPQ path per line) from the MPQs in Data/, first on one thread,\n");
+    printf("then on <threads> threads at once, and prints the reads per second and the reads that returned wrong data.\n");
+}
+
+// loads all extracted height maps of a map, for the benchmarks
+static bool LoadBenchTiles(MapTileStorage& tiles, std::vector<uint32>& loaded, uint32 mapid, const char *dir, const char *bench)
+{
+    char fn[512];
+    for(uint32 x = 0; x < 64; x++)
+    {
+        for(uint32 y = 0; y < 64; y++)
+        {
+            sprintf(fn,"%s/%u_%u_%u.hmap",dir,mapid,x,y);
+            if(!FileExists(fn))
+                continue;
+            MapTile *tile = new MapTile();
+            if(!tile->LoadHeightMap(fn, 0))
+            {
+                printf("%s: Can't load '%s'\n",bench,fn);
+                delete tile;
+                continue;
+            }
+            tiles.SetTile(tile, x, y);
+            loaded.push_back(y * 64 + x);
+        }
+    }
+    if(loaded.empty())
+    {
+        printf("%s: No height maps of map %u in '%s'\n",bench,mapid,dir);
+        return false;
+    }
+    return true;
+}
+
+// a random cell of a tile that can be walked from, as world position
+static bool RandomNavCell(MapTileStorage& tiles, uint32 pos, float& x, float& y)
+{
+    const NavGrid *nav = tiles.GetTile(pos)->GetNavGrid();
+    for(uint32 tries = 0; tries < 1000; tries++)
+    {
+        uint32 cx = rand() % NAVGRID_SIZE, cy = rand() % NAVGRID_SIZE;
+        if(nav->Get(cx, cy) & NAVGRID_DIRS)
+        {
+            x = ZEROPOINT - ((pos / 64) * NAVGRID_SIZE + cx + 0.5f) * UNITSIZE; // tile y runs along world x
+            y = ZEROPOINT - ((pos % 64) * NAVGRID_SIZE + cy + 0.5f) * UNITSIZE;
+            return true;
+        }
+    }
+    return false;
+}
+
+static float PathLength(std::vector<NavPoint>& path)
+{
+    float len = 0;
+    for(uint32 i = 1; i < path.size(); i++)
+        len += sqrtf((path[i].x - path[i-1].x) * (path[i].x - path[i-1].x) + (path[i].y - path[i-1].y) * (path[i].y - path[i-1].y));
+    return len;
+}
+
+// paths between tiles at least 2 apart, over the navgraphs and, for comparison, over all cells
+static void RunLongPathBench(MapTileStorage& tiles, std::vector<uint32>& loaded, uint32 mapid, const char *dir, uint32 count)
+{
+    NavGraph graph(mapid, dir);
+    uint32 t = getMSTime(), built = graph.BuildAll();
+    printf("pathbench: %u navgraphs built in %u ms, the others were up to date\n", built, getMSTime() - t);
+
+    std::vector<float> ends;
+    for(uint32 tries = 0; tries < count * 10 && ends.size() < count * 4; tries++)
+    {
+        uint32 from = loaded[rand() % loaded.size()], to = loaded[rand() % loaded.size()];
+        if(abs(int32(from % 64) - int32(to % 64)) < 2 && abs(int32(from / 64) - int32(to / 64)) < 2)
+            continue;
+        float p[4];
+        if(RandomNavCell(tiles, from, p[0], p[1]) && RandomNavCell(tiles, to, p[2], p[3]))
+            ends.insert(ends.end(), p, p + 4);
+    }
+    uint32 n = ends.size() / 4;
+    if(!n)
+    {
+        printf("pathbench: The map is too small for long paths\n");
+        return;
+    }
+
+    std::vector<NavPoint> path;
+    std::vector<float> lengths(n, 0.0f);
+    uint32 found = 0, expanded = 0, refined = 0;
+    t = getMSTime();
+    for(uint32 i = 0; i < n; i++)
+    {
+        if(graph.FindPath(ends[i*4], ends[i*4+1], ends[i*4+2], ends[i*4+3], path))
+        {
+            found++;
+            lengths[i] = PathLength(path);
+        }
+        expanded += graph.GetExpandedCount();
+        refined += graph.GetRefinedCount();
+    }
+    uint32 ht = getMSTime() - t;
+    printf("pathbench: long paths over the navgraphs: %u searches in %u ms, %.1f paths/sec, %u found, %.0f entrances expanded and %.1f cell searches avg\n",
+        n, ht, ht ? n * 1000.0f / ht : 0.0f, found, float(expanded) / n, float(refined) / n);
+
+    Pathfinder pf;
+    pf.SetMaxNodes(uint32(-1));
+    uint32 cfound = 0, both = 0, mismatch = 0;
+    double hlen = 0, clen = 0;
+    t = getMSTime();
+    for(uint32 i = 0; i < n; i++)
+    {
+        bool ok = pf.FindPath(tiles, ends[i*4], ends[i*4+1], ends[i*4+2], ends[i*4+3], path);
+        if(ok)
+            cfound++;
+        if(ok != (lengths[i] > 0.0f))
+            mismatch++;
+        else if(ok)
+        {
+            both++;
+            hlen += lengths[i];
+            clen += PathLength(path);
+        }
+    }
+    uint32 ct = getMSTime() - t;
+    printf("pathbench: the same on the cells: %u ms, %.1f paths/sec, %u found; navgraph paths %.1f%% longer, %u found by only one of both\n",
+        ct, ct ? n * 1000.0f / ct : 0.0f, cfound, clen > 0 ? 100.0 * (hlen / clen - 1.0) : 0.0, mismatch);
+}
+
+// stuffextract -pathbench <mapid> <paths> [<mapsdir>]
+// loads all .hmap files of the map and searches paths between random cells of the same or neighbouring tiles,
+// about the distances a bot walks with the tiles the client keeps loaded.
+int RunPathBench(int argc, char *argv[])
+{
+    uint32 mapid = atoi(argv[2]), count = atoi(argv[3]);
+    const char *dir = argc >= 5 ? argv[4] : MAPSDIR;
+    MapTileStorage tiles;
+    std::vector<uint32> loaded;
+    if(!LoadBenchTiles(tiles, loaded, mapid, dir, "pathbench"))
+        return 1;
+
+    uint32 t = getMSTime(), walkable = 0;
+    for(uint32 i = 0; i < loaded.size(); i++)
+        walkable += tiles.GetTile(loaded[i])->GetNavGrid()->GetWalkableCount();
+    t = getMSTime() - t;
+    printf("pathbench: %u tiles, nav grids built in %u ms (%.2f ms per tile), %.1f%% of the cells walkable\n",
+        (uint32)loaded.size(), t, float(t) / loaded.size(), 100.0f * walkable / (loaded.size() * NAVGRID_SIZE * NAVGRID_SIZE));
+
+    srand(1);
+    std::vector<float> ends; // sx sy ex ey ...
+    for(uint32 i = 0; i < count; i++)
+    {
+        uint32 from = loaded[rand() % loaded.size()], to = from;
+        int32 tx = int32(from % 64) + rand() % 3 - 1, ty = int32(from / 64) + rand() % 3 - 1;
+        if(tx >= 0 && tx < 64 && ty >= 0 && ty < 64 && tiles.GetTile(tx, ty))
+            to = ty * 64 + tx;
+        float p[4];
+        if(RandomNavCell(tiles, from, p[0], p[1]) && RandomNavCell(tiles, to, p[2], p[3]))
+            ends.insert(ends.end(), p, p + 4);
+    }
+
+    Pathfinder pf;
+    std::vector<NavPoint> path;
+    uint32 n = ends.size() / 4, found = 0, points = 0, failtime = 0;
+    uint64 expanded = 0;
+    t = getMSTime();
+    for(uint32 i = 0; i < n; i++)
+    {
+        uint32 st = getMSTime();
+        if(pf.FindPath(tiles, ends[i*4], ends[i*4+1], ends[i*4+2], ends[i*4+3], path))
+        {
+            found++;
+            points += path.size();
+        }
+        else
+            failtime += getMSTime() - st; // unreachable ends: the search looks at everything reachable from the start
+        expanded += pf.GetExpandedCount();
+    }
+    t = getMSTime() - t;
+    printf("pathbench: %u searches in %u ms, %.1f paths/sec, %u found (%.1f points avg), %.0f cells expanded avg, arena %u KB\n",
+        n, t, t ? n * 1000.0f / t : 0.0f, found, found ? float(points) / found : 0.0f, n ? float(expanded) / n : 0.0f, pf.GetArenaSize() / 1024);
+    printf("pathbench: found paths only: %.1f paths/sec, %u ms spent on %u searches without result\n",
+        t > failtime ? found * 1000.0f / (t - failtime) : 0.0f, failtime, n - found);
+
+    RunLongPathBench(tiles, loaded, mapid, dir, count);
+    return 0;
+}
+
+// stuffextract -getzbench <mapid> <lookups> [<mapsdir>]
+// looks up the terrain height at random positions of the extracted tiles, one by one and with the batch call.
+// the positions are grouped by tile, the way MapMgr::GetZ() hands them to the tiles.
+int RunGetZBench(int argc, char *argv[])
+{
+    uint32 mapid = atoi(argv[2]), count = atoi(argv[3]);
+    const char *dir = argc >= 5 ? argv[4] : MAPSDIR;
+    MapTileStorage tiles;
+    std::vector<uint32> loaded;
+    if(!count || !LoadBenchTiles(tiles, loaded, mapid, dir, "getzbench"))
+        return 1;
+
+    srand(1);
+    std::vector<float> xs(count), ys(count), zs(count), zb(count);
+    std::vector<MapTile*> owner(count);
+    for(uint32 i = 0; i < count; i++)
+    {
+        MapTile *tile = tiles.GetTile(loaded[uint64(i) * loaded.size() / count]);
+        xs[i] = tile->GetBaseX() - (rand() / (RAND_MAX + 1.0f)) * TILESIZE;
+        ys[i] = tile->GetBaseY() - (rand() / (RAND_MAX + 1.0f)) * TILESIZE;
+        owner[i] = tile;
+    }
+
+    uint32 t = getMSTime();
+    for(uint32 i = 0; i < count; i++)
+        zs[i] = owner[i]->GetZ(xs[i], ys[i]);
+    uint32 ts = getMSTime() - t;
+
+    t = getMSTime();
+    for(uint32 i = 0, run; i < count; i += run)
+    {
+        for(run = 1; i + run < count && owner[i + run] == owner[i]; run++);
+        owner[i]->GetZ(&xs[i], &ys[i], &zb[i], run);
+    }
+    uint32 tb = getMSTime() - t;
+
+    uint32 invalid = 0, differ = 0;
+    for(uint32 i = 0; i < count; i++)
+    {
+        if(zs[i] == INVALID_HEIGHT)
+            invalid++;
+        if(zs[i] != zb[i])
+            differ++;
+    }
+    printf("getzbench: %u tiles, %u lookups, %u without height\n", (uint32)loaded.size(), count, invalid);
+    printf("getzbench: single: %u ms, %.1f M/sec\n", ts, ts ? count / (ts * 1000.0f) : 0.0f);
+    printf("getzbench: batch:  %u ms, %.1f M/sec, %u results differ from single lookups\n", tb, tb ? count / (tb * 1000.0f) : 0.0f, differ);
+    return differ ? 1 : 0;
+}
+
+// stuffextract -logbench <lines> [<logfile>]
+// writes the line the client logs for every object created by an update packet, with timestamps and to a logfile.
+// once synchronously, once through the async writer; the async run also counts the time until everything is written.
+int RunLogBench(int argc, char *argv[])
+{
+    uint32 count = atoi(argv[2]);
+    log_prepare(argc >= 4 ? argv[3] : "logbench.txt", "w");
+    log_setloglevel(2);
+    log_setlogtime(true);
+    for(uint32 async = 0; async < 2; async++)
+    {
+        log_setasync(async != 0);
+        uint32 t = getMSTime();
+        for(uint32 i = 0; i < count; i++)
+            logdebug("Create Object type %u with guid "I64FMT, i & 7, uint64(i) * 0x1000000ULL + 12345);
+        uint32 tl = getMSTime() - t;
+        log_setasync(false); // waits until the writer is done
+        uint32 tw = getMSTime() - t;
+        fprintf(stderr,"logbench: %s: %u lines, %u ms in the logging thread (%.0f lines/sec), %u ms until written (%.0f lines/sec)\n",
+            async ? "async" : "sync", count, tl, tl ? count * 1000.0f / tl : 0.0f, tw, tw ? count * 1000.0f / tw : 0.0f);
+    }
+    log_close();
+    return 0;
+}
+
+static std::string MPQBenchDigest(uint8 *buf, uint32 size)
+{
+    MD5Hash h;
+    h.Update(buf, size);
+    h.Finalize();
+    return std::string((char*)h.GetDigest(), h.GetLength());
+}
+
+// reads all files of the -mpqbench list through the global MPQHelper and counts those that came out different
+class MPQBenchWorker : public ZThread::Runnable
+{
+public:
+    MPQBenchWorker(std::vector<std::string> *names, std::vector<std::string> *digests, uint32 *bad)
+        : _names(names), _digests(digests), _bad(bad) {}
+    void run(void)
+    {
+        for(uint32 i = 0; i < _names->size(); i++)
+        {
+            uint8 *buf;
+            uint32 size;
+            if(!mpq.ExtractFile((*_names)[i].c_str(), buf, size))
+            {
+                (*_bad)++;
+                continue;
+            }
+            if(MPQBenchDigest(buf, size) != (*_digests)[i])
+                (*_bad)++;
+            delete [] buf;
+        }
+    }
+private:
+    std::vector<std::string> *_names, *_digests;
+    uint32 *_bad;
+};
+
+// stuffextract -mpqbench <locale> <threads> <filelist>
+// the DataLoader threads of the client all read through one MPQHelper; this does the same with the files of a list.
+int RunMPQBench(int argc, char *argv[])
+{
+    uint32 nthreads = atoi(argv[3]);
+    std::vector<std::string> names, digests;
+    std::ifstream fh(argv[4]);
+    std::string line;
+    while(std::getline(fh, line))
+    {
+        while(line.size() && (line[line.size()-1] == '\r' || line[line.size()-1] == ' '))
+            line.erase(line.size()-1);
+        if(line.size())
+            names.push_back(line);
+    }
+    if(names.empty() || !nthreads)
+    {
+        printf("mpqbench: No file names in '%s'\n",argv[4]);
+        return 1;
+    }
+    SetLocale(argv[2]);
+    uint32 t = getMSTime();
+    mpq.Init();
+    printf("mpqbench: archives opened and indexed in %u ms\n", getMSTime() - t);
+
+    // the single-threaded reads give the data to compare with
+    uint32 missing = 0;
+    uint64 bytes = 0;
+    t = getMSTime();
+    for(uint32 i = 0; i < names.size(); i++)
+    {
+        uint8 *buf;
+        uint32 size;
+        if(!mpq.ExtractFile(names[i].c_str(), buf, size))
+        {
+            missing++;
+            digests.push_back("");
+            continue;
+        }
+        digests.push_back(MPQBenchDigest(buf, size));
+        bytes += size;
+        delete [] buf;
+    }
+    t = getMSTime() - t;
+    printf("mpqbench: 1 thread: %u reads in %u ms (%.1f MB), %u files not found\n", (uint32)names.size(), t, bytes / 1048576.0f, missing);
+
+    t = getMSTime();
+    for(uint32 r = 0; r < 20; r++)
+        for(uint32 i = 0; i < names.size(); i++)
+            mpq.FileExists(names[i].c_str());
+    printf("mpqbench: %u FileExists() in %u ms\n", (uint32)names.size() * 20, getMSTime() - t);
+
+    std::vector<uint32> bad(nthreads, 0);
+    std::vector<ZThread::Thread*> thr;
+    t = getMSTime();
+    for(uint32 i = 0; i < nthreads; i++)
+        thr.push_back(new ZThread::Thread(new MPQBenchWorker(&names, &digests, &bad[i]))); // the thread takes ownership of the worker
+    uint32 badreads = 0;
+    for(uint32 i = 0; i < nthreads; i++)
+    {
+        thr[i]->wait();
+        delete thr[i];
+        badreads += bad[i];
+    }
+    t = getMSTime() - t;
+    badreads -= missing * nthreads;
+    printf("mpqbench: %u threads: %u reads in %u ms, %u returned wrong data\n", nthreads, (uint32)names.size() * nthreads, t, badreads);
+    return badreads ? 1 : 0;
 }
 
 
@@ -714,6 +1102,21 @@ void ExtractMaps(void)
                         fh.write((char*)bb.contents(),bb.size());
                         fh.flush();
                         fh.close();
+
+                        // preprocessed heights, so that clients without GUI can map them instead of parsing the ADT
+                        ADTFile *adt = new ADTFile();
+                        ByteBuffer adtbb(bb);
+                        if(adt->LoadMem(adtbb))
+                        {
+                            HeightMap hmap;
+                            hmap.BuildFromADT(adt, bb.size());
+                            sprintf(outbuf,MAPSDIR"/%lu_%lu_%lu.hmap",it->first,x,y);
+                            if(!hmap.Save(outbuf))
+                                printf("\nWARNING: could not save height map %s\n",outbuf);
+                            sprintf(outbuf,MAPSDIR"/%lu_%lu_%lu.adt",it->first,x,y); // used again for the md5 list
+                        }
+                        delete adt;
+
                         olddeps = texNames.size() + modelNames.size() + wmoNames.size();
 
                         if(doTextures) ADT_FillTextureData(bb.contents(),texNames);
@@ -738,6 +1141,13 @@ void ExtractMaps(void)
         }
         extrtotal+=extr;
         printf("\n");
+        if(doNavGraphs && extr)
+        {
+            uint32 t = getMSTime();
+            NavGraph graph(it->first, MAPSDIR);
+            uint32 built = graph.BuildAll();
+            printf("Built %u navgraphs of map %u in %u ms\n",built,it->first,getMSTime()-t);
+        }
     }
 
     printf("\nDONE - %lu maps extracted, %u total dependencies.\n",extrtotal, texNames.size() + modelNames.size() + wmoNames.size());
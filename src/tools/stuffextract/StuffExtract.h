@@ -32,6 +32,10 @@ int main(int argc, char *argv[]);
 void ProcessCmdArgs(int argc, char *argv[]);
 void PrintConfig(void);
 void PrintHelp(void);
+int RunPathBench(int argc, char *argv[]);
+int RunGetZBench(int argc, char *argv[]);
+int RunLogBench(int argc, char *argv[]);
+int RunMPQBench(int argc, char *argv[]);
 void OutSCP(const char*, SCPStorageMap&, std::string);
 void OutMD5(const char*, MD5FileMap&);
 bool ConvertDBC(void);
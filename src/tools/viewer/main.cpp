@@ -820,6 +820,79 @@ public:
 };
 
 
+/*
+A headless skinning benchmark, started with
+    viewer -skinbench <nodes> <frames> <model.m2> [<model.m2> ...]
+Every model is loaded <nodes> times, so that each scene node animates its own copy
+of the mesh like different characters in a town would. The scene is drawn <frames>
+times with the null driver, with a fixed step of 33 msecs per frame, first skinned
+on the render thread only and then on the skinning threads as well.
+*/
+int runSkinBench(int argc, char* argv[])
+{
+	u32 nodes = atoi(argv[2]);
+	u32 frames = atoi(argv[3]);
+
+	Device = createDevice(video::EDT_NULL, core::dimension2d<u32>(800, 600));
+	if (Device == 0)
+		return 1;
+
+	video::IVideoDriver* driver = Device->getVideoDriver();
+	scene::ISceneManager* smgr = Device->getSceneManager();
+	fact = new CM2MeshSceneNodeFactory(smgr);
+	smgr->registerSceneNodeFactory(fact);
+	scene::CM2MeshFileLoader* m2loader = new scene::CM2MeshFileLoader(Device);
+
+	u32 count = 0, vertices = 0;
+	for (int a = 4; a < argc; ++a)
+	{
+		for (u32 n = 0; n < nodes; ++n)
+		{
+			io::IReadFile* file = io::IrrCreateIReadFileBasic(Device, argv[a]);
+			scene::IAnimatedMesh* m = file ? m2loader->createMesh(file) : 0;
+			if (file)
+				file->drop();
+			if (!m)
+			{
+				printf("skinbench: Can't load '%s'\n", argv[a]);
+				break;
+			}
+			scene::CM2MeshSceneNode* node = ((scene::CM2MeshSceneNode*)(fact->addM2SceneNode(m, NULL)));
+			node->setSkinId(0);
+			node->setAnimationSpeed(1000);
+			node->setM2Animation(0);
+			node->setCurrentFrame(node->getStartFrame() + (f32)((n * 97) % (node->getEndFrame() - node->getStartFrame() + 1)));
+			node->setAutomaticCulling(scene::EAC_OFF);
+			for (u32 i = 0; i < m->getMeshBufferCount(); ++i)
+				vertices += m->getMeshBuffer(i)->getVertexCount();
+			m->drop();
+			++count;
+		}
+	}
+	smgr->addCameraSceneNode(0, core::vector3df(0, 0, -50), core::vector3df(0, 0, 0));
+
+	for (u32 pass = 0; pass < 2; ++pass)
+	{
+		u32 threads = pass ? M2_SKIN_THREADS : 0;
+		scene::CM2Mesh::setSkinningThreads(threads);
+		u32 start = Device->getTimer()->getRealTime();
+		for (u32 f = 0; f < frames; ++f)
+		{
+			Device->getTimer()->setTime(f * 33);
+			driver->beginScene(true, true, video::SColor(150,50,50,50));
+			smgr->drawAll();
+			driver->endScene();
+		}
+		u32 time = Device->getTimer()->getRealTime() - start;
+		printf("skinbench: %u nodes, %u vertices, %u frames, %u skinning threads: %u ms, %.2f ms per frame\n",
+			count, vertices, frames, threads, time, frames ? (f32)time / frames : 0.f);
+	}
+
+	Device->drop();
+	return 0;
+}
+
+
 /*
 Most of the hard work is done. We only need to create the Irrlicht Engine
 device and all the buttons, menus and toolbars. We start up the engine as
@@ -837,6 +910,9 @@ int main(int argc, char* argv[])
   log_prepare("viewerlog.txt","w");
   MemoryDataHolder::SetUseMPQ("enUS");
 
+  if(argc >= 5 && !strcmp(argv[1], "-skinbench"))
+    return runSkinBench(argc, argv);
+
   FILE* f;
   f = fopen("viewer_last.txt","r");
   if(f!=NULL)